@@ -39,6 +39,21 @@ LOCAL_SRC_FILES:= main.c \
     fw_update.c \
     tcs_wrapper.c \
     kct_netlink.c \
+    reactor.c \
+    workqueue.c \
+    boottask.c \
+    usage.c \
+    retention.c \
+    propcache.c \
+    crashfile.c \
+    keygen.c \
+    storm.c \
+    admission.c \
+    notifier.c \
+    patmatch.c \
+    filescan.c \
+    compress.c \
+    logreader.c \
     iptrak.c \
     uefivar.c
 
@@ -56,5 +71,16 @@ LOCAL_C_INCLUDES += \
 LOCAL_MODULE_TAGS := eng debug
 LOCAL_MODULE:= crashlogd
 
-LOCAL_SHARED_LIBRARIES:= libparse_stack libc libcutils libmmgrcli libtcs
+LOCAL_SHARED_LIBRARIES:= libparse_stack libc libcutils libmmgrcli libtcs libz
+
+ifeq ($(CRASHLOGD_USE_ZSTD),true)
+    LOCAL_CFLAGS += -DCONFIG_ZSTD
+    LOCAL_C_INCLUDES += external/zstd/lib
+    LOCAL_SHARED_LIBRARIES += libzstd
+endif
+
+ifeq ($(CRASHLOGD_USE_CRYPTO),true)
+    LOCAL_CFLAGS += -DCONFIG_CRYPTO_SHA1
+    LOCAL_SHARED_LIBRARIES += libcrypto
+endif
 include $(BUILD_EXECUTABLE)
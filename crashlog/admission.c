@@ -0,0 +1,259 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file admission.c
+ * @brief File containing the admission control of the incoming events.
+ */
+
+#include "admission.h"
+#include "crashutils.h"
+#include "privconfig.h"
+
+#include <cutils/log.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Tokens are counted in 1/ADMIT_UNIT : a rate per minute is then exactly
+ * <rate> units per ms */
+#define ADMIT_UNIT              60000LL
+
+struct bucket {
+    const char *name;
+    int rate;                   /* tokens per minute */
+    int burst;                  /* max tokens, 0 if disabled */
+    long long level;            /* available tokens, in 1/ADMIT_UNIT */
+    long long stamp;            /* last refill time in ms, 0 if never */
+};
+
+static struct bucket buckets[ADMIT_BUCKETS] = {
+    [ADMIT_SRC_INOTIFY]                    = { "inotify", 120, 40, 0, 0 },
+    [ADMIT_SRC_KCT]                        = { "kct",      60, 20, 0, 0 },
+    [ADMIT_SRC_MMGR]                       = { "mmgr",     30, 10, 0, 0 },
+    [ADMIT_SOURCES + ADMIT_CLASS_CRASH]    = { "crash",    20, 10, 0, 0 },
+    [ADMIT_SOURCES + ADMIT_CLASS_ERROR]    = { "error",    60, 20, 0, 0 },
+    [ADMIT_SOURCES + ADMIT_CLASS_INFO]     = { "info",     60, 20, 0, 0 },
+    [ADMIT_SOURCES + ADMIT_CLASS_STATS]    = { "stats",    60, 20, 0, 0 },
+};
+
+static const char *class_events[ADMIT_CLASSES] = {
+    [ADMIT_CLASS_CRASH] = CRASHEVENT,
+    [ADMIT_CLASS_ERROR] = ERROREVENT,
+    [ADMIT_CLASS_INFO]  = INFOEVENT,
+    [ADMIT_CLASS_STATS] = STATSEVENT,
+};
+
+static struct admission_stats stats;
+static unsigned long reported;          /* degraded count at the last report */
+static long long report_stamp;
+static pthread_mutex_t admission_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + 1;
+}
+
+/* Refills b up to now. admission_lock shall be held */
+static void refill(struct bucket *b, long long now) {
+    long long max = b->burst * ADMIT_UNIT;
+
+    if (!b->stamp)
+        b->level = max;
+    else
+        b->level += (now - b->stamp) * b->rate;
+    if (b->level > max)
+        b->level = max;
+    b->stamp = now;
+}
+
+/* Logs the degraded events once per ADMIT_REPORT_PERIOD. admission_lock
+ * shall be held */
+static void report(long long now) {
+    char buffer[256];
+    int i, len = 0;
+
+    if (stats.degraded == reported || now - report_stamp < ADMIT_REPORT_PERIOD * 1000LL)
+        return;
+    for (i = 0 ; i < ADMIT_BUCKETS ; i++)
+        len += snprintf(buffer + len, sizeof(buffer) - len, " %s:%lu",
+            buckets[i].name, stats.drops[i]);
+    LOGW("%s: %lu events degraded to history only (%lu since the start, refused by%s)\n",
+        __FUNCTION__, stats.degraded - reported, stats.degraded, buffer);
+    reported = stats.degraded;
+    report_stamp = now;
+}
+
+/**
+ * @brief Checks an incoming event against the buckets of its source and
+ * class
+ *
+ * Both buckets shall hold a token for the event to be admitted. Otherwise,
+ * the event is recorded in the history with no log and the drop counted.
+ *
+ * @param source of the event
+ * @param class of the event, ADMIT_CLASS_CRITICAL to bypass the control
+ * @param event name recorded when degraded, NULL for the one of the class
+ * @param type of the event
+ *
+ * @return 1 if the event shall be processed, 0 if it was degraded.
+ */
+int admit_event(e_admit_source_t source, e_admit_class_t class,
+    char *event, char *type) {
+    struct bucket *b[2];
+    long long now;
+    int i, admitted = 1;
+    char *key;
+
+    if (source >= ADMIT_SOURCES || class >= ADMIT_CLASSES)
+        return 1;
+
+    b[0] = &buckets[source];
+    b[1] = &buckets[ADMIT_SOURCES + class];
+    now = now_ms();
+    pthread_mutex_lock(&admission_lock);
+    for (i = 0 ; i < 2 ; i++) {
+        if (!b[i]->burst)
+            continue;
+        refill(b[i], now);
+        if (b[i]->level < ADMIT_UNIT) {
+            stats.drops[b[i] - buckets]++;
+            admitted = 0;
+        }
+    }
+    if (admitted) {
+        for (i = 0 ; i < 2 ; i++)
+            if (b[i]->burst)
+                b[i]->level -= ADMIT_UNIT;
+        stats.admitted++;
+    } else {
+        stats.degraded++;
+        report(now);
+    }
+    pthread_mutex_unlock(&admission_lock);
+
+    if (admitted)
+        return 1;
+
+    if (!event)
+        event = (char *)class_events[class];
+    key = raise_event(event, type, NULL, NULL);
+    LOGD("%s: %s %s from %s over budget, degraded as %s\n", __FUNCTION__,
+        event, type, buckets[source].name, key);
+    free(key);
+    return 0;
+}
+
+/**
+ * @brief Gives the admission class of an event detected by inotify
+ *
+ * @param eventtype of the watched directory
+ *
+ * @return the class
+ */
+e_admit_class_t admission_class_of_type(int eventtype) {
+    switch (eventtype) {
+    case STATTRIG_TYPE:
+    case APLOGTRIG_TYPE:
+        return ADMIT_CLASS_STATS;
+    case INFOTRIG_TYPE:
+        return ADMIT_CLASS_INFO;
+    case ERRORTRIG_TYPE:
+        return ADMIT_CLASS_ERROR;
+    case CMDTRIG_TYPE:
+    case UPTIME_TYPE:
+    case MDMCRASH_TYPE:
+    case APIMR_TYPE:
+    case MRST_TYPE:
+        return ADMIT_CLASS_CRITICAL;
+    default:
+        return ADMIT_CLASS_CRASH;
+    }
+}
+
+/**
+ * @brief Gives the admission class of an event name
+ *
+ * @param event name (CRASH, ERROR, INFO or STATS)
+ *
+ * @return the class, ADMIT_CLASS_CRASH if unknown
+ */
+e_admit_class_t admission_class_of_event(const char *event) {
+    int i;
+
+    for (i = 0 ; i < ADMIT_CLASSES ; i++)
+        if (!strcmp(event, class_events[i]))
+            return i;
+    return ADMIT_CLASS_CRASH;
+}
+
+/**
+ * @brief Gives the name of a bucket, as used in the configuration
+ *
+ * @return the name, NULL if bucket is out of range
+ */
+const char *admission_bucket_name(int bucket) {
+    if (bucket < 0 || bucket >= ADMIT_BUCKETS)
+        return NULL;
+    return buckets[bucket].name;
+}
+
+/**
+ * @brief Sets the budget of a bucket
+ *
+ * @param name of the bucket
+ * @param rate in tokens per minute, -1 to keep the current one
+ * @param burst max number of tokens, 0 to disable the bucket, -1 to keep
+ * the current one
+ *
+ * @return 0 on success, -EINVAL if name is unknown.
+ */
+int admission_set(const char *name, int rate, int burst) {
+    int i;
+
+    for (i = 0 ; i < ADMIT_BUCKETS ; i++) {
+        if (strcmp(name, buckets[i].name))
+            continue;
+        pthread_mutex_lock(&admission_lock);
+        if (rate >= 0)
+            buckets[i].rate = rate;
+        if (burst >= 0)
+            buckets[i].burst = burst;
+        buckets[i].stamp = 0;
+        pthread_mutex_unlock(&admission_lock);
+        LOGI("%s: %s bucket set to %d/min, burst %d\n", __FUNCTION__,
+            name, buckets[i].rate, buckets[i].burst);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/**
+ * @brief Gets the admission counters
+ *
+ * @param out: filled with the current counters
+ */
+void get_admission_stats(struct admission_stats *out) {
+    pthread_mutex_lock(&admission_lock);
+    *out = stats;
+    pthread_mutex_unlock(&admission_lock);
+}
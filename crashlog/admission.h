@@ -0,0 +1,69 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file admission.h
+ * @brief File containing the admission control of the incoming events.
+ *
+ * Each event consumes a token from the bucket of its source (inotify, kct
+ * or mmgr) and from the bucket of its class (crash, error, info or stats).
+ * A bucket is refilled at <rate> tokens per minute up to <burst> tokens,
+ * both set from the ADMISSION section of crashlog.conf with the keys
+ * <bucket>_rate and <bucket>_burst. A burst of 0 disables the bucket.
+ * An event over budget is degraded to a history-only entry : no directory
+ * is created and no log is collected. The critical events (modem panics,
+ * APIMR, commands...) are never throttled.
+ */
+
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+typedef enum e_admit_source {
+    ADMIT_SRC_INOTIFY = 0,
+    ADMIT_SRC_KCT,
+    ADMIT_SRC_MMGR,
+    ADMIT_SOURCES,
+} e_admit_source_t;
+
+typedef enum e_admit_class {
+    ADMIT_CLASS_CRASH = 0,
+    ADMIT_CLASS_ERROR,
+    ADMIT_CLASS_INFO,
+    ADMIT_CLASS_STATS,
+    ADMIT_CLASSES,
+    ADMIT_CLASS_CRITICAL = ADMIT_CLASSES, /* never throttled */
+} e_admit_class_t;
+
+#define ADMIT_BUCKETS           (ADMIT_SOURCES + ADMIT_CLASSES)
+/* Min delay (in s) between two reports of the degraded events */
+#define ADMIT_REPORT_PERIOD     60
+
+struct admission_stats {
+    unsigned long admitted;                 /* events admitted */
+    unsigned long degraded;                 /* events degraded */
+    unsigned long drops[ADMIT_BUCKETS];     /* events refused per bucket */
+};
+
+int admit_event(e_admit_source_t source, e_admit_class_t class,
+    char *event, char *type);
+e_admit_class_t admission_class_of_type(int eventtype);
+e_admit_class_t admission_class_of_event(const char *event);
+const char *admission_bucket_name(int bucket);
+int admission_set(const char *name, int rate, int burst);
+void get_admission_stats(struct admission_stats *out);
+
+#endif /* __ADMISSION_H__ */
@@ -40,44 +40,26 @@
 #include "anruiwdt.h"
 #include "dropbox.h"
 #include "fsutils.h"
+#include "compress.h"
 
-#ifdef FULL_REPORT
 static void priv_prepare_anruiwdt(char *destion)
 {
-    char cmd[PATHMAX];
+    char source[PATHMAX];
     int len = strlen(destion);
     if (len < 4) return;
 
     if ( destion[len-3] == '.' && destion[len-2] == 'g' && destion[len-1] == 'z') {
         /* extract gzip file */
-        snprintf(cmd, sizeof(cmd), "gunzip %s", destion);
-        system(cmd);
+        snprintf(source, sizeof(source), "%s", destion);
         destion[len-3] = 0;
-        if (do_chown(destion, PERM_USER, PERM_GROUP)!=0) {
-            LOGE("%s: do_chown failed : status=%s...\n", __FUNCTION__, strerror(errno));}
+        if (decompress_file(source, destion) < 0)
+            return;
+        remove(source);
     }
 }
-#else
-static void priv_prepare_anruiwdt(char *destion)
-{
-    char cmd[PATHMAX];
-    int len = strlen(destion);
-    if (len < 4) return;
-
-    if ( destion[len-3] == '.' && destion[len-2] == 'g' && destion[len-1] == 'z') {
-        /* extract gzip file */
-        do_copy_tail(destion,"/logs/tmp_anr_uiwdt.gz",0);
-        system("gunzip /logs/tmp_anr_uiwdt.gz");
-        do_chown("/logs/tmp_anr_uiwdt", PERM_USER, PERM_GROUP);
-        destion[strlen(destion) - 3] = 0;
-        do_copy_tail("/logs/tmp_anr_uiwdt",destion,0);
-        remove("/logs/tmp_anr_uiwdt");
-    }
-}
-#endif
 
 #ifdef FULL_REPORT
-static void process_anruiwdt_tracefile(char *destion, int dir, int removeunparsed)
+static void process_anruiwdt_tracefile(char *destion, char *dirbase, int dir, int removeunparsed)
 {
     char cmd[PATHMAX];
     int src, dest;
@@ -108,7 +90,7 @@ static void process_anruiwdt_tracefile(char *destion, int dir, int removeunparse
                 LOGE("%s: Failed to open trace file %s:%s\n", __FUNCTION__, tracefile, strerror(errno));
                 break;
             }
-            snprintf(dest_path, sizeof(dest_path), "%s%d/trace_all_stack.txt", CRASH_DIR, dir);
+            snprintf(dest_path, sizeof(dest_path), "%s%d/trace_all_stack.txt", dirbase, dir);
             fstat(src, &stat_buf);
             dest = open(dest_path, O_WRONLY|O_CREAT, 0600);
             if (dest < 0) {
@@ -146,13 +128,13 @@ static void process_anruiwdt_tracefile(char *destion, int dir, int removeunparse
 }
 #endif
 
-static void backtrace_anruiwdt(char *dest, int dir) {
+static void backtrace_anruiwdt(char *dest, char *dirbase, int dir) {
 #ifdef FULL_REPORT
     char value[PROPERTY_VALUE_MAX];
 
     property_get(PROP_ANR_USERSTACK, value, "0");
     if (strncmp(value, "1", 1)) {
-        process_anruiwdt_tracefile(dest, dir, 0);
+        process_anruiwdt_tracefile(dest, dirbase, dir, 0);
     }
 #endif
 }
@@ -167,13 +149,14 @@ int process_anruiwdt_event(struct watch_entry *entry, struct inotify_event *even
     char destion[PATHMAX];
     const char *dateshort = get_current_time_short(1);
     char *key;
+    char *dirbase;
     int dir;
 
     /* Check for duplicate dropbox event first */
     if ( manage_duplicate_dropbox_events(event) )
         return 1;
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
     if (dir < 0 || !file_exists(path)) {
         if (dir < 0)
@@ -186,20 +169,21 @@ int process_anruiwdt_event(struct watch_entry *entry, struct inotify_event *even
         return -1;
     }
 
-    snprintf(destion,sizeof(destion),"%s%d/%s", CRASH_DIR, dir, event->name);
+    snprintf(destion,sizeof(destion),"%s%d/%s", dirbase, dir, event->name);
+    wait_file_complete(path, event->mask);
     do_copy_tail(path, destion, MAXFILESIZE);
     priv_prepare_anruiwdt(destion);
-    usleep(TIMEOUT_VALUE);
-    do_log_copy(entry->eventname, dir, dateshort, APLOG_TYPE);
-    backtrace_anruiwdt(destion, dir);
+    wait_aplog_flushed();
+    do_log_copy(entry->eventname, dirbase, dir, dateshort, APLOG_TYPE);
+    backtrace_anruiwdt(destion, dirbase, dir);
     restart_profile_srv(1);
-    snprintf(destion, sizeof(destion), "%s%d", CRASH_DIR, dir);
+    snprintf(destion, sizeof(destion), "%s%d", dirbase, dir);
     key = raise_event(CRASHEVENT, entry->eventname, NULL, destion);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), entry->eventname, destion);
     switch (entry->eventtype) {
 #ifdef FULL_REPORT
         case ANR_TYPE:
-            if (start_dumpstate_srv(CRASH_DIR, dir, key) <= 0) {
+            if (start_dumpstate_srv(dirbase, dir, key) <= 0) {
                 /* Finally raise the event as the dumpstate server is busy or failed to be started */
                 free(key);
             }
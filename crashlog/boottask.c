@@ -0,0 +1,140 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file boottask.c
+ * @brief File containing the boot task graph running the boot-time checks.
+ */
+
+#include "boottask.h"
+#include "privconfig.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+struct boot_graph {
+    const struct boot_task *tasks;
+    int count;
+    void *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    unsigned int done;
+};
+
+struct boot_runner {
+    struct boot_graph *graph;
+    int index;
+};
+
+static long long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000LL +
+        (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void run_task(struct boot_graph *graph, int index) {
+    const struct boot_task *task = &graph->tasks[index];
+    struct timespec start;
+
+    pthread_mutex_lock(&graph->lock);
+    while ((graph->done & task->deps) != task->deps)
+        pthread_cond_wait(&graph->done_cond, &graph->lock);
+    pthread_mutex_unlock(&graph->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    task->run(graph->ctx);
+    LOGD("%s: %s done in %lld ms\n", __FUNCTION__, task->name, elapsed_ms(&start));
+
+    pthread_mutex_lock(&graph->lock);
+    graph->done |= BOOTTASK_DEP(index);
+    pthread_cond_broadcast(&graph->done_cond);
+    pthread_mutex_unlock(&graph->lock);
+}
+
+static void *task_thread(void *arg) {
+    struct boot_runner *runner = arg;
+
+    run_task(runner->graph, runner->index);
+    return NULL;
+}
+
+/**
+ * @brief Runs a graph of boot tasks and waits for their completion
+ *
+ * A thread is started for each task. When a thread can't be created, the
+ * task is run by the caller once all the started threads are spawned; the
+ * dependencies only pointing to lower indexes, the graph can't deadlock.
+ *
+ * @param tasks : tasks of the graph
+ * @param count : number of tasks
+ * @param ctx : context given to each task
+ *
+ * @return 0 on success, -EINVAL if the graph is invalid.
+ */
+int run_boot_tasks(const struct boot_task *tasks, int count, void *ctx) {
+    struct boot_graph graph;
+    struct boot_runner runners[BOOTTASK_MAX];
+    pthread_t threads[BOOTTASK_MAX];
+    int started[BOOTTASK_MAX];
+    struct timespec start;
+    int i, ret;
+
+    if (count < 0 || count > BOOTTASK_MAX)
+        return -EINVAL;
+    for (i = 0 ; i < count ; i++) {
+        if (tasks[i].deps & ~(BOOTTASK_DEP(i) - 1)) {
+            LOGE("%s: invalid dependencies for %s\n", __FUNCTION__, tasks[i].name);
+            return -EINVAL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&graph, 0, sizeof(graph));
+    graph.tasks = tasks;
+    graph.count = count;
+    graph.ctx = ctx;
+    pthread_mutex_init(&graph.lock, NULL);
+    pthread_cond_init(&graph.done_cond, NULL);
+
+    for (i = 0 ; i < count ; i++) {
+        runners[i].graph = &graph;
+        runners[i].index = i;
+        ret = pthread_create(&threads[i], NULL, task_thread, &runners[i]);
+        started[i] = (ret == 0);
+        if (ret != 0)
+            LOGE("%s: pthread_create error for %s - %s\n", __FUNCTION__,
+                tasks[i].name, strerror(ret));
+    }
+
+    /* Tasks not started are run in order by the caller */
+    for (i = 0 ; i < count ; i++)
+        if (!started[i])
+            run_task(&graph, i);
+
+    for (i = 0 ; i < count ; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&graph.done_cond);
+    pthread_mutex_destroy(&graph.lock);
+    LOGI("%s: %d tasks done in %lld ms\n", __FUNCTION__, count, elapsed_ms(&start));
+    return 0;
+}
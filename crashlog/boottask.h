@@ -0,0 +1,49 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file boottask.h
+ * @brief File containing the boot task graph running the boot-time checks.
+ *
+ * Each boot-time check is a task which may depend on previous tasks of the
+ * graph. All the tasks are started at once; a task only runs when all its
+ * dependencies are done, so independent checks run concurrently.
+ * The tasks shall only share data through their dependencies: the crash
+ * directory allocation, the history writes and the aplog copies are
+ * serialized on their own, and the current time is kept per thread.
+ */
+
+#ifndef __BOOTTASK_H__
+#define __BOOTTASK_H__
+
+/* Max number of tasks in a graph */
+#define BOOTTASK_MAX            16
+
+/* Dependency mask of a task on the task with index i */
+#define BOOTTASK_DEP(i)         (1U << (i))
+
+struct boot_task {
+    const char *name;
+    void (*run)(void *ctx);
+    /* Mask of the tasks (BOOTTASK_DEP) to complete first. Only tasks with a
+     * lower index in the graph can be depended on */
+    unsigned int deps;
+};
+
+int run_boot_tasks(const struct boot_task *tasks, int count, void *ctx);
+
+#endif /* __BOOTTASK_H__ */
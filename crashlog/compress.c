@@ -0,0 +1,469 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file compress.c
+ * @brief File containing the streaming compression of the logs.
+ */
+
+#include "compress.h"
+#include "crashutils.h"
+#include "fsutils.h"
+#include "usage.h"
+#include "privconfig.h"
+
+#include <cutils/properties.h>
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/* gzip header (windowBits + 16), or gzip/zlib auto-detection (+ 32) */
+#define GZIP_WINDOW_BITS        (15 + 16)
+#define GUNZIP_WINDOW_BITS      (15 + 32)
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+#ifdef CONFIG_ZSTD
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+#endif
+
+/**
+ * @brief Gets the compression format set by property
+ *
+ * zstd is only used if it is built in, gzip otherwise.
+ */
+e_compress_format_t get_compress_format(void) {
+#ifdef CONFIG_ZSTD
+    char value[PROPERTY_VALUE_MAX];
+
+    if (property_get(PROP_COMPRESS_FORMAT, value, "gzip") > 0 && !strcmp(value, "zstd"))
+        return COMPRESS_ZSTD;
+#endif
+    return COMPRESS_GZIP;
+}
+
+/**
+ * @brief Gets the compression level set by property, bound to the format range
+ */
+int get_compress_level(e_compress_format_t format) {
+    char value[PROPERTY_VALUE_MAX];
+    int level, max = 9;
+
+#ifdef CONFIG_ZSTD
+    if (format == COMPRESS_ZSTD)
+        max = ZSTD_maxCLevel();
+#else
+    (void)format;
+#endif
+    if (property_get(PROP_COMPRESS_LEVEL, value, "") <= 0)
+        return COMPRESS_LEVEL_DEF;
+    level = atoi(value);
+    if (level < 1)
+        level = 1;
+    if (level > max)
+        level = max;
+    return level;
+}
+
+const char *get_compress_suffix(e_compress_format_t format) {
+    return (format == COMPRESS_ZSTD ? ".zst" : ".gz");
+}
+
+/**
+ * @brief Checks if a file name has the suffix of a compressed file
+ */
+int is_compressed_name(const char *filename) {
+    size_t len = strlen(filename);
+
+    return ((len > 3 && !strcmp(&filename[len-3], ".gz")) ||
+            (len > 4 && !strcmp(&filename[len-4], ".zst")));
+}
+
+static int write_out(int fd, const void *buffer, size_t len) {
+    const char *ptr = buffer;
+    ssize_t nr;
+
+    while (len > 0) {
+        nr = do_write(fd, ptr, len);
+        if (nr < 0)
+            return nr;
+        if (nr == 0)
+            return -ENOSPC;
+        ptr += nr;
+        len -= nr;
+    }
+    return 0;
+}
+
+/* Reads the next chunk, at most *remaining bytes if remaining is not NULL */
+static ssize_t read_in(int fd, void *buffer, off_t *remaining) {
+    size_t len = CPBUFFERSIZE;
+    ssize_t nr;
+
+    if (remaining && (off_t)len > *remaining)
+        len = *remaining;
+    if (!len)
+        return 0;
+    nr = do_read(fd, buffer, len);
+    if (nr < 0)
+        return -errno;
+    if (remaining)
+        *remaining -= nr;
+    return nr;
+}
+
+static off_t gzip_fd(int fsrc, int fdest, off_t *remaining, int level, void *in, void *out) {
+    z_stream strm;
+    ssize_t nr;
+    off_t written = 0;
+    int flush, ret = 0;
+    size_t have;
+
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -ENOMEM;
+
+    do {
+        nr = read_in(fsrc, in, remaining);
+        if (nr < 0) {
+            ret = nr;
+            break;
+        }
+        flush = (nr == 0 ? Z_FINISH : Z_NO_FLUSH);
+        strm.next_in = in;
+        strm.avail_in = nr;
+        do {
+            strm.next_out = out;
+            strm.avail_out = CPBUFFERSIZE;
+            deflate(&strm, flush);
+            have = CPBUFFERSIZE - strm.avail_out;
+            ret = write_out(fdest, out, have);
+            written += have;
+        } while (ret == 0 && strm.avail_out == 0);
+    } while (ret == 0 && flush != Z_FINISH);
+
+    deflateEnd(&strm);
+    return (ret < 0 ? ret : written);
+}
+
+static off_t gunzip_fd(int fsrc, int fdest, void *in, void *out) {
+    z_stream strm;
+    ssize_t nr;
+    off_t written = 0;
+    int zret = Z_OK, ret = 0;
+    size_t have;
+
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, GUNZIP_WINDOW_BITS) != Z_OK)
+        return -ENOMEM;
+
+    for (;;) {
+        nr = read_in(fsrc, in, NULL);
+        if (nr <= 0) {
+            ret = nr;
+            break;
+        }
+        strm.next_in = in;
+        strm.avail_in = nr;
+        while (ret == 0 && strm.avail_in > 0) {
+            /* Like gunzip, concatenated gzip members are all extracted */
+            if (zret == Z_STREAM_END && inflateReset(&strm) != Z_OK) {
+                ret = -EBADMSG;
+                break;
+            }
+            strm.next_out = out;
+            strm.avail_out = CPBUFFERSIZE;
+            zret = inflate(&strm, Z_NO_FLUSH);
+            if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR) {
+                ret = (zret == Z_MEM_ERROR ? -ENOMEM : -EBADMSG);
+                break;
+            }
+            have = CPBUFFERSIZE - strm.avail_out;
+            ret = write_out(fdest, out, have);
+            written += have;
+        }
+        if (ret < 0)
+            break;
+    }
+    /* A truncated stream is an error */
+    if (ret == 0 && zret != Z_STREAM_END)
+        ret = -EBADMSG;
+
+    inflateEnd(&strm);
+    return (ret < 0 ? ret : written);
+}
+
+#ifdef CONFIG_ZSTD
+static off_t zstd_fd(int fsrc, int fdest, off_t *remaining, int level, void *in, void *out) {
+    ZSTD_CCtx *cctx;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    ZSTD_EndDirective mode;
+    ssize_t nr;
+    off_t written = 0;
+    size_t left;
+    int ret = 0;
+
+    cctx = ZSTD_createCCtx();
+    if (!cctx)
+        return -ENOMEM;
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+
+    do {
+        nr = read_in(fsrc, in, remaining);
+        if (nr < 0) {
+            ret = nr;
+            break;
+        }
+        mode = (nr == 0 ? ZSTD_e_end : ZSTD_e_continue);
+        input.src = in;
+        input.size = nr;
+        input.pos = 0;
+        do {
+            output.dst = out;
+            output.size = CPBUFFERSIZE;
+            output.pos = 0;
+            left = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(left)) {
+                ret = -EIO;
+                break;
+            }
+            ret = write_out(fdest, out, output.pos);
+            written += output.pos;
+        } while (ret == 0 && (mode == ZSTD_e_end ? left != 0 : input.pos < input.size));
+    } while (ret == 0 && mode != ZSTD_e_end);
+
+    ZSTD_freeCCtx(cctx);
+    return (ret < 0 ? ret : written);
+}
+
+static off_t unzstd_fd(int fsrc, int fdest, void *in, void *out) {
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    ssize_t nr;
+    off_t written = 0;
+    size_t left = 1;
+    int ret = 0;
+
+    dctx = ZSTD_createDCtx();
+    if (!dctx)
+        return -ENOMEM;
+
+    while (ret == 0) {
+        nr = read_in(fsrc, in, NULL);
+        if (nr <= 0) {
+            ret = nr;
+            break;
+        }
+        input.src = in;
+        input.size = nr;
+        input.pos = 0;
+        while (ret == 0 && input.pos < input.size) {
+            output.dst = out;
+            output.size = CPBUFFERSIZE;
+            output.pos = 0;
+            left = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(left)) {
+                ret = -EBADMSG;
+                break;
+            }
+            ret = write_out(fdest, out, output.pos);
+            written += output.pos;
+        }
+    }
+    /* A truncated frame is an error */
+    if (ret == 0 && left != 0)
+        ret = -EBADMSG;
+
+    ZSTD_freeDCtx(dctx);
+    return (ret < 0 ? ret : written);
+}
+#endif
+
+/**
+ * @brief Opens the source and creates the destination of a (de)compression
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+static int open_files(const char *src, const char *dest, int *fsrc, int *fdest) {
+    int ret;
+
+    if (src == NULL || dest == NULL) return -EINVAL;
+
+    if ( ( *fsrc = open(src, O_RDONLY) ) < 0 )
+        return -errno;
+    /* dest is truncated, its new size is accounted once closed */
+    usage_add(dest, -usage_bytes(dest));
+    if ( ( *fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0) {
+        ret = -errno;
+        LOGE("%s: can not open file: %s - %s\n", __FUNCTION__, dest, strerror(errno));
+        close(*fsrc);
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the files of a (de)compression and reports its result
+ *
+ * On failure, the destination is removed.
+ */
+static off_t close_files(const char *src, const char *dest, int fsrc, int fdest, off_t ret) {
+    close(fsrc);
+    if (close(fdest) < 0 && ret >= 0)
+        ret = -errno;
+    if (ret < 0) {
+        LOGE("%s: processing %s into %s failed - %s\n", __FUNCTION__, src, dest, strerror(-ret));
+        /* CRASHLOG_ERROR_FULL shall only be raised if dest indicates LOGS_DIR */
+        if ((ret == -ENOSPC || ret == -EDQUOT) && check_partlogfull(dest))
+            raise_infoerror(ERROREVENT, CRASHLOG_ERROR_FULL);
+        remove(dest);
+        return ret;
+    }
+    usage_add(dest, usage_bytes(dest));
+    do_chown(dest, PERM_USER, PERM_GROUP);
+    return ret;
+}
+
+/**
+ * @brief Compresses a file, or a window of it
+ *
+ * The window is read and compressed in a single pass, so the uncompressed
+ * data is never written.
+ *
+ * @param src file to compress
+ * @param dest compressed file, created or truncated
+ * @param window part of src to compress
+ * @param limit max number of bytes of src to compress, 0 for no limit. For
+ * the files whose size is unknown, the first limit bytes are compressed
+ * whatever the window.
+ * @param format of the compressed file
+ * @param level of compression
+ *
+ * @return the size of the compressed file, a negative errno value on error.
+ */
+off_t compress_file_window(const char *src, const char *dest, e_copy_window_t window,
+        off_t limit, e_compress_format_t format, int level) {
+    struct stat info;
+    void *in, *out;
+    int fsrc, fdest;
+    off_t ret, remaining = limit;
+
+#ifndef CONFIG_ZSTD
+    (void)format;
+#endif
+    ret = open_files(src, dest, &fsrc, &fdest);
+    if (ret < 0)
+        return ret;
+
+    if (window == COPY_TAIL && limit > 0 && fstat(fsrc, &info) == 0 &&
+            S_ISREG(info.st_mode) && info.st_size > limit)
+        lseek(fsrc, info.st_size - limit, SEEK_SET);
+
+    in = malloc(CPBUFFERSIZE);
+    out = malloc(CPBUFFERSIZE);
+    if (!in || !out)
+        ret = -ENOMEM;
+#ifdef CONFIG_ZSTD
+    else if (format == COMPRESS_ZSTD)
+        ret = zstd_fd(fsrc, fdest, (limit > 0 ? &remaining : NULL), level, in, out);
+#endif
+    else
+        ret = gzip_fd(fsrc, fdest, (limit > 0 ? &remaining : NULL), level, in, out);
+    free(in);
+    free(out);
+
+    return close_files(src, dest, fsrc, fdest, ret);
+}
+
+/**
+ * @brief Compresses a file
+ *
+ * @return the size of the compressed file, a negative errno value on error.
+ */
+off_t compress_file(const char *src, const char *dest, e_compress_format_t format, int level) {
+    return compress_file_window(src, dest, COPY_ALL, 0, format, level);
+}
+
+/**
+ * @brief Copies a window of a file compressed with the configured format
+ *
+ * The suffix of the format is appended to dest.
+ *
+ * @return the size of the compressed file, a negative errno value on error.
+ */
+off_t compress_copy(const char *src, const char *dest, e_copy_window_t window, off_t limit) {
+    e_compress_format_t format = get_compress_format();
+    char path[PATHMAX];
+
+    snprintf(path, sizeof(path), "%s%s", dest, get_compress_suffix(format));
+    return compress_file_window(src, path, window, limit, format, get_compress_level(format));
+}
+
+/**
+ * @brief Checks if the logs copied in the crash directories shall be compressed
+ */
+int is_log_compression_enabled(void) {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(PROP_COMPRESS_LOGS, value, "0");
+    return (atoi(value) > 0);
+}
+
+/**
+ * @brief Decompresses a file, whose format is found from its content
+ *
+ * @return the size of the decompressed file, a negative errno value on error.
+ */
+off_t decompress_file(const char *src, const char *dest) {
+    unsigned char magic[4];
+    void *in, *out;
+    int fsrc, fdest;
+    off_t ret;
+
+    ret = open_files(src, dest, &fsrc, &fdest);
+    if (ret < 0)
+        return ret;
+
+    memset(magic, 0, sizeof(magic));
+    in = malloc(CPBUFFERSIZE);
+    out = malloc(CPBUFFERSIZE);
+    if (!in || !out)
+        ret = -ENOMEM;
+    else if (do_read(fsrc, magic, sizeof(magic)) < 0 || lseek(fsrc, 0, SEEK_SET) < 0)
+        ret = -errno;
+#ifdef CONFIG_ZSTD
+    else if (!memcmp(magic, zstd_magic, sizeof(zstd_magic)))
+        ret = unzstd_fd(fsrc, fdest, in, out);
+#endif
+    else if (!memcmp(magic, gzip_magic, sizeof(gzip_magic)))
+        ret = gunzip_fd(fsrc, fdest, in, out);
+    else
+        ret = -EBADMSG;
+    free(in);
+    free(out);
+
+    return close_files(src, dest, fsrc, fdest, ret);
+}
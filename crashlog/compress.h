@@ -0,0 +1,55 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file compress.h
+ * @brief File containing the streaming compression of the logs.
+ *
+ * The logs are compressed or decompressed in a single read pass by the
+ * thread processing the event, without forking any gzip/gunzip process.
+ * gzip is always available; zstd is available when crashlogd is built with
+ * CONFIG_ZSTD. The format and the level are read from properties.
+ * A window of a file can be compressed while it is copied, so the logs
+ * reach the crash directories compressed without any intermediate copy.
+ */
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include "fsutils.h"
+
+#include <sys/types.h>
+
+typedef enum e_compress_format {
+    COMPRESS_GZIP = 0,
+    COMPRESS_ZSTD,
+} e_compress_format_t;
+
+/* Default compression level, the one of the gzip command */
+#define COMPRESS_LEVEL_DEF      6
+
+e_compress_format_t get_compress_format(void);
+int get_compress_level(e_compress_format_t format);
+const char *get_compress_suffix(e_compress_format_t format);
+int is_compressed_name(const char *filename);
+off_t compress_file_window(const char *src, const char *dest, e_copy_window_t window,
+        off_t limit, e_compress_format_t format, int level);
+off_t compress_file(const char *src, const char *dest, e_compress_format_t format, int level);
+off_t compress_copy(const char *src, const char *dest, e_copy_window_t window, off_t limit);
+int is_log_compression_enabled(void);
+off_t decompress_file(const char *src, const char *dest);
+
+#endif /* __COMPRESS_H__ */
@@ -31,6 +31,9 @@
 #include "config_handler.h"
 #include "modem.h"
 #include "tcs_wrapper.h"
+#include "patmatch.h"
+#include "usage.h"
+#include "admission.h"
 
 #include <stdlib.h>
 
@@ -39,14 +42,67 @@ pconfig g_current_modem_config = NULL; /* Points to current modem_config in list
 
 /* Global variables set from loaded config and used accross crashlogd source code */
 extern int  gcurrent_uptime_hour_frequency;
-extern long current_sd_size_limit;
 int g_current_serial_device_id = 0; /* Specifies where serial ID should be retrieved (from emmc or from properties )*/
 static int check_modem_version = 0;
 
+/* Compiled matching patterns of the generic configs list */
+static pconfig generic_head = NULL;
+static pconfig *generic_configs = NULL;
+static struct patmatch *generic_matcher = NULL;
+
+static void free_generic_matcher() {
+    patmatch_free(generic_matcher);
+    free(generic_configs);
+    generic_matcher = NULL;
+    generic_configs = NULL;
+    generic_head = NULL;
+}
+
+/* Compiles the matching patterns of a configs list so an event name is
+ * matched in one pass whatever the number of configs */
+static void compile_generic_matcher(pconfig first) {
+    const char **patterns;
+    pconfig tmp_config;
+    int count = 0, idx = 0;
+
+    free_generic_matcher();
+    for (tmp_config = first ; tmp_config ; tmp_config = tmp_config->next)
+        count++;
+    if (!count)
+        return;
+
+    generic_configs = malloc(count * sizeof(pconfig));
+    patterns = malloc(count * sizeof(char *));
+    if (!generic_configs || !patterns) {
+        LOGE("%s: Cannot allocate the patterns, use slow matching\n", __FUNCTION__);
+        free(patterns);
+        free_generic_matcher();
+        return;
+    }
+    for (tmp_config = first ; tmp_config ; tmp_config = tmp_config->next) {
+        generic_configs[idx] = tmp_config;
+        patterns[idx++] = tmp_config->matching_pattern;
+    }
+    generic_matcher = patmatch_compile(patterns, count);
+    free(patterns);
+    if (!generic_matcher) {
+        LOGE("%s: Cannot compile the patterns, use slow matching\n", __FUNCTION__);
+        free_generic_matcher();
+        return;
+    }
+    generic_head = first;
+}
+
 //to get pconfig if it exists
 pconfig get_generic_config(char* event_name, pconfig config_to_match) {
     pconfig result = NULL;
     pconfig tmp_config = config_to_match;
+    int idx;
+
+    if (generic_matcher && config_to_match == generic_head) {
+        idx = patmatch_first(generic_matcher, event_name);
+        return (idx < 0 ? NULL : generic_configs[idx]);
+    }
     while (tmp_config) {
         if (strstr(event_name, tmp_config->matching_pattern)){
             result = tmp_config;
@@ -116,6 +172,7 @@ void generic_add_watch(pconfig config_to_watch, int fd){
         }
         tmp_config = tmp_config->next;
     }
+    compile_generic_matcher(config_to_watch);
 }
 
 /*
@@ -126,6 +183,9 @@ void free_config(pconfig first)
 {
     pconfig nextconfig;
     pconfig current = first;
+
+    if (first && first == generic_head)
+        free_generic_matcher();
     while (current){
         nextconfig = current->next;
         free(current->eventname);
@@ -260,6 +320,32 @@ void load_config_by_pattern(char *section_pattern, char *key_pattern, struct con
     }
 }
 
+/* Reads the <bucket>_rate and <bucket>_burst keys of the admission section */
+static void load_admission_config(struct config_handle *a_conf_handle){
+    char key[32];
+    const char *name;
+    pchar tmp;
+    int i, rate, burst;
+
+    for (i = 0 ; (name = admission_bucket_name(i)) != NULL ; i++){
+        rate = burst = -1;
+        snprintf(key, sizeof(key), "%s_rate", name);
+        if (sk_exists(ADMISSION_CONF_PATTERN, key, a_conf_handle)){
+            tmp = get_value(ADMISSION_CONF_PATTERN, key, a_conf_handle);
+            if (tmp && atoi(tmp) >= 0)
+                rate = atoi(tmp);
+        }
+        snprintf(key, sizeof(key), "%s_burst", name);
+        if (sk_exists(ADMISSION_CONF_PATTERN, key, a_conf_handle)){
+            tmp = get_value(ADMISSION_CONF_PATTERN, key, a_conf_handle);
+            if (tmp && atoi(tmp) >= 0)
+                burst = atoi(tmp);
+        }
+        if (rate >= 0 || burst >= 0)
+            admission_set(name, rate, burst);
+    }
+}
+
 void load_config(){
     struct stat info;
     char cur_extra_section[PATHMAX];
@@ -289,7 +375,7 @@ void load_config(){
                 if (tmp){
                     l_tmp = atol(tmp);
                     if (l_tmp > 0){
-                        current_sd_size_limit = l_tmp;
+                        usage_set_quota(USAGE_SD, l_tmp);
                     }
                 }
             }
@@ -339,6 +425,7 @@ void load_config(){
                 }
             }
             load_config_by_pattern(NOTIFY_CONF_PATTERN,"matching_pattern",my_conf_handle);
+            load_admission_config(&my_conf_handle);
             //ADD other config pattern HERE
             free_config_file(&my_conf_handle);
         }else{
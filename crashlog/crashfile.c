@@ -0,0 +1,261 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file crashfile.c
+ * @brief File containing the writer of the crashfiles and event files.
+ *
+ * The fields are formatted in a buffer of the writer and the static header
+ * segments are referenced in place, so a file is usually written by a single
+ * writev() on a descriptor created with its final mode and owner.
+ */
+
+#include "crashfile.h"
+#include "crashutils.h"
+#include "fsutils.h"
+#include "propcache.h"
+#include "privconfig.h"
+
+#include <cutils/properties.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+extern char gboardversion[PROPERTY_VALUE_MAX];
+extern char guuid[256];
+
+struct crashfile_header {
+    int complete;
+    size_t serial_len;
+    size_t platform_len;
+    char serial[sizeof(guuid) + 8];
+    char platform[SIZE_FOOTPRINT_MAX + 2 * PROPERTY_VALUE_MAX + 32];
+};
+
+/* A header is never modified once published. It is built again once when
+ * the IMEI was not yet known, hence the two instances */
+static struct crashfile_header headers[2];
+static struct crashfile_header *header = NULL;
+static pthread_mutex_t header_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void build_header(struct crashfile_header *hdr, const char *imei) {
+    int len;
+
+    len = snprintf(hdr->serial, sizeof(hdr->serial), "SN=%s\n", guuid);
+    hdr->serial_len = ((size_t)len < sizeof(hdr->serial)) ? (size_t)len : sizeof(hdr->serial) - 1;
+    len = snprintf(hdr->platform, sizeof(hdr->platform), "BUILD=%s\nBOARD=%s\nIMEI=%s\n",
+        get_build_footprint(), gboardversion, imei);
+    hdr->platform_len = ((size_t)len < sizeof(hdr->platform)) ? (size_t)len : sizeof(hdr->platform) - 1;
+    hdr->complete = (imei[0] != 0);
+}
+
+static const struct crashfile_header *get_header(void) {
+    const struct crashfile_header *hdr;
+    char imei[PROPERTY_VALUE_MAX];
+
+    pthread_mutex_lock(&header_lock);
+    if (!header || !header->complete) {
+        propcache_get(IMEI_FIELD, imei, "");
+        if (!header) {
+            build_header(&headers[0], imei);
+            header = &headers[0];
+        } else if (imei[0] != 0) {
+            build_header(&headers[1], imei);
+            header = &headers[1];
+        }
+    }
+    hdr = header;
+    pthread_mutex_unlock(&header_lock);
+    return hdr;
+}
+
+static void crashfile_flush(struct crashfile *cf) {
+    struct iovec *iov = cf->iov;
+    int count = cf->iovcnt;
+    ssize_t written;
+
+    while (count > 0 && !cf->error) {
+        written = writev(cf->fd, iov, count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            cf->error = (written < 0) ? -errno : -EIO;
+            break;
+        }
+        /* Short write: skip what was written and retry with the rest */
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    cf->iovcnt = 0;
+    cf->used = 0;
+}
+
+static void crashfile_append(struct crashfile *cf, const char *data, size_t len) {
+    struct iovec *last;
+
+    if (cf->iovcnt > 0) {
+        last = &cf->iov[cf->iovcnt - 1];
+        if ((const char *)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (cf->iovcnt == CRASHFILE_IOV_MAX)
+        crashfile_flush(cf);
+    cf->iov[cf->iovcnt].iov_base = (void *)data;
+    cf->iov[cf->iovcnt].iov_len = len;
+    cf->iovcnt++;
+}
+
+/**
+ * @brief Creates a file with its final mode and owner
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int crashfile_open(struct crashfile *cf, const char *path) {
+    cf->error = 0;
+    cf->iovcnt = 0;
+    cf->used = 0;
+    cf->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, CRASHFILE_MODE);
+    if (cf->fd < 0)
+        return -errno;
+    do_fchown(cf->fd, path, PERM_USER, PERM_GROUP);
+    return 0;
+}
+
+/**
+ * @brief Appends formatted text to the file
+ *
+ * The text is written when the buffer of the writer is full or when the file
+ * is closed. A text longer than CRASHFILE_BUFSIZE is truncated.
+ */
+void crashfile_printf(struct crashfile *cf, const char *fmt, ...) {
+    va_list args;
+    size_t room;
+    int len;
+
+    if (cf->fd < 0 || cf->error)
+        return;
+    if (cf->iovcnt == CRASHFILE_IOV_MAX)
+        crashfile_flush(cf);
+
+    for (;;) {
+        room = sizeof(cf->buf) - cf->used;
+        va_start(args, fmt);
+        len = vsnprintf(cf->buf + cf->used, room, fmt, args);
+        va_end(args);
+        if (len < 0)
+            return;
+        if ((size_t)len < room)
+            break;
+        if (cf->used == 0) {
+            LOGW("%s: line truncated to %d bytes\n", __FUNCTION__, (int)room - 1);
+            len = room - 1;
+            break;
+        }
+        crashfile_flush(cf);
+    }
+    crashfile_append(cf, cf->buf + cf->used, len);
+    cf->used += len;
+}
+
+/**
+ * @brief Appends the SN field
+ */
+void crashfile_add_serial(struct crashfile *cf) {
+    const struct crashfile_header *hdr = get_header();
+
+    if (cf->fd >= 0 && !cf->error)
+        crashfile_append(cf, hdr->serial, hdr->serial_len);
+}
+
+/**
+ * @brief Appends the BUILD, BOARD and IMEI fields
+ */
+void crashfile_add_platform(struct crashfile *cf) {
+    const struct crashfile_header *hdr = get_header();
+
+    if (cf->fd >= 0 && !cf->error)
+        crashfile_append(cf, hdr->platform, hdr->platform_len);
+}
+
+/**
+ * @brief Writes the pending data and closes the file
+ *
+ * @return 0 on success, a negative errno value if any write failed.
+ */
+int crashfile_close(struct crashfile *cf) {
+    if (cf->fd < 0)
+        return -EBADF;
+    crashfile_flush(cf);
+    if (close(cf->fd) < 0 && !cf->error)
+        cf->error = -errno;
+    cf->fd = -1;
+    return cf->error;
+}
+
+/**
+ * @brief Sets a field of an existing crashfile
+ *
+ * The field replaces its previous value, if any, or is added before the
+ * _END line. The updated file replaces the previous one atomically.
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int crashfile_set_field(const char *path, const char *field, const char *value) {
+    struct line_reader reader;
+    struct crashfile cf;
+    char line[MAXLINESIZE];
+    char tmp[PATHMAX];
+    int res, len = strlen(field), found = 0;
+
+    if ((res = line_reader_open(&reader, path)) < 0)
+        return res;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((res = crashfile_open(&cf, tmp)) < 0) {
+        line_reader_close(&reader);
+        return res;
+    }
+    while (line_reader_next(&reader, line) > 0) {
+        if (!strncmp(line, field, len) && line[len] == '=')
+            continue;
+        if (!strncmp(line, "_END", 4) && !found) {
+            crashfile_printf(&cf, "%s=%s\n", field, value);
+            found = 1;
+        }
+        crashfile_printf(&cf, "%s", line);
+    }
+    line_reader_close(&reader);
+    if (!found)
+        crashfile_printf(&cf, "%s=%s\n", field, value);
+
+    if ((res = crashfile_close(&cf)) == 0 && rename(tmp, path) < 0)
+        res = -errno;
+    if (res < 0)
+        unlink(tmp);
+    return res;
+}
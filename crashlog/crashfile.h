@@ -0,0 +1,56 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file crashfile.h
+ * @brief File containing the writer of the crashfiles and event files.
+ *
+ * A file is created with its final mode and owner, filled in memory and
+ * written with a single writev() in most cases. The fields that never change
+ * during a boot (SN, BUILD, BOARD and IMEI) are formatted once and shared by
+ * all the files.
+ */
+
+#ifndef __CRASHFILE_H__
+#define __CRASHFILE_H__
+
+#include <sys/uio.h>
+
+/* Same mode as fopen: the umask applies */
+#define CRASHFILE_MODE          0666
+/* Max number of pending segments before a write */
+#define CRASHFILE_IOV_MAX       16
+/* Size of the buffer holding the formatted fields */
+#define CRASHFILE_BUFSIZE       4096
+
+struct crashfile {
+    int fd;
+    int error;
+    int iovcnt;
+    size_t used;
+    struct iovec iov[CRASHFILE_IOV_MAX];
+    char buf[CRASHFILE_BUFSIZE];
+};
+
+int crashfile_open(struct crashfile *cf, const char *path);
+void crashfile_printf(struct crashfile *cf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void crashfile_add_serial(struct crashfile *cf);
+void crashfile_add_platform(struct crashfile *cf);
+int crashfile_close(struct crashfile *cf);
+int crashfile_set_field(const char *path, const char *field, const char *value);
+
+#endif /* __CRASHFILE_H__ */
@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/sha1.h>
 
 #include <cutils/properties.h>
@@ -47,6 +48,9 @@
 #include <privconfig.h>
 #include <history.h>
 #include <fsutils.h>
+#include <propcache.h>
+#include <keygen.h>
+#include <notifier.h>
 #include <dropbox.h>
 
 char gbuildversion[PROPERTY_VALUE_MAX] = {0,};
@@ -54,11 +58,42 @@ char gboardversion[PROPERTY_VALUE_MAX] = {0,};
 char guuid[256] = {0,};
 int gabortcleansd = 0;
 
+/* Array containing the current date/time under different formats */
+struct crashlog_time {
+    char value[TIME_FORMAT_LENGTH];
+};
+static struct crashlog_time shared_time_array[TIME_FORMAT_LONG + 1];
+static pthread_key_t time_array_key;
+static pthread_once_t time_array_once = PTHREAD_ONCE_INIT;
+
+static void create_time_array_key(void) {
+    if (pthread_key_create(&time_array_key, free) != 0)
+        LOGE("%s: Cannot create the time array key\n", __FUNCTION__);
+}
+
+/* Each thread has its own array, so the date/time a thread computed isn't
+ * overwritten by another one while it is being used */
+static struct crashlog_time *get_time_array(void) {
+    struct crashlog_time *array;
+
+    pthread_once(&time_array_once, create_time_array_key);
+    array = pthread_getspecific(time_array_key);
+    if (!array) {
+        array = calloc(DIM(shared_time_array), sizeof(*array));
+        if (!array || pthread_setspecific(time_array_key, array) != 0) {
+            free(array);
+            return shared_time_array;
+        }
+    }
+    return array;
+}
+
 /**
  * @brief Returns the date/time under the input format.
  *
  * if refresh requested, returns current date/time.
  * if refresh not requested, returns previous computed time if available.
+ * The date/time is kept per thread.
  *
  * @param[in] refresh : force date/time re-computing or not.
  * @param[in] format : specifies requested date/time format.
@@ -73,12 +108,9 @@ const char *  __attribute__( ( noinline ) ) get_current_system_time(int refresh,
             [ TIME_FORMAT_SHORT ] = { "%Y%m%d%H%M%S" },
             [ TIME_FORMAT_LONG ]  = { "%Y-%m-%d/%H:%M:%S  " },
     };
-    /* Array containing the current date/time under different formats */
-    static struct { char value[TIME_FORMAT_LENGTH]; } crashlog_time_array[] = {
-            [ DATE_FORMAT_SHORT ] = { {0,} },
-            [ TIME_FORMAT_SHORT ] = { {0,} },
-            [ TIME_FORMAT_LONG ]  = { {0,} },
-    };
+    struct crashlog_time *crashlog_time_array = get_time_array();
+    struct tm tm;
+
     /* to NOT refresh and time array already initialized : returns value previously computed */
     if (!refresh && crashlog_time_array[format].value[0] != 0 )
         return crashlog_time_array[format].value;
@@ -88,10 +120,11 @@ const char *  __attribute__( ( noinline ) ) get_current_system_time(int refresh,
     if (time(&t) == (time_t)-1 )
         LOGE("%s: Can't get current system time : use value previously got - error is %s", __FUNCTION__, strerror(errno));
     else {
-        for ( format_idx = 0 ; format_idx < (int)DIM(crashlog_time_array); format_idx++ )
+        localtime_r(&t, &tm);
+        for ( format_idx = 0 ; format_idx < (int)DIM(date_time_format); format_idx++ )
             PRINT_TIME( crashlog_time_array[format_idx].value ,
                         date_time_format[format_idx].format ,
-                        localtime((const time_t *)&t));
+                        &tm);
     }
     return crashlog_time_array[format].value;
 }
@@ -146,73 +179,45 @@ unsigned long long get_uptime(int refresh, int *error)
     return time_ns;
 }
 
-void do_last_kmsg_copy(int dir) {
+void do_last_kmsg_copy(char *dirbase, int dir) {
     char destion[PATHMAX];
 
     if ( file_exists(LAST_KMSG) ) {
-        snprintf(destion, sizeof(destion), "%s%d/%s", CRASH_DIR, dir, LAST_KMSG_FILE);
+        snprintf(destion, sizeof(destion), "%s%d/%s", dirbase, dir, LAST_KMSG_FILE);
         do_copy_tail(LAST_KMSG, destion, MAXFILESIZE);
     } else if ( file_exists(CONSOLE_RAMOOPS) ) {
-        snprintf(destion, sizeof(destion), "%s%d/%s", CRASH_DIR, dir, CONSOLE_RAMOOPS_FILE);
+        snprintf(destion, sizeof(destion), "%s%d/%s", dirbase, dir, CONSOLE_RAMOOPS_FILE);
         do_copy_tail(CONSOLE_RAMOOPS, destion, MAXFILESIZE);
     }
     if ( file_exists(FTRACE_RAMOOPS) ) {
-        snprintf(destion, sizeof(destion), "%s%d/%s", CRASH_DIR, dir, FTRACE_RAMOOPS_FILE);
+        snprintf(destion, sizeof(destion), "%s%d/%s", dirbase, dir, FTRACE_RAMOOPS_FILE);
         do_copy_tail(FTRACE_RAMOOPS, destion, MAXFILESIZE);
     }
 }
 
-void do_last_fw_msg_copy(int dir) {
+void do_last_fw_msg_copy(char *dirbase, int dir) {
     char destion[PATHMAX];
 
     if ( (dir >= 0) && file_exists(CURRENT_PROC_OFFLINE_SCU_LOG_NAME) ) {
-        snprintf(destion, sizeof(destion), "%s%d/%s.txt", CRASH_DIR, dir, OFFLINE_SCU_LOG_NAME);
+        snprintf(destion, sizeof(destion), "%s%d/%s.txt", dirbase, dir, OFFLINE_SCU_LOG_NAME);
         do_copy_eof(CURRENT_PROC_OFFLINE_SCU_LOG_NAME, destion);
     }
 }
 
-/* Compute key shall be checked only once at the first call to insure the
-  memory allocation succeeded */
-static int compute_key(char* key, char *event, char *type)
-{
-    static SHA1_CTX *sha = NULL;
-    char buf[256] = { '\0', };
-    long long time_ns=0;
-    char *tmp_key = key;
-    unsigned char results[SHA1_DIGEST_LENGTH];
-    int i;
-
-    if (sha == NULL) {
-        sha = (SHA1_CTX*)malloc(sizeof(SHA1_CTX));
-        if (sha == NULL) {
-            LOGE("%s - Cannot create SHA1_CTX memory... fails to compute the key!\n", __FUNCTION__);
-            return -1;
-        }
-        SHA1Init(sha);
-    }
-
-    if (!key || !event || !type) return -EINVAL;
-
-    time_ns = get_uptime(1, &i);
-    snprintf(buf, 256, "%s%s%s%s%lld", gbuildversion, guuid, event, type, time_ns);
-
-    SHA1Update(sha, (unsigned char*) buf, strlen(buf));
-    SHA1Final(results, sha);
-    for (i = 0; i < SHA1_DIGEST_LENGTH/2; i++)
-    {
-        sprintf(tmp_key, "%02x", results[i]);
-        tmp_key+=2;
-    }
-    *tmp_key=0;
-    return 0;
-}
-
 static void check_prop_modemid(){
     static int propFound = -1;
+    static char lastprop[PROPERTY_VALUE_MAX] = { 0, };
     char prop[PROPERTY_VALUE_MAX];
-    if (propFound !=0){
-        propFound = read_file_prop_uid(MODEM_FIELD, MODEM_UUID, prop, "unknown");
+
+    /* The modem id file is only updated when the property changes */
+    if (propFound == 0) {
+        propcache_get(MODEM_FIELD, prop, "");
+        if (!strcmp(prop, lastprop))
+            return;
     }
+    propFound = read_file_prop_uid(MODEM_FIELD, MODEM_UUID, prop, "unknown");
+    if (propFound == 0)
+        strncpy(lastprop, prop, PROPERTY_VALUE_MAX);
 }
 
 char **commachain_to_fixedarray(char *chain,
@@ -278,18 +283,9 @@ char **commachain_to_fixedarray(char *chain,
     return array;
 }
 
-static const char *get_imei() {
-    static char imei[PROPERTY_VALUE_MAX] = { 0, };
-
-    if (imei[0] != 0) return imei;
-
-    property_get(IMEI_FIELD, imei, "");
-    return imei;
-}
-
 static const char *get_operator() {
     static char operator[PROPERTY_VALUE_MAX] = { 0, };
-    property_get(OPERATOR_FIELD, operator, "UNKNOWN");
+    propcache_get(OPERATOR_FIELD, operator, "UNKNOWN");
     return operator;
 }
 
@@ -299,42 +295,25 @@ static const char *get_operator() {
 static int create_minimal_crashfile(char * event, const char* type, const char* path, char* key,
       const char* uptime, const char* date, int data_ready, char* data0, char* data1, char* data2)
 {
-    FILE *fp;
+    struct crashfile cf;
     char fullpath[PATHMAX];
     char mpanicpath[PATHMAX];
+    int res;
 
     snprintf(fullpath, sizeof(fullpath)-1, "%s/%s", path, CRASHFILE_NAME);
 
     //Create crashfile
-    errno = 0;
-    fp = fopen(fullpath,"w");
-    if (fp == NULL)
-    {
-        LOGE("%s: Cannot create %s - %s\n", __FUNCTION__, fullpath, strerror(errno));
-        return -errno;
-    }
-    fclose(fp);
-    do_chown(fullpath, PERM_USER, PERM_GROUP);
-
-    fp = fopen(fullpath,"w");
-    if (fp == NULL)
-    {
-        LOGE("%s: can not open file: %s\n", __FUNCTION__, fullpath);
-        return -errno;
+    if ((res = crashfile_open(&cf, fullpath)) < 0) {
+        LOGE("%s: Cannot create %s - %s\n", __FUNCTION__, fullpath, strerror(-res));
+        return res;
     }
 
     //Fill crashfile
-    fprintf(fp,"EVENT=%s\n", event);
-    fprintf(fp,"ID=%s\n", key);
-    fprintf(fp,"SN=%s\n", guuid);
-    fprintf(fp,"DATE=%s\n", date);
-    fprintf(fp,"UPTIME=%s\n", uptime);
-    fprintf(fp,"BUILD=%s\n", get_build_footprint());
-    fprintf(fp,"BOARD=%s\n", gboardversion);
-    fprintf(fp,"IMEI=%s\n", get_imei());
-    fprintf(fp,"TYPE=%s\n", type);
-    fprintf(fp,"DATA_READY=%d\n", data_ready);
-    fprintf(fp,"OPERATOR=%s\n", get_operator());
+    crashfile_printf(&cf, "EVENT=%s\nID=%s\n", event, key);
+    crashfile_add_serial(&cf);
+    crashfile_printf(&cf, "DATE=%s\nUPTIME=%s\n", date, uptime);
+    crashfile_add_platform(&cf);
+    crashfile_printf(&cf, "TYPE=%s\nDATA_READY=%d\nOPERATOR=%s\n", type, data_ready, get_operator());
     //MPANIC crash : fill DATA field and preempt data012 mechanism
     if (!strcmp(MDMCRASH_EVNAME, type)){
         LOGI("Modem panic detected : generating DATA0\n");
@@ -344,7 +323,7 @@ static int create_minimal_crashfile(char * event, const char* type, const char*
         d = opendir(path);
         if(!d) {
             LOGE("%s: Can't open dir %s\n",__FUNCTION__, path);
-            fclose(fp);
+            crashfile_close(&cf);
             return -1;
         }
         while ((de = readdir(d))) {
@@ -362,11 +341,11 @@ static int create_minimal_crashfile(char * event, const char* type, const char*
                 char value[PATHMAX] = "";
                 if (ismpanic) {
                     fscanf(fd_panic, "%s", value);
-                    fprintf(fp,"DATA0=%s\n", value);
+                    crashfile_printf(&cf, "DATA0=%s\n", value);
                 }
                 else { // iscrashdata
                     while (fgets(value,sizeof(value),fd_panic) && !strstr(value,"_END"))
-                        fprintf(fp,"%s\n", value);
+                        crashfile_printf(&cf, "%s\n", value);
                 }
                 fclose(fd_panic);
                 break;
@@ -375,18 +354,19 @@ static int create_minimal_crashfile(char * event, const char* type, const char*
         closedir(d);
     } else {
         if (data0)
-            fprintf(fp,"DATA0=%s\n", data0);
+            crashfile_printf(&cf, "DATA0=%s\n", data0);
         if (data1)
-            fprintf(fp,"DATA1=%s\n", data1);
+            crashfile_printf(&cf, "DATA1=%s\n", data1);
         if (data2)
-            fprintf(fp,"DATA2=%s\n", data2);
+            crashfile_printf(&cf, "DATA2=%s\n", data2);
     }
-    fprintf(fp,"_END\n");
-    fclose(fp);
-    return 0;
+    crashfile_printf(&cf, "_END\n");
+    if ((res = crashfile_close(&cf)) < 0)
+        LOGE("%s: Cannot write %s - %s\n", __FUNCTION__, fullpath, strerror(-res));
+    return res;
 }
 
-static char *priv_raise_event(char *event, char *type, char *subtype, char *log,
+static char *priv_raise_event_unlocked(char *event, char *type, char *subtype, char *log,
         int add_uptime, int data_ready, char* data0, char* data1, char* data2) {
     struct history_entry entry;
     char key[SHA1_DIGEST_LENGTH+1];
@@ -468,11 +448,25 @@ static char *priv_raise_event(char *event, char *type, char *subtype, char *log,
 
     /* Notify CrashReport except for UIWDT events */
     if (strncmp(type, SYSSERVER_EVNAME, sizeof(SYSSERVER_EVNAME))) {
-            notify_crashreport();
+            notify_crashreport(key);
     }
     return strdup(key);
 }
 
+/* Events may be raised from the worker pool : key computation, history and
+ * crashfile updates are serialized */
+static char *priv_raise_event(char *event, char *type, char *subtype, char *log,
+        int add_uptime, int data_ready, char* data0, char* data1, char* data2) {
+    static pthread_mutex_t raise_lock = PTHREAD_MUTEX_INITIALIZER;
+    char *key;
+
+    pthread_mutex_lock(&raise_lock);
+    key = priv_raise_event_unlocked(event, type, subtype, log, add_uptime,
+            data_ready, data0, data1, data2);
+    pthread_mutex_unlock(&raise_lock);
+    return key;
+}
+
 char *raise_event_nouptime(char *event, char *type, char *subtype, char *log) {
     return priv_raise_event(event, type, subtype, log, NO_UPTIME, 1, NULL , NULL, NULL);
 }
@@ -511,18 +505,13 @@ void restart_profile_srv(int serveridx) {
         default: return;
     }
 
-    if (property_get(PROP_PROFILE, value, NULL) <= 0) return;
+    if (propcache_get(PROP_PROFILE, value, NULL) <= 0) return;
     if ( value[0] == expected )
         start_daemon(profile_srv);
 }
 
 int check_running_modem_trace() {
-    char modemtrace[PROPERTY_VALUE_MAX];
-
-    property_get("init.svc.mtsp", modemtrace, "");
-    if (!strncmp(modemtrace, "running", 7))
-        return 1;
-    return 0;
+    return propcache_is("init.svc.mtsp", "running");
 }
 
 void check_running_power_service() {
@@ -530,8 +519,8 @@ void check_running_power_service() {
     char powerservice[PROPERTY_VALUE_MAX];
     char powerenable[PROPERTY_VALUE_MAX];
 
-    property_get("init.svc.profile_power", powerservice, "");
-    property_get("persist.service.power.enable", powerenable, "");
+    propcache_get("init.svc.profile_power", powerservice, "");
+    propcache_get("persist.service.power.enable", powerenable, "");
     if (strcmp(powerservice, "running") && !strcmp(powerenable, "1")) {
         LOGE("power service stopped whereas property is set .. restarting\n");
         start_daemon("profile_power");
@@ -540,7 +529,8 @@ void check_running_power_service() {
 }
 
 int get_build_board_versions(char *filename, char *buildver, char *boardver) {
-    FILE *fd;
+    struct line_reader reader;
+    int res;
     char buffer[MAXLINESIZE];
     char bldpattern[MAXLINESIZE], brdpattern[MAXLINESIZE];
     int bldfieldlen, brdfieldlen;
@@ -551,9 +541,9 @@ int get_build_board_versions(char *filename, char *buildver, char *boardver) {
     property_get(PROP_BOARD_FIELD, boardver, "");
     if (buildver[0] != 0 && boardver[0] != 0) return 0;
 
-    if ((fd = fopen(filename, "r")) == NULL) {
-        LOGE("%s - Cannot read %s - %s\n", __FUNCTION__, filename, strerror(errno));
-        return -errno;
+    if ((res = line_reader_open(&reader, filename)) < 0) {
+        LOGE("%s - Cannot read %s - %s\n", __FUNCTION__, filename, strerror(-res));
+        return res;
     }
 
     /* build the patterns */
@@ -565,14 +555,14 @@ int get_build_board_versions(char *filename, char *buildver, char *boardver) {
     brdpattern[brdfieldlen+3] = '0';brdpattern[brdfieldlen+2] = 's';brdpattern[brdfieldlen+1] = '%';brdpattern[brdfieldlen] = '=';
 
     /* read the file */
-    while (freadline(fd, buffer) > 0) {
+    while (line_reader_next(&reader, buffer) > 0) {
         if (buildver[0] == 0)
             sscanf(buffer, bldpattern, buildver);
         if (boardver[0] == 0)
             sscanf(buffer, brdpattern, boardver);
         if (buildver[0] != 0 && boardver[0] != 0) break;
     }
-    fclose(fd);
+    line_reader_close(&reader);
     return ((buildver[0] != 0 && boardver[0] != 0) ? 0 : -1);
 }
 
@@ -602,6 +592,7 @@ int process_info_and_error_inotify_callback(struct watch_entry *entry, struct in
 */
 int process_info_and_error(char *filename, char *name) {
     int dir;
+    char *dirbase;
     char path[PATHMAX];
     char destion[PATHMAX];
     unsigned int j = 0;
@@ -625,7 +616,7 @@ int process_info_and_error(char *filename, char *name) {
     }
     snprintf(tmp,sizeof(tmp),"%s",name);
 
-    dir = find_new_crashlog_dir(MODE_STATS);
+    dir = find_new_crashlog_dir(MODE_STATS, &dirbase);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         p = strstr(tmp,"trigger");
@@ -643,16 +634,16 @@ int process_info_and_error(char *filename, char *name) {
         strcpy(p,"_data");
         find_matching_file(filename,tmp, tmp_data_name);
         snprintf(path, sizeof(path),"%s/%s", filename,tmp_data_name);
-        snprintf(destion,sizeof(destion),"%s%d/%s", STATS_DIR, dir, tmp_data_name);
+        snprintf(destion,sizeof(destion),"%s%d/%s", dirbase, dir, tmp_data_name);
         do_copy_tail(path, destion, 0);
         remove(path);
     }
     /*copy trigger file*/
     snprintf(path, sizeof(path),"%s/%s", filename,name);
-    snprintf(destion,sizeof(destion),"%s%d/%s", STATS_DIR,dir,name);
+    snprintf(destion,sizeof(destion),"%s%d/%s", dirbase,dir,name);
     do_copy_tail(path, destion, 0);
     remove(path);
-    snprintf(destion,sizeof(destion),"%s%d/", STATS_DIR,dir);
+    snprintf(destion,sizeof(destion),"%s%d/", dirbase,dir);
     /*create type */
     snprintf(tmp,sizeof(tmp),"%s",name);
     /*Set to upper case*/
@@ -684,27 +675,25 @@ int process_info_and_error(char *filename, char *name) {
  */
 void create_infoevent(char* filename, char* data0, char* data1, char* data2)
 {
-    FILE *fp;
+    struct crashfile cf;
     char fullpath[PATHMAX];
 
     snprintf(fullpath, sizeof(fullpath)-1, "%s/%s", LOGS_DIR, filename);
 
-    fp = fopen(fullpath,"w");
-    if (fp == NULL)
+    if (crashfile_open(&cf, fullpath) < 0)
     {
         LOGE("can not create file1: %s\n", fullpath);
         return;
     }
     //Fill DATA fields
     if (data0 != NULL)
-        fprintf(fp,"DATA0=%s\n", data0);
+        crashfile_printf(&cf, "DATA0=%s\n", data0);
     if (data1 != NULL)
-        fprintf(fp,"DATA1=%s\n", data1);
+        crashfile_printf(&cf, "DATA1=%s\n", data1);
     if (data2 != NULL)
-        fprintf(fp,"DATA2=%s\n", data2);
-    fprintf(fp,"_END\n");
-    fclose(fp);
-    do_chown(fullpath, PERM_USER, PERM_GROUP);
+        crashfile_printf(&cf, "DATA2=%s\n", data2);
+    crashfile_printf(&cf, "_END\n");
+    crashfile_close(&cf);
 
     process_info_and_error(LOGS_DIR, filename);
 }
@@ -776,21 +765,17 @@ void start_daemon(const char *daemonname) {
 
 
 
-void notify_crashreport() {
-    char boot_state[PROPERTY_VALUE_MAX];
-
+void notify_crashreport(const char *key) {
     /* Does current crashlog mode allow notifs to crashreport ?*/
     if ( !CRASHLOG_MODE_NOTIFS_ENABLED(g_crashlog_mode) ) {
         LOGD("%s : Current crashlog mode is %s - crashreport notifs disabled.\n", __FUNCTION__, CRASHLOG_MODE_NAME(g_crashlog_mode) );
         return;
     }
-    property_get(PROP_BOOT_STATUS, boot_state, "-1");
-    if (strcmp(boot_state, "1"))
+    if (propcache_get_int(PROP_BOOT_STATUS, -1) != 1)
         return;
 
-    int status = system("am broadcast -n com.intel.crashreport/.specific.NotificationReceiver -a com.intel.crashreport.intent.CRASH_NOTIFY -c android.intent.category.ALTERNATIVE");
-    if (status != 0)
-        LOGI("notify crashreport status: %d.\n", status);
+    /* Bursts of events are coalesced into a single notification */
+    notifier_post(NOTIFY_CRASH, key);
 }
 
 /**
@@ -934,6 +919,9 @@ void clean_crashlog_in_sd(char *dir_to_search, int max) {
     if (d) {
         while ((de = readdir(d))) {
             const char *name = de->d_name;
+            /* Already queued for deletion */
+            if (is_rmfr_tombstone(name))
+                continue;
             snprintf(path, sizeof(path)-1, "%s/%s", dir_to_search, name);
             if ( (strstr(path, SDCARD_CRASH_DIR) ||
                  (strstr(path, SDCARD_STATS_DIR)) ||
@@ -941,7 +929,7 @@ void clean_crashlog_in_sd(char *dir_to_search, int max) {
                 /* If current path is not written in the history file, it's a legacy folder to remove */
                 if (!history_has_event(path)) {
                     LOGD("%s : remove legacy crash folder %s", __FUNCTION__, path);
-                    if  (rmfr(path) < 0)
+                    if  (rmfr_deferred(path) < 0)
                         LOGE("%s: failed to remove folder %s", __FUNCTION__, path);
                     i++;
                     if (i >= max)
@@ -957,8 +945,9 @@ void clean_crashlog_in_sd(char *dir_to_search, int max) {
 //This function creates a reboot file(DATA0/1 set to RESETSRC0/1).
 int create_rebootfile(char* key, int data_ready)
 {
-    FILE *fp;
+    struct crashfile cf;
     char fullpath[PATHMAX];
+    int res;
 
     if(!file_exists(EVENTS_DIR)) {
         /* Create a fresh directory */
@@ -973,25 +962,12 @@ int create_rebootfile(char* key, int data_ready)
     snprintf(fullpath, sizeof(fullpath)-1, "%s/%s_%s", EVENTS_DIR, EVENTFILE_NAME, key);
 
     //Create crashfile
-    errno = 0;
-    fp = fopen(fullpath,"w");
-    if (fp == NULL)
-    {
-        LOGE("%s: Cannot create %s - %s\n", __FUNCTION__, fullpath, strerror(errno));
-        return -errno;
+    if ((res = crashfile_open(&cf, fullpath)) < 0) {
+        LOGE("%s: Cannot create %s - %s\n", __FUNCTION__, fullpath, strerror(-res));
+        return res;
     }
-    fclose(fp);
-    do_chown(fullpath, PERM_USER, PERM_GROUP);
 
-    errno = 0;
-    fp = fopen(fullpath,"w");
-    if (fp == NULL)
-    {
-        LOGE("%s: can not open file: %s %s\n", __FUNCTION__, fullpath, strerror(errno));
-        return -errno;
-    }
-
-    fprintf(fp,"DATA_READY=%d\n", data_ready);
+    crashfile_printf(&cf, "DATA_READY=%d\n", data_ready);
     if (data_ready){
         LOGI("reset source detected : generating DATA0\n");
         char tmp[PATHMAX] = "";
@@ -999,19 +975,20 @@ int create_rebootfile(char* key, int data_ready)
             snprintf(tmp, sizeof(tmp), RESET_SOURCE_0);
         else if(file_exists(RESET_IRQ_1))
             snprintf(tmp, sizeof(tmp), RESET_IRQ_1);
-        get_data_from_boot_file(tmp, "DATA3", fp);
+        get_data_from_boot_file(tmp, "DATA3", &cf);
 
         tmp[0] = '\0';
         if(file_exists(RESET_SOURCE_1))
             snprintf(tmp, sizeof(tmp), RESET_SOURCE_1);
         else if(file_exists(RESET_IRQ_2))
             snprintf(tmp, sizeof(tmp), RESET_IRQ_2);
-        get_data_from_boot_file(tmp,"DATA4", fp);
+        get_data_from_boot_file(tmp,"DATA4", &cf);
 
     }
-    fprintf(fp,"_END\n");
-    fclose(fp);
-    return 0;
+    crashfile_printf(&cf, "_END\n");
+    if ((res = crashfile_close(&cf)) < 0)
+        LOGE("%s: Cannot write %s - %s\n", __FUNCTION__, fullpath, strerror(-res));
+    return res;
 }
 
 /**
@@ -1024,7 +1001,7 @@ int reboot_reason_files_present() {
 
 }
 
-void get_data_from_boot_file(char *file, char* data, FILE* fp) {
+void get_data_from_boot_file(char *file, char* data, struct crashfile *cf) {
     char value[PATHMAX] = "";
     FILE *fd_source = fopen(file, "r");
     errno = 0;
@@ -1036,7 +1013,7 @@ void get_data_from_boot_file(char *file, char* data, FILE* fp) {
             int size = strlen(value);
             if(value[size-1] == '\n')
                 value[size-1] = '\0';
-            fprintf(fp,"%s=%s\n", data, value);
+            crashfile_printf(cf, "%s=%s\n", data, value);
         }
         fclose(fd_source);
     }
@@ -29,6 +29,7 @@
 #define __CRASHUTILS_H__
 
 #include "inotify_handler.h"
+#include "crashfile.h"
 
 /* Define time formats */
 enum time_format {
@@ -57,14 +58,14 @@ char **commachain_to_fixedarray(char *chain,
         unsigned int recordsize, unsigned int maxrecords, int *res);
 int do_screenshot_copy(char* bz_description, char* bzdir);
 
-void do_last_kmsg_copy(int dir);
-void do_last_fw_msg_copy(int dir);
+void do_last_kmsg_copy(char *dirbase, int dir);
+void do_last_fw_msg_copy(char *dirbase, int dir);
 void clean_crashlog_in_sd(char *dir_to_search, int max);
 void check_crashlog_died();
 int raise_infoerror(char *type, char *subtype);
 int create_rebootfile(char* key, int data_ready);
 int reboot_reason_files_present();
-void get_data_from_boot_file(char *file, char* data, FILE* fp);
+void get_data_from_boot_file(char *file, char* data, struct crashfile *cf);
 char *raise_event(char *event, char *type, char *subtype, char *log);
 char *raise_event_nouptime(char *event, char *type, char *subtype, char *log);
 char *raise_event_bootuptime(char *event, char *type, char *subtype, char *log);
@@ -73,7 +74,7 @@ char *raise_event_dataready012(char *event, char *type, char *subtype, char *log
                             int data_ready,char* data0, char* data1, char* data2);
 void create_infoevent(char* filename, char* data0, char* data1,
     char* data2);
-void notify_crashreport();
+void notify_crashreport(const char *key);
 char *create_crashdir_move_crashfile(char *origpath, char *crashfile, int copylogs);
 
 void start_daemon(const char *daemonname);
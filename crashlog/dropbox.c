@@ -29,17 +29,22 @@
 #include <errno.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <sys/sha1.h>
 
 #include "crashutils.h"
 #include "privconfig.h"
 #include "fsutils.h"
 #include "dropbox.h"
+#include "propcache.h"
+#include "notifier.h"
 
 static char gcurrent_key[2][SHA1_DIGEST_LENGTH+1] = {{0,},{0,}};
 static int index_prod = 0;
 static int index_cons = 0;
 static int  gfile_monitor_fd = -1;
+/* Keys are produced by the workers and consumed by the monitor thread */
+static pthread_mutex_t gkey_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void dropbox_set_file_monitor_fd(int file_monitor_fd) {
     gfile_monitor_fd = file_monitor_fd;
@@ -47,6 +52,7 @@ void dropbox_set_file_monitor_fd(int file_monitor_fd) {
 
 int start_dumpstate_srv(char* crash_dir, int crashidx, char *key) {
     char dumpstate_dir[PROPERTY_VALUE_MAX];
+    int prod;
     if ( !crash_dir || !key ) return 0;
 
     /* Check if a dumpstate is already running */
@@ -67,44 +73,50 @@ int start_dumpstate_srv(char* crash_dir, int crashidx, char *key) {
 #else
     start_daemon("logsystemstate");
 #endif
+    /* Store the key before the watch is added so that a dropbox event
+     * processed right away finds it */
+    pthread_mutex_lock(&gkey_lock);
+    strncpy(gcurrent_key[index_prod],key,SHA1_DIGEST_LENGTH+1);
+    prod = index_prod;
+    index_prod = (index_prod + 1) % 2;
+    pthread_mutex_unlock(&gkey_lock);
     if (inotify_add_watch(gfile_monitor_fd, dumpstate_dir, IN_CLOSE_WRITE) < 0) {
         LOGE("%s: Can't add watch for %s - %s.\n", __FUNCTION__,
             dumpstate_dir, strerror(errno));
+        pthread_mutex_lock(&gkey_lock);
+        gcurrent_key[prod][0] = 0;
+        index_prod = prod;
+        pthread_mutex_unlock(&gkey_lock);
         return -1;
     }
-    strncpy(gcurrent_key[index_prod],key,SHA1_DIGEST_LENGTH+1);
-    index_prod = (index_prod + 1) % 2;
     return 1;
 }
 
 /* TODO, change the current key with a list of keys and compare with the
  * event to retreive the one */
 int finalize_dropbox_pending_event(const struct inotify_event __attribute__((unused)) *event) {
-    char cmd[512];
-    char boot_state[PROPERTY_VALUE_MAX];
+    char key[SHA1_DIGEST_LENGTH+1];
 
     /* gcurrent_key is in provision */
+    pthread_mutex_lock(&gkey_lock);
     if (gcurrent_key[index_cons][0] == 0) {
+        pthread_mutex_unlock(&gkey_lock);
         LOGE("%s: Received a dropbox event but no key is pending, drop it...\n", __FUNCTION__);
         return -1;
     }
 
-    property_get(PROP_BOOT_STATUS, boot_state, "-1");
-    if (strcmp(boot_state, "1"))
+    if (propcache_get_int(PROP_BOOT_STATUS, -1) != 1) {
+        pthread_mutex_unlock(&gkey_lock);
         return -1;
+    }
 
-
-    snprintf(cmd,sizeof(cmd)-1,"am broadcast -n com.intel.crashreport"
-        "/.specific.NotificationReceiver -a com.intel.crashreport.intent.CRASH_LOGS_COPY_FINISHED "
-        "-c android.intent.category.ALTERNATIVE --es com.intel.crashreport.extra.EVENT_ID %s",
-        gcurrent_key[index_cons]);
-
-    int status = system(cmd);
-    if (status != 0)
-        LOGI("%s: Notify crashreport status(%d) for command \"%s\".\n", __FUNCTION__, status, cmd);
-
+    strncpy(key, gcurrent_key[index_cons], sizeof(key));
     gcurrent_key[index_cons][0] = 0;
     index_cons = (index_cons + 1) % 2;
+    pthread_mutex_unlock(&gkey_lock);
+
+    notifier_post(NOTIFY_LOGS_COPIED, key);
+
     return 0;
 }
 
@@ -191,6 +203,7 @@ long extract_dropbox_timestamp(char* filename)
  */
 int manage_duplicate_dropbox_events(struct inotify_event *event)
 {
+    /* Only used by the worker processing the dropbox events */
     static uint32_t previous_event_cookie = 0;
     static char previous_filename[PATHMAX] = { '\0', };
     char info_filename[PATHMAX] = { '\0',};
@@ -275,6 +288,7 @@ int manage_duplicate_dropbox_events(struct inotify_event *event)
 
 int process_lost_event(struct watch_entry __attribute__((unused)) *entry, struct inotify_event *event) {
     int dir;
+    char *dirbase;
     char destination[PATHMAX], path[PATHMAX];
     char lostevent[32];
     char lostevent_subtype[32];
@@ -297,7 +311,7 @@ int process_lost_event(struct watch_entry __attribute__((unused)) *entry, struct
 
     snprintf(lostevent_subtype, sizeof(lostevent_subtype), "%s_%s", LOST_EVNAME, lostevent);
 
-    dir = find_new_crashlog_dir(MODE_CRASH_NOSD);
+    dir = find_new_crashlog_dir(MODE_CRASH_NOSD, &dirbase);
     if (dir < 0) {
         LOGE("%s: Find dir for lost dropbox failed\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, lostevent, lostevent_subtype, NULL);
@@ -307,11 +321,11 @@ int process_lost_event(struct watch_entry __attribute__((unused)) *entry, struct
     }
     /* Copy the *.lost dropbox file */
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
-    snprintf(destination,sizeof(destination),"%s%d/%s", CRASH_DIR,dir,event->name);
+    snprintf(destination,sizeof(destination),"%s%d/%s", dirbase,dir,event->name);
     do_copy(path, destination, 0);
-    usleep(TIMEOUT_VALUE);
-    snprintf(destination,sizeof(destination),"%s%d/",CRASH_DIR,dir);
-    do_log_copy(lostevent, dir, get_current_time_short(1), APLOG_TYPE);
+    wait_aplog_flushed();
+    snprintf(destination,sizeof(destination),"%s%d/",dirbase,dir);
+    do_log_copy(lostevent, dirbase, dir, get_current_time_short(1), APLOG_TYPE);
     key = raise_event(CRASHEVENT, lostevent, lostevent_subtype, destination);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), lostevent, destination);
     free(key);
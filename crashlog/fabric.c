@@ -24,53 +24,56 @@
 #include "crashutils.h"
 #include "privconfig.h"
 #include "fsutils.h"
+#include "filescan.h"
 
 #include <stdlib.h>
 
-struct fabric_type {
-    char *keyword;
-    char *tail;
-    char *name;
+enum {
+    F_FAKE_DW2,
+    F_FAKE_DW3,
+    F_FAKE_DW3_E103,
+    F_FAKE_DW11,
+    F_INFORMATIVE_MSG,
+    F_TYPES,
 };
 
-struct fabric_type fabric_types_array[] = {
-    {"DW0:", "f501", "MEMERR"},
-    {"DW0:", "f502", "INSTERR"},
-    {"DW0:", "f504", "SRAMECCERR"},
-    {"DW0:", "00dd", "HWWDTLOGERR"},
-    {"DW3:", "0000e101", "MEMERR"},
-    {"DW3:", "0000e102", "INSTERR"},
-    {"DW3:", "0000e104", "SRAMECCERR"},
-    {"DW3:", "0000e106", "NORTHFUSEERR"},
-    {"DW3:", "0000e10a", "KERNELHANG"},
-    {"DW3:", "0000e10b", "KERNELWDT"},
-    {"DW3:", "0000e10c", "SCUWDT"},
-    {"DW3:", "0000e10d", "FABRICXML"},
-    {"DW3:", "0000e601", "PLLLOCKERR"},
-    {"DW3:", "0000e603", "UNDEFL1ERR"},
-    {"DW3:", "0000e604", "PUNITMBBTIMEOUT"},
-    {"DW3:", "0000e605", "VOLTKERR"},
-    {"DW3:", "0000e606", "VOLTSAIATKERR"},
-    {"DW3:", "0000e607", "LPEINTERR"},
-    {"DW3:", "0000e608", "PSHINTERR"},
-    {"DW3:", "0000e609", "FUSEINTERR"},
-    {"DW3:", "0000e60a", "IPC2ERR"},
-    {"DW3:", "0000e60b", "KWDTIPCERR"},
+/* Patterns searched in the fabric dump. A fake fabric is reported by 2 rules
+ * hitting together, see fabric_fakes. Rules from F_TYPES on are the known
+ * fabric types by priority order */
+static const struct scan_rule fabric_rules[] = {
+    [ F_FAKE_DW2 ] = {"DW2:", "02608002", NULL, "FABRIC_FAKE"},
+    [ F_FAKE_DW3 ] = {"DW3:", "ff222230", NULL, "FABRIC_FAKE"},
+    [ F_FAKE_DW3_E103 ] = {"DW3:", "0000e103", NULL, "FABRIC_FAKE"},
+    [ F_FAKE_DW11 ] = {"DW11:", "ff222230", NULL, "FABRIC_FAKE"},
+    [ F_INFORMATIVE_MSG ] = {"DW0:", "f506", NULL, "FIRMWARE"},
+    [ F_TYPES ] = {"DW0:", "f501", NULL, "MEMERR"},
+    {"DW0:", "f502", NULL, "INSTERR"},
+    {"DW0:", "f504", NULL, "SRAMECCERR"},
+    {"DW0:", "00dd", NULL, "HWWDTLOGERR"},
+    {"DW3:", "0000e101", NULL, "MEMERR"},
+    {"DW3:", "0000e102", NULL, "INSTERR"},
+    {"DW3:", "0000e104", NULL, "SRAMECCERR"},
+    {"DW3:", "0000e106", NULL, "NORTHFUSEERR"},
+    {"DW3:", "0000e10a", NULL, "KERNELHANG"},
+    {"DW3:", "0000e10b", NULL, "KERNELWDT"},
+    {"DW3:", "0000e10c", NULL, "SCUWDT"},
+    {"DW3:", "0000e10d", NULL, "FABRICXML"},
+    {"DW3:", "0000e601", NULL, "PLLLOCKERR"},
+    {"DW3:", "0000e603", NULL, "UNDEFL1ERR"},
+    {"DW3:", "0000e604", NULL, "PUNITMBBTIMEOUT"},
+    {"DW3:", "0000e605", NULL, "VOLTKERR"},
+    {"DW3:", "0000e606", NULL, "VOLTSAIATKERR"},
+    {"DW3:", "0000e607", NULL, "LPEINTERR"},
+    {"DW3:", "0000e608", NULL, "PSHINTERR"},
+    {"DW3:", "0000e609", NULL, "FUSEINTERR"},
+    {"DW3:", "0000e60a", NULL, "IPC2ERR"},
+    {"DW3:", "0000e60b", NULL, "KWDTIPCERR"},
 };
 
-struct fabric_type fabric_fakes_array[] = {
-    {"DW2:", "02608002", "FABRIC_FAKE"},
-    {"DW3:", "ff222230", "FABRIC_FAKE"},
-    {"DW3:", "0000e103", "FABRIC_FAKE"},
-    {"DW11:", "ff222230", "FABRIC_FAKE"},
-};
-
-enum {
-    F_INFORMATIVE_MSG
-};
-
-static const struct fabric_type fabric_event[] = {
-    [ F_INFORMATIVE_MSG ] = {"DW0:", "f506", "FIRMWARE"},
+/* Pairs of rules identifying a fake fabric */
+static const int fabric_fakes[][2] = {
+    {F_FAKE_DW2, F_FAKE_DW3},
+    {F_FAKE_DW3_E103, F_FAKE_DW11},
 };
 
 int cfg_check_hwwdt = 0;
@@ -81,13 +84,16 @@ int crashlog_check_fabric(char *reason, int test) {
     char crashtype[32] = {'\0'};
     char event_name[10] = CRASHEVENT;
     int dir, dir_err = 0;
+    char *dirbase;
+    char hits[DIM(fabric_rules)];
     unsigned int i = 0;
+    int rule;
     char *key;
 
     if ( !test && !file_exists(CURRENT_PROC_FABRIC_ERROR_NAME) ) return 1;
 
     destination[0] = '\0';
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
 
     if (dir < 0) {
         LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
@@ -95,52 +101,51 @@ int crashlog_check_fabric(char *reason, int test) {
         snprintf(destination, sizeof(destination), "%s", LOG_FABRICTEMP);
     } else {
         destination[0] = '\0';
-        snprintf(destination, sizeof(destination), "%s%d/%s_%s.txt", CRASH_DIR, dir,
+        snprintf(destination, sizeof(destination), "%s%d/%s_%s.txt", dirbase, dir,
                 FABRIC_ERROR_NAME, dateshort);
     }
 
     do_copy_eof(CURRENT_PROC_FABRIC_ERROR_NAME, destination);
 
+    if (scan_file(destination, fabric_rules, DIM(fabric_rules), hits) < 0)
+        memset(hits, 0, sizeof(hits));
+
     /* Looks first for fake fabrics */
-    if (( find_str_in_file(destination, fabric_fakes_array[0].keyword, fabric_fakes_array[0].tail) > 0 &&
-          find_str_in_file(destination, fabric_fakes_array[1].keyword, fabric_fakes_array[1].tail) > 0 ) ||
-        ( find_str_in_file(destination, fabric_fakes_array[2].keyword, fabric_fakes_array[2].tail) > 0 &&
-          find_str_in_file(destination, fabric_fakes_array[3].keyword, fabric_fakes_array[3].tail) > 0 )) {
+    for (i = 0; i < DIM(fabric_fakes); i++) {
+        if (hits[fabric_fakes[i][0]] && hits[fabric_fakes[i][1]]) {
             /* Got it, it's a fake!! */
-            strncpy(crashtype, fabric_fakes_array[i].name, sizeof(crashtype)-1);
+            strncpy(crashtype, fabric_rules[fabric_fakes[i][0]].name, sizeof(crashtype)-1);
             if (!strncmp(reason, "HWWDT_RESET", strlen("HWWDT_RESET")))
                 strcat(reason,"_FAKE");
+            break;
+        }
     }
 
     if (crashtype[0] == 0) {
         /* Not a fake, checks for the type in the know fabrics list */
-        for (i = 0; i < DIM(fabric_types_array); i++) {
-            if ( find_str_in_file(destination, fabric_types_array[i].keyword, fabric_types_array[i].tail) > 0 ) {
-               /* Got it! */
-               strncpy(crashtype, fabric_types_array[i].name, sizeof(crashtype)-1);
-               if (strstr(crashtype, "HANG"))
-                   strncpy(event_name, INFOEVENT, sizeof(event_name)-1);
-               break;
-            }
-        }
-        if (crashtype[0] == 0) {
+        rule = scan_first_hit(hits, F_TYPES, DIM(fabric_rules));
+        if (rule >= 0) {
+            /* Got it! */
+            strncpy(crashtype, fabric_rules[rule].name, sizeof(crashtype)-1);
+            if (strstr(crashtype, "HANG"))
+                strncpy(event_name, INFOEVENT, sizeof(event_name)-1);
+        } else {
             /* Not a fake but still unknown!! set a default type */
             strcpy(crashtype, FABRIC_ERROR);
         }
     }
     /* Search for INFORMATIVE_MSG reported by kernel fabric module */
-    if ( find_str_in_file(destination, fabric_event[F_INFORMATIVE_MSG].keyword,
-            fabric_event[F_INFORMATIVE_MSG].tail) > 0 ) {
+    if (hits[F_INFORMATIVE_MSG]) {
         /* Informative_Msg from fabric -> info event */
         strncpy(event_name, INFOEVENT, sizeof(event_name)-1);
-        strncpy(crashtype, fabric_event[F_INFORMATIVE_MSG].name, sizeof(crashtype)-1);
+        strncpy(crashtype, fabric_rules[F_INFORMATIVE_MSG].name, sizeof(crashtype)-1);
     }
 
     if (dir_err == 0) {
-        do_last_kmsg_copy(dir);
-        do_last_fw_msg_copy(dir);
+        do_last_kmsg_copy(dirbase, dir);
+        do_last_fw_msg_copy(dirbase, dir);
         destination[0] = '\0';
-        snprintf(destination, sizeof(destination),"%s%d/", CRASH_DIR, dir);
+        snprintf(destination, sizeof(destination),"%s%d/", dirbase, dir);
         key = raise_event(event_name, crashtype, NULL, destination);
         LOGE("%-8s%-22s%-20s%s %s\n", event_name, key, get_current_time_long(0), crashtype, destination);
         free(key);
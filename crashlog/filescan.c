@@ -0,0 +1,231 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file filescan.c
+ * @brief File containing the rule scanner used to classify crash dumps.
+ */
+
+#include "filescan.h"
+#include "patmatch.h"
+#include "privconfig.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+struct scan_state {
+    const struct scan_rule *rules;
+    const char *data;
+    size_t size;
+    char *hits;
+    int remaining;
+};
+
+/* Checks if the [start, end[ area contains str */
+static int area_contains(const char *start, const char *end, const char *str) {
+    size_t len = strlen(str);
+
+    if (!len) return 1;
+    while ((size_t)(end - start) >= len) {
+        start = memchr(start, str[0], end - start - len + 1);
+        if (!start) return 0;
+        if (!memcmp(start, str, len)) return 1;
+        start++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Evaluates a rule whose keyword is found in the data
+ *
+ * The line limits are only computed for the rules requiring them. As the
+ * keywords can't contain a new line, an occurrence never spans two lines.
+ */
+static int check_rule(int rule, size_t end, void *ctx) {
+    struct scan_state *state = ctx;
+    const struct scan_rule *current = &state->rules[rule];
+    const char *start, *stop;
+    size_t taillen;
+
+    if (state->hits[rule])
+        return 0;
+
+    if (current->tail || current->common) {
+        start = state->data + end - strlen(current->keyword);
+        while (start > state->data && start[-1] != '\n')
+            start--;
+        stop = memchr(state->data + end, '\n', state->size - end);
+        if (!stop)
+            stop = state->data + state->size;
+
+        if (current->tail) {
+            taillen = strlen(current->tail);
+            if ((size_t)(stop - start) < taillen ||
+                    memcmp(stop - taillen, current->tail, taillen))
+                return 0;
+        }
+        if (current->common && !area_contains(start, stop, current->common))
+            return 0;
+    }
+
+    state->hits[rule] = 1;
+    /* Stop the scan once every rule hits */
+    return (--state->remaining == 0);
+}
+
+/**
+ * @brief Gets the content of a file, mapped if possible
+ *
+ * Files whose size is unknown (like the proc files) are read into a buffer.
+ *
+ * @return 0 on success with *mapped set if data shall be unmapped rather
+ * than freed, a negative errno value otherwise.
+ */
+static int load_file(const char *filename, char **data, size_t *size, int *mapped) {
+    struct stat info;
+    char *buffer = NULL, *tmp;
+    size_t bufsize = 0;
+    ssize_t len;
+    int fd, ret = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        LOGE("%s: can not open file: %s - error is %s.\n", __FUNCTION__, filename, strerror(errno));
+        return -errno;
+    }
+
+    *data = NULL;
+    *size = 0;
+    *mapped = 0;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        buffer = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            *data = buffer;
+            *size = info.st_size;
+            *mapped = 1;
+            close(fd);
+            return 0;
+        }
+        buffer = NULL;
+    }
+
+    for (;;) {
+        if (*size == bufsize) {
+            bufsize += 64 * KB;
+            tmp = realloc(buffer, bufsize);
+            if (!tmp) {
+                ret = -ENOMEM;
+                break;
+            }
+            buffer = tmp;
+        }
+        len = read(fd, buffer + *size, bufsize - *size);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            ret = -errno;
+        if (len <= 0)
+            break;
+        *size += len;
+    }
+    close(fd);
+    if (ret < 0) {
+        LOGE("%s: can not read file: %s - error is %s.\n", __FUNCTION__, filename, strerror(-ret));
+        free(buffer);
+        *size = 0;
+        return ret;
+    }
+    *data = buffer;
+    return 0;
+}
+
+/**
+ * @brief Evaluates a table of rules over a file in a single pass
+ *
+ * A rule hits if one line of the file contains its keyword and, when they
+ * are set, ends with its tail (the new line excluded) and contains its common
+ * keyword. The rules with a NULL keyword never hit.
+ *
+ * @param filename of the file to scan
+ * @param rules to evaluate
+ * @param count of rules
+ * @param hits array of count flags, set to 1 for each rule that hits
+ *
+ * @return the number of rules that hit, a negative errno value on error.
+ */
+int scan_file(const char *filename, const struct scan_rule *rules, int count, char *hits) {
+    struct scan_state state;
+    struct patmatch *matcher;
+    const char **keywords;
+    char *data;
+    size_t size;
+    int i, mapped, ret;
+
+    if (!filename || !rules || !hits || count <= 0)
+        return -EINVAL;
+    memset(hits, 0, count);
+
+    keywords = malloc(count * sizeof(char *));
+    if (!keywords)
+        return -ENOMEM;
+    for (i = 0 ; i < count ; i++)
+        keywords[i] = rules[i].keyword;
+    matcher = patmatch_compile(keywords, count);
+    free(keywords);
+    if (!matcher)
+        return -ENOMEM;
+
+    ret = load_file(filename, &data, &size, &mapped);
+    if (ret < 0) {
+        patmatch_free(matcher);
+        return ret;
+    }
+
+    state.rules = rules;
+    state.data = data;
+    state.size = size;
+    state.hits = hits;
+    state.remaining = count;
+    patmatch_scan(matcher, data, size, check_rule, &state);
+
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
+    patmatch_free(matcher);
+    return count - state.remaining;
+}
+
+/**
+ * @brief Gets the first rule that hits in a range of a rules table
+ *
+ * @return the index of the first rule in [from, count[ that hits, -1 if none.
+ */
+int scan_first_hit(const char *hits, int from, int count) {
+    int i;
+
+    for (i = from ; i < count ; i++) {
+        if (hits[i])
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,40 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file filescan.h
+ * @brief File containing the rule scanner used to classify crash dumps.
+ *
+ * A classification is described as a table of rules. A rule hits when a line
+ * of the file contains its keyword and, optionally, ends with a tail or also
+ * contains a common keyword. All the rules of a table are evaluated in a
+ * single pass over the file, whatever their number.
+ */
+
+#ifndef __FILESCAN_H__
+#define __FILESCAN_H__
+
+struct scan_rule {
+    const char *keyword;    /* string the line shall contain */
+    const char *tail;       /* if not NULL, string the line shall end with */
+    const char *common;     /* if not NULL, other string the line shall contain */
+    const char *name;       /* result of the rule, free for the caller */
+};
+
+int scan_file(const char *filename, const struct scan_rule *rules, int count, char *hits);
+int scan_first_hit(const char *hits, int from, int count);
+
+#endif /* __FILESCAN_H__ */
@@ -25,6 +25,11 @@
 #include "fsutils.h"
 #include "privconfig.h"
 #include "crashutils.h"
+#include "compress.h"
+#include "logreader.h"
+#include "usage.h"
+#include "retention.h"
+#include "propcache.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,18 +40,42 @@
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <cutils/log.h>
 #ifndef __TEST__
 #include <private/android_filesystem_config.h>
 #endif
 
-long current_sd_size_limit = LONG_MAX;
-
 /* No header in bionic... */
 ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
 
-static int check_partlogfull(const char* path) {
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+/* Methods of the copy engine, from the fastest to the most generic */
+enum copy_method {
+    COPY_CLONE = 0,
+    COPY_RANGE,
+    COPY_SENDFILE,
+    COPY_READWRITE,
+};
+
+static const char *copy_method_names[] = {
+    [COPY_CLONE] = "clone",
+    [COPY_RANGE] = "copy_file_range",
+    [COPY_SENDFILE] = "sendfile",
+    [COPY_READWRITE] = "read/write",
+};
+
+int check_partlogfull(const char* path) {
 
     static int partlogfull_errorset = 0;
 
@@ -109,30 +138,36 @@ static int read_file(const char *filename, unsigned int *pcurrent) {
     return res;
 }
 
-static int update_file(const char *filename, unsigned int current) {
-    FILE *fd;
-    int res;
-
-    /* Open file in reading and writing */
-    fd = fopen(filename, "r+");
-    if (fd == NULL) {
-        LOGE("%s: Cannot open the file %s in update mode\n", __FUNCTION__, filename);
-        raise_infoerror(ERROREVENT, CRASHLOG_ERROR_PATH);
-        return -1;
+/* Journaled update of an index file : the value is written to a temporary
+ * file which then replaces the index file, so a power cut leaves either the
+ * previous or the new value */
+static int persist_index(const char *filename, unsigned int value) {
+    char tmp[PATHMAX];
+    char buffer[8];
+    int fd, len, res = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOGE("%s: Cannot open the file %s - error is %s\n", __FUNCTION__,
+            tmp, strerror(errno));
+        return -errno;
     }
-
-    /* Write new current value in file */
-    res = fprintf(fd, "%4u", ((current+1) % gmaxfiles));
-    if (res <= 0) {
+    len = snprintf(buffer, sizeof(buffer), "%4u", value);
+    if (do_write(fd, buffer, len) != len || fsync(fd) < 0)
+        res = -(errno ? errno : EIO);
+    if (close(fd) < 0 && !res)
+        res = -errno;
+    if (!res && rename(tmp, filename) < 0)
+        res = -errno;
+    if (res) {
         LOGE("%s: Cannot update file %s - error is %s.\n", __FUNCTION__,
-                filename, strerror(errno));
-        /* Close file */
-        close_file(filename, fd);
-        return -1;
+            filename, strerror(-res));
+        unlink(tmp);
+        return res;
     }
-
-    /* Close file */
-    return (close_file(filename, fd));
+    do_chown(filename, PERM_USER, PERM_GROUP);
+    return 0;
 }
 
 void reset_file(const char *filename) {
@@ -149,68 +184,91 @@ void reset_file(const char *filename) {
     do_chown(filename, PERM_USER, PERM_GROUP);
 }
 
-int readline(int fd, char buffer[MAXLINESIZE]) {
-    int size = 0, res;
-    char *pbuffer = &buffer[0];
+/**
+ * @brief Initializes a line reader on an open file descriptor
+ */
+void line_reader_init(struct line_reader *reader, int fd) {
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+}
 
-    /* Read the file until end of line or file */
-    while ((res = read(fd, pbuffer, 1)) == 1 && size < MAXLINESIZE-1) {
-        if (pbuffer[0] == '\n') {
-            buffer[++size] = 0;
-            return size;
-        }
-        pbuffer++;
-        size++;
-    }
+/**
+ * @brief Opens a file to be read line by line
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int line_reader_open(struct line_reader *reader, const char *filename) {
+    int fd = open(filename, O_RDONLY);
 
-    /* Check the last read result */
-    if (res < 0) {
-        /* ernno is checked in the upper layer as we could
-           print the filename here */
-        return res;
-    }
-    /* last line */
-    buffer[size] = 0;
-    return size;
+    if (fd < 0)
+        return -errno;
+    line_reader_init(reader, fd);
+    return 0;
 }
 
-int freadline(FILE *fd, char buffer[MAXLINESIZE]) {
-    int size = 0, res;
-    char *pbuffer = &buffer[0];
-
-    /* Read the file until end of line or file */
-    while ((res = fread(pbuffer, 1 , 1, fd)) == 1 && size < MAXLINESIZE-1) {
-        if (pbuffer[0] == '\n') {
-            buffer[++size] = 0;
-            return size;
+/**
+ * @brief Gets the next line of a file
+ *
+ * The file is read by blocks of LINE_READER_BUFSIZE bytes. A line longer
+ * than MAXLINESIZE-1 bytes is returned in several parts.
+ *
+ * @param line: filled with the next line, including its trailing '\n' if
+ * any, and null terminated
+ *
+ * @return the length of the line, 0 at the end of the file or a negative
+ * errno value on read error.
+ */
+int line_reader_next(struct line_reader *reader, char line[MAXLINESIZE]) {
+    int size = 0, len, res;
+    char *eol = NULL;
+
+    while (!eol && size < MAXLINESIZE - 1) {
+        if (reader->start == reader->end) {
+            res = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+            if (res < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -errno;
+            }
+            if (res == 0)
+                break;
+            reader->start = 0;
+            reader->end = res;
         }
-        pbuffer++;
-        size++;
-    }
-
-    /* Check the last read result */
-    if (res < 0) {
-        /* ernno is checked in the upper layer as we could
-           print the filename here */
-        return res;
-    }
-    /* last line */
-    buffer[size] = 0;
+        len = reader->end - reader->start;
+        if (len > MAXLINESIZE - 1 - size)
+            len = MAXLINESIZE - 1 - size;
+        eol = memchr(&reader->buffer[reader->start], '\n', len);
+        if (eol)
+            len = eol - &reader->buffer[reader->start] + 1;
+        memcpy(&line[size], &reader->buffer[reader->start], len);
+        reader->start += len;
+        size += len;
+    }
+    line[size] = 0;
     return size;
 }
 
+void line_reader_close(struct line_reader *reader) {
+    if (reader->fd >= 0)
+        close(reader->fd);
+    reader->fd = -1;
+}
+
 int find_oneofstrings_in_file(char *filename, char **keywords, int nbkeywords) {
 
     char buffer[MAXLINESIZE];
-    int fd, linesize, idx;
+    struct line_reader reader;
+    int linesize, idx, res;
 
     if (!keywords || !filename || !nbkeywords)
         return -EINVAL;
 
-    fd = open(filename, O_RDONLY);
-    if(fd <= 0) return -errno;
+    if ((res = line_reader_open(&reader, filename)) < 0)
+        return res;
 
-    while((linesize = readline(fd, buffer)) > 0) {
+    while((linesize = line_reader_next(&reader, buffer)) > 0) {
         /* Remove the trailing '\n' if it's there */
         if (buffer[linesize-1] == '\n') {
             linesize--;
@@ -220,27 +278,28 @@ int find_oneofstrings_in_file(char *filename, char **keywords, int nbkeywords) {
         /* Check the keywords */
         for (idx = 0 ; idx < nbkeywords ; idx++) {
             if ( strstr(buffer, keywords[idx]) ) {
-                close(fd);
+                line_reader_close(&reader);
                 return 1;
             }
         }
     }
-    close(fd);
+    line_reader_close(&reader);
     return 0;
 }
 
 int find_oneofstrings_in_file_with_keyword(char *filename, char **keywords, char *common_keyword,int nbkeywords){
 
     char buffer[MAXLINESIZE];
-    int fd, linesize, idx;
+    struct line_reader reader;
+    int linesize, idx, res;
 
     if (!keywords || !filename || !nbkeywords)
         return -EINVAL;
 
-    fd = open(filename, O_RDONLY);
-    if(fd <= 0) return -errno;
+    if ((res = line_reader_open(&reader, filename)) < 0)
+        return res;
 
-    while((linesize = readline(fd, buffer)) > 0) {
+    while((linesize = line_reader_next(&reader, buffer)) > 0) {
         /* Remove the trailing '\n' if it's there */
         if (buffer[linesize-1] == '\n') {
             linesize--;
@@ -252,13 +311,13 @@ int find_oneofstrings_in_file_with_keyword(char *filename, char **keywords, char
             if ( strstr(buffer, keywords[idx]) ) {
                 //and check the additional keyword
                 if ( strstr(buffer, common_keyword) ) {
-                    close(fd);
+                    line_reader_close(&reader);
                     return 1;
                 }
             }
         }
     }
-    close(fd);
+    line_reader_close(&reader);
     return 0;
 }
 
@@ -271,19 +330,19 @@ int find_oneofstrings_in_file_with_keyword(char *filename, char **keywords, char
  */
 int find_str_in_standard_file(char *filename, char *keyword, char *tail) {
     char buffer[MAXLINESIZE];
-    int fd, linesize;
+    struct line_reader reader;
+    int linesize, res;
     int taillen;
 
     if (keyword == NULL || filename == NULL)
         return -EINVAL;
-    fd = open(filename, O_RDONLY);
-    if(fd <= 0)
-        return -errno;
+    if ((res = line_reader_open(&reader, filename)) < 0)
+        return res;
 
     /* Check the tail length once and for all */
     taillen = (tail ? strlen(tail) : 0);
 
-    while((linesize = readline(fd, buffer)) > 0) {
+    while((linesize = line_reader_next(&reader, buffer)) > 0) {
         /* Remove the trailing '\n' if it's there */
         if (buffer[linesize-1] == '\n') {
             linesize--;
@@ -303,7 +362,7 @@ int find_str_in_standard_file(char *filename, char *keyword, char *tail) {
         if ( !strncmp(&buffer[linesize - taillen], tail, taillen) ) break;
     }
 
-    close(fd);
+    line_reader_close(&reader);
     return (linesize > 0 ? 1 : 0);
 }
 
@@ -401,91 +460,229 @@ int get_value_in_file(char *file, char *keyword, char *value, unsigned int sizem
     return -1;
 }
 
-int get_sdcard_paths(e_dir_mode_t mode) {
-    char value[PROPERTY_VALUE_MAX];
-    DIR *d;
+/* Base directories of the events, per storage. They are never modified so
+ * the base returned to a worker stays valid while another one allocates */
+enum {
+    STORAGE_EMMC = 0,
+    STORAGE_SDCARD,
+    STORAGES
+};
 
-    CRASH_DIR = EMMC_CRASH_DIR;
-    STATS_DIR = EMMC_STATS_DIR;
-    APLOGS_DIR = EMMC_APLOGS_DIR;
-    BZ_DIR = EMMC_BZ_DIR;
+static char * const crash_dirs[STORAGES] = { EMMC_CRASH_DIR, SDCARD_CRASH_DIR };
+static char * const stats_dirs[STORAGES] = { EMMC_STATS_DIR, SDCARD_STATS_DIR };
+static char * const aplogs_dirs[STORAGES] = { EMMC_APLOGS_DIR, SDCARD_APLOGS_DIR };
+static char * const bz_dirs[STORAGES] = { EMMC_BZ_DIR, SDCARD_BZ_DIR };
 
+/**
+ * @brief Selects the storage of the events of a mode
+ *
+ * @return STORAGE_SDCARD if the sdcard logs directory can be used,
+ * STORAGE_EMMC otherwise.
+ */
+static int select_storage(e_dir_mode_t mode) {
 #ifndef FULL_REPORT
-    return 0;
+    (void)mode;
+    return STORAGE_EMMC;
 #else
+    char value[PROPERTY_VALUE_MAX];
+    DIR *d;
 
-    property_get(PROP_CRASH_MODE, value, "");
+    propcache_get(PROP_CRASH_MODE, value, "");
     if ((!strncmp(value, "lowmemory", 9)) || (mode == MODE_CRASH_NOSD) || !sdcard_allowed())
-        return 0;
+        return STORAGE_EMMC;
 
-    errno = 0;
     if (!file_exists(SDCARD_LOGS_DIR))
         mkdir(SDCARD_LOGS_DIR, 0777);
 
     if ( (d = opendir(SDCARD_LOGS_DIR)) != NULL ){
-        CRASH_DIR = SDCARD_CRASH_DIR;
-        STATS_DIR = SDCARD_STATS_DIR;
-        APLOGS_DIR = SDCARD_APLOGS_DIR;
-        BZ_DIR = SDCARD_BZ_DIR;
         closedir(d);
+        return STORAGE_SDCARD;
     }
-    return -errno;
+    return STORAGE_EMMC;
 #endif
 }
 
-int find_new_crashlog_dir(e_dir_mode_t mode) {
+int get_sdcard_paths(e_dir_mode_t mode) {
+    int storage;
+
+    errno = 0;
+    storage = select_storage(mode);
+    CRASH_DIR = crash_dirs[storage];
+    STATS_DIR = stats_dirs[storage];
+    APLOGS_DIR = aplogs_dirs[storage];
+    BZ_DIR = bz_dirs[storage];
+    return -errno;
+}
+
+/* In-memory copies of the current index files. The next slot is handed out
+ * with a compare and swap, the index file is only written back */
+struct dir_counter {
+    const char *filename;
+    int loaded;
+    unsigned int current;
+    unsigned int persisted;
+    pthread_mutex_t lock;
+};
+
+enum {
+    COUNTER_CRASH = 0,
+    COUNTER_STATS,
+    COUNTER_APLOGS,
+    COUNTER_BZ,
+    COUNTERS
+};
+
+static struct dir_counter dir_counters[COUNTERS] = {
+    [COUNTER_CRASH] = { CRASH_CURRENT_LOG, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER },
+    [COUNTER_STATS] = { STATS_CURRENT_LOG, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER },
+    [COUNTER_APLOGS] = { APLOGS_CURRENT_LOG, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER },
+    [COUNTER_BZ] = { BZ_CURRENT_LOG, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER },
+};
+
+static int load_dir_counter(struct dir_counter *counter) {
+    unsigned int current;
+    int res = 0;
+
+    if (__sync_fetch_and_add(&counter->loaded, 0))
+        return 0;
+
+    pthread_mutex_lock(&counter->lock);
+    if (!counter->loaded) {
+        res = read_file(counter->filename, &current);
+        if (res >= 0) {
+            counter->current = current;
+            counter->persisted = current;
+            __sync_synchronize();
+            counter->loaded = 1;
+        }
+    }
+    pthread_mutex_unlock(&counter->lock);
+    return res;
+}
+
+/* Writes the latest index back; an older value never overwrites a newer one
+ * as the value is read under the lock */
+static int save_dir_counter(struct dir_counter *counter) {
+    unsigned int current;
+    int res = 0;
+
+    pthread_mutex_lock(&counter->lock);
+    current = __sync_fetch_and_add(&counter->current, 0);
+    if (current != counter->persisted) {
+        res = persist_index(counter->filename, current);
+        if (res == 0)
+            counter->persisted = current;
+    }
+    pthread_mutex_unlock(&counter->lock);
+    return res;
+}
+
+static unsigned int next_dir_slot(struct dir_counter *counter) {
+    unsigned int current, next;
+
+    do {
+        current = counter->current;
+        next = (current + 1) % gmaxfiles;
+    } while (!__sync_bool_compare_and_swap(&counter->current, current, next));
+    return current;
+}
+
+/**
+ * @brief Resets the index of the directories of a mode to 0
+ *
+ * @param mode of the directories
+ */
+void reset_crashlog_dir_index(e_dir_mode_t mode) {
+    struct dir_counter *counter;
+
+    switch(mode) {
+        case MODE_STATS: counter = &dir_counters[COUNTER_STATS]; break;
+        case MODE_APLOGS: counter = &dir_counters[COUNTER_APLOGS]; break;
+        case MODE_BZ: counter = &dir_counters[COUNTER_BZ]; break;
+        default: counter = &dir_counters[COUNTER_CRASH]; break;
+    }
+
+    pthread_mutex_lock(&counter->lock);
+    reset_file(counter->filename);
+    counter->current = 0;
+    counter->persisted = 0;
+    __sync_synchronize();
+    counter->loaded = 1;
+    pthread_mutex_unlock(&counter->lock);
+}
+
+/**
+ * @brief Allocates a new directory for an event
+ *
+ * Slots are handed out from in-memory counters so several workers can
+ * allocate concurrently. The counter is written back to its index file and
+ * the previous content of the slot is deleted in background.
+ *
+ * @param mode of the directory
+ * @param dirbase set to the base path of the new directory (like CRASH_DIR),
+ * to be used instead of the directory globals. May be NULL.
+ *
+ * @return the index of the new directory, -1 on error
+ */
+int find_new_crashlog_dir(e_dir_mode_t mode, char **dirbase) {
+    struct dir_counter *counter;
     char path[PATHMAX];
-    int res;
     unsigned int current;
     char *dir;
-
-    get_sdcard_paths(mode);
+    int res;
 
     switch(mode) {
         case MODE_CRASH:
         case MODE_CRASH_NOSD:
-            snprintf(path, sizeof(path), CRASH_CURRENT_LOG);
-            dir = CRASH_DIR;
+            counter = &dir_counters[COUNTER_CRASH];
+            dir = crash_dirs[select_storage(mode)];
             break;
         case MODE_APLOGS:
-            snprintf(path, sizeof(path), APLOGS_CURRENT_LOG);
-            dir = APLOGS_DIR;
+            counter = &dir_counters[COUNTER_APLOGS];
+            dir = aplogs_dirs[select_storage(mode)];
             break;
         case MODE_BZ:
-            snprintf(path, sizeof(path), BZ_CURRENT_LOG);
-            dir = BZ_DIR;
+            counter = &dir_counters[COUNTER_BZ];
+            dir = bz_dirs[select_storage(mode)];
             break;
         case MODE_STATS:
-            snprintf(path, sizeof(path), STATS_CURRENT_LOG);
-            dir = STATS_DIR;
+            counter = &dir_counters[COUNTER_STATS];
+            dir = stats_dirs[select_storage(mode)];
             break;
         case MODE_KDUMP:
-            snprintf(path, sizeof(path), CRASH_CURRENT_LOG);
+            counter = &dir_counters[COUNTER_CRASH];
             dir = KDUMP_CRASH_DIR;
             break;
         default:
             LOGE("%s: Invalid mode %d\n", __FUNCTION__, mode);
             return -1;
     }
+    if (dirbase)
+        *dirbase = dir;
 
-    /* Read current value in file */
-    res = read_file(path, &current);
-    if (res < 0)
-        return -1;
-
-    /* Open file in read/write mode to update the new current */
-    res = update_file(path, current);
-    if (res < 0)
+    if (load_dir_counter(counter) < 0)
         return -1;
+    current = next_dir_slot(counter);
+    if (save_dir_counter(counter) < 0)
+        raise_infoerror(ERROREVENT, CRASHLOG_ERROR_PATH);
 
     snprintf(path, sizeof(path), "%s%d", dir, current);
-    /* Call rmfr which will fail if the path does not exist
-     * but doesn't matter as we create it afterwards
-     */
-    rmfr(path);
+    /* The previous content of the slot is deleted in background */
+    rmfr_deferred(path);
+    retention_slot_allocated(dir, current);
+    /* Make room for the event data if the partition is getting full */
+    retention_reclaim();
 
     /* Create a fresh directory */
-    if (mkdir(path, 0777) == -1) {
+    res = mkdir(path, 0777);
+    if (res == -1 && errno == ENOSPC) {
+        /* Retry once the space is reclaimed */
+        if (retention_reclaim() > 0)
+            res = mkdir(path, 0777);
+        else
+            errno = ENOSPC;
+    }
+    if (res == -1) {
         LOGE("%s: Cannot create dir %s\n", __FUNCTION__, path);
         /* Full partition (no space left on device)
          * path could either indicate LOGS_DIR or SDCARD_DIR
@@ -529,19 +726,29 @@ int find_matching_file(char *dir_to_search, char *pattern, char *filename_found)
     return result;
 }
 
-int rmfr(char *path) {
-    return rmfr_specific(path, 1);
+/* Removes a file or an empty directory and releases its space */
+static int remove_accounted(const char *path, int dir) {
+    long long bytes = usage_bytes(path);
+    int res;
+
+    res = (dir ? rmdir(path) : unlink(path));
+    if (res == 0)
+        usage_add(path, -bytes);
+    return res;
 }
 
-int rmfr_specific(char *path, int remove_dir) {
+/* Removes path recursively. pace is called after each removed entry */
+static int rmfr_walk(const char *path, int remove_dir, void (*pace)(void)) {
     DIR *d;
     struct dirent *de;
     char fsentry[PATHMAX];
     int subres = 0;
-    unsigned char isFile = 0x8;
 
     /* Check for a simple file or link first */
-    if ( !unlink(path) ) return 0;
+    if ( !remove_accounted(path, 0) ) {
+        if (pace) pace();
+        return 0;
+    }
 
     /* Failed; if the error was not EISDIR or ENOENT,
      * no need to pursue...
@@ -559,23 +766,248 @@ int rmfr_specific(char *path, int remove_dir) {
         if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
             continue;
         /* Remove file in every case and remove directory if required */
-        if ( de->d_type == isFile || (de->d_type != isFile && remove_dir) ) {
+        if ( de->d_type == DT_REG || remove_dir ) {
             snprintf(fsentry, sizeof(fsentry), "%s/%s", path, de->d_name);
-            if ( unlink(path) ) {
+            if ( remove_accounted(fsentry, 0) ) {
                 if (errno == EISDIR)
-                    subres = rmfr(fsentry);
-                if (subres) return subres;
-            }
+                    subres = rmfr_walk(fsentry, 1, pace);
+                if (subres) {
+                    closedir(d);
+                    return subres;
+                }
+            } else if (pace)
+                pace();
         }
     }
     closedir(d);
     if (remove_dir)
         /* Finally delete the empty directory */
-        return rmdir(path);
+        return remove_accounted(path, 1);
     else
         return 0;
 }
 
+int rmfr(char *path) {
+    return rmfr_walk(path, 1, NULL);
+}
+
+int rmfr_specific(char *path, int remove_dir) {
+    return rmfr_walk(path, remove_dir, NULL);
+}
+
+/* Deferred deletion service : tombstones are removed by a single low
+ * priority thread, a few entries at a time */
+struct tombstone {
+    struct tombstone *next;
+    char path[];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct tombstone *head;
+    struct tombstone *tail;
+    int started;
+    unsigned int seq;
+    unsigned int removed;
+} deleter = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0
+};
+
+static void pace_deletion(void) {
+    if (++deleter.removed % RMFR_DEFERRED_BATCH == 0)
+        usleep(RMFR_DEFERRED_PAUSE);
+}
+
+static void *deleter_mainloop(void *arg) {
+    struct tombstone *tombstone;
+    (void)arg;
+
+    /* Lowest CPU priority and idle I/O class for this thread only */
+    setpriority(PRIO_PROCESS, syscall(__NR_gettid), 19);
+#ifdef __NR_ioprio_set
+    syscall(__NR_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0,
+        3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+
+    for (;;) {
+        pthread_mutex_lock(&deleter.lock);
+        while (!deleter.head)
+            pthread_cond_wait(&deleter.cond, &deleter.lock);
+        tombstone = deleter.head;
+        deleter.head = tombstone->next;
+        if (!deleter.head)
+            deleter.tail = NULL;
+        pthread_mutex_unlock(&deleter.lock);
+
+        /* A tombstone may be queued twice by a sweep */
+        if (rmfr_walk(tombstone->path, 1, pace_deletion) && errno != ENOENT)
+            LOGE("%s: Cannot remove %s - %s\n", __FUNCTION__, tombstone->path,
+                strerror(errno));
+        free(tombstone);
+    }
+    return NULL;
+}
+
+/* Queues a path for deletion. Returns -errno if the deleter can't take it */
+static int queue_tombstone(const char *path) {
+    struct tombstone *tombstone;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int res = 0;
+
+    tombstone = malloc(sizeof(*tombstone) + strlen(path) + 1);
+    if (!tombstone)
+        return -ENOMEM;
+    strcpy(tombstone->path, path);
+    tombstone->next = NULL;
+
+    pthread_mutex_lock(&deleter.lock);
+    if (!deleter.started) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        res = -pthread_create(&thread, &attr, deleter_mainloop, NULL);
+        pthread_attr_destroy(&attr);
+        deleter.started = (res == 0);
+    }
+    if (res == 0) {
+        if (deleter.tail)
+            deleter.tail->next = tombstone;
+        else
+            deleter.head = tombstone;
+        deleter.tail = tombstone;
+        pthread_cond_signal(&deleter.cond);
+    }
+    pthread_mutex_unlock(&deleter.lock);
+
+    if (res < 0) {
+        LOGE("%s: Cannot start the deleter - %s\n", __FUNCTION__, strerror(-res));
+        free(tombstone);
+    }
+    return res;
+}
+
+/**
+ * @brief Renames a file or a directory to a tombstone next to it
+ *
+ * The path disappears at once and can be recreated right away. The
+ * tombstone is then removed with rmfr() or rmfr_tombstone().
+ *
+ * @param path to rename
+ * @param tombstone filled with the name of the tombstone
+ * @param size of tombstone
+ *
+ * @return 0 on success, a negative errno value otherwise (-ENOENT if path
+ * doesn't exist).
+ */
+int rmfr_bury(const char *path, char *tombstone, int size) {
+    int res;
+
+    pthread_mutex_lock(&deleter.lock);
+    res = snprintf(tombstone, size, "%s" RMFR_TOMBSTONE_SUFFIX "%u",
+        path, deleter.seq++);
+    pthread_mutex_unlock(&deleter.lock);
+    if (res >= size)
+        return -ENAMETOOLONG;
+    if (rename(path, tombstone) < 0)
+        return -errno;
+    return 0;
+}
+
+/**
+ * @brief Removes a tombstone in background
+ *
+ * The tombstone is removed synchronously if the deletion can't be deferred.
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int rmfr_tombstone(const char *tombstone) {
+    int res;
+
+    if (queue_tombstone(tombstone) < 0) {
+        res = rmfr((char *)tombstone);
+        return (res > 0 ? -res : res);
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a file or a directory in background
+ *
+ * The path is renamed to a tombstone next to it, so it disappears at once
+ * and can be recreated right away, then the tombstone is deleted by a low
+ * priority thread. The path is removed synchronously if the deletion can't
+ * be deferred.
+ *
+ * @param path to remove
+ *
+ * @return 0 on success, a negative errno value otherwise (-ENOENT if path
+ * doesn't exist).
+ */
+int rmfr_deferred(const char *path) {
+    char tombstone[PATHMAX];
+    int res;
+
+    res = rmfr_bury(path, tombstone, sizeof(tombstone));
+    if (res == -ENOENT || res == -ENAMETOOLONG)
+        return res;
+    if (res < 0) {
+        LOGW("%s: Cannot rename %s - %s\n", __FUNCTION__, path, strerror(-res));
+        res = rmfr((char *)path);
+        return (res > 0 ? -res : res);
+    }
+    return rmfr_tombstone(tombstone);
+}
+
+/**
+ * @brief Tells if a name is a tombstone made by rmfr_bury
+ *
+ * @return 1 if name ends with the tombstone suffix followed by digits only,
+ * 0 otherwise.
+ */
+int is_rmfr_tombstone(const char *name) {
+    const char *suffix = NULL, *cur;
+
+    for (cur = strstr(name, RMFR_TOMBSTONE_SUFFIX) ; cur ;
+            cur = strstr(cur + 1, RMFR_TOMBSTONE_SUFFIX))
+        suffix = cur;
+    if (!suffix)
+        return 0;
+    suffix += strlen(RMFR_TOMBSTONE_SUFFIX);
+    if (!*suffix)
+        return 0;
+    for ( ; *suffix ; suffix++) {
+        if (*suffix < '0' || *suffix > '9')
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Queues the tombstones left in a directory for deletion
+ *
+ * Deferred deletions pending when the device rebooted left their tombstone
+ * behind.
+ *
+ * @param dir to sweep
+ */
+void rmfr_deferred_sweep(const char *dir) {
+    char path[PATHMAX];
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (!is_rmfr_tombstone(de->d_name))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (queue_tombstone(path) < 0)
+            rmfr(path);
+    }
+    closedir(d);
+}
 
 #ifndef USE_SYSTEM_CMDS
 static mode_t get_mode(const char *s)
@@ -677,6 +1109,34 @@ int do_chown(const char *file, char *uid, char *gid)
     return 0;
 }
 
+/**
+ * @brief Same as do_chown on an already open file
+ *
+ * @param[in] fd : descriptor of the file
+ * @param[in] file : path of the file, used to skip the sdcard files
+ */
+int do_fchown(int fd, const char *file, char *uid, char *gid)
+{
+    unsigned int duid, dgid;
+    int result = 0;
+
+    if (file == NULL) return -ENOENT;
+
+    if (strstr(file, SDCARD_CRASH_DIR))
+        return 0;
+
+    duid = decode_uid(uid, &result);
+    if ( result ) return result;
+
+    dgid = decode_uid(gid, &result);
+    if ( result ) return result;
+
+    if ( fchown(fd, duid, dgid) )
+        return -errno;
+
+    return 0;
+}
+
 ssize_t do_read(int fd, void *buf, size_t len)
 {
     ssize_t nr;
@@ -701,156 +1161,263 @@ ssize_t do_write(int fd, const void *buf, size_t len)
     }
 }
 
-int do_copy_eof(const char *src, const char *des)
-{
-    int buflen;
-    char buffer[CPBUFFERSIZE];
-    int rc = 0;
-    int fd1 = -1, fd2 = -1;
-    struct stat info;
-    int r_count, w_count;
+/* Errors telling a copy method can't be used with these files */
+static int copy_unsupported(int err) {
+    return (err == ENOSYS || err == EINVAL || err == EXDEV || err == EOPNOTSUPP ||
+            err == ENOTTY || err == EBADF || err == ETXTBSY);
+}
 
-    if (src == NULL || des == NULL) return -EINVAL;
+/* Writes the whole buffer at offset */
+static ssize_t write_all(int fd, const char *buffer, size_t len, off_t offset) {
+    size_t done = 0;
+    ssize_t nr;
 
-    if (stat(src, &info) < 0) {
-        LOGE("%s: can not open file: %s\n", __FUNCTION__, src);
-        return -errno;
+    while (done < len) {
+        nr = pwrite(fd, buffer + done, len - done, offset + done);
+        if (nr < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (nr < 0)
+            return -errno;
+        if (nr == 0)
+            return -ENOSPC;
+        done += nr;
     }
+    return done;
+}
 
-    if ( ( fd1 = open(src, O_RDONLY) ) < 0 ) {
-        return -errno;
+/**
+ * @brief Copies a window of a regular file
+ *
+ * Copies length bytes of fsrc from offset to the start of fdest. Each method
+ * of the chain goes on from where the previous one stopped, so partial
+ * transfers are completed by the next method. If until_eof is set, the data
+ * appended to fsrc meanwhile is copied too.
+ *
+ * @return the number of bytes copied, a negative errno value on error.
+ */
+static off_t copy_fd_window(int fsrc, int fdest, off_t offset, off_t length,
+        int until_eof, enum copy_method *method) {
+    struct stat info;
+    char *buffer;
+    off_t copied = 0, pos;
+    ssize_t nr = 0;
+    size_t chunk;
+
+    /* A whole file is shared rather than copied when the fs supports it,
+     * a clone can't stop short of the end of the file */
+    *method = COPY_CLONE;
+    if (offset == 0 && fstat(fsrc, &info) == 0 && length == info.st_size &&
+            ioctl(fdest, FICLONE, fsrc) == 0) {
+        copied = length;
+        if (!until_eof)
+            return copied;
+    } else if (length > 0)
+        fallocate(fdest, 0, 0, length);
+
+#ifdef __NR_copy_file_range
+    if (copied < length)
+        *method = COPY_RANGE;
+    while (copied < length) {
+        loff_t in = offset + copied, out = copied;
+
+        nr = syscall(__NR_copy_file_range, fsrc, &in, fdest, &out, length - copied, 0);
+        if (nr < 0 && errno == EINTR)
+            continue;
+        if (nr <= 0)
+            break;
+        copied += nr;
     }
-
-    if ( ( fd2 = open(des, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0) {
-        LOGE("%s: can not open file: %s\n", __FUNCTION__, des);
-        close(fd1);
+    if (nr < 0 && !copy_unsupported(errno))
         return -errno;
-    }
+#endif
 
-    /* Start copy loop */
-    while (1) {
-        /* Read data from src */
-        r_count = do_read(fd1, buffer, CPBUFFERSIZE);
-        if (r_count < 0) {
-            LOGE("%s: read failed, err:%s", __FUNCTION__, strerror(errno));
-            rc = -1;
-            break;
+    if (copied < length) {
+        *method = COPY_SENDFILE;
+        if (lseek(fdest, copied, SEEK_SET) < 0)
+            return -errno;
+        while (copied < length) {
+            pos = offset + copied;
+            nr = sendfile(fdest, fsrc, &pos, length - copied);
+            if (nr < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (nr <= 0)
+                break;
+            copied += nr;
         }
+        if (nr < 0 && !copy_unsupported(errno))
+            return -errno;
+    }
 
-        if (r_count == 0)
-            break;
-
-        /* Copy data to des */
-        w_count = do_write(fd2, buffer, r_count);
-        if (w_count < 0) {
-            LOGE("%s: write failed, err:%s", __FUNCTION__, strerror(errno));
-            rc = -1;
-            break;
-        }
-        if (r_count != w_count) {
-            LOGE("%s: write failed, r_count:%d w_count:%d",
-                 __FUNCTION__, r_count, w_count);
-            rc = -1;
-            break;
+    if (copied < length || until_eof) {
+        buffer = malloc(CPBUFFERSIZE);
+        if (!buffer)
+            return -ENOMEM;
+        if (copied < length)
+            *method = COPY_READWRITE;
+        while (copied < length || until_eof) {
+            chunk = CPBUFFERSIZE;
+            if (!until_eof && (off_t)chunk > length - copied)
+                chunk = length - copied;
+            nr = pread(fsrc, buffer, chunk, offset + copied);
+            if (nr < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (nr < 0)
+                nr = -errno;
+            if (nr <= 0)
+                break;
+            nr = write_all(fdest, buffer, nr, copied);
+            if (nr < 0)
+                break;
+            copied += nr;
         }
+        free(buffer);
+        if (nr < 0)
+            return nr;
     }
+    return copied;
+}
 
-    /* Error occurred while copying data */
-    if ((rc == -1) && (w_count == -ENOSPC)) {
-        /* CRASHLOG_ERROR_FULL shall only be raised if des indicates LOGS_DIR */
-        if (check_partlogfull(des))
-            raise_infoerror(ERROREVENT, CRASHLOG_ERROR_FULL);
+/**
+ * @brief Copies a file whose size is unknown (like the proc files)
+ *
+ * The file is read until its end, or limit bytes if limit is not 0.
+ *
+ * @return the number of bytes copied, a negative errno value on error.
+ */
+static off_t copy_fd_stream(int fsrc, int fdest, off_t limit) {
+    char *buffer;
+    off_t copied = 0;
+    ssize_t nr = 0;
+    size_t chunk;
+
+    buffer = malloc(CPBUFFERSIZE);
+    if (!buffer)
+        return -ENOMEM;
+    while (!limit || copied < limit) {
+        chunk = CPBUFFERSIZE;
+        if (limit && (off_t)chunk > limit - copied)
+            chunk = limit - copied;
+        nr = do_read(fsrc, buffer, chunk);
+        if (nr < 0)
+            nr = -errno;
+        if (nr <= 0)
+            break;
+        nr = write_all(fdest, buffer, nr, copied);
+        if (nr < 0)
+            break;
+        copied += nr;
     }
-
-    if (fd1 >= 0)
-        close(fd1);
-    if (fd2 >= 0)
-        close(fd2);
-
-    do_chown(des, PERM_USER, PERM_GROUP);
-    return rc;
+    free(buffer);
+    return (nr < 0 ? nr : copied);
 }
 
-int do_copy_tail(char *src, char *dest, int limit) {
-    int rc = 0;
-    int fsrc = -1, fdest = -1;
+/**
+ * @brief Copies a file, or a window of it
+ *
+ * Regular files are copied through the fastest available method: clone of
+ * the whole file, copy_file_range, sendfile then a read/write loop, each one
+ * taking over on a partial transfer or if the previous one is not supported.
+ * Other files are read until their end.
+ *
+ * @param src file to copy
+ * @param dest file created (or truncated) with the copy
+ * @param window part of src to copy
+ * @param limit max number of bytes copied, 0 for no limit. For the files
+ * whose size is unknown, the first limit bytes are copied whatever the window.
+ *
+ * @return the number of bytes copied, a negative errno value on error.
+ */
+off_t copy_file(const char *src, const char *dest, e_copy_window_t window, off_t limit) {
     struct stat info;
-    off_t offset = 0;
+    struct timespec start, end;
+    enum copy_method method = COPY_READWRITE;
+    off_t offset = 0, length, copied;
+    long long usecs;
+    int fsrc, fdest;
 
     if (src == NULL || dest == NULL) return -EINVAL;
 
-    if (stat(src, &info) < 0) {
-        return -errno;
-    }
-
     if ( ( fsrc = open(src, O_RDONLY) ) < 0 ) {
         return -errno;
     }
-
-    if ( ( fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0) {
+    if (fstat(fsrc, &info) < 0) {
+        copied = -errno;
         close(fsrc);
-        return -errno;
+        return copied;
     }
 
-    if ((limit == 0) || (info.st_size < limit))
-        limit = info.st_size;
-
-    if (info.st_size > limit)
-        offset = info.st_size - limit;
-
-    rc = sendfile(fdest, fsrc, &offset, limit);
-    /* CRASHLOG_ERROR_FULL shall only be raised if dest indicates LOGS_DIR */
-    if ((rc != -1) && (rc != limit) && check_partlogfull(dest))
-        raise_infoerror(ERROREVENT, CRASHLOG_ERROR_FULL);
+    /* dest is truncated, its new size is accounted once closed */
+    usage_add(dest, -usage_bytes(dest));
+    if ( ( fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0) {
+        copied = -errno;
+        LOGE("%s: can not open file: %s - %s\n", __FUNCTION__, dest, strerror(errno));
+        close(fsrc);
+        return copied;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        length = info.st_size;
+        if (limit > 0 && limit < length)
+            length = limit;
+        if (window == COPY_TAIL)
+            offset = info.st_size - length;
+        copied = copy_fd_window(fsrc, fdest, offset, length,
+            (window == COPY_ALL && !limit), &method);
+        /* Drop the preallocated space if the file got shorter */
+        if (copied >= 0 && copied < length)
+            ftruncate(fdest, copied);
+    } else
+        copied = copy_fd_stream(fsrc, fdest, limit);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
     close(fsrc);
     close(fdest);
+    usage_add(dest, usage_bytes(dest));
+
+    if (copied < 0) {
+        LOGE("%s: copy of %s to %s failed - %s\n", __FUNCTION__, src, dest, strerror(-copied));
+        /* CRASHLOG_ERROR_FULL shall only be raised if dest indicates LOGS_DIR */
+        if ((copied == -ENOSPC || copied == -EDQUOT) && check_partlogfull(dest))
+            raise_infoerror(ERROREVENT, CRASHLOG_ERROR_FULL);
+    } else {
+        usecs = (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
+        LOGD("%s: %s copied to %s, %lld bytes in %lld us (%lld KB/s) by %s\n", __FUNCTION__,
+            src, dest, (long long)copied, usecs,
+            (long long)copied * 1000000 / KB / (usecs > 0 ? usecs : 1), copy_method_names[method]);
+    }
+
     do_chown(dest, PERM_USER, PERM_GROUP);
-    return rc;
+    return copied;
 }
 
-int do_copy(char *src, char *dest, int limit) {
-    int rc = 0;
-    int fsrc = -1, fdest = -1;
-    struct stat info;
+int do_copy_eof(const char *src, const char *des)
+{
+    off_t rc = copy_file(src, des, COPY_ALL, 0);
 
-    if (src == NULL || dest == NULL) return -EINVAL;
+    return (rc < 0 ? rc : 0);
+}
 
-    if (stat(src, &info) < 0) {
-        return -errno;
-    }
+off_t do_copy_tail(char *src, char *dest, off_t limit) {
+    return copy_file(src, dest, COPY_TAIL, limit);
+}
 
-    if ( ( fsrc = open(src, O_RDONLY) ) < 0 ) {
-        return -errno;
-    }
+int do_copy(char *src, char *dest, int limit) {
+    int fdest;
 
-    if ( ( fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0) {
-        close(fsrc);
-        return -errno;
-    }
+    if (src == NULL || dest == NULL) return -EINVAL;
 
     if (limit == 0) {
-        /* test this late as if limit is 0, the dest file shall be
-         * empty
-         */
-        close(fsrc);
+        /* if limit is 0, the dest file shall be empty */
+        if (access(src, F_OK) < 0)
+            return -errno;
+        if ( ( fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660) ) < 0)
+            return -errno;
         close(fdest);
         do_chown(dest, PERM_USER, PERM_GROUP);
         return 0;
     }
-
-    if (info.st_size <= limit)
-        limit = info.st_size;
-
-    rc = sendfile(fdest, fsrc, NULL, limit);
-    /* CRASHLOG_ERROR_FULL shall only be raised if dest indicates LOGS_DIR */
-    if ((rc != -1) && (rc != limit) && check_partlogfull(dest))
-        raise_infoerror(ERROREVENT, CRASHLOG_ERROR_FULL);
-
-    close(fsrc);
-    close(fdest);
-    do_chown(dest, PERM_USER, PERM_GROUP);
-    return rc;
+    return copy_file(src, dest, COPY_HEAD, limit);
 }
 
 int do_mv(char *src, char *dest) {
@@ -874,93 +1441,25 @@ int do_mv(char *src, char *dest) {
         LOGE("%s: failed on '%s', err:%s\n",  __FUNCTION__, src, strerror(errno));
         return -1;
     }
+    usage_moved(src, dest);
     return 0;
 }
 
-void qs_swap(void *array, int *indexes, int first, int second) {
-    int itmp;
-    char *vtmp;
-    char **carray = array;
-
-    itmp = indexes[first];
-    indexes[first] = indexes[second];
-    indexes[second] = itmp;
-
-    vtmp = carray[first];
-    carray[first] = carray[second];
-    carray[second] = vtmp;
-}
-
-int qs_partition(void *array, int *indexes, int start, int end, int pivot) {
-    int j = start, i;
+static void reverse_records(char **records, int start, int end) {
+    char *tmp;
 
-    qs_swap(array, indexes, pivot, end);
-    for (i = start ; i < end ; i++) {
-        if (indexes[i] <= indexes[end]) {
-            qs_swap(array, indexes, i, j);
-            j++;
-        }
-    }
-    qs_swap(array, indexes, end, j);
-    return j;
-}
-
-void __quicksort(void *array, int *indexes, int start, int end) {
-    int pivot;
-    if ( start < end ) {
-        pivot = qs_partition(array, indexes, start, end, start);
-        __quicksort(array, indexes, start, pivot-1);
-        __quicksort(array, indexes, pivot+1, end);
+    while (start < --end) {
+        tmp = records[start];
+        records[start++] = records[end];
+        records[end] = tmp;
     }
 }
 
-#ifdef __DEBUG_QS__
-void dump_char_array(char **array, int size) {
-    int idx;
-
-    for (idx = 0 ; idx < size ; idx++)
-        printf("line %d: %s", idx, array[idx]);
-}
-
-void dump_int_array(int *array, int size) {
-    int idx;
-
-    printf("[");
-    for (idx = 0 ; idx < size - 1 ; idx++)
-        printf("%d, ", array[idx]);
-    printf("%d]\n", array[idx]);
-}
-#endif
-
-int quicksort(void *array, int dim, int pivot) {
-    int *indexes, i, diff;
-
-    indexes = (int*)malloc(dim*sizeof(int));
-    if (indexes == NULL) return -ENOMEM;
-
-    diff = dim - pivot;
-    for (i = 0 ; i < dim ; i++) {
-        if (i < pivot)
-            indexes[i] = diff + i;
-        else indexes[i] = i - pivot;
-    }
-#ifdef __DEBUG_QS__
-    printf("Sort an array of %d items from pivot %d containing:\n", dim, pivot);
-    dump_char_array((char**)array, dim);
-    printf("Unsorted indexes: ");
-    dump_int_array(indexes, dim);
-#endif
-    __quicksort(array, indexes, 0, dim-1);
-
-#ifdef __DEBUG_QS__
-    printf("Sorted into:\n");
-    dump_char_array((char**)array, dim);
-    printf("Sorted indexes: ");
-    dump_int_array(indexes, dim);
-#endif
-
-    free(indexes);
-    return 0;
+/* Rotates in place an array of records by shift records to the left */
+static void rotate_records(char **records, int count, int shift) {
+    reverse_records(records, 0, shift);
+    reverse_records(records, shift, count);
+    reverse_records(records, 0, count);
 }
 
 /*
@@ -972,7 +1471,8 @@ int quicksort(void *array, int dim, int pivot) {
 int cache_file(char *filename, char **records, int maxrecords, int cachemode, int offset) {
 
     char curline[MAXLINESIZE];
-    int fd, res = 0, index, line_idx = 0;
+    struct line_reader reader;
+    int res = 0, index, line_idx = 0;
 
     if (cachemode != CACHE_START && cachemode != CACHE_TAIL) {
         return -EINVAL;
@@ -982,8 +1482,8 @@ int cache_file(char *filename, char **records, int maxrecords, int cachemode, in
     }
     if (maxrecords == 0) return 0;
 
-    if ( ( fd = open(filename, O_RDONLY) ) < 0) {
-        return -errno;
+    if ( ( res = line_reader_open(&reader, filename) ) < 0) {
+        return res;
     }
     /* Initialize the buffer to NULL pointers */
     for ( index = 0 ; index < maxrecords ; index++)
@@ -991,15 +1491,15 @@ int cache_file(char *filename, char **records, int maxrecords, int cachemode, in
 
     if (cachemode == CACHE_START) {
         for (index = 0 ; index < maxrecords ; index++) {
-            if ( (res = readline(fd, curline)) < 0) {
-                /* readline failed, cleanup and exit */
+            if ( (res = line_reader_next(&reader, curline)) < 0) {
+                /* read failed, cleanup and exit */
                 goto do_cleanup;
             }
             /*Start to copy line in the buffer when line number is equal to offset value*/
             if ( line_idx >= offset) {
                 if (res == 0) {
                     /* file terminated */
-                    close(fd);
+                    line_reader_close(&reader);
                     return (index - offset);
                 }
                 /* add a new line to our buffer */
@@ -1011,13 +1511,13 @@ int cache_file(char *filename, char **records, int maxrecords, int cachemode, in
             }
             line_idx++;
         }
-        close(fd);
+        line_reader_close(&reader);
         return index;
     }
 
     if (cachemode == CACHE_TAIL) {
         int curindex = 0, count = 0;
-        while((res = readline(fd, curline)) > 0) {
+        while((res = line_reader_next(&reader, curline)) > 0) {
             /*Start to copy line when line number is equal to offset value*/
             if ( line_idx >= offset) {
                 /* add a new file to our buffer */
@@ -1035,21 +1535,15 @@ int cache_file(char *filename, char **records, int maxrecords, int cachemode, in
             line_idx++;
         }
         if ( res < 0) {
-            /* readline failed, cleanup and exit */
+            /* read failed, cleanup and exit */
             goto do_cleanup;
         }
         /* res == 0 => EOF */
         if (count == maxrecords && curindex != 0) {
-            /* Reordering the buffer is necessary */
-#ifdef __DEBUG_QS__
-            printf("Reorder the buffer (count = %d, maxrecords = %d, curindex = %d)\n", count, maxrecords, curindex);
-#endif
-            if ((res = quicksort(records, count, curindex)) < 0) {
-                LOGE("%s: Cannot sort the final array: %s\n", __FUNCTION__, strerror(-res));
-                goto do_cleanup;
-            }
+            /* The oldest line is at curindex, rotate the buffer to start with it */
+            rotate_records(records, count, curindex);
         }
-        close(fd);
+        line_reader_close(&reader);
         return count;
     }
 do_cleanup:
@@ -1058,7 +1552,7 @@ do_cleanup:
             free(records[index]);
             records[index] = NULL;
         }
-    close(fd);
+    line_reader_close(&reader);
     return res;
 }
 
@@ -1097,20 +1591,21 @@ int overwrite_file(char *filename, char *value) {
 
 int read_file_prop_uid(char* source, char *filename, char *uid, char* defaultvalue) {
     FILE *fd;
+    struct line_reader reader;
     char buffer[MAXLINESIZE];
     char temp_uid[PROPERTY_VALUE_MAX];
 
     if ((source && filename && uid && defaultvalue) == 0)
         return -1;
     strncpy(uid, defaultvalue, PROPERTY_VALUE_MAX);
-    fd = fopen(filename, "r");
-    if (fd!=NULL){
-        freadline(fd, buffer);
+    buffer[0] = 0;
+    if (line_reader_open(&reader, filename) == 0) {
+        line_reader_next(&reader, buffer);
         strncpy(uid, buffer, PROPERTY_VALUE_MAX);
-        fclose(fd);
+        line_reader_close(&reader);
     }
 
-    if (property_get(source, temp_uid, "") <= 0) {
+    if (propcache_get(source, temp_uid, "") <= 0) {
         LOGE("Property %s not readable\n", source);
         return -1;
     }
@@ -1130,46 +1625,55 @@ int read_file_prop_uid(char* source, char *filename, char *uid, char* defaultval
     return 0;
 }
 
-void flush_aplog(e_aplog_file_t file, const char *mode, int *dir, const char *ts) {
+/* Serializes the aplog dumps into APLOG_FILE_0 with its copies */
+static pthread_mutex_t aplog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Locks APLOG_FILE_0, to be held from its flush until it is copied
+ */
+void aplog_lock(void) {
+    pthread_mutex_lock(&aplog_mutex);
+}
+
+void aplog_unlock(void) {
+    pthread_mutex_unlock(&aplog_mutex);
+}
+
+void flush_aplog(e_aplog_file_t file, const char *mode, const char *dirbase, int *dir, const char *ts) {
     char log_boot_name[512] = { '\0', };
-    int status;
+    unsigned int buffers = LOG_BUFFER_MAIN | LOG_BUFFER_SYSTEM | LOG_BUFFER_RADIO | LOG_BUFFER_EVENTS;
+    off_t status;
 
     switch (file) {
     case APLOG:
 #ifndef FULL_REPORT
-        if (file_exists(APLOG_FILE_0)) {
-            remove(APLOG_FILE_0);
-        }
-        status = system("/system/bin/logcat -b system -b main -b radio -b events -v threadtime -d -f /logs/aplog");
-        if (status != 0)
-            LOGE("dump logcat returns status: %d.\n", status);
+        status = dump_log_buffers(buffers, APLOG_FILE_0, 0, 0);
+        if (status < 0)
+            LOGE("dump logcat returns status: %d.\n", (int)status);
         do_chown(APLOG_FILE_0, PERM_USER, PERM_GROUP);
 #endif
         break;
 
     case APLOG_BOOT:
-        if ((mode == NULL) || (dir == NULL) || (ts == NULL)) {
+        if ((mode == NULL) || (dirbase == NULL) || (dir == NULL) || (ts == NULL)) {
             LOGE("invalid parameters\n");
             return;
         }
 
         snprintf(log_boot_name, sizeof(log_boot_name)-1, "%s%d/%s_%s_%s",
-                CRASH_DIR, *dir, strrchr(APLOG_FILE_BOOT,'/')+1, mode, ts);
+                dirbase, *dir, strrchr(APLOG_FILE_BOOT,'/')+1, mode, ts);
 
 #ifdef FULL_REPORT
-        status = system("/system/bin/logcat -b system -b main -b radio -b events -b kernel -v threadtime -d -f /logs/aplog_boot");
-#else
-        status = system("/system/bin/logcat -b system -b main -b radio -b events -v threadtime -d -f /logs/aplog_boot");
+        buffers |= LOG_BUFFER_KERNEL;
 #endif
-        if (status != 0) {
-            LOGE("flush ap log from boot returns status: %d.\n", status);
+        /* The buffers are dumped straight into the crash directory */
+        status = dump_log_buffers(buffers, log_boot_name, 0, MAXFILESIZE);
+        usage_add(log_boot_name, usage_bytes(log_boot_name));
+        if (status < 0) {
+            LOGE("flush ap log from boot returns status: %d.\n", (int)status);
             return;
         }
-
-        if(file_exists(APLOG_FILE_BOOT)) {
-            do_copy(APLOG_FILE_BOOT, log_boot_name, MAXFILESIZE);
-            remove(APLOG_FILE_BOOT);
-        }
+        do_chown(log_boot_name, PERM_USER, PERM_GROUP);
         break;
 
     default:
@@ -1184,7 +1688,7 @@ char *compute_bp_log(const char* ext_file) {
     char dir_pattern_base[PATHMAX];
     char temp_path_log[PROPERTY_VALUE_MAX];
 
-    if (property_get("persist.service.mts.output", temp_path_log, BPLOG_FILE_0) > 0) {
+    if (propcache_get("persist.service.mts.output", temp_path_log, BPLOG_FILE_0) > 0) {
         strncpy(dir_pattern_base, temp_path_log, PATHMAX);
     }else{
         //default value
@@ -1196,26 +1700,176 @@ char *compute_bp_log(const char* ext_file) {
     return strdup(destination);
 }
 
-void do_log_copy(char *mode, int dir, const char* timestamp, int type) {
+static long long monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Returns the time elapsed (in ms) since the last change of a file */
+static long long mtime_age_ms(const struct stat *info) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (ts.tv_sec - info->st_mtim.tv_sec) * 1000LL
+        + (ts.tv_nsec - info->st_mtim.tv_nsec) / 1000000;
+}
+
+/* Polls the size and mtime of path, for when inotify is not available */
+static int poll_file_stable(const char *path, long long last, long long start,
+        int quiet_ms, int deadline_ms) {
+    struct stat info, prev;
+    long long now;
+
+    if (stat(path, &prev) < 0)
+        return -errno;
+    for (now = monotonic_ms() ; now - last < quiet_ms ; now = monotonic_ms()) {
+        if (now - start >= deadline_ms)
+            return -ETIMEDOUT;
+        usleep(MIN(quiet_ms, 50) * 1000);
+        if (stat(path, &info) < 0)
+            return -errno;
+        if (info.st_size != prev.st_size || info.st_mtim.tv_sec != prev.st_mtim.tv_sec
+                || info.st_mtim.tv_nsec != prev.st_mtim.tv_nsec)
+            last = monotonic_ms();
+        prev = info;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for a file, or the content of a directory, to be written
+ *
+ * A file is complete once closed by its writer or once unchanged for
+ * quiet_ms; a file already unchanged for quiet_ms is returned at once.
+ * A directory is complete once none of its files changed for quiet_ms.
+ *
+ * @param path of the file or directory
+ * @param quiet_ms with no change for the file to be complete
+ * @param deadline_ms max wait
+ *
+ * @return 0 if complete, -ETIMEDOUT if still written at the deadline,
+ * -ENOENT if removed, a negative errno otherwise.
+ */
+int wait_file_stable(const char *path, int quiet_ms, int deadline_ms) {
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    struct pollfd pfd;
+    struct stat info;
+    long long now, start, last;
+    int fd, isdir, len, res = 1;
+    char *p;
+
+    if (!path)
+        return -EINVAL;
+    if (stat(path, &info) < 0)
+        return -errno;
+    isdir = S_ISDIR(info.st_mode);
+    start = last = monotonic_ms();
+    if (!isdir) {
+        if (mtime_age_ms(&info) >= quiet_ms)
+            return 0;
+        last -= MAX(mtime_age_ms(&info), 0);
+    }
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, path, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE
+            | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return poll_file_stable(path, last, start, quiet_ms, deadline_ms);
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (res > 0) {
+        now = monotonic_ms();
+        if (now - last >= quiet_ms) {
+            res = 0;
+            break;
+        }
+        if (now - start >= deadline_ms) {
+            res = -ETIMEDOUT;
+            break;
+        }
+        len = poll(&pfd, 1, (int)MIN(last + quiet_ms - now, start + deadline_ms - now));
+        if (len < 0 && errno != EINTR) {
+            res = -errno;
+            break;
+        }
+        if (len <= 0)
+            continue;
+        len = read(fd, buffer, sizeof(buffer));
+        for (p = buffer ; len > 0 && p < buffer + len ; p += sizeof(*event) + event->len) {
+            event = (struct inotify_event *)p;
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                res = -ENOENT;
+            else if (!isdir && (event->mask & IN_CLOSE_WRITE))
+                res = 0;
+        }
+        last = monotonic_ms();
+    }
+    close(fd);
+    if (res == -ETIMEDOUT)
+        LOGW("%s: %s still written after %d ms\n", __FUNCTION__, path, deadline_ms);
+    return res;
+}
+
+/**
+ * @brief Waits for the file of an inotify event to be completely written
+ *
+ * The files reported once closed or renamed are complete; the others
+ * (created, replayed after an overflow) may still be written.
+ *
+ * @param path of the file
+ * @param mask of the inotify event
+ *
+ * @return 0 if complete, a negative errno otherwise (see wait_file_stable)
+ */
+int wait_file_complete(const char *path, unsigned int mask) {
+    if (mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        return 0;
+    return wait_file_stable(path, STABLE_QUIET_MS, STABLE_DEADLINE_MS);
+}
+
+/**
+ * @brief Waits, up to LOG_SETTLE_MS, for the logs of the event being
+ * processed to reach the aplog
+ */
+void wait_aplog_flushed(void) {
+    wait_file_stable(APLOG_FILE_0, LOG_QUIET_MS, LOG_SETTLE_MS);
+}
+
+/**
+ * @brief Copies the tail of a log into a crash directory
+ *
+ * If enabled, the log is compressed while being copied; it is copied as is
+ * if the compression fails.
+ */
+static void copy_log_tail(char *src, char *dest, int limit, int compress) {
+    if (compress && compress_copy(src, dest, COPY_TAIL, limit) >= 0)
+        return;
+    do_copy_tail(src, dest, limit);
+}
+
+static void do_log_copy_locked(char *mode, char *dir_pattern, int dir, const char* timestamp, int type) {
     char destination[PATHMAX], *logfile0, *logfile1, *extension;
     struct stat info;
-    char *dir_pattern = CRASH_DIR;
     int limit = MAXFILESIZE;
+    int compress = is_log_compression_enabled();
 
     switch (type) {
         case APLOG_TYPE:
         case APLOG_STATS_TYPE:
         case KDUMP_TYPE:
 #ifndef FULL_REPORT
-            flush_aplog(APLOG, NULL, NULL, NULL);
+            flush_aplog(APLOG, NULL, NULL, NULL, NULL);
 #endif
             logfile0 = APLOG_FILE_0;
             logfile1 = APLOG_FILE_1;
             extension = "";
-            if (type == APLOG_STATS_TYPE)
-                dir_pattern = STATS_DIR;
-            else if (type == KDUMP_TYPE)
-                dir_pattern = KDUMP_CRASH_DIR;
             break;
         case BPLOG_TYPE:
         case BPLOG_STATS_TYPE:
@@ -1223,8 +1877,6 @@ void do_log_copy(char *mode, int dir, const char* timestamp, int type) {
             logfile1 = compute_bp_log(BPLOG_FILE_1_EXT ); //BPLOG_FILE_1;
             extension = ".istp";
             limit = 0; /* no limit size for bplogs copy */
-            if (type == BPLOG_STATS_TYPE)
-                dir_pattern = STATS_DIR;
             break;
         case BPLOG_TYPE_OLD:
             logfile0 = compute_bp_log(BPLOG_FILE_1_OLD_EXT); // BPLOG_FILE_1_OLD;
@@ -1238,10 +1890,10 @@ void do_log_copy(char *mode, int dir, const char* timestamp, int type) {
     }
     if(stat(logfile0, &info) == 0) {
         snprintf(destination,sizeof(destination), "%s%d/%s_%s_%s%s", dir_pattern, dir, strrchr(logfile0,'/')+1, mode, timestamp, extension);
-        do_copy_tail(logfile0, destination, limit);
+        copy_log_tail(logfile0, destination, limit, compress);
         if(info.st_size < 1*MB) {
             snprintf(destination,sizeof(destination), "%s%d/%s_%s_%s%s", dir_pattern, dir, strrchr(logfile1,'/')+1, mode, timestamp, extension);
-            do_copy_tail(logfile1, destination, limit);
+            copy_log_tail(logfile1, destination, limit, compress);
         }
 #ifndef FULL_REPORT
         remove(APLOG_FILE_0);
@@ -1255,6 +1907,7 @@ void do_log_copy(char *mode, int dir, const char* timestamp, int type) {
             //nothing to do
             break;
         case BPLOG_TYPE:
+        case BPLOG_STATS_TYPE:
         case BPLOG_TYPE_OLD:
             free(logfile0);
             free(logfile1);
@@ -1265,6 +1918,19 @@ void do_log_copy(char *mode, int dir, const char* timestamp, int type) {
     }
 }
 
+/**
+ * @brief Copies the logs of a type into an event directory
+ *
+ * @param dirbase of the event directory, as returned by find_new_crashlog_dir
+ * @param dir index of the event directory
+ */
+void do_log_copy(char *mode, char *dirbase, int dir, const char* timestamp, int type) {
+    /* APLOG_FILE_0 is flushed then removed on each copy */
+    aplog_lock();
+    do_log_copy_locked(mode, dirbase, dir, timestamp, type);
+    aplog_unlock();
+}
+
 void copy_dir(void *arguments)
 {
     struct arg_copy *args = (struct arg_copy *)arguments;
@@ -1279,14 +1945,15 @@ void copy_dir(void *arguments)
     cp_time_val = args->time_val;
     //free parameter the sooner to avoid any possible leak
     free(args);
+    //wait for the producer to be done, up to cp_time_val seconds
+    if (cp_time_val > 0){
+        wait_file_stable(dir_src, COPY_DIR_QUIET_MS, cp_time_val * 1000);
+    }
     d = opendir(dir_src);
     if(!d) {
         LOGE("%s: Can't open dir %s\n",__FUNCTION__, dir_src);
         return;
     }
-    if (cp_time_val > 0){
-        sleep(cp_time_val);
-    }
     while ((de = readdir(d))) {
         //protection for . and .. "default folder"
         if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
@@ -1297,8 +1964,8 @@ void copy_dir(void *arguments)
         //TO DO : rework the "/" part
         snprintf(src, sizeof(src), "%s/%s", dir_src,name);
         snprintf(des, sizeof(des), "%s/%s", dir_des,name);
-        int status = do_copy(src, des, 0);
-        if (status != 0)
+        off_t status = copy_file(src, des, COPY_ALL, 0);
+        if (status < 0)
             LOGE("copy error for %s.\n",name);
     }
     closedir(d);
@@ -1368,27 +2035,7 @@ int get_parent_dir( char * dir, char *parent_dir )
 
 long get_sd_size()
 {
-    FILE *fd;
-    long l_size=0;
-    //first calculate SDSIZE folder with the result of a du command
-    int status = system(SDSIZE_SYSTEM_CMD);
-    if (status != 0){
-        LOGE("get_sd_size status: %d.\n", status);
-    }
-    //then read the result
-    fd = fopen(SDSIZE_CURRENT_LOG, "r");
-    if (fd == NULL){
-        LOGE("can not open file: %s\n", SDSIZE_CURRENT_LOG);
-        //if size could not be calculated, we consider size at zero value
-        return 0;
-    }
-    if (fscanf(fd, "%ld", &l_size)==EOF) {
-        l_size = 0;
-    }
-    if (fd != NULL){
-        fclose(fd);
-    }
-    return l_size;
+    return (long)usage_get_kb(USAGE_SD);
 }
 
 int sdcard_allowed()
@@ -1399,8 +2046,8 @@ int sdcard_allowed()
         return 0;
     }
     //now check remain size on SD
-    if (get_sd_size() > current_sd_size_limit){
-        LOGE("SD not allowed - current_sd_size_limit reached: %ld.\n", current_sd_size_limit);
+    if (usage_over_quota(USAGE_SD)) {
+        LOGE("SD not allowed - size limit reached: %ld KB used.\n", get_sd_size());
         return 0;
     }else{
         return 1;
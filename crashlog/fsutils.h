@@ -54,11 +54,35 @@ typedef enum e_dir_mode {
     MODE_KDUMP,
 } e_dir_mode_t;
 
+/* Part of the source file copied by copy_file */
+typedef enum e_copy_window {
+    COPY_ALL = 0,   /* whole file, including the data appended during the copy */
+    COPY_HEAD,      /* first bytes */
+    COPY_TAIL,      /* last bytes */
+} e_copy_window_t;
+
 typedef enum e_aplog_file {
     APLOG,
     APLOG_BOOT,
 } e_aplog_file_t;
 
+/* Buffered reader returning a file line by line */
+#define LINE_READER_BUFSIZE     (16 * KB)
+
+struct line_reader {
+    int fd;
+    int start;      /* first unread byte of buffer */
+    int end;        /* end of the bytes read in buffer */
+    char buffer[LINE_READER_BUFSIZE];
+};
+
+/* Deferred deletion : suffix of the tombstones (followed by a sequence
+ * number), and pause (in us) done by the deleter each time it removed a
+ * batch of entries */
+#define RMFR_TOMBSTONE_SUFFIX   ".del"
+#define RMFR_DEFERRED_BATCH     32
+#define RMFR_DEFERRED_PAUSE     20000
+
 /* Mode used to cache a file into a buffer*/
 #define CACHE_TAIL      0
 #define CACHE_START     1
@@ -101,9 +125,10 @@ static inline int get_file_size(char *filename) {
 }
 
 int read_file_prop_uid(char* propsource, char *filename, char *uid, char* defaultvalue);
-int find_new_crashlog_dir(e_dir_mode_t mode);
+int find_new_crashlog_dir(e_dir_mode_t mode, char **dirbase);
+void reset_crashlog_dir_index(e_dir_mode_t mode);
 int get_sdcard_paths(e_dir_mode_t mode);
-void do_log_copy(char *mode, int dir, const char* ts, int type);
+void do_log_copy(char *mode, char *dirbase, int dir, const char* ts, int type);
 long get_sd_size();
 int sdcard_allowed();
 
@@ -113,22 +138,39 @@ int find_str_in_file(char *filename, char *keyword, char *tail);
 int find_str_in_standard_file(char *filename, char *keyword, char *tail);
 int find_oneofstrings_in_file(char *file, char **keywords, int nbkeywords);
 int find_oneofstrings_in_file_with_keyword(char *filename, char **keywords, char *common_keyword,int nbkeywords);
-void flush_aplog(e_aplog_file_t file, const char *mode, int *dir, const char *ts);
+void aplog_lock(void);
+void aplog_unlock(void);
+void flush_aplog(e_aplog_file_t file, const char *mode, const char *dirbase, int *dir, const char *ts);
 void reset_file(const char *filename);
-int readline(int fd, char buffer[MAXLINESIZE]);
-int freadline(FILE *fd, char buffer[MAXLINESIZE]);
+void line_reader_init(struct line_reader *reader, int fd);
+int line_reader_open(struct line_reader *reader, const char *filename);
+int line_reader_next(struct line_reader *reader, char line[MAXLINESIZE]);
+void line_reader_close(struct line_reader *reader);
 int append_file(char *filename, char *text);
 int overwrite_file(char *filename, char *value);
 
+ssize_t do_read(int fd, void *buf, size_t len);
+ssize_t do_write(int fd, const void *buf, size_t len);
 int do_chmod(char *path, char *mode);
 int do_chown(const char *file, char *uid, char *gid);
+int do_fchown(int fd, const char *file, char *uid, char *gid);
+int check_partlogfull(const char* path);
+off_t copy_file(const char *src, const char *dest, e_copy_window_t window, off_t limit);
 int do_copy_eof(const char *src, const char *des);
-int do_copy_tail(char *src, char *dest, int limit);
+off_t do_copy_tail(char *src, char *dest, off_t limit);
 int do_copy(char *src, char *dest, int limit);
 int do_mv(char *src, char *dest);
 int rmfr(char *path);
 int rmfr_specific(char *path, int remove_dir);
-
+int rmfr_bury(const char *path, char *tombstone, int size);
+int rmfr_tombstone(const char *tombstone);
+int rmfr_deferred(const char *path);
+int is_rmfr_tombstone(const char *name);
+void rmfr_deferred_sweep(const char *dir);
+
+int wait_file_stable(const char *path, int quiet_ms, int deadline_ms);
+int wait_file_complete(const char *path, unsigned int mask);
+void wait_aplog_flushed(void);
 void copy_dir(void *arguments);
 void update_logs_permission(void);
 
@@ -29,6 +29,7 @@
 #include "privconfig.h"
 #include "history.h"
 #include "fsutils.h"
+#include "propcache.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -36,14 +37,84 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <sys/sha1.h>
 
 #define HISTORY_FIRST_LINE_FMT  "#V1.0 " UPTIME_EVNAME "   %-24s\n"
 #define HISTORY_BLANK_LINE1     "#V1.0 " UPTIME_EVNAME "   0000:00:00              \n"
 #define HISTORY_BLANK_LINE2     "#EVENT  ID                    DATE                 TYPE\n"
+/* Last field of an event line with repeats folded into it. The counter has
+ * a fixed width so that its updates keep the line length */
+#define HISTORY_REPEAT_FIELD    "REPEAT="
+#define HISTORY_REPEAT_WIDTH    10
 
+/* The history is stored in a ring file of fixed size records, the first
+ * record slot holding the ring header. Adding an event is a single record
+ * write. The HISTORY_FILE text file is an export kept for the consumers :
+ * new events are appended to it and, once it holds HISTORY_EXPORT_MAX
+ * events, it is regenerated with the HISTORY_EXPORT_MAX -
+ * HISTORY_EXPORT_SLACK newest ones, so it is only rewritten every
+ * HISTORY_EXPORT_SLACK events. */
+#define HISTORY_RING_MAGIC      "HISTRING"
+#define HISTORY_RING_VERSION    1
+#define HISTORY_RECORD_SIZE     256
+#define HISTORY_EXPORT_MAX      MAX_RECORDS
+#define HISTORY_EXPORT_SLACK    (MAX_RECORDS / 10)
+#define HISTORY_RECORD_OFFSET(slot) ((off_t)((slot) + 1) * HISTORY_RECORD_SIZE)
+/* Size of the lookup tables, a power of 2 greater than twice MAX_RECORDS */
+#define HISTORY_INDEX_SIZE      16384
+#define HISTORY_INDEX_MASK      (HISTORY_INDEX_SIZE - 1)
+
+struct history_ring_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned int capacity;
+};
+
+struct history_record {
+    unsigned int seq;   /* 0 for an empty slot */
+    char line[HISTORY_RECORD_SIZE - sizeof(unsigned int)];
+};
+
+/* Fields of a cached event used by the lookup tables */
+struct history_slot {
+    char id[SHA1_DIGEST_LENGTH+1];
+    int diroff;         /* offset of the log directory in the line, -1 if none */
+    int dirlen;
+    int repeatoff;      /* offset of the repeat field in the line, -1 if none */
+    unsigned int repeat;
+    off_t exportoff;    /* offset of the line in the text export, -1 if unknown */
+};
+
+/* The cached lines are stored back to back in a single circular arena
+ * instead of one allocation each. The evicted line is always the oldest
+ * one, so the arena works as a byte FIFO : a line not fitting at the end of
+ * the arena is stored at its start and the end stays unused until the
+ * oldest lines are released. When the arena is too small, the lines are
+ * rotated in place to be contiguous and the arena is enlarged. */
+#define HISTORY_ARENA_MIN       (64 * KB)
+
+/* historycache[slot] mirrors the ring record of the same slot */
 static char *historycache[MAX_RECORDS];
+static char *arena = NULL;
+static size_t arenasize = 0;
+static size_t arenahead = 0;    /* offset of the oldest line */
+static size_t arenatail = 0;    /* offset of the next line */
+static size_t arenawrap = 0;    /* end of the lines stored before the tail wrapped */
+static size_t arenaused = 0;    /* bytes held by the cached lines */
+static int arenalines = 0;
+static struct history_slot slotinfo[MAX_RECORDS];
+/* Open addressing tables of slots, keyed by event ID and by log directory */
+static int idindex[HISTORY_INDEX_SIZE];
+static int dirindex[HISTORY_INDEX_SIZE];
 static int nextline = -1;
+static unsigned int lastseq = 0;
+static int exportlines = 0;
+static int ringfd = -1;
+/* protects the cache, the ring and the text export */
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
 static int loop_uptime_event = 1;
 /* last uptime value set at device boot only */
 static char lastbootuptime[24] = "0000:00:00";
@@ -112,8 +183,444 @@ static int get_timed_firstline(char *buffer, int *hours, char lastuptime[24], in
     }
 }
 
+static unsigned int history_hash(const char *key, int len) {
+    unsigned int hash = 2166136261u;
+
+    while (len-- > 0) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Returns the key of slot in the given lookup table */
+static const char *history_slot_key(int *table, int slot, int *len) {
+    if (table == idindex) {
+        *len = strlen(slotinfo[slot].id);
+        return slotinfo[slot].id;
+    }
+    *len = slotinfo[slot].dirlen;
+    return historycache[slot] + slotinfo[slot].diroff;
+}
+
+/* Returns the position of key in table, or of the empty place ending its probe */
+static int history_index_find(int *table, const char *key, int len) {
+    int pos = history_hash(key, len) & HISTORY_INDEX_MASK;
+    const char *slotkey;
+    int slotlen;
+
+    while (table[pos] >= 0) {
+        slotkey = history_slot_key(table, table[pos], &slotlen);
+        if (slotlen == len && !memcmp(slotkey, key, len))
+            break;
+        pos = (pos + 1) & HISTORY_INDEX_MASK;
+    }
+    return pos;
+}
+
+static int history_index_lookup(int *table, const char *key, int len) {
+    if (len <= 0) return -1;
+    return table[history_index_find(table, key, len)];
+}
+
+/* The most recent event wins when several share the same key */
+static void history_index_insert(int *table, int slot) {
+    const char *key;
+    int len;
+
+    key = history_slot_key(table, slot, &len);
+    if (len > 0)
+        table[history_index_find(table, key, len)] = slot;
+}
+
+static void history_index_remove(int *table, int slot) {
+    const char *key;
+    int len, pos, next, ideal;
+
+    key = history_slot_key(table, slot, &len);
+    if (len <= 0) return;
+    pos = history_index_find(table, key, len);
+    /* Key may now belong to a more recent event */
+    if (table[pos] != slot) return;
+
+    /* Backward shift deletion keeps the probe sequences unbroken */
+    table[pos] = -1;
+    for (next = (pos + 1) & HISTORY_INDEX_MASK ; table[next] >= 0 ;
+            next = (next + 1) & HISTORY_INDEX_MASK) {
+        key = history_slot_key(table, table[next], &len);
+        ideal = history_hash(key, len) & HISTORY_INDEX_MASK;
+        if (((next - ideal) & HISTORY_INDEX_MASK) >= ((next - pos) & HISTORY_INDEX_MASK)) {
+            table[pos] = table[next];
+            table[next] = -1;
+            pos = next;
+        }
+    }
+}
+
+/* Parses the cached line of slot and adds it to the lookup tables */
+static void index_history_slot(int slot) {
+    struct history_slot *info = &slotinfo[slot];
+    char *line = historycache[slot], *start, *end;
+
+    info->diroff = -1;
+    info->dirlen = 0;
+    info->repeatoff = -1;
+    info->repeat = 0;
+    info->exportoff = -1;
+    if (sscanf(line, "%*s %20s", info->id) != 1)
+        info->id[0] = 0;
+
+    /* The log directory is the last field, if any, or the one before the
+     * repeat field */
+    end = line + strlen(line);
+    while (end > line && isspace(end[-1]))
+        end--;
+    start = end;
+    while (start > line && !isspace(start[-1]))
+        start--;
+    if (!strncmp(start, HISTORY_REPEAT_FIELD, strlen(HISTORY_REPEAT_FIELD))) {
+        info->repeat = strtoul(start + strlen(HISTORY_REPEAT_FIELD), NULL, 10);
+        end = start;
+        while (end > line && isspace(end[-1]))
+            end--;
+        info->repeatoff = end - line;
+        start = end;
+        while (start > line && !isspace(start[-1]))
+            start--;
+    }
+    if (start < end && *start == '/') {
+        info->diroff = start - line;
+        info->dirlen = end - start;
+    }
+    history_index_insert(idindex, slot);
+    history_index_insert(dirindex, slot);
+}
+
+static void unindex_history_slot(int slot) {
+    history_index_remove(idindex, slot);
+    history_index_remove(dirindex, slot);
+}
+
+/* Returns the line of slot with its current repeat field, in buffer if it
+ * differs from the cached one */
+static const char *history_slot_line(int slot, char buffer[MAXLINESIZE]) {
+    struct history_slot *info = &slotinfo[slot];
+    const char *line = historycache[slot];
+    int len;
+
+    if (info->repeatoff < 0 && info->repeat == 0)
+        return line;
+    if (info->repeatoff >= 0) {
+        len = info->repeatoff;
+    } else {
+        len = strlen(line);
+        while (len > 0 && isspace(line[len - 1]))
+            len--;
+    }
+    if (info->repeat == 0)
+        snprintf(buffer, MAXLINESIZE, "%.*s\n", len, line);
+    else
+        snprintf(buffer, MAXLINESIZE, "%.*s " HISTORY_REPEAT_FIELD "%0*u\n",
+            len, line, HISTORY_REPEAT_WIDTH, info->repeat);
+    return buffer;
+}
+
+static void reverse_bytes(char *start, char *end) {
+    char tmp;
+
+    while (start < --end) {
+        tmp = *start;
+        *start++ = *end;
+        *end = tmp;
+    }
+}
+
+/* Rotates in place the len first bytes of the arena by shift bytes to the
+ * left and moves the cached lines accordingly */
+static void rotate_history_arena(size_t len, size_t shift) {
+    size_t offset;
+    int slot;
+
+    if (shift == 0 || shift >= len)
+        return;
+    reverse_bytes(arena, arena + shift);
+    reverse_bytes(arena + shift, arena + len);
+    reverse_bytes(arena, arena + len);
+    for (slot = 0 ; slot < MAX_RECORDS ; slot++) {
+        if (!historycache[slot])
+            continue;
+        offset = historycache[slot] - arena;
+        historycache[slot] = arena + (offset >= shift ? offset - shift : offset + len - shift);
+    }
+}
+
+static void report_history_arena() {
+    size_t lost = (arenatail < arenahead ? arenasize - arenawrap : 0);
+
+    LOGI("%s: %d lines, %lu bytes used in a %lu bytes arena, %lu bytes unusable at wrap\n",
+        __FUNCTION__, arenalines, (unsigned long)arenaused,
+        (unsigned long)arenasize, (unsigned long)lost);
+}
+
+/* Makes the lines contiguous from the arena start and enlarges it so that
+ * at least len more bytes fit */
+static int grow_history_arena(size_t len) {
+    size_t newsize;
+    char *newarena;
+    int slot;
+
+    if (arenalines && arenatail <= arenahead)
+        /* Wrapped : newest lines, free space, oldest lines, unused end */
+        rotate_history_arena(arenawrap, arenahead);
+    else if (arenalines)
+        rotate_history_arena(arenatail, arenahead);
+    arenahead = 0;
+    arenatail = arenaused;
+    arenawrap = arenasize;
+    if (arenasize - arenatail >= len)
+        return 0;
+
+    newsize = (arenaused + len) + (arenaused + len) / 4 + MAXLINESIZE;
+    if (newsize < HISTORY_ARENA_MIN)
+        newsize = HISTORY_ARENA_MIN;
+    newarena = realloc(arena, newsize);
+    if (!newarena)
+        return -ENOMEM;
+    for (slot = 0 ; slot < MAX_RECORDS ; slot++)
+        if (historycache[slot])
+            historycache[slot] = newarena + (historycache[slot] - arena);
+    arena = newarena;
+    arenasize = newsize;
+    arenawrap = newsize;
+    LOGD("%s: history arena enlarged to %lu bytes\n", __FUNCTION__, (unsigned long)newsize);
+    return 0;
+}
+
+/* Stores a copy of line in the arena, returns NULL on error */
+static char *store_history_line(const char *line) {
+    size_t len = strlen(line) + 1;
+    int wrapped = (arenalines && arenatail <= arenahead);
+    char *copy;
+
+    if (wrapped ? (arenahead - arenatail < len) :
+            (arenasize - arenatail < len && arenahead < len)) {
+        if (grow_history_arena(len) < 0)
+            return NULL;
+    } else if (!wrapped && arenasize - arenatail < len) {
+        /* Not enough room at the end, wrap to the start */
+        arenawrap = arenatail;
+        arenatail = 0;
+    }
+    copy = arena + arenatail;
+    memcpy(copy, line, len);
+    arenatail += len;
+    arenaused += len;
+    arenalines++;
+    return copy;
+}
+
+/* Releases the line of slot, which is the oldest line of the arena */
+static void release_history_line(int slot) {
+    char *line = historycache[slot];
+    size_t len = strlen(line) + 1;
+
+    historycache[slot] = NULL;
+    arenaused -= len;
+    arenalines--;
+    if (line != arena + arenahead)
+        LOGE("%s: line of slot %d released out of order\n", __FUNCTION__, slot);
+    else
+        arenahead += len;
+
+    if (!arenalines) {
+        arenahead = arenatail = 0;
+        arenawrap = arenasize;
+    } else if (arenahead == arenawrap) {
+        arenahead = 0;
+        arenawrap = arenasize;
+    }
+}
+
+/**
+ * @brief Opens the history ring file, creates it if missing or invalid
+ *
+ * @return 1 if the ring was created, 0 if an existing ring was opened,
+ * a negative errno value otherwise.
+ */
+static int open_history_ring() {
+    struct history_ring_header header;
+    int res;
+
+    if (ringfd >= 0) return 0;
+
+    ringfd = open(HISTORY_RING_FILE, O_RDWR);
+    if (ringfd >= 0) {
+        if (pread(ringfd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                !memcmp(header.magic, HISTORY_RING_MAGIC, sizeof(header.magic)) &&
+                header.version == HISTORY_RING_VERSION &&
+                header.record_size == HISTORY_RECORD_SIZE &&
+                header.capacity == MAX_RECORDS) {
+            fcntl(ringfd, F_SETFD, FD_CLOEXEC);
+            return 0;
+        }
+        LOGE("%s: Invalid header in %s, recreate it\n", __FUNCTION__, HISTORY_RING_FILE);
+        close(ringfd);
+    }
+
+    ringfd = open(HISTORY_RING_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ringfd < 0) return -errno;
+    fcntl(ringfd, F_SETFD, FD_CLOEXEC);
+    do_chown(HISTORY_RING_FILE, PERM_USER, PERM_GROUP);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HISTORY_RING_MAGIC, sizeof(header.magic));
+    header.version = HISTORY_RING_VERSION;
+    header.record_size = HISTORY_RECORD_SIZE;
+    header.capacity = MAX_RECORDS;
+    if (pwrite(ringfd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        res = -errno;
+        close(ringfd);
+        ringfd = -1;
+        return res;
+    }
+    return 1;
+}
+
+static int write_history_record(unsigned int seq, const char *line) {
+    struct history_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.seq = seq;
+    strncpy(record.line, line, sizeof(record.line) - 1);
+    if (strlen(line) >= sizeof(record.line)) {
+        LOGW("%s: history line too long, truncated in %s\n", __FUNCTION__, HISTORY_RING_FILE);
+        record.line[sizeof(record.line) - 2] = '\n';
+    }
+    if (pwrite(ringfd, &record, sizeof(record),
+            HISTORY_RECORD_OFFSET((seq - 1) % MAX_RECORDS)) != (ssize_t)sizeof(record))
+        return -errno;
+    return 0;
+}
+
+/* Fills the cache with the ring records, returns the number of records read */
+static int load_history_ring() {
+    struct history_record *records;
+    int slot = 0, count = 0, nb, idx;
+    ssize_t res;
+    const int chunk = 64;
+
+    records = malloc(chunk * sizeof(struct history_record));
+    if (!records) return -ENOMEM;
+
+    lastseq = 0;
+    while (slot < MAX_RECORDS) {
+        res = pread(ringfd, records, chunk * sizeof(struct history_record),
+                HISTORY_RECORD_OFFSET(slot));
+        if (res < 0) {
+            res = -errno;
+            free(records);
+            return res;
+        }
+        nb = res / sizeof(struct history_record);
+        if (nb == 0) break;
+        for (idx = 0 ; idx < nb && slot < MAX_RECORDS ; idx++, slot++) {
+            if (records[idx].seq == 0 ||
+                    (int)((records[idx].seq - 1) % MAX_RECORDS) != slot)
+                continue;
+            records[idx].line[sizeof(records[idx].line) - 1] = 0;
+            if ((historycache[slot] = store_history_line(records[idx].line)) == NULL) {
+                free(records);
+                return -ENOMEM;
+            }
+            index_history_slot(slot);
+            if (records[idx].seq > lastseq)
+                lastseq = records[idx].seq;
+            count++;
+        }
+    }
+    free(records);
+
+    /* The lines were stored in slot order : rotate them so that the oldest
+     * one, evicted first, is at the start of the arena */
+    for (slot = lastseq % MAX_RECORDS ; slot < MAX_RECORDS ; slot++) {
+        if (historycache[slot]) {
+            rotate_history_arena(arenatail, historycache[slot] - arena);
+            break;
+        }
+    }
+    return count;
+}
+
+/* Fills the cache with the last events of the text file, returns the number
+ * of events read */
+static int import_history_file() {
+    char line[MAXLINESIZE];
+    struct line_reader reader;
+    int count = 0, skip, res;
+
+    if ((res = line_reader_open(&reader, HISTORY_FILE)) < 0)
+        return res;
+    /* Only the last MAX_RECORDS events are kept, after the 2 first lines */
+    while (line_reader_next(&reader, line) > 0)
+        count++;
+    skip = (count > MAX_RECORDS + 2 ? count - MAX_RECORDS : 2);
+    lseek(reader.fd, 0, SEEK_SET);
+    line_reader_init(&reader, reader.fd);
+
+    count = 0;
+    lastseq = 0;
+    while (line_reader_next(&reader, line) > 0) {
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        if (write_history_record(count + 1, line) < 0) {
+            LOGE("%s: Cannot write %s - %s.\n", __FUNCTION__,
+                HISTORY_RING_FILE, strerror(errno));
+            break;
+        }
+        if ((historycache[count] = store_history_line(line)) == NULL) {
+            line_reader_close(&reader);
+            return -ENOMEM;
+        }
+        index_history_slot(count);
+        lastseq = ++count;
+    }
+    line_reader_close(&reader);
+    return count;
+}
+
+/* Finds the offset of the cached events in the text export and returns the
+ * number of events it contains */
+static int index_export_file() {
+    char line[MAXLINESIZE];
+    char id[SHA1_DIGEST_LENGTH+1];
+    char buffer[MAXLINESIZE];
+    struct line_reader reader;
+    off_t offset = 0;
+    int count = 0, slot, len;
+
+    if (line_reader_open(&reader, HISTORY_FILE) < 0)
+        return 0;
+    while ((len = line_reader_next(&reader, line)) > 0) {
+        /* Skip the 2 first lines */
+        if (count++ >= 2 && sscanf(line, "%*s %20s", id) == 1) {
+            slot = history_index_lookup(idindex, id, strlen(id));
+            if (slot >= 0 && !strcmp(history_slot_line(slot, buffer), line))
+                slotinfo[slot].exportoff = offset;
+        }
+        offset += len;
+    }
+    line_reader_close(&reader);
+    return (count > 2 ? count - 2 : 0);
+}
+
 static int cache_history_file() {
     int res;
+
+    /* The cache is empty : so are the lookup tables */
+    memset(idindex, -1, sizeof(idindex));
+    memset(dirindex, -1, sizeof(dirindex));
     if ( !file_exists(HISTORY_FILE) ) {
         char firstline[MAXLINESIZE];
         char lastuptime[24];
@@ -127,30 +634,57 @@ static int cache_history_file() {
         fprintf(to, "%s", firstline);
         fprintf(to, HISTORY_BLANK_LINE2);
         fclose(to);
+
+        /* A new history starts : drop the previous ring */
+        if (ringfd >= 0) {
+            close(ringfd);
+            ringfd = -1;
+        }
+        unlink(HISTORY_RING_FILE);
+    }
+
+    res = open_history_ring();
+    if (res == 0) {
+        res = load_history_ring();
+    } else if (res > 0) {
+        /* New ring : import the events of the text file */
+        res = import_history_file();
     }
-    /* Cache the history file without the 2 first lines */
-    res = cache_file(HISTORY_FILE, (char**)historycache, MAX_RECORDS, CACHE_TAIL, 2);
 
     if ( res < 0 ) {
-        LOGE("%s: Cannot cache the contents of %s - %s.\n",
-            __FUNCTION__, HISTORY_FILE, strerror(-res));
+        LOGE("%s: Cannot cache the history - %s.\n",
+            __FUNCTION__, strerror(-res));
         return res;
     }
-    nextline = res % MAX_RECORDS;
+    nextline = lastseq % MAX_RECORDS;
+    exportlines = index_export_file();
+    report_history_arena();
     return res;
 }
 
+/* Empties the cache, the arena is kept for the next lines */
+static void free_history_cache() {
+    memset(historycache, 0, sizeof(historycache));
+    arenahead = arenatail = arenaused = 0;
+    arenawrap = arenasize;
+    arenalines = 0;
+    nextline = -1;
+}
+
+/* Rebuilds the cache and the ring from the text file */
 int reset_history_cache() {
-    if (nextline > 0) {
-        int idx;
-        /* delete the cache first */
-        for (idx = 0 ; idx < MAX_RECORDS ; idx++)
-            if (historycache[idx]) {
-                free(historycache[idx]);
-                historycache[idx] = NULL;
-            }
+    int res;
+
+    pthread_mutex_lock(&history_lock);
+    free_history_cache();
+    if (ringfd >= 0) {
+        close(ringfd);
+        ringfd = -1;
     }
-    return cache_history_file();
+    unlink(HISTORY_RING_FILE);
+    res = cache_history_file();
+    pthread_mutex_unlock(&history_lock);
+    return res;
 }
 
 static void entry_to_history_line(struct history_entry *entry,
@@ -180,69 +714,15 @@ static void entry_to_history_line(struct history_entry *entry,
     }
 }
 
-int update_history_file(struct history_entry *entry) {
-
-    /* historycache is a circular buffer indexed with next index */
-    int index = 0, fd, res;
-    char newline[MAXLINESIZE];
+/* Regenerates the text export from the cache. history_lock shall be held */
+static int export_history_file(int keep) {
+    int index, fd, skip, count = 0;
+    off_t offset;
     char firstline[MAXLINESIZE];
+    char buffer[MAXLINESIZE];
     char lastuptime[24];
     int tmp;
-    if (!entry || !entry->key ||
-            !entry->eventtime)
-        return -EINVAL;
 
-    if ( !file_exists(HISTORY_FILE) && (res = reset_history_cache()) < 0 ) {
-        LOGE("%s: Cannot reset history cache %s - %s.\n", __FUNCTION__,
-            HISTORY_FILE, strerror(-res));
-        return res;
-    } else if ( nextline < 0 && (res = cache_history_file()) < 0  ) {
-        LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
-            HISTORY_FILE, strerror(-res));
-        return res;
-    }
-
-    entry_to_history_line(entry, newline);
-
-    if (newline[0] == 0) {
-        LOGE("%s: Cannot build the history line for entry %s - %s.\n",
-            __FUNCTION__, entry->key, strerror(errno));
-        return -errno;
-    }
-
-    /* Check if the buffer is full */
-    if ( historycache[nextline] == NULL ) {
-        /* Still have some room */
-        if ( (historycache[nextline] = strdup(newline)) == NULL) {
-            newline[strlen(newline) - 1] = 0; /*Remove trailing character for display purpose*/
-            LOGE("%s: Cannot copy the line %s - %s.\n", __FUNCTION__,
-                newline, strerror(nextline));
-            return -errno;
-        }
-        nextline = (nextline + 1) % MAX_RECORDS;
-        /* We can just write the new line at the end of the file */
-        res = append_file(HISTORY_FILE, newline);
-        if (res > 0) return 0;
-        newline[strlen(newline) - 1] = 0; /*Remove trailing character for display purpose*/
-        LOGE("%s: Cannot append the line %s to %s- %s.\n", __FUNCTION__,
-            newline, HISTORY_FILE, strerror(-res));
-        return res;
-    }
-
-    /* The buffer is full */
-    LOGD("%s : History cache buffer is full\n", __FUNCTION__);
-
-    free(historycache[nextline]);
-    if ( (historycache[nextline] = strdup(newline)) == NULL) {
-        newline[strlen(newline) - 1] = 0; /*Remove trailing character for display purpose*/
-        LOGE("%s: Cannot copy the line %s - %s.\n", __FUNCTION__,
-            newline, strerror(nextline));
-        return -errno;
-    }
-    nextline = (nextline + 1) % MAX_RECORDS;
-    /* We need to recreate a new file and write the full buffer
-     * costly!!!
-     */
     fd = open(HISTORY_FILE, O_RDWR | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
     if (fd < 0) {
         LOGE("%s: Cannot create %s\n", HISTORY_FILE, strerror(errno));
@@ -267,41 +747,135 @@ int update_history_file(struct history_entry *entry) {
        return -errno;
    }
 
-    /* Copy the buffer from nextline to the end */
-    for (index = nextline ; index < MAX_RECORDS ; index++) {
-        if (write(fd, historycache[index], strlen(historycache[index]))
-            != (int)strlen(historycache[index]) ) {
-            close(fd);
-            return -errno;
-        }
-    }
-    /* Copy the buffer from 0 to nextline */
-    for (index = 0 ; index < nextline ; index++) {
-        if (write(fd, historycache[index], strlen(historycache[index]))
-            != (int)strlen(historycache[index]) ) {
+    offset = lseek(fd, 0, SEEK_CUR);
+    /* Only the keep newest events are exported */
+    for (index = 0, skip = 0 ; index < MAX_RECORDS ; index++)
+        if (historycache[index])
+            skip++;
+    skip -= keep;
+    /* Copy the buffer from nextline to the end, then from 0 to nextline */
+    for (index = 0 ; index < MAX_RECORDS ; index++) {
+        int slot = (nextline + index) % MAX_RECORDS;
+        const char *line = historycache[slot];
+        if (!line)
+            continue;
+        slotinfo[slot].exportoff = -1;
+        if (skip-- > 0)
+            continue;
+        line = history_slot_line(slot, buffer);
+        if (write(fd, line, strlen(line)) != (int)strlen(line)) {
             close(fd);
             return -errno;
         }
+        slotinfo[slot].exportoff = offset;
+        offset += strlen(line);
+        count++;
     }
     close(fd);
+    exportlines = count;
     return 0;
 }
 
+/* Adds a line to the history. history_lock shall be held */
+static int add_history_line(char *newline) {
+    int res, slot, offset;
+
+    if ( !file_exists(HISTORY_FILE) ) {
+        free_history_cache();
+        if ( (res = cache_history_file()) < 0 ) {
+            LOGE("%s: Cannot reset history cache %s - %s.\n", __FUNCTION__,
+                HISTORY_FILE, strerror(-res));
+            return res;
+        }
+    } else if ( nextline < 0 && (res = cache_history_file()) < 0  ) {
+        LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
+            HISTORY_FILE, strerror(-res));
+        return res;
+    }
+
+    /* A single record write whatever the history size */
+    if ( (res = write_history_record(lastseq + 1, newline)) < 0 ) {
+        LOGE("%s: Cannot write the record in %s - %s.\n", __FUNCTION__,
+            HISTORY_RING_FILE, strerror(-res));
+        return res;
+    }
+    lastseq++;
+    slot = nextline;
+    if (historycache[slot]) {
+        unindex_history_slot(slot);
+        release_history_line(slot);
+    }
+    nextline = lastseq % MAX_RECORDS;
+    if ( (historycache[slot] = store_history_line(newline)) == NULL) {
+        newline[strlen(newline) - 1] = 0; /*Remove trailing character for display purpose*/
+        LOGE("%s: Cannot copy the line %s - %s.\n", __FUNCTION__,
+            newline, strerror(ENOMEM));
+        return -ENOMEM;
+    }
+    index_history_slot(slot);
+
+    if ( exportlines >= HISTORY_EXPORT_MAX ) {
+        /* The export is full, only keep the newest events */
+        LOGD("%s : History export is full, regenerate it\n", __FUNCTION__);
+        return export_history_file(HISTORY_EXPORT_MAX - HISTORY_EXPORT_SLACK);
+    }
+    /* We can just write the new line at the end of the export */
+    offset = get_file_size(HISTORY_FILE);
+    res = append_file(HISTORY_FILE, newline);
+    if (res > 0) {
+        slotinfo[slot].exportoff = offset;
+        exportlines++;
+        return 0;
+    }
+    newline[strlen(newline) - 1] = 0; /*Remove trailing character for display purpose*/
+    LOGE("%s: Cannot append the line %s to %s- %s.\n", __FUNCTION__,
+        newline, HISTORY_FILE, strerror(-res));
+    return res;
+}
+
+int update_history_file(struct history_entry *entry) {
+    char newline[MAXLINESIZE];
+    int res;
+
+    if (!entry || !entry->key ||
+            !entry->eventtime)
+        return -EINVAL;
+
+    entry_to_history_line(entry, newline);
+
+    if (newline[0] == 0) {
+        LOGE("%s: Cannot build the history line for entry %s - %s.\n",
+            __FUNCTION__, entry->key, strerror(errno));
+        return -errno;
+    }
+
+    pthread_mutex_lock(&history_lock);
+    res = add_history_line(newline);
+    pthread_mutex_unlock(&history_lock);
+    return res;
+}
+
 int uptime_history() {
     FILE *to;
     int res;
     char name[32];
+    char line[MAXLINESIZE];
     const char *datelong = get_current_time_long(1);
+
+    /* The first line is also rewritten by the uptime updates */
+    pthread_mutex_lock(&history_lock);
     to = fopen(HISTORY_FILE, "r");
     if (to == NULL) {
         res = errno;
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Cannot open %s - %s\n", __FUNCTION__,
-            HISTORY_FILE, strerror(errno));
+            HISTORY_FILE, strerror(res));
         return -res;
     }
     fscanf(to, "#V1.0 %16s%24s\n", name, lastbootuptime);
     fclose(to);
     if (memcmp(name, "CURRENTUPTIME", sizeof("CURRENTUPTIME"))) {
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Bad first line; cannot continue\n",
             __FUNCTION__);
         return -1;
@@ -310,16 +884,18 @@ int uptime_history() {
     to = fopen(HISTORY_FILE, "r+");
     if (to == NULL) {
         res = errno;
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Cannot reopen %s - %s\n", __FUNCTION__,
-            HISTORY_FILE, strerror(errno));
+            HISTORY_FILE, strerror(res));
         return -res;
     }
     fprintf(to, HISTORY_BLANK_LINE1);
-    strcpy(name, PER_UPTIME);
-    fseek(to, 0, SEEK_END);
-    fprintf(to, "%-8s00000000000000000000  %-20s%s\n", name, datelong, lastbootuptime);
     fclose(to);
-    return 0;
+    strcpy(name, PER_UPTIME);
+    snprintf(line, sizeof(line), "%-8s00000000000000000000  %-20s%s\n", name, datelong, lastbootuptime);
+    res = add_history_line(line);
+    pthread_mutex_unlock(&history_lock);
+    return res;
 }
 
 /**
@@ -328,14 +904,19 @@ int uptime_history() {
 */
 int reset_uptime_history() {
     FILE *to;
+    int idx;
+    pthread_mutex_lock(&history_lock);
     if ( nextline < 0 && cache_history_file() < 0) {
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
             HISTORY_FILE, strerror(errno));
         return -errno;
     }
 
+    /* The cached events are kept, only the text export restarts */
     to = fopen(HISTORY_FILE, "w");
     if (to == NULL) {
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Cannot open %s - %s.\n", __FUNCTION__,
             HISTORY_FILE, strerror(errno));
         return -errno;
@@ -343,6 +924,10 @@ int reset_uptime_history() {
     fprintf(to, HISTORY_BLANK_LINE1);
     fprintf(to, HISTORY_BLANK_LINE2);
     fclose(to);
+    exportlines = 0;
+    for (idx = 0 ; idx < MAX_RECORDS ; idx++)
+        slotinfo[idx].exportoff = -1;
+    pthread_mutex_unlock(&history_lock);
 
     /* create uptime file */
     to = fopen(HISTORY_UPTIME, "w");
@@ -357,21 +942,27 @@ int reset_uptime_history() {
 
 int history_has_event(char *eventdir) {
 
-    int idx;
+    int len, res = 0;
     if (!eventdir) return -EINVAL;
 
+    pthread_mutex_lock(&history_lock);
     if ( nextline < 0 && cache_history_file() < 0) {
+        res = -errno;
+        pthread_mutex_unlock(&history_lock);
         LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
-            HISTORY_FILE, strerror(errno));
-        return -errno;
+            HISTORY_FILE, strerror(-res));
+        return res;
     }
 
-    for (idx = 0 ; idx < MAX_RECORDS ; idx ++) {
-        if (historycache[idx] &&
-                strstr(historycache[idx], eventdir) != NULL)
-            return 1;
-    }
-    return 0;
+    /* eventdir is either an event ID or a log directory */
+    len = strlen(eventdir);
+    while (len > 1 && eventdir[len - 1] == '/')
+        len--;
+    if (history_index_lookup(idindex, eventdir, len) >= 0 ||
+            history_index_lookup(dirindex, eventdir, len) >= 0)
+        res = 1;
+    pthread_mutex_unlock(&history_lock);
+    return res;
 }
 
 void clean_fake_property() {
@@ -396,7 +987,7 @@ void clean_fake_property() {
                 // decrease countdown
                 fake_prop_countdown--;
                 if (fake_prop_countdown <=0){
-                    property_set(PROP_REPORT_FAKE,"");
+                    propcache_set(PROP_REPORT_FAKE,"");
                     strcpy(lastfakeprop, "");
                 }
                 sprintf(str, "%d", fake_prop_countdown);
@@ -451,6 +1042,110 @@ int add_uptime_event() {
     return 0;
 }
 
+/* Returns the sequence number of the event cached in slot. history_lock shall be held */
+static unsigned int history_slot_seq(int slot) {
+    return lastseq - (((lastseq - 1) % MAX_RECORDS) - slot + MAX_RECORDS) % MAX_RECORDS;
+}
+
+/**
+ * @brief Marks the crash event of slot as deleted and removes its log directory
+ *
+ * The event type is overwritten in place in the cache, the ring and the text
+ * export. history_lock shall be held.
+ *
+ * @return 1 if the event was a crash, 0 otherwise.
+ */
+static int delete_history_crash(int slot) {
+    char crashdir[MAXLINESIZE];
+    char buffer[MAXLINESIZE];
+    char *line = historycache[slot];
+    int fd;
+
+    if (!line || strncmp(line, "CRASH ", 6))
+        return 0;
+
+    memcpy(line, "DELETE", 6);
+    if (write_history_record(history_slot_seq(slot), history_slot_line(slot, buffer)) < 0)
+        LOGE("%s: Cannot update %s - %s.\n", __FUNCTION__,
+            HISTORY_RING_FILE, strerror(errno));
+    if (slotinfo[slot].exportoff >= 0) {
+        fd = open(HISTORY_FILE, O_WRONLY);
+        if (fd < 0 || pwrite(fd, "DELETE", 6, slotinfo[slot].exportoff) != 6)
+            LOGE("%s: Cannot update %s - %s.\n", __FUNCTION__,
+                HISTORY_FILE, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+    }
+    if (slotinfo[slot].diroff >= 0) {
+        snprintf(crashdir, sizeof(crashdir), "%.*s", slotinfo[slot].dirlen,
+            line + slotinfo[slot].diroff);
+        rmfr_deferred(crashdir);
+    }
+    return 1;
+}
+
+/**
+ * @brief Sets the number of events folded into the event key
+ *
+ * The repeat field of the event line is updated in the ring and in the text
+ * export. As the field has a fixed width, the export line is patched in
+ * place once it holds the field. The field is added in place only when the
+ * line is the last one of the export; otherwise the line is left as is until
+ * the next regeneration of the export, so a crash loop never rewrites it.
+ *
+ * @return 0 on success, -ENOENT if the event is no longer in the history,
+ * another negative errno value otherwise.
+ */
+int update_history_repeat(const char *key, unsigned int repeat) {
+    char buffer[MAXLINESIZE];
+    const char *line;
+    int slot, fd, len, oldlen = -1, res = 0;
+    off_t size;
+
+    if (!key) return -EINVAL;
+
+    pthread_mutex_lock(&history_lock);
+    if ( nextline < 0 && (res = cache_history_file()) < 0) {
+        pthread_mutex_unlock(&history_lock);
+        LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
+            HISTORY_FILE, strerror(-res));
+        return res;
+    }
+    slot = history_index_lookup(idindex, key, strlen(key));
+    if (slot < 0) {
+        pthread_mutex_unlock(&history_lock);
+        return -ENOENT;
+    }
+
+    if (slotinfo[slot].exportoff >= 0)
+        oldlen = strlen(history_slot_line(slot, buffer));
+    slotinfo[slot].repeat = repeat;
+    line = history_slot_line(slot, buffer);
+    len = strlen(line);
+
+    if ((res = write_history_record(history_slot_seq(slot), line)) < 0)
+        LOGE("%s: Cannot update %s - %s.\n", __FUNCTION__,
+            HISTORY_RING_FILE, strerror(-res));
+
+    size = get_file_size(HISTORY_FILE);
+    if (oldlen == len || (oldlen >= 0 && slotinfo[slot].exportoff + oldlen == size)) {
+        fd = open(HISTORY_FILE, O_WRONLY);
+        if (fd < 0 || pwrite(fd, line, len, slotinfo[slot].exportoff) != len ||
+                (oldlen != len && ftruncate(fd, slotinfo[slot].exportoff + len) < 0))
+            res = -errno;
+        if (fd >= 0)
+            close(fd);
+    } else {
+        /* Deferred to the next regeneration of the export */
+        slotinfo[slot].exportoff = -1;
+    }
+    pthread_mutex_unlock(&history_lock);
+    if (res < 0)
+        LOGE("%s: Cannot update %s - %s.\n", __FUNCTION__,
+            HISTORY_FILE, strerror(-res));
+    return res;
+}
+
 /**
 * Name          : update_history_on_cmd_delete
 * Description   : This function updates the history_event on a CMDDELETE command
@@ -461,43 +1156,42 @@ int add_uptime_event() {
 *   char *events          -> chain containing events separated by comma
 **/
 int update_history_on_cmd_delete(char *events) {
-    char **events_list = NULL, crashdir[MAXLINESIZE], line[MAXLINESIZE], eventid[SHA1_DIGEST_LENGTH+1];
-    int nbpatterns, maxpatterns = 10, maxpatternsize = 48, res, idx;
-    FILE *fd;
-    fd = fopen(HISTORY_FILE, "r+");
-    if (!fd) {
-        LOGE("%s: Unable to open %s - %s\n",
-            __FUNCTION__, HISTORY_FILE, strerror(errno));
-        return -1;
-    }
+    char **events_list = NULL;
+    int nbpatterns, maxpatterns = 10, maxpatternsize = 48, idx, slot;
+
     /* Get events list from input events comma chain*/
     events_list = commachain_to_fixedarray(events, maxpatternsize, maxpatterns, &nbpatterns);
     if (nbpatterns <= 0) {
         LOGE("%s: Not patterns found in %s... stop the operation\n",
             __FUNCTION__, events);
-        fclose(fd);
         return -1;
     }
-    /*read each line of history file and check if event id matches one of the list*/
-    while (freadline(fd, line) > 0) {
-        res = sscanf(line, "CRASH %s %*s %*s %s\n", eventid, crashdir);
-        if (res == 2) {
-            /* Found a crash line, check the patterns */
-            for (idx = 0 ; idx < nbpatterns ; idx++)
-                if (strstr(eventid, events_list[idx])) {
-                    fseek(fd, -strlen(line), SEEK_CUR);
-                    fwrite("DELETE", 1, 6, fd);
-                    fseek(fd, strlen(line)-6, SEEK_CUR);
-                    rmfr(crashdir);
-                }
+
+    pthread_mutex_lock(&history_lock);
+    if ( nextline < 0 && cache_history_file() < 0) {
+        LOGE("%s: Cannot cache %s - %s.\n", __FUNCTION__,
+            HISTORY_FILE, strerror(errno));
+    } else {
+        for (idx = 0 ; idx < nbpatterns ; idx++) {
+            slot = history_index_lookup(idindex, events_list[idx], strlen(events_list[idx]));
+            if (slot >= 0) {
+                delete_history_crash(slot);
+                continue;
+            }
+            /* Not a full event ID : check every cached event */
+            for (slot = 0 ; slot < MAX_RECORDS ; slot++) {
+                if (historycache[slot] && strstr(slotinfo[slot].id, events_list[idx]))
+                    delete_history_crash(slot);
+            }
         }
     }
+    pthread_mutex_unlock(&history_lock);
+
     /*free allocated resources*/
     for (idx = 0 ; idx < maxpatterns ; idx++) {
         free(events_list[idx]);
     }
     free(events_list);
-    fclose(fd);
     return 0;
 }
 
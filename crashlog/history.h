@@ -22,6 +22,11 @@
  * This file contains the functions to handle the history file and the uptime event.
  * A circular buffer locally defined has its content synchronized on the history file
  * content.
+ * The event lines of the history file are made of space separated fields:
+ * EVENT ID DATE TYPE followed by the event data or log directory. A crash
+ * with repeats folded into it (see storm.h) gets a last "REPEAT=<n>" field,
+ * n being written on 10 digits, so the parsers of the history file shall
+ * ignore a last field starting with "REPEAT=".
  */
 
 #ifndef __HISTORY__H__
@@ -49,6 +54,7 @@ int history_has_event(char *eventdir);
 int reset_history_cache();
 int add_uptime_event();
 int update_history_on_cmd_delete(char *events);
+int update_history_repeat(const char *key, unsigned int repeat);
 int process_uptime_event(struct watch_entry *entry, struct inotify_event *event);
 
 #endif /* __HISTORY__H__ */
@@ -24,9 +24,11 @@
  * The watcher initialization is performed with a local array containing every
  * kind of watched events. Each event is linked to a directory to be watched and linked
  * to a specific callback processing function.
- * Each time the inotify watcher file descriptor is set, the buffer is read to
- * treat each event it contains. When an event can't be processed normally the
- * buffer content not yet read is dumped and flushed to LOG.
+ * Each time the inotify watcher file descriptor is set, it is read by large
+ * batches until empty and each event is handled in place. When an event can't
+ * be processed normally the batch content is dumped and flushed to LOG.
+ * When the kernel queue overflows, the watched directories are rescanned so
+ * the files whose events were dropped are still processed.
  *
  */
 
@@ -36,10 +38,16 @@
 #include "dropbox.h"
 #include "modem.h"
 #include "config_handler.h"
+#include "workqueue.h"
+#include "patmatch.h"
+#include "admission.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -83,6 +91,127 @@ struct watch_entry wd_array[] = {
     {0, MDMCRASH_DIR_MASK,  MRST_TYPE,      0,      MRST_EVNAME,        LOGS_MODEM_DIR,     "mreset.txt",               NULL},
 };
 
+/* Size of the watch descriptor dispatch table, a power of 2 well above the
+ * number of wd_array entries */
+#define WD_DISPATCH_SIZE    64
+
+/* Watched entries of a watch descriptor, the patterns of the entries are
+ * compiled so a file name is matched in one pass */
+struct wd_dispatch {
+    int wd;
+    int count;
+    struct watch_entry *entries[DIM(wd_array)];
+    struct watch_entry *file_entry;     /* entry of a watched file */
+    struct watch_entry *modem_entry;    /* entry of the modem logs directory */
+    struct patmatch *matcher;
+};
+
+static struct wd_dispatch dispatch_table[WD_DISPATCH_SIZE];
+
+/* Files handled since the kernel queue was last seen empty, to skip them
+ * during an overflow rescan */
+static uint32_t seen_events[INOTIFY_SEEN_EVENTS];
+static int seen_count = 0;
+/* Time at which the kernel queue was last seen empty, read from the clock
+ * used for the file timestamps */
+static struct timespec drained_time;
+/* Set when the worker pool refused an event, to replay it at the next drain */
+static int replay_pending = 0;
+
+/* The kernel stamps the files with the coarse clock : a file written after
+ * the drain can't be older than the drain time */
+static void get_drain_time(struct timespec *ts) {
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, ts) == 0)
+        return;
+#endif
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static struct inotify_stats stats;
+static time_t rate_start = 0;
+static unsigned long rate_events = 0;
+static time_t report_time = 0;
+
+static struct wd_dispatch *get_wd_dispatch(int wd) {
+    unsigned int idx = (unsigned int)wd % WD_DISPATCH_SIZE;
+
+    if (wd <= 0)
+        return NULL;
+    while (dispatch_table[idx].wd) {
+        if (dispatch_table[idx].wd == wd)
+            return &dispatch_table[idx];
+        idx = (idx + 1) % WD_DISPATCH_SIZE;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Builds the dispatch table of the wd_array watches
+ *
+ * Shall be called each time the watch descriptors of wd_array are updated.
+ */
+static void build_dispatch_table() {
+    const char *patterns[DIM(wd_array)];
+    struct wd_dispatch *dispatch;
+    unsigned int slot;
+    int idx, i;
+
+    for (slot = 0 ; slot < WD_DISPATCH_SIZE ; slot++)
+        patmatch_free(dispatch_table[slot].matcher);
+    memset(dispatch_table, 0, sizeof(dispatch_table));
+
+    for (idx = 0 ; idx < (int)DIM(wd_array) ; idx++) {
+        if (wd_array[idx].wd <= 0)
+            continue;
+        dispatch = get_wd_dispatch(wd_array[idx].wd);
+        if (!dispatch) {
+            slot = (unsigned int)wd_array[idx].wd % WD_DISPATCH_SIZE;
+            while (dispatch_table[slot].wd)
+                slot = (slot + 1) % WD_DISPATCH_SIZE;
+            dispatch = &dispatch_table[slot];
+            dispatch->wd = wd_array[idx].wd;
+        }
+        dispatch->entries[dispatch->count++] = &wd_array[idx];
+        if (!dispatch->file_entry && !wd_array[idx].eventpattern)
+            dispatch->file_entry = &wd_array[idx];
+        if (!dispatch->modem_entry && strstr(LOGS_MODEM_DIR, wd_array[idx].eventpath))
+            dispatch->modem_entry = &wd_array[idx];
+    }
+
+    for (slot = 0 ; slot < WD_DISPATCH_SIZE ; slot++) {
+        dispatch = &dispatch_table[slot];
+        if (!dispatch->wd)
+            continue;
+        for (i = 0 ; i < dispatch->count ; i++)
+            patterns[i] = dispatch->entries[i]->eventpattern;
+        dispatch->matcher = patmatch_compile(patterns, dispatch->count);
+        if (!dispatch->matcher)
+            LOGE("%s: Cannot compile the patterns of wd %d, use slow matching\n",
+                __FUNCTION__, dispatch->wd);
+    }
+}
+
+static struct watch_entry *get_event_entry(int wd, char *eventname) {
+    struct wd_dispatch *dispatch = get_wd_dispatch(wd);
+    int idx;
+
+    if ( !dispatch )
+        return NULL;
+    if ( !eventname )
+        return dispatch->file_entry;
+    if ( dispatch->matcher ) {
+        idx = patmatch_first(dispatch->matcher, eventname);
+        return (idx < 0 ? NULL : dispatch->entries[idx]);
+    }
+    for (idx = 0 ; idx < dispatch->count ; idx++) {
+        if ( dispatch->entries[idx]->eventpattern &&
+                strstr(eventname, dispatch->entries[idx]->eventpattern) )
+            return dispatch->entries[idx];
+    }
+    return NULL;
+}
+
 int set_watch_entry_callback(unsigned int watch_type, inotify_callback pcallback) {
 
     if ( watch_type >= DIM(wd_array) ) {
@@ -157,6 +286,8 @@ int init_inotify_handler() {
     }
     //add generic watch here
     generic_add_watch(g_first_modem_config, fd);
+    build_dispatch_table();
+    get_drain_time(&drained_time);
 
     return fd;
 }
@@ -256,20 +387,6 @@ void build_crashenv_dir_list_option( char crashenv_param[PATHMAX] ) {
     return;
 }
 
-static struct watch_entry *get_event_entry(int wd, char *eventname) {
-    int idx;
-    for (idx = 0 ; idx < (int)DIM(wd_array) ; idx++) {
-        if ( wd_array[idx].wd == wd ) {
-            if ( !eventname && !wd_array[idx].eventpattern )
-                return &wd_array[idx];
-            if ( eventname &&
-                    strstr(eventname, wd_array[idx].eventpattern) )
-                return &wd_array[idx];
-        }
-    }
-    return NULL;
-}
-
 /**
  * @brief Show the contents of an array of inotify_events
  * Called when a problem occurred during the parsing of
@@ -278,10 +395,10 @@ static struct watch_entry *get_event_entry(int wd, char *eventname) {
  * @param buffer: buffer containing the inotify events
  * @param len: length of the buffer
  */
-static void dump_inotify_events(char *buffer, unsigned int len,
-    char *lastevent) {
+static void dump_inotify_events(char *buffer, unsigned int len) {
 
     struct inotify_event *event;
+    char *ptr;
     int i;
 
     LOGD("%s: Dump the wd_array:\n", __FUNCTION__);
@@ -289,204 +406,323 @@ static void dump_inotify_events(char *buffer, unsigned int len,
         LOGD("%s: wd_array[%d]: filename=%s, wd=%d\n", __FUNCTION__, i, wd_array[i].eventpath, wd_array[i].wd);
     }
 
-    while (1) {
-        if (len == 0) {
-            /* End of the buffer */
+    for (ptr = buffer ; ptr < buffer + len ; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (struct inotify_event *)ptr;
+        LOGD("%s: event received (name=%s, wd=%d, mask=0x%x, len=%d)\n", __FUNCTION__,
+            (event->len ? event->name : ""), event->wd, event->mask, event->len);
+    }
+}
+
+static uint32_t hash_event(int wd, const char *name) {
+    uint32_t hash = 2166136261U ^ (uint32_t)wd;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    /* 0 marks a free entry */
+    return hash ? hash : 1;
+}
+
+/* Returns 1 if the file was already handled since the last drain, else
+ * records it if record is set and returns 0 */
+static int check_seen_event(int wd, const char *name, int record) {
+    uint32_t hash = hash_event(wd, name);
+    unsigned int idx = hash % INOTIFY_SEEN_EVENTS;
+
+    while (seen_events[idx]) {
+        if (seen_events[idx] == hash)
+            return 1;
+        idx = (idx + 1) % INOTIFY_SEEN_EVENTS;
+    }
+    /* Keep a free entry to stop the probing */
+    if (record && seen_count < INOTIFY_SEEN_EVENTS - 1) {
+        seen_events[idx] = hash;
+        seen_count++;
+    }
+    return 0;
+}
+
+static void rescan_watched_dirs();
+
+static void mark_queue_drained() {
+    /* Replay the events the workers couldn't take, from the previous drain */
+    if (replay_pending) {
+        replay_pending = 0;
+        rescan_watched_dirs();
+        if (replay_pending)
             return;
-        }
-        event = (struct inotify_event*)buffer;
-        if (len < sizeof(struct inotify_event) ||
-            len < (sizeof(struct inotify_event) + event->len)) {
-            /* Not enought room the last event,
-             * get it from the lastevent */
-            event = (struct inotify_event*)lastevent;
-            if (!event->wd && !event->mask && !event->cookie && !event->len)
-                // no last event
-                return;
-        } else {
-            buffer += sizeof(struct inotify_event) + event->len;
-            len -= sizeof(struct inotify_event) + event->len;
-        }
-        LOGD("%s: event received (name=%s, wd=%d, mask=0x%x, len=%d)\n", __FUNCTION__, event->name, event->wd, event->mask, event->len);
+    }
+    if (seen_count) {
+        memset(seen_events, 0, sizeof(seen_events));
+        seen_count = 0;
+    }
+    get_drain_time(&drained_time);
+}
+
+static void count_events(unsigned long count) {
+    time_t now = time(NULL);
+
+    stats.events += count;
+    rate_events += count;
+    if (now - rate_start >= INOTIFY_RATE_PERIOD) {
+        if (rate_start)
+            stats.rate = rate_events / (now - rate_start);
+        rate_start = now;
+        rate_events = 0;
+    }
+    if (now - report_time >= INOTIFY_REPORT_PERIOD) {
+        LOGI("%s: inotify events: %lu (%u/s), overflows: %lu, replayed files: %lu\n",
+            __FUNCTION__, stats.events, stats.rate, stats.overflows, stats.rescanned);
+        report_time = now;
     }
 }
 
 /**
- * @brief Handle inotify events
- *
- * Calls the callcbacks
+ * @brief Gets the inotify watcher counters
  *
- * @param files nb max of logs destination directories (crashlog,
- * aplogs, bz... )
+ * @param out: filled with the current counters
+ */
+void get_inotify_stats(struct inotify_stats *out) {
+    *out = stats;
+}
+
+/* Hands a file event over to the worker pool, or processes it right now
+ * when the pool is not running. Events over budget are only recorded, the
+ * ones the pool can't take are left for a replay. The replayed files were
+ * missed, not flooding: they are not subject to admission */
+static int dispatch_event(struct watch_entry *entry, struct inotify_event *event, int replay) {
+    char path[PATHMAX];
+    e_admit_class_t class;
+    int res;
+
+    if ( !entry->pcallback )
+        return 0;
+    class = admission_class_of_type(entry->eventtype);
+    if ( !replay && !admit_event(ADMIT_SRC_INOTIFY, class, NULL, entry->eventname) ) {
+        if ( event->len )
+            check_seen_event(event->wd, event->name, 1);
+        /* Don't let the dropped triggers pile up in the stats directory */
+        if ( event->len && (class == ADMIT_CLASS_STATS || class == ADMIT_CLASS_INFO
+                || class == ADMIT_CLASS_ERROR) && entry->eventtype != APLOGTRIG_TYPE ) {
+            snprintf(path, sizeof(path), "%s/%s", entry->eventpath, event->name);
+            remove(path);
+        }
+        return 0;
+    }
+    res = workqueue_push(entry, event);
+    if ( res == -EAGAIN ) {
+        /* The file is left for a replay, not to block the monitor thread */
+        replay_pending = 1;
+        return 0;
+    }
+    if ( event->len )
+        check_seen_event(event->wd, event->name, 1);
+    if ( res == -ENODEV && entry->pcallback(entry, event) < 0 ) {
+        LOGE("%s: Can't handle the event %s...\n", __FUNCTION__,
+            (event->len ? event->name : "empty event"));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handles one inotify event
  *
  * @return 0 on success, -1 on error.
  */
-int receive_inotify_events(int inotify_fd) {
-    int len = 0, orig_len, idx, wd, missing_bytes;
-    char orig_buffer[sizeof(struct inotify_event)+PATHMAX], *buffer, lastevent[sizeof(struct inotify_event)+PATHMAX];
-    struct inotify_event *event;
+static int handle_inotify_event(int inotify_fd, struct inotify_event *event) {
+    int idx, wd;
     struct watch_entry *entry;
+    struct wd_dispatch *dispatch;
+
+    /* First check the kind of the subject of this event (file or directory?) */
+    if (!(event->mask & IN_ISDIR)) {
+        /* event concerns a file into a watched directory */
+        entry = get_event_entry(event->wd, (event->len ? event->name : NULL));
+        if ( !entry ) {
+            /* Didn't find any entry for this event, check for
+             * a dropbox final event... */
+            if (event->len > 8 && !strncmp(event->name, "dropbox-", 8)) {
+                /* dumpstate is done so remove the watcher */
+                LOGD("%s: Received a dropbox event(%s)...",
+                    __FUNCTION__, event->name);
+                inotify_rm_watch(inotify_fd, event->wd);
+                finalize_dropbox_pending_event(event);
+                return 0;
+            }
+            /* Stray event... */
+            LOGD("%s: Can't handle the event \"%s\", no valid entry found, drop it...\n",
+                __FUNCTION__, (event->len ? event->name : "empty event"));
+            return 0;
+        }
+        return dispatch_event(entry, event, 0);
+    }
 
-    len = read(inotify_fd, orig_buffer, sizeof(orig_buffer));
-    if (len < 0) {
-        LOGE("%s: Cannot read file_monitor_fd, error is %s\n", __FUNCTION__, strerror(errno));
-        return -errno;
+    /*event concerns a watched directory itself */
+    dispatch = get_wd_dispatch(event->wd);
+    /* Manage case where a watched directory is deleted*/
+    if ( event->mask & (IN_DELETE_SELF | IN_MOVE_SELF) ) {
+        /* Recreate the dir and reinstall the watch */
+        entry = (dispatch ? dispatch->entries[0] : NULL);
+        if ( entry && entry->eventpath ) {
+            mkdir(entry->eventpath, 0777); /* TO DO : restoring previous rights/owner/group ?*/
+            inotify_rm_watch(inotify_fd, event->wd);
+            wd = inotify_add_watch(inotify_fd, entry->eventpath, entry->eventmask);
+            if ( wd < 0 ) {
+                LOGE("Can't add watch for %s.\n", entry->eventpath);
+                return -1;
+            }
+            LOGW("%s: watched directory %s : \'%s\' has been created and snooped",__FUNCTION__,
+                    (event->mask & (IN_DELETE_SELF) ? "deleted" : "moved"), entry->eventpath);
+            /* if the watch was duplicated, set it for all the entries */
+            for (idx = 0 ; idx < dispatch->count ; idx++)
+                dispatch->entries[idx]->wd = wd;
+            build_dispatch_table();
+        }
+        /* Do nothing more on directory events */
+        return 0;
     }
 
-    buffer = &orig_buffer[0];
-    orig_len = len;
-    event = (struct inotify_event *)buffer;
+    /* for modem generic */
+    /* TO IMPROVE : change flag management and put this in main loop */
+    if (dispatch && dispatch->modem_entry && generic_match(event->name, g_first_modem_config))
+        process_modem_generic(dispatch->modem_entry, event, inotify_fd);
+    pconfig check_config = generic_match_by_wd(event->name, g_first_modem_config, event->wd);
+    if(check_config){
+            process_modem_generic( &check_config->wd_config, event, inotify_fd);
+    }else{
+        LOGE("%s: Directory not catched %s.\n", __FUNCTION__, event->name);
+    }
+    /* Do nothing more on directory events */
+    return 0;
+}
 
-    /* Preinitialize lastevent (in case it was not used so it is not dumped) */
-    ((struct inotify_event *)lastevent)->wd = 0;
-    ((struct inotify_event *)lastevent)->mask = 0;
-    ((struct inotify_event *)lastevent)->cookie = 0;
-    ((struct inotify_event *)lastevent)->len = 0;
+/**
+ * @brief Replays the files of the watched directories after an overflow
+ *
+ * The kernel dropped events when its queue overflowed: every file of the
+ * watched directories modified since the queue was last seen empty and not
+ * handled yet is processed as if it had just been written.
+ */
+static void rescan_watched_dirs() {
+    union {
+        struct inotify_event event;
+        char buffer[sizeof(struct inotify_event) + PATHMAX];
+    } ev;
+    char path[PATHMAX];
+    const char *dirpath;
+    struct watch_entry *entry;
+    struct wd_dispatch *dispatch;
+    struct dirent *de;
+    struct stat info;
+    DIR *d;
+    unsigned int slot;
+    size_t len;
+    unsigned long count = 0;
+
+    if (seen_count == INOTIFY_SEEN_EVENTS - 1)
+        LOGW("%s: too many events since last drain, files may be processed twice\n",
+            __FUNCTION__);
+
+    for (slot = 0 ; slot < WD_DISPATCH_SIZE ; slot++) {
+        dispatch = &dispatch_table[slot];
+        /* Only the directories matching files are replayed */
+        if (!dispatch->wd || dispatch->file_entry)
+            continue;
+        dirpath = dispatch->entries[0]->eventpath;
 
-    while (1) {
-        if (len == 0) {
-            /* End of the events to read */
-            return 0;
+        if ((d = opendir(dirpath)) == NULL) {
+            LOGE("%s: Cannot open %s - %s\n", __FUNCTION__, dirpath, strerror(errno));
+            continue;
         }
-        if ((unsigned int)len < sizeof(struct inotify_event)) {
-            /* Not enough room for an empty event */
-            LOGI("%s: incomplete inotify_event received (%d bytes), complete it\n", __FUNCTION__, len);
-            /* copy the last bytes received */
-            if( (unsigned int)len <= sizeof(lastevent) )
-                memcpy(lastevent, buffer, len);
-            else {
-                LOGE("%s: Cannot copy buffer\n", __FUNCTION__);
-                return -1;
-            }
-            /* read the missing bytes to get the full length */
-            missing_bytes = (int)sizeof(struct inotify_event)-len;
-            if(((int) len + missing_bytes) < ((int)sizeof(lastevent))) {
-                if (read(inotify_fd, &lastevent[len], missing_bytes) != missing_bytes ){
-                    LOGE("%s: Cannot complete the last inotify_event received (structure part) - %s\n", __FUNCTION__, strerror(errno));
-                    return -1;
-                }
-            }
-            else {
-                LOGE("%s: Cannot read missing bytes, not enought space in lastevent\n", __FUNCTION__);
-                return -1;
-            }
-            event = (struct inotify_event*)lastevent;
-            /* now, reads the full last event, including its name field */
-            if ( read(inotify_fd, &lastevent[sizeof(struct inotify_event)],
-                event->len) != (int)event->len) {
-                LOGE("%s: Cannot complete the last inotify_event received (name part) - %s\n",
-                    __FUNCTION__, strerror(errno));
-                return -1;
-            }
-            len = 0;
-            /* now, the last event is complete, we can continue the parsing */
-        } else if ( (unsigned int)len < sizeof(struct inotify_event) + event->len ) {
-            int res, missing_bytes = (int)sizeof(struct inotify_event) + event->len - len;
-            event = (struct inotify_event*)lastevent;
-            /* The event was truncated */
-            LOGI("%s: truncated inotify_event received (%d bytes missing), complete it\n", __FUNCTION__, missing_bytes);
-
-            /* Robustness : check 'lastevent' array size before reading inotify fd*/
-            if( (unsigned int)len > sizeof(lastevent) ) {
-                LOGE("%s: not enough space on array lastevent.\n", __FUNCTION__);
-                return -1;
-            }
-            /* copy the last bytes received */
-            memcpy(lastevent, buffer, len);
-            /* now, reads the full last event, including its name field */
-            res = read(inotify_fd, &lastevent[len], missing_bytes);
-            if ( res != missing_bytes ) {
-                LOGE("%s: Cannot complete the last inotify_event received (name part2); received %d bytes, expected %d bytes - %s\n",
-                    __FUNCTION__, res, missing_bytes, strerror(errno));
-                return -1;
-            }
-            len = 0;
-            /* now, the last event is complete, we can continue the parsing */
-        } else {
-            event = (struct inotify_event *)buffer;
-            buffer += sizeof(struct inotify_event) + event->len;
-            len -= sizeof(struct inotify_event) + event->len;
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            len = strlen(de->d_name) + 1;
+            if (len > PATHMAX)
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dirpath, de->d_name);
+            if (stat(path, &info) < 0 || !S_ISREG(info.st_mode) ||
+                    info.st_mtim.tv_sec < drained_time.tv_sec ||
+                    (info.st_mtim.tv_sec == drained_time.tv_sec &&
+                     info.st_mtim.tv_nsec < drained_time.tv_nsec))
+                continue;
+            entry = get_event_entry(dispatch->wd, de->d_name);
+            if (!entry || !entry->pcallback ||
+                    check_seen_event(dispatch->wd, de->d_name, 0))
+                continue;
+
+            ev.event.wd = dispatch->wd;
+            /* Found by the scan, the file may still be written */
+            ev.event.mask = IN_CREATE;
+            ev.event.cookie = 0;
+            ev.event.len = len;
+            memcpy(ev.event.name, de->d_name, len);
+            LOGI("%s: replay %s\n", __FUNCTION__, path);
+            dispatch_event(entry, &ev.event, 1);
+            count++;
         }
-        /* Handle the event read from the buffer*/
-        /* First check the kind of the subject of this event (file or directory?) */
-        if (!(event->mask & IN_ISDIR)) {
-            /* event concerns a file into a watched directory */
-            entry = get_event_entry(event->wd, (event->len ? event->name : NULL));
-            if ( !entry ) {
-                /* Didn't find any entry for this event, check for
-                 * a dropbox final event... */
-                if (event->len > 8 && !strncmp(event->name, "dropbox-", 8)) {
-                    /* dumpstate is done so remove the watcher */
-                    LOGD("%s: Received a dropbox event(%s)...",
-                        __FUNCTION__, event->name);
-                    inotify_rm_watch(inotify_fd, event->wd);
-                    finalize_dropbox_pending_event(event);
-                    continue;
-                }
-                /* Stray event... */
-                LOGD("%s: Can't handle the event \"%s\", no valid entry found, drop it...\n",
-                    __FUNCTION__, (event->len ? event->name : "empty event"));
+        closedir(d);
+    }
+    stats.rescanned += count;
+    LOGI("%s: %lu file(s) replayed\n", __FUNCTION__, count);
+}
+
+/**
+ * @brief Handle inotify events
+ *
+ * Reads the watcher by batches of events until its queue is empty (or
+ * INOTIFY_MAX_READS batches have been read) and calls the callbacks.
+ * The kernel only returns complete events so the events are handled in
+ * place in the read buffer.
+ *
+ * @param inotify_fd: non-blocking inotify watcher
+ *
+ * @return 0 once events have been handled, -EAGAIN if there was no event to
+ * read, -1 if an event could not be handled, another negative errno value on
+ * read error.
+ */
+int receive_inotify_events(int inotify_fd) {
+    static char buffer[INOTIFY_BUFFER_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    char *ptr;
+    int len, reads, res = 0;
+    unsigned long count;
+
+    for (reads = 0 ; reads < INOTIFY_MAX_READS ; reads++) {
+        len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len < 0) {
+            if (errno == EINTR)
                 continue;
+            if (errno == EAGAIN) {
+                /* Nothing left to read on a non-blocking watcher */
+                mark_queue_drained();
+                return (reads ? res : -EAGAIN);
             }
+            LOGE("%s: Cannot read file_monitor_fd, error is %s\n", __FUNCTION__, strerror(errno));
+            return -errno;
         }
-        /*event concerns a watched directory itself */
-        else {
-            entry = NULL;
-            /* Manage case where a watched directory is deleted*/
-            if ( event->mask & (IN_DELETE_SELF | IN_MOVE_SELF) ) {
-                /* Recreate the dir and reinstall the watch */
-                for (idx = 0 ; idx < (int)DIM(wd_array) ; idx++) {
-                    if ( wd_array[idx].wd == event->wd )
-                        entry = &wd_array[idx];
-                }
-                if ( entry && entry->eventpath ) {
-                    mkdir(entry->eventpath, 0777); /* TO DO : restoring previous rights/owner/group ?*/
-                    inotify_rm_watch(inotify_fd, event->wd);
-                    wd = inotify_add_watch(inotify_fd, entry->eventpath, entry->eventmask);
-                    if ( wd < 0 ) {
-                        LOGE("Can't add watch for %s.\n", entry->eventpath);
-                        return -1;
-                    }
-                    LOGW("%s: watched directory %s : \'%s\' has been created and snooped",__FUNCTION__,
-                            (event->mask & (IN_DELETE_SELF) ? "deleted" : "moved"), entry->eventpath);
-                    /* if the watch was duplicated, set it for all the entries */
-                    for (idx = 0 ; idx < (int)DIM(wd_array) ; idx++) {
-                        if (wd_array[idx].wd == event->wd)
-                            wd_array[idx].wd = wd;
-                    }
-                    /* Do nothing more on directory events */
-                    continue;
-                }
-            }
-            else {
-                for (idx = 0 ; idx < (int)DIM(wd_array) ; idx++) {
-                    if ( wd_array[idx].wd != event->wd )
-                        continue;
-                    entry = &wd_array[idx];
-                    /* for modem generic */
-                    /* TO IMPROVE : change flag management and put this in main loop */
-                    if(strstr(LOGS_MODEM_DIR, entry->eventpath) && (generic_match(event->name, g_first_modem_config))){
-                        process_modem_generic(entry, event, inotify_fd);
-                        break;
-                    }
-                }
-                pconfig check_config = generic_match_by_wd(event->name, g_first_modem_config, event->wd);
-                if(check_config){
-                        process_modem_generic( &check_config->wd_config, event, inotify_fd);
-                }else{
-                    LOGE("%s: Directory not catched %s.\n", __FUNCTION__, event->name);
-                }
-                /* Do nothing more on directory events */
+
+        count = 0;
+        for (ptr = buffer ; ptr < buffer + len ; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)ptr;
+            count++;
+            if (event->mask & IN_Q_OVERFLOW) {
+                stats.overflows++;
+                LOGE("%s: inotify queue overflow (%lu so far), rescan the watched directories\n",
+                    __FUNCTION__, stats.overflows);
+                rescan_watched_dirs();
                 continue;
             }
+            if (handle_inotify_event(inotify_fd, event) < 0) {
+                dump_inotify_events(buffer, len);
+                res = -1;
+            }
         }
-        if ( entry->pcallback && entry->pcallback(entry, event) < 0 ) {
-            LOGE("%s: Can't handle the event %s...\n", __FUNCTION__,
-                event->name);
-            dump_inotify_events(orig_buffer, orig_len, lastevent);
-            return -1;
-        }
+        count_events(count);
     }
 
-    return 0;
+    return res;
 }
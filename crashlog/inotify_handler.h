@@ -24,9 +24,11 @@
  * The watcher initialization is performed with a local array containing every
  * kind of watched events. Each event is linked to a directory to be watched and linked
  * to a specific callback processing function.
- * Each time the inotify watcher file descriptor is set, the buffer is read to
- * treat each event it contains. When an event can't be processed normally the
- * buffer content not yet read is dumped and flushed to LOG.
+ * Each time the inotify watcher file descriptor is set, it is read by large
+ * batches until empty and each event is handled in place. When an event can't
+ * be processed normally the batch content is dumped and flushed to LOG.
+ * When the kernel queue overflows, the watched directories are rescanned so
+ * the files whose events were dropped are still processed.
  *
  */
 
@@ -47,6 +49,18 @@
 #define MDMCRASH_DIR_MASK   (BASE_DIR_MASK)
 #define VBCRASH_DIR_MASK    (BASE_DIR_MASK|IN_CREATE)
 
+/* Size of the watcher read buffer, holds hundreds of events */
+#define INOTIFY_BUFFER_SIZE     (64 * 1024)
+/* Max number of buffers read in a row before giving a turn to other sources */
+#define INOTIFY_MAX_READS       16
+/* Max number of handled files remembered to skip them on overflow rescan,
+ * twice the default kernel queue size (fs.inotify.max_queued_events) */
+#define INOTIFY_SEEN_EVENTS     32768
+/* Period in seconds of the events rate computation */
+#define INOTIFY_RATE_PERIOD     10
+/* Period in seconds of the counters logging */
+#define INOTIFY_REPORT_PERIOD   3600
+
 struct watch_entry;
 
 /* The callback API is:
@@ -68,11 +82,19 @@ struct watch_entry {
     inotify_callback pcallback;
 };
 
+struct inotify_stats {
+    unsigned long events;       /* events read since the start */
+    unsigned long overflows;    /* kernel queue overflows */
+    unsigned long rescanned;    /* files replayed after an overflow */
+    unsigned int rate;          /* events/sec over the last period */
+};
+
 int init_inotify_handler();
 void handle_missing_watched_dir();
 int get_missing_watched_dir_nb();
 void build_crashenv_dir_list_option( char crashenv_param[PATHMAX] );
 int set_watch_entry_callback(unsigned int watch_type, inotify_callback pcallback);
 int receive_inotify_events(int inotify_fd);
+void get_inotify_stats(struct inotify_stats *out);
 
 #endif /* __INOTIFY_HANDLER_H__ */
@@ -40,6 +40,7 @@
 #include "fsutils.h"
 #include "crashutils.h"
 #include "kct_netlink.h"
+#include "admission.h"
 
 #define PROP_PREFIX "dev.log"
 #define BINARY_SUFFIX ".bin"
@@ -90,18 +91,22 @@ int kct_netlink_get_fd() {
     return sock_nl_fd;
 }
 
-void kct_netlink_handle_msg(void) {
+int kct_netlink_handle_msg(void) {
 
     struct kct_packet *msg;
 
     msg = netlink_get_packet(sock_nl_fd);
     if (msg == NULL) {
+        /* No more pending packet on the non-blocking socket */
+        if (errno == EAGAIN)
+            return -EAGAIN;
         LOGE("Could not receive kernel packet: %s", strerror(errno));
-        return;
+        return -errno;
     }
 
     handle_event(&msg->event);
     free(msg);
+    return 0;
 }
 
 static int netlink_sendto_kct(int fd, int type, const void *data,
@@ -185,6 +190,9 @@ static struct kct_packet *netlink_get_packet(int fd) {
     /* MSG_PEEK let the pkt in queue; MSG_TRUNK return full pkt length */
     len = recvfrom(fd, buf, sizeof(buf), MSG_PEEK|MSG_TRUNC,
             (struct sockaddr*)&nladdr, &nladdrlen);
+    if (len < 0)
+        /* errno is set by recvfrom */
+        return NULL;
     if ((size_t)len < sizeof(buf)) {
         if (len >= 0) {
             /* pop invalid packet from queue so we don't retrieve it later */
@@ -261,18 +269,15 @@ static void process_netlink_msg(struct ct_event *ev) {
     switch (ev->type) {
     case CT_EV_STAT:
         mode = MODE_STATS;
-        dir_mode = STATS_DIR;
         snprintf(name_event, sizeof(name_event), "%s", STATSEVENT);
         break;
     case CT_EV_INFO:
         mode = MODE_STATS;
-        dir_mode = STATS_DIR;
         snprintf(name_event, sizeof(name_event), "%s", INFOEVENT);
         break;
     case CT_EV_ERROR:
     case CT_EV_CRASH:
         mode = MODE_STATS;
-        dir_mode = STATS_DIR;
         snprintf(name_event, sizeof(name_event), "%s", ERROREVENT);
         break;
     case CT_EV_LAST:
@@ -286,7 +291,10 @@ static void process_netlink_msg(struct ct_event *ev) {
     /* Convert lower-case name into upper-case name */
     convert_name_to_upper_case(name);
 
-    dir = find_new_crashlog_dir(mode);
+    if (!admit_event(ADMIT_SRC_KCT, admission_class_of_event(name_event), name_event, name))
+        return;
+
+    dir = find_new_crashlog_dir(mode, &dir_mode);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         key = raise_event(name_event, name, NULL, NULL);
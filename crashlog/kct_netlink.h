@@ -24,6 +24,6 @@
 
 void kct_netlink_init_comm(void);
 int kct_netlink_get_fd();
-void kct_netlink_handle_msg(void);
+int kct_netlink_handle_msg(void);
 
 #endif /* __KCT_NETLINK_H__ */
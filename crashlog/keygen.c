@@ -0,0 +1,135 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file keygen.c
+ * @brief File containing the generation of the event keys.
+ */
+
+#include "keygen.h"
+#include "privconfig.h"
+
+#include <cutils/properties.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef CONFIG_CRYPTO_SHA1
+/* The SHA1_* API is deprecated, but not removed, by OpenSSL 3 */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+typedef SHA_CTX key_ctx_t;
+#define key_init(ctx)               SHA1_Init(ctx)
+#define key_update(ctx, data, len)  SHA1_Update(ctx, data, len)
+#define key_final(digest, ctx)      SHA1_Final(digest, ctx)
+#else
+typedef SHA1_CTX key_ctx_t;
+#define key_init(ctx)               SHA1Init(ctx)
+#define key_update(ctx, data, len)  SHA1Update(ctx, (unsigned char *)(data), len)
+#define key_final(digest, ctx)      SHA1Final(digest, ctx)
+#endif
+
+extern char gbuildversion[PROPERTY_VALUE_MAX];
+extern char guuid[256];
+
+/* State after hashing the build version and the uuid */
+static key_ctx_t prefix_ctx;
+static pthread_once_t prefix_once = PTHREAD_ONCE_INIT;
+/* Makes the keys generated within the same ns unique */
+static unsigned int key_sequence = 0;
+
+static void init_prefix(void) {
+    key_init(&prefix_ctx);
+    key_update(&prefix_ctx, gbuildversion, strlen(gbuildversion));
+    key_update(&prefix_ctx, guuid, strlen(guuid));
+}
+
+static long long get_time_ns(void) {
+    struct timespec ts;
+
+    /* Same clock as ANDROID_ALARM_ELAPSED_REALTIME, without opening
+     * /dev/alarm for each key */
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void finish_key(const key_ctx_t *base, long long time_ns,
+        unsigned int sequence, char *key) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[SHA1_DIGEST_LENGTH];
+    char suffix[32];
+    key_ctx_t ctx = *base;
+    int i, len;
+
+    len = snprintf(suffix, sizeof(suffix), "%lld-%u", time_ns, sequence);
+    key_update(&ctx, suffix, len);
+    key_final(digest, &ctx);
+    for (i = 0 ; i < KEY_LENGTH / 2 ; i++) {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 0xf];
+    }
+    key[KEY_LENGTH] = 0;
+}
+
+/**
+ * @brief Computes the key of a new event
+ *
+ * @param[out] key : buffer of KEY_LENGTH + 1 bytes
+ *
+ * @return 0 on success, -EINVAL on a missing parameter.
+ */
+int compute_key(char *key, const char *event, const char *type) {
+    key_ctx_t ctx;
+
+    if (!key || !event || !type) return -EINVAL;
+
+    pthread_once(&prefix_once, init_prefix);
+    ctx = prefix_ctx;
+    key_update(&ctx, event, strlen(event));
+    key_update(&ctx, type, strlen(type));
+    finish_key(&ctx, get_time_ns(), __sync_fetch_and_add(&key_sequence, 1), key);
+    return 0;
+}
+
+/**
+ * @brief Computes the keys of several events of the same event and type
+ *
+ * The event and the type are hashed once for the whole batch and the keys
+ * only differ by their sequence number.
+ *
+ * @return 0 on success, -EINVAL on a missing parameter.
+ */
+int compute_keys(event_key_t *keys, int count, const char *event, const char *type) {
+    key_ctx_t ctx;
+    long long time_ns;
+    unsigned int sequence;
+    int i;
+
+    if (!keys || count < 0 || !event || !type) return -EINVAL;
+
+    pthread_once(&prefix_once, init_prefix);
+    ctx = prefix_ctx;
+    key_update(&ctx, event, strlen(event));
+    key_update(&ctx, type, strlen(type));
+    time_ns = get_time_ns();
+    sequence = __sync_fetch_and_add(&key_sequence, count);
+    for (i = 0 ; i < count ; i++)
+        finish_key(&ctx, time_ns, sequence + i, keys[i]);
+    return 0;
+}
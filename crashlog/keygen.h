@@ -0,0 +1,43 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file keygen.h
+ * @brief File containing the generation of the event keys.
+ *
+ * A key is made of the first SHA1_DIGEST_LENGTH/2 bytes, in hexadecimal, of
+ * the SHA1 of the build version, the uuid, the event, the type, the uptime in
+ * ns and a sequence number. The hash of the build version and the uuid is
+ * computed once and its state is cloned for each key.
+ *
+ * The SHA1 of libcrypto, which uses the SHA instructions of the CPU when
+ * they exist, is used when built with CONFIG_CRYPTO_SHA1.
+ */
+
+#ifndef __KEYGEN_H__
+#define __KEYGEN_H__
+
+#include <sys/sha1.h>
+
+/* Length of a key, without the terminating null byte */
+#define KEY_LENGTH              SHA1_DIGEST_LENGTH
+
+typedef char event_key_t[KEY_LENGTH + 1];
+
+int compute_key(char *key, const char *event, const char *type);
+int compute_keys(event_key_t *keys, int count, const char *event, const char *type);
+
+#endif /* __KEYGEN_H__ */
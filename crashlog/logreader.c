@@ -0,0 +1,505 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file logreader.c
+ * @brief File containing the native reader of the Android log buffers.
+ */
+
+#include "logreader.h"
+#include "privconfig.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/* Header of the logger entries. In the v1 format, hdr_size is 0 and the
+ * header ends with nsec; the v2 format adds the euid */
+struct logger_entry_hdr {
+    uint16_t len;
+    uint16_t hdr_size;
+    int32_t pid;
+    int32_t tid;
+    int32_t sec;
+    int32_t nsec;
+};
+
+#define LOGGER_ENTRY_V1_HDR     ((int)sizeof(struct logger_entry_hdr))
+#define LOGREADER_OUT_SIZE      (16*KB)
+#define LOGREADER_PREFIX_SIZE   128
+#define LOGREADER_TAG_SIZE      64
+
+/* Types of the binary events values */
+enum {
+    EVENT_TYPE_INT = 0,
+    EVENT_TYPE_LONG,
+    EVENT_TYPE_STRING,
+    EVENT_TYPE_LIST,
+};
+
+static const struct log_buffer {
+    unsigned int id;
+    const char *name;
+    int binary;
+} log_buffers[] = {
+    { LOG_BUFFER_MAIN, "main", 0 },
+    { LOG_BUFFER_SYSTEM, "system", 0 },
+    { LOG_BUFFER_RADIO, "radio", 0 },
+    { LOG_BUFFER_EVENTS, "events", 1 },
+    { LOG_BUFFER_KERNEL, "kernel", 0 },
+};
+
+struct log_source {
+    const struct log_buffer *buffer;
+    int fd;
+    int start, end;
+    struct logger_entry_hdr entry;  /* current entry */
+    const char *payload;            /* NULL once the source is drained */
+    char data[2 * LOGGER_ENTRY_MAX_LEN];
+};
+
+struct log_output {
+    int fd;
+    int used;
+    off_t written;
+    off_t maxsize;
+    int full;
+    int error;
+    char data[LOGREADER_OUT_SIZE];
+};
+
+struct event_tag {
+    unsigned int tag;
+    char *name;
+};
+
+struct event_tags {
+    struct event_tag *tags;
+    int count;
+};
+
+/**
+ * @brief Gets the next entry of a source
+ *
+ * A logger device returns one entry per read. A plain file (used for the
+ * tests) returns several entries, possibly truncated, so entries are parsed
+ * from the buffered data.
+ *
+ * @return 1 if an entry is available, 0 if the source is drained.
+ */
+static int next_entry(struct log_source *source) {
+    int avail, hdr_size;
+    ssize_t nr;
+
+    for (;;) {
+        avail = source->end - source->start;
+        if (avail >= LOGGER_ENTRY_V1_HDR) {
+            memcpy(&source->entry, &source->data[source->start], LOGGER_ENTRY_V1_HDR);
+            hdr_size = (source->entry.hdr_size ? source->entry.hdr_size : LOGGER_ENTRY_V1_HDR);
+            if (hdr_size < LOGGER_ENTRY_V1_HDR || hdr_size + source->entry.len > LOGGER_ENTRY_MAX_LEN) {
+                LOGE("%s: corrupted entry in %s log buffer\n", __FUNCTION__, source->buffer->name);
+                break;
+            }
+            if (avail >= hdr_size + source->entry.len) {
+                source->payload = &source->data[source->start + hdr_size];
+                source->start += hdr_size + source->entry.len;
+                return 1;
+            }
+        }
+        /* Move the partial entry to the beginning and read more */
+        memmove(source->data, &source->data[source->start], avail);
+        source->start = 0;
+        source->end = avail;
+        nr = read(source->fd, &source->data[source->end], sizeof(source->data) - source->end);
+        if (nr < 0 && errno == EINTR)
+            continue;
+        if (nr <= 0) {
+            if (nr < 0 && errno != EAGAIN)
+                LOGE("%s: read of %s log buffer failed - %s\n", __FUNCTION__,
+                    source->buffer->name, strerror(errno));
+            break;
+        }
+        source->end += nr;
+    }
+    source->payload = NULL;
+    return 0;
+}
+
+static void flush_output(struct log_output *output) {
+    int done = 0;
+    ssize_t nr;
+
+    while (done < output->used) {
+        nr = write(output->fd, &output->data[done], output->used - done);
+        if (nr < 0 && errno == EINTR)
+            continue;
+        if (nr <= 0) {
+            output->error = (nr < 0 ? errno : ENOSPC);
+            LOGE("%s: write failed - %s\n", __FUNCTION__, strerror(output->error));
+            output->full = 1;
+            break;
+        }
+        done += nr;
+    }
+    output->used = 0;
+}
+
+/* Writes a line, unless it would exceed the max size of the output */
+static void output_line(struct log_output *output, const char *prefix, int prefixlen,
+        const char *line, int len) {
+    int total = prefixlen + len + 1;
+
+    if (output->full)
+        return;
+    if (output->maxsize && output->written + total > output->maxsize) {
+        output->full = 1;
+        return;
+    }
+    if (output->used + total > LOGREADER_OUT_SIZE)
+        flush_output(output);
+    if (total > LOGREADER_OUT_SIZE) {
+        /* Can't happen with entries bounded to LOGGER_ENTRY_MAX_LEN */
+        return;
+    }
+    memcpy(&output->data[output->used], prefix, prefixlen);
+    memcpy(&output->data[output->used + prefixlen], line, len);
+    output->data[output->used + total - 1] = '\n';
+    output->used += total;
+    output->written += total;
+}
+
+/* Builds the threadtime prefix: "date time pid tid prio tag: " */
+static int format_prefix(char *prefix, const struct logger_entry_hdr *entry,
+        char priority, const char *tag) {
+    struct tm tm;
+    time_t sec = entry->sec;
+    int len;
+
+    localtime_r(&sec, &tm);
+    len = strftime(prefix, LOGREADER_PREFIX_SIZE, "%m-%d %H:%M:%S", &tm);
+    len += snprintf(&prefix[len], LOGREADER_PREFIX_SIZE - len, ".%03d %5d %5d %c %-8s: ",
+        entry->nsec / 1000000, entry->pid, entry->tid, priority, tag);
+    return (len < LOGREADER_PREFIX_SIZE ? len : LOGREADER_PREFIX_SIZE - 1);
+}
+
+/* Writes a message, each of its lines being prefixed */
+static void output_message(struct log_output *output, const char *prefix, int prefixlen,
+        const char *msg, int msglen) {
+    const char *eol;
+    int len;
+
+    while (msglen > 0 && msg[msglen - 1] == '\n')
+        msglen--;
+    do {
+        eol = memchr(msg, '\n', msglen);
+        len = (eol ? eol - msg : msglen);
+        output_line(output, prefix, prefixlen, msg, len);
+        msg += len + 1;
+        msglen -= len + 1;
+    } while (eol);
+}
+
+/* Writes a text entry, made of a priority, a tag and a message */
+static void output_text_entry(struct log_output *output, const struct log_source *source) {
+    static const char priorities[] = "??VDIWEFS";
+    const char *payload = source->payload, *msg;
+    char prefix[LOGREADER_PREFIX_SIZE];
+    char tag[LOGREADER_TAG_SIZE];
+    int len = source->entry.len, taglen, msglen, prefixlen;
+    char priority;
+
+    if (len < 2)
+        return;
+    priority = ((unsigned char)payload[0] < sizeof(priorities) - 1 ? priorities[(int)payload[0]] : '?');
+    /* The tag and the message are not null terminated in truncated entries */
+    taglen = strnlen(&payload[1], len - 1);
+    snprintf(tag, sizeof(tag), "%.*s", taglen, &payload[1]);
+    msg = &payload[1 + taglen + 1];
+    msglen = (msg < payload + len ? (int)strnlen(msg, payload + len - msg) : 0);
+
+    prefixlen = format_prefix(prefix, &source->entry, priority, tag);
+    output_message(output, prefix, prefixlen, msg, msglen);
+}
+
+static int compare_tags(const void *a, const void *b) {
+    const struct event_tag *taga = a, *tagb = b;
+
+    return (taga->tag > tagb->tag) - (taga->tag < tagb->tag);
+}
+
+/**
+ * @brief Loads the names of the event tags, if available
+ *
+ * Each line of the tags file starts with a tag number and its name.
+ */
+static void load_event_tags(struct event_tags *tags) {
+    char line[256], name[LOGREADER_TAG_SIZE];
+    struct event_tag *tmp;
+    unsigned int tag;
+    int size = 0;
+    FILE *fd;
+
+    tags->tags = NULL;
+    tags->count = 0;
+    fd = fopen(EVENT_LOG_TAGS, "r");
+    if (!fd)
+        return;
+    while (fgets(line, sizeof(line), fd)) {
+        if (sscanf(line, "%u %63s", &tag, name) != 2)
+            continue;
+        if (tags->count == size) {
+            size = (size ? 2 * size : 256);
+            tmp = realloc(tags->tags, size * sizeof(struct event_tag));
+            if (!tmp)
+                break;
+            tags->tags = tmp;
+        }
+        tags->tags[tags->count].tag = tag;
+        tags->tags[tags->count].name = strdup(name);
+        if (tags->tags[tags->count].name)
+            tags->count++;
+    }
+    fclose(fd);
+    qsort(tags->tags, tags->count, sizeof(struct event_tag), compare_tags);
+}
+
+static void free_event_tags(struct event_tags *tags) {
+    int i;
+
+    for (i = 0 ; i < tags->count ; i++)
+        free(tags->tags[i].name);
+    free(tags->tags);
+}
+
+/* Appends to a decoded value, clamped to outsize. Returns -1 once out is full */
+static int append_event_value(char *out, int outsize, int *outlen, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    if (*outlen >= outsize - 1)
+        return -1;
+    va_start(ap, fmt);
+    len = vsnprintf(out + *outlen, outsize - *outlen, fmt, ap);
+    va_end(ap);
+    if (len < 0 || *outlen + len >= outsize - 1) {
+        *outlen = outsize - 1;
+        return -1;
+    }
+    *outlen += len;
+    return 0;
+}
+
+/**
+ * @brief Decodes a binary event value as logcat prints it
+ *
+ * The decoding stops once out is full, *outlen is always below outsize.
+ *
+ * @return 0 on success, -1 if the value is truncated, unknown or too long.
+ */
+static int decode_event_value(const char **data, int *left, char *out, int outsize, int *outlen) {
+    int32_t ival;
+    int64_t lval;
+    int i, count, ret = 0;
+    unsigned char type;
+
+    if (*left < 1)
+        return -1;
+    type = (unsigned char)**data;
+    (*data)++;
+    (*left)--;
+
+    switch (type) {
+    case EVENT_TYPE_INT:
+        if (*left < 4) return -1;
+        memcpy(&ival, *data, 4);
+        *data += 4;
+        *left -= 4;
+        return append_event_value(out, outsize, outlen, "%d", ival);
+    case EVENT_TYPE_LONG:
+        if (*left < 8) return -1;
+        memcpy(&lval, *data, 8);
+        *data += 8;
+        *left -= 8;
+        return append_event_value(out, outsize, outlen, "%lld", (long long)lval);
+    case EVENT_TYPE_STRING:
+        if (*left < 4) return -1;
+        memcpy(&ival, *data, 4);
+        *data += 4;
+        *left -= 4;
+        if (ival < 0 || ival > *left) return -1;
+        ret = append_event_value(out, outsize, outlen, "%.*s", ival, *data);
+        *data += ival;
+        *left -= ival;
+        return ret;
+    case EVENT_TYPE_LIST:
+        if (*left < 1) return -1;
+        count = (unsigned char)**data;
+        (*data)++;
+        (*left)--;
+        ret = append_event_value(out, outsize, outlen, "[");
+        for (i = 0 ; i < count && ret == 0 ; i++) {
+            if (i && (ret = append_event_value(out, outsize, outlen, ",")) < 0)
+                break;
+            ret = decode_event_value(data, left, out, outsize, outlen);
+        }
+        if (ret == 0)
+            ret = append_event_value(out, outsize, outlen, "]");
+        return ret;
+    default:
+        return -1;
+    }
+}
+
+/* Writes a binary event entry, made of a tag number and a typed value */
+static void output_event_entry(struct log_output *output, const struct log_source *source,
+        const struct event_tags *tags) {
+    char prefix[LOGREADER_PREFIX_SIZE];
+    char tag[LOGREADER_TAG_SIZE];
+    char msg[LOGGER_ENTRY_MAX_LEN];
+    struct event_tag key, *found;
+    const char *data = source->payload;
+    int left = source->entry.len, msglen = 0, prefixlen;
+    uint32_t tagid;
+
+    if (left < 4)
+        return;
+    memcpy(&tagid, data, 4);
+    data += 4;
+    left -= 4;
+
+    key.tag = tagid;
+    found = (tags->count ? bsearch(&key, tags->tags, tags->count, sizeof(struct event_tag), compare_tags) : NULL);
+    if (found)
+        snprintf(tag, sizeof(tag), "%s", found->name);
+    else
+        snprintf(tag, sizeof(tag), "%u", tagid);
+
+    if (left > 0 && decode_event_value(&data, &left, msg, sizeof(msg), &msglen) < 0)
+        append_event_value(msg, sizeof(msg), &msglen, "[truncated]");
+
+    prefixlen = format_prefix(prefix, &source->entry, 'I', tag);
+    output_message(output, prefix, prefixlen, msg, msglen);
+}
+
+/* Gets the source whose current entry is the oldest */
+static struct log_source *oldest_source(struct log_source *sources, int count) {
+    struct log_source *oldest = NULL;
+    int i;
+
+    for (i = 0 ; i < count ; i++) {
+        if (!sources[i].payload)
+            continue;
+        if (!oldest || sources[i].entry.sec < oldest->entry.sec ||
+                (sources[i].entry.sec == oldest->entry.sec && sources[i].entry.nsec < oldest->entry.nsec))
+            oldest = &sources[i];
+    }
+    return oldest;
+}
+
+/**
+ * @brief Dumps log buffers into a file
+ *
+ * The entries of all the buffers are merged by time and written in the
+ * threadtime format, as "logcat -v threadtime -d -f dest" does.
+ *
+ * @param buffers to dump, as a LOG_BUFFER_* mask. The missing ones are skipped.
+ * @param dest file created (or truncated) with the dump
+ * @param since only the entries logged from this time are dumped, 0 for all
+ * @param maxsize of dest, 0 for no limit. The dump stops at the first line
+ * that would exceed it.
+ *
+ * @return the size of dest, a negative errno value on error.
+ */
+off_t dump_log_buffers(unsigned int buffers, const char *dest, time_t since, off_t maxsize) {
+    struct log_source *sources, *source;
+    struct log_output *output;
+    struct event_tags tags = { NULL, 0 };
+    char path[PATHMAX];
+    int i, count = 0;
+    off_t ret;
+
+    if (!dest) return -EINVAL;
+
+    sources = malloc(DIM(log_buffers) * sizeof(struct log_source));
+    output = malloc(sizeof(struct log_output));
+    if (!sources || !output) {
+        free(sources);
+        free(output);
+        return -ENOMEM;
+    }
+
+    for (i = 0 ; i < (int)DIM(log_buffers) ; i++) {
+        if (!(buffers & log_buffers[i].id))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", LOGGER_DIR, log_buffers[i].name);
+        sources[count].fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (sources[count].fd < 0) {
+            LOGI("%s: %s log buffer not available - %s\n", __FUNCTION__, log_buffers[i].name, strerror(errno));
+            continue;
+        }
+        sources[count].buffer = &log_buffers[i];
+        sources[count].start = sources[count].end = 0;
+        if (log_buffers[i].binary && !tags.tags)
+            load_event_tags(&tags);
+        count++;
+    }
+    if (!count) {
+        free(sources);
+        free(output);
+        return -ENOENT;
+    }
+
+    output->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (output->fd < 0) {
+        ret = -errno;
+        LOGE("%s: can not open file: %s - %s\n", __FUNCTION__, dest, strerror(errno));
+        goto out;
+    }
+    output->used = 0;
+    output->written = 0;
+    output->maxsize = maxsize;
+    output->full = 0;
+    output->error = 0;
+
+    for (i = 0 ; i < count ; i++)
+        next_entry(&sources[i]);
+    while (!output->full && (source = oldest_source(sources, count))) {
+        if (source->entry.sec >= since) {
+            if (source->buffer->binary)
+                output_event_entry(output, source, &tags);
+            else
+                output_text_entry(output, source);
+        }
+        next_entry(source);
+    }
+    flush_output(output);
+    ret = (output->error ? -output->error : output->written);
+    if (close(output->fd) < 0 && ret >= 0)
+        ret = -errno;
+
+out:
+    for (i = 0 ; i < count ; i++)
+        close(sources[i].fd);
+    free_event_tags(&tags);
+    free(sources);
+    free(output);
+    return ret;
+}
@@ -0,0 +1,46 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file logreader.h
+ * @brief File containing the native reader of the Android log buffers.
+ *
+ * The log buffers are read from the logger devices and their entries are
+ * merged by time and written in the logcat "threadtime" format straight to
+ * the destination file, like "logcat -v threadtime -d -f" would do but
+ * without any process or temporary file. The memory used is bounded: one
+ * read buffer per log buffer and one output buffer.
+ */
+
+#ifndef __LOGREADER_H__
+#define __LOGREADER_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+/* Log buffers, as selected by logcat -b */
+#define LOG_BUFFER_MAIN         (1 << 0)
+#define LOG_BUFFER_SYSTEM       (1 << 1)
+#define LOG_BUFFER_RADIO        (1 << 2)
+#define LOG_BUFFER_EVENTS       (1 << 3)
+#define LOG_BUFFER_KERNEL       (1 << 4)
+
+/* Max size of an entry, header included */
+#define LOGGER_ENTRY_MAX_LEN    (5*1024)
+
+off_t dump_log_buffers(unsigned int buffers, const char *dest, time_t since, off_t maxsize);
+
+#endif /* __LOGREADER_H__ */
@@ -44,10 +44,15 @@
 #include "tcs_wrapper.h"
 #include "kct_netlink.h"
 #include "iptrak.h"
+#include "reactor.h"
+#include "workqueue.h"
+#include "boottask.h"
+#include "usage.h"
+#include "retention.h"
+#include "notifier.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -88,24 +93,25 @@ int process_command_event(struct watch_entry *entry, struct inotify_event *event
     char action[MAXLINESIZE];
     char args[MAXLINESIZE];
     char line[MAXLINESIZE];
-    FILE *fd;
+    struct line_reader reader;
+    int res;
 
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
-    if ( (fd = fopen(path, "r")) == NULL) {
-        LOGE("%s: Cannot open %s - %s\n", __FUNCTION__, path, strerror(errno));
+    if ( (res = line_reader_open(&reader, path)) < 0) {
+        LOGE("%s: Cannot open %s - %s\n", __FUNCTION__, path, strerror(-res));
         /* Tries to remove it in case of an improbable error */
         rmfr(path);
-        return -errno;
+        return res;
     }
 
     /* now, read the file and get the last action/args found */
     action[0] = 0;
     args[0] = 0;
-    while ( freadline(fd, line) > 0 ) {
+    while ( line_reader_next(&reader, line) > 0 ) {
         sscanf(line, "ACTION=%s", action);
         sscanf(line, "ARGS=%s", args);
     }
-    fclose(fd);
+    line_reader_close(&reader);
     rmfr(path);
     if (!action[0] || !args[0]) {
         LOGE("%s: Cannot find action/args in %s\n", __FUNCTION__, path);
@@ -243,9 +249,9 @@ static void reset_after_swupdate(void)
     reset_logdir(LOGS_MODEM_DIR, 0);
     reset_logdir(LOGS_GPS_DIR, 1);
     remove(MODEM_UUID);
-    reset_file(CRASH_CURRENT_LOG);
-    reset_file(STATS_CURRENT_LOG);
-    reset_file(APLOGS_CURRENT_LOG);
+    reset_crashlog_dir_index(MODE_CRASH);
+    reset_crashlog_dir_index(MODE_STATS);
+    reset_crashlog_dir_index(MODE_APLOGS);
     reset_uptime_history();
 }
 
@@ -298,11 +304,79 @@ static void early_check_nomain(char *boot_mode, int test) {
 }
 
 
+/* Context shared by the boot-time checks */
+struct boot_check_ctx {
+    char *startupreason;
+    char *watchdog;
+    int test;
+};
+
+static void boot_check_fabric(void *arg) {
+    struct boot_check_ctx *ctx = arg;
+    crashlog_check_fabric_events(ctx->startupreason, ctx->watchdog, ctx->test);
+}
+
+static void boot_check_panic(void *arg) {
+    struct boot_check_ctx *ctx = arg;
+    crashlog_check_panic_events(ctx->startupreason, ctx->watchdog, ctx->test);
+}
+
+static void boot_check_kdump(void *arg) {
+    struct boot_check_ctx *ctx = arg;
+    crashlog_check_kdump(ctx->startupreason, ctx->test);
+}
+
+static void boot_check_modem_shutdown(void *arg) {
+    (void)arg;
+    crashlog_check_modem_shutdown();
+}
+
+static void boot_check_mpanic_abort(void *arg) {
+    (void)arg;
+    crashlog_check_mpanic_abort();
+}
+
+static void boot_check_startupreason(void *arg) {
+    struct boot_check_ctx *ctx = arg;
+    crashlog_check_startupreason(ctx->startupreason, ctx->watchdog);
+}
+
+static void boot_check_recovery(void *arg) {
+    (void)arg;
+    crashlog_check_recovery();
+}
+
+enum {
+    BOOT_CHECK_FABRIC,
+    BOOT_CHECK_PANIC,
+    BOOT_CHECK_KDUMP,
+    BOOT_CHECK_MODEM_SHUTDOWN,
+    BOOT_CHECK_MPANIC_ABORT,
+    BOOT_CHECK_STARTUPREASON,
+    BOOT_CHECK_RECOVERY,
+    BOOT_CHECKS
+};
+
+/* Fabric, panic and startup reason checks update the startupreason and
+ * watchdog strings in turn; the other checks are independent */
+static const struct boot_task boot_checks[BOOT_CHECKS] = {
+    [BOOT_CHECK_FABRIC] = { "fabric", boot_check_fabric, 0 },
+    [BOOT_CHECK_PANIC] = { "panic", boot_check_panic,
+        BOOTTASK_DEP(BOOT_CHECK_FABRIC) },
+    [BOOT_CHECK_KDUMP] = { "kdump", boot_check_kdump, 0 },
+    [BOOT_CHECK_MODEM_SHUTDOWN] = { "modem_shutdown", boot_check_modem_shutdown, 0 },
+    [BOOT_CHECK_MPANIC_ABORT] = { "mpanic_abort", boot_check_mpanic_abort, 0 },
+    [BOOT_CHECK_STARTUPREASON] = { "startupreason", boot_check_startupreason,
+        BOOTTASK_DEP(BOOT_CHECK_PANIC) },
+    [BOOT_CHECK_RECOVERY] = { "recovery", boot_check_recovery, 0 },
+};
+
 static void early_check(char *encryptstate, int test) {
 
     char startupreason[32] = { '\0', };
     char flashtype[32] = { '\0', };
     char watchdog[16] = { '\0', };
+    struct boot_check_ctx ctx;
     int modem_name_check_result = 0;
     const char *datelong;
     char *key;
@@ -322,13 +396,10 @@ static void early_check(char *encryptstate, int test) {
 
     strcpy(watchdog,"WDT");
 
-    crashlog_check_fabric_events(startupreason, watchdog, test);
-    crashlog_check_panic_events(startupreason, watchdog, test);
-    crashlog_check_kdump(startupreason, test);
-    crashlog_check_modem_shutdown();
-    crashlog_check_mpanic_abort();
-    crashlog_check_startupreason(startupreason, watchdog);
-    crashlog_check_recovery();
+    ctx.startupreason = startupreason;
+    ctx.watchdog = watchdog;
+    ctx.test = test;
+    run_boot_tasks(boot_checks, BOOT_CHECKS, &ctx);
 
     key = raise_event_bootuptime(SYS_REBOOT, startupreason, NULL, NULL);
     datelong = get_current_time_long(0);
@@ -501,10 +572,22 @@ int get_inotify_fd() {
     return file_monitor_fd;
 }
 
+/* Reactor handlers of the main event sources */
+static int inotify_source_handler(int fd, void __attribute__((unused)) *ctx) {
+    return receive_inotify_events(fd);
+}
+
+static int mmgr_source_handler(int __attribute__((unused)) fd,
+        void __attribute__((unused)) *ctx) {
+    return mmgr_handle();
+}
+
+static int kct_source_handler(int __attribute__((unused)) fd,
+        void __attribute__((unused)) *ctx) {
+    return kct_netlink_handle_msg();
+}
+
 int do_monitor() {
-    fd_set read_fds; /**< file descriptor set watching data availability from sources */
-    int max = 0; /**< select max fd value +1 {@see man select(2) nfds} */
-    int select_result; /**< select result */
     int file_monitor_fd = get_inotify_fd();
     dropbox_set_file_monitor_fd(file_monitor_fd);
 
@@ -543,57 +626,27 @@ int do_monitor() {
 
     kct_netlink_init_comm();
 
-    for(;;) {
-        // Clear fd set
-        FD_ZERO(&read_fds);
-
-        // File monitor fd setup
-        if ( file_monitor_fd > 0 ) {
-            FD_SET(file_monitor_fd, &read_fds);
-            if (file_monitor_fd > max)
-                max = file_monitor_fd;
-        }
+    /* Inotify callbacks are run by the workers, events keep being processed
+     * by this thread if they can't be started */
+    if (workqueue_init() < 0)
+        LOGE("%s: failed to start the worker pool\n", __FUNCTION__);
 
-        //mmgr fd setup
-        if (mmgr_get_fd() > 0) {
-            FD_SET(mmgr_get_fd(), &read_fds);
-            if (mmgr_get_fd() > max)
-                max = mmgr_get_fd();
-        }
+    /* Deletions interrupted by the previous shutdown */
+    rmfr_deferred_sweep(LOGS_DIR);
+    rmfr_deferred_sweep(SDCARD_LOGS_DIR);
+    rmfr_deferred_sweep(LOGS_MEDIA_DIR);
 
-        //kct fd setup
-        if (kct_netlink_get_fd() > 0) {
-            FD_SET(kct_netlink_get_fd(), &read_fds);
-            if (kct_netlink_get_fd() > max)
-                max = kct_netlink_get_fd();
-        }
-
-        // Wait for events
-        select_result = select(max+1, &read_fds, NULL, NULL, NULL);
+    /* Register the event sources in the reactor */
+    if (reactor_add_source(file_monitor_fd, "inotify", inotify_source_handler, NULL) < 0)
+        return -1;
+    if (mmgr_get_fd() > 0)
+        reactor_add_source(mmgr_get_fd(), "mmgr", mmgr_source_handler, NULL);
+    if (kct_netlink_get_fd() > 0)
+        reactor_add_source(kct_netlink_get_fd(), "kct", kct_source_handler, NULL);
+    if (notifier_get_fd() >= 0)
+        reactor_add_source(notifier_get_fd(), "notifier", notifier_accept, NULL);
 
-        if (select_result == -1 && errno == EINTR) // Interrupted, need to recycle
-            continue;
-
-        // Result processing
-        if (select_result > 0) {
-            /* clean children to avoid zombie processes */
-            while(waitpid(-1, NULL, WNOHANG) > 0){};
-            // File monitor
-            if (FD_ISSET(file_monitor_fd, &read_fds)) {
-                receive_inotify_events(file_monitor_fd);
-            }
-            // mmgr monitor
-            if (FD_ISSET(mmgr_get_fd(), &read_fds)) {
-                LOGD("mmgr fd set");
-                mmgr_handle();
-            }
-            // kct monitor
-            if (FD_ISSET(kct_netlink_get_fd(), &read_fds)) {
-                LOGD("kct fd set");
-                kct_netlink_handle_msg();
-            }
-        }
-    }
+    reactor_run();
 
     close_mmgr_cli_source();
     free_config(g_first_modem_config);
@@ -695,6 +748,16 @@ int main(int argc, char **argv) {
     /* first thing to do : load configuration */
     load_config();
 
+    /* Event loop, the sources are registered from then on */
+    if (reactor_init() < 0)
+        return -1;
+
+    /* Space used by the logs, kept up to date from then on */
+    usage_init();
+    retention_init();
+    /* Notifications to CrashReport are coalesced from the first events on */
+    notifier_init();
+
     /* Get the properties and read the local files to set properly the env variables */
     get_crash_env(boot_mode, crypt_state, encrypt_progress, decrypt, token);
 
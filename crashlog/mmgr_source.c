@@ -28,6 +28,8 @@
 #include "crashutils.h"
 #include "privconfig.h"
 #include "fsutils.h"
+#include "propcache.h"
+#include "admission.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -55,11 +57,9 @@ static int mmgr_monitor_fd[2];
 static bool is_mmgr_fake_event() {
     char prop_mmgr[PROPERTY_VALUE_MAX];
 
-    if(property_get(PROP_REPORT_FAKE, prop_mmgr, NULL)){
-        if (!strcmp(prop_mmgr, "modem")) {
-            return 1;
-        }
-    }
+    if (propcache_get(PROP_REPORT_FAKE, prop_mmgr, NULL) > 0 &&
+            !strcmp(prop_mmgr, "modem"))
+        return 1;
     return 0;
 }
 
@@ -435,7 +435,6 @@ int mmgr_handle(void) {
 
     // get data from mmgr pipe
     nbytes = read(mmgr_get_fd(), &cur_data, sizeof( struct mmgr_data));
-    strcpy(type,cur_data.string);
 
     if (nbytes == 0) {
         LOGW("No data found in mmgr_get_fd.\n");
@@ -443,9 +442,13 @@ int mmgr_handle(void) {
     }
     if (nbytes < 0) {
         nbytes = -errno;
+        if (nbytes == -EAGAIN)
+            return nbytes;
         LOGE("%s: Error while reading mmgr_get_fd - %s.\n", __FUNCTION__, strerror(errno));
         return nbytes;
     }
+    cur_data.string[sizeof(cur_data.string) - 1] = 0;
+    snprintf(type, sizeof(type), "%s", cur_data.string);
     //find_dir should be done before event_dir is set
     LOGD("Received string from mmgr: %s  - %d bytes", type,nbytes);
     // For "TFT" event, parameters are given by the data themselves
@@ -548,7 +551,7 @@ int mmgr_handle(void) {
             }
         }
         // Remove the "TFT" tag added in top of cur_data.string
-        strcpy(type, &cur_data.string[3]);
+        snprintf(type, sizeof(type), "%s", &cur_data.string[3]);
     } else if (strstr(type, "START_CD" )){
         FILE *fp = fopen(MCD_PROCESSING,"w");
         if (fp == NULL){
@@ -558,7 +561,14 @@ int mmgr_handle(void) {
         return 0;
     }
 
-    dir = find_new_crashlog_dir(event_mode);
+    /* Modem panics and IPC errors are never throttled */
+    if (!admit_event(ADMIT_SRC_MMGR,
+            (strstr(type, "MPANIC") || strstr(type, "APIMR")) ?
+            ADMIT_CLASS_CRITICAL : admission_class_of_event(event_name),
+            event_name, type))
+        return 0;
+
+    dir = find_new_crashlog_dir(event_mode, &event_dir);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, event_name, NULL, NULL);
@@ -567,14 +577,11 @@ int mmgr_handle(void) {
         return -1;
     }
 
-    // update event_dir should be done after find_dir call
-    event_dir = (event_mode == MODE_STATS ? STATS_DIR : CRASH_DIR);
-
     if (copy_aplog > 0) {
-        do_log_copy(type, dir, dateshort, aplog_mode);
+        do_log_copy(type, event_dir, dir, dateshort, aplog_mode);
     }
     if (copy_bplog > 0) {
-        do_log_copy(type, dir, dateshort, bplog_mode);
+        do_log_copy(type, event_dir, dir, dateshort, bplog_mode);
     }
     snprintf(destion, sizeof(destion), "%s%d/", event_dir, dir);
     // copying file (if required)
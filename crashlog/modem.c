@@ -64,6 +64,11 @@ static int copy_modemcoredump(char *spath, char *dpath) {
             /* file form is cd_xxx.tar.gz */
             snprintf(src, sizeof(src), "%s/%s", spath, de->d_name);
             snprintf(des, sizeof(des), "%s/%s", dpath, de->d_name);
+            /* The archive is complete once closed by the modem manager */
+            if (wait_file_stable(src, STABLE_QUIET_MS, COREDUMP_DEADLINE_MS) < 0) {
+                LOGE("%s: %s not complete, not copied\n", __FUNCTION__, src);
+                continue;
+            }
             do_copy_tail(src, des, 0);
             remove(src);
         }
@@ -78,13 +83,14 @@ static int copy_modemcoredump(char *spath, char *dpath) {
 
 int process_modem_event(struct watch_entry *entry, struct inotify_event *event) {
     int dir;
+    char *dirbase;
     char path[PATHMAX];
     char destion[PATHMAX];
     const char *dateshort = get_current_time_short(1);
     char *key;
 
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0) {
         LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, entry->eventname, NULL, NULL);
@@ -94,19 +100,20 @@ int process_modem_event(struct watch_entry *entry, struct inotify_event *event)
         return -1;
     }
 
-    snprintf(destion,sizeof(destion),"%s%d", CRASH_DIR,dir);
+    snprintf(destion,sizeof(destion),"%s%d", dirbase,dir);
     /*Copy Coredump only if event is a modem crash*/
     if (entry->eventtype == MDMCRASH_TYPE ) {
         int status = copy_modemcoredump(entry->eventpath, destion);
         if (status != 0)
             LOGE("backup modem core dump status: %d.\n", status);
     }
-    snprintf(destion,sizeof(destion),"%s%d/%s", CRASH_DIR, dir, event->name);
+    snprintf(destion,sizeof(destion),"%s%d/%s", dirbase, dir, event->name);
+    wait_file_complete(path, event->mask);
     do_copy_tail(path, destion, MAXFILESIZE);
-    snprintf(destion,sizeof(destion),"%s%d", CRASH_DIR, dir);
-    usleep(TIMEOUT_VALUE);
-    do_log_copy(entry->eventname, dir, dateshort, APLOG_TYPE);
-    do_log_copy(entry->eventname, dir, dateshort, BPLOG_TYPE);
+    snprintf(destion,sizeof(destion),"%s%d", dirbase, dir);
+    wait_aplog_flushed();
+    do_log_copy(entry->eventname, dirbase, dir, dateshort, APLOG_TYPE);
+    do_log_copy(entry->eventname, dirbase, dir, dateshort, BPLOG_TYPE);
     key = raise_event(CRASHEVENT, entry->eventname, NULL, destion);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), entry->eventname, destion);
     rmfr(path);
@@ -118,6 +125,7 @@ int crashlog_check_modem_shutdown() {
     const char *dateshort = get_current_time_short(1);
     char destion[PATHMAX];
     int dir;
+    char *dirbase;
     char *key;
 
     if ( !file_exists(MODEM_SHUTDOWN_TRIGGER) ) {
@@ -125,7 +133,7 @@ int crashlog_check_modem_shutdown() {
         return 0;
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0) {
         LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, MODEM_SHUTDOWN, NULL, NULL);
@@ -136,11 +144,11 @@ int crashlog_check_modem_shutdown() {
     }
 
     destion[0] = '\0';
-    snprintf(destion, sizeof(destion), "%s%d/", CRASH_DIR, dir);
+    snprintf(destion, sizeof(destion), "%s%d/", dirbase, dir);
 
-    usleep(TIMEOUT_VALUE);
-    do_log_copy(MODEM_SHUTDOWN, dir, dateshort, APLOG_TYPE);
-    do_last_kmsg_copy(dir);
+    wait_aplog_flushed();
+    do_log_copy(MODEM_SHUTDOWN, dirbase, dir, dateshort, APLOG_TYPE);
+    do_last_kmsg_copy(dirbase, dir);
     key = raise_event(CRASHEVENT, MODEM_SHUTDOWN, NULL, destion);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), MODEM_SHUTDOWN, destion);
     free(key);
@@ -152,13 +160,14 @@ int crashlog_check_modem_shutdown() {
 int crashlog_check_mpanic_abort(){
     char destion[PATHMAX];
     int dir;
+    char *dirbase;
     char *key;
     const char *dateshort = get_current_time_short(1);
 
     if (file_exists(MCD_PROCESSING)) {
         remove(MCD_PROCESSING);
 
-        dir = find_new_crashlog_dir(MODE_CRASH);
+        dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
         if (dir < 0) {
             LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
             key = raise_event(CRASHEVENT, MDMCRASH_EVNAME, NULL, NULL);
@@ -167,10 +176,10 @@ int crashlog_check_mpanic_abort(){
             return -1;
         }
 
-        do_log_copy(MDMCRASH_EVNAME,dir,dateshort,APLOG_TYPE);
-        do_log_copy(MDMCRASH_EVNAME,dir,dateshort,BPLOG_TYPE_OLD);
+        do_log_copy(MDMCRASH_EVNAME,dirbase,dir,dateshort,APLOG_TYPE);
+        do_log_copy(MDMCRASH_EVNAME,dirbase,dir,dateshort,BPLOG_TYPE_OLD);
 
-        snprintf(destion,sizeof(destion),"%s%d/", CRASH_DIR,dir);
+        snprintf(destion,sizeof(destion),"%s%d/", dirbase,dir);
 
         FILE *fp;
         char fullpath[PATHMAX];
@@ -207,6 +216,7 @@ int process_modem_generic(struct watch_entry *entry, struct inotify_event *event
     const char *dateshort = get_current_time_short(1);
     char *key;
     int dir;
+    char *dirbase;
     char path[PATHMAX];
     char path_linked[PATHMAX];
     char name_linked[PATHMAX];
@@ -246,7 +256,7 @@ int process_modem_generic(struct watch_entry *entry, struct inotify_event *event
 
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
 
-    dir = find_new_crashlog_dir(event_mode);
+    dir = find_new_crashlog_dir(event_mode, &dirbase);
     if (dir < 0) {
         LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, curConfig->eventname, NULL, NULL);
@@ -256,16 +266,11 @@ int process_modem_generic(struct watch_entry *entry, struct inotify_event *event
         return -1;
     }
 
-    //update event_dir should be done after find_dir call
-    if (event_mode == MODE_STATS){
-        snprintf(destion,sizeof(destion),"%s%d/", STATS_DIR,dir);
-    }else if (event_mode == MODE_CRASH) {
-        snprintf(destion,sizeof(destion),"%s%d/", CRASH_DIR,dir);
-    }
-    usleep(TIMEOUT_VALUE);
+    snprintf(destion,sizeof(destion),"%s%d/", dirbase,dir);
+    wait_aplog_flushed();
 
     //massive copy of directory found for type "directory"
-    do_log_copy(curConfig->eventname, dir, dateshort, APLOG_TYPE);
+    do_log_copy(curConfig->eventname, dirbase, dir, dateshort, APLOG_TYPE);
     if (curConfig->type ==1){
         struct arg_copy * args =  malloc(sizeof(struct arg_copy));
         if(!args) {
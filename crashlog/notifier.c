@@ -0,0 +1,351 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file notifier.c
+ * @brief File containing the notification channel to CrashReport.
+ */
+
+#include "notifier.h"
+#include "privconfig.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef __TEST__
+#include <private/android_filesystem_config.h>
+#endif
+
+#ifdef TEST_USER
+#define NOTIFY_SYSTEM_UID       TEST_USER
+#else
+#define NOTIFY_SYSTEM_UID       AID_SYSTEM
+#endif
+
+#define NOTIFY_INTENT_BASE \
+    "am broadcast -n com.intel.crashreport/.specific.NotificationReceiver " \
+    "-c android.intent.category.ALTERNATIVE "
+
+struct notify_batch {
+    char ids[NOTIFY_MAX_IDS][NOTIFY_ID_LEN];
+    int count;
+};
+
+static const char *kind_names[NOTIFY_KINDS] = {
+    [NOTIFY_CRASH] = "CRASH_NOTIFY",
+    [NOTIFY_LOGS_COPIED] = "CRASH_LOGS_COPY_FINISHED",
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t posted;
+    pthread_cond_t flushed;
+    struct notify_batch batches[NOTIFY_KINDS];
+    struct timespec first;      /* first post of the window */
+    int clients[NOTIFY_MAX_CLIENTS];
+    long long sent[NOTIFY_MAX_CLIENTS]; /* last send to each client (in ms) */
+    int listen_fd;
+    int started;
+} notifier = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    {{{{0}}, 0}}, {0, 0}, {-1, -1, -1, -1}, {0}, -1, 0
+};
+
+/* Fallback when no subscriber got the notification */
+static void broadcast_intent(e_notify_kind_t kind, const struct notify_batch *batch) {
+    char cmd[512];
+    int i, status;
+
+    if (kind == NOTIFY_CRASH) {
+        status = system(NOTIFY_INTENT_BASE "-a com.intel.crashreport.intent.CRASH_NOTIFY");
+        if (status != 0)
+            LOGI("notify crashreport status: %d.\n", status);
+        return;
+    }
+    for (i = 0 ; i < batch->count ; i++) {
+        if (!batch->ids[i][0])
+            continue;
+        snprintf(cmd, sizeof(cmd), NOTIFY_INTENT_BASE
+            "-a com.intel.crashreport.intent.CRASH_LOGS_COPY_FINISHED "
+            "--es com.intel.crashreport.extra.EVENT_ID %s", batch->ids[i]);
+        status = system(cmd);
+        if (status != 0)
+            LOGI("%s: Notify crashreport status(%d) for command \"%s\".\n",
+                __FUNCTION__, status, cmd);
+    }
+}
+
+/* Sends a batch to the subscribers. Returns the number of subscribers reached */
+static int send_batch(e_notify_kind_t kind, const struct notify_batch *batch) {
+    char message[NOTIFY_MAX_IDS * NOTIFY_ID_LEN + 64];
+    struct timespec ts;
+    long long now;
+    int i, len, unread, sent = 0;
+
+    len = snprintf(message, sizeof(message), "%s", kind_names[kind]);
+    for (i = 0 ; i < batch->count ; i++)
+        if (batch->ids[i][0])
+            len += snprintf(message + len, sizeof(message) - len, " %s", batch->ids[i]);
+    len += snprintf(message + len, sizeof(message) - len, "\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    pthread_mutex_lock(&notifier.lock);
+    for (i = 0 ; i < NOTIFY_MAX_CLIENTS ; i++) {
+        if (notifier.clients[i] < 0)
+            continue;
+        /* A subscriber which didn't read a notification sent for a while
+         * is gone */
+        if (now - notifier.sent[i] >= NOTIFY_WINDOW_MS &&
+                ioctl(notifier.clients[i], SIOCOUTQ, &unread) == 0 && unread > 0) {
+            LOGI("%s: dropping subscriber %d - %d bytes not read\n", __FUNCTION__,
+                notifier.clients[i], unread);
+        } else if (send(notifier.clients[i], message, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len) {
+            notifier.sent[i] = now;
+            sent++;
+            continue;
+        } else
+            LOGI("%s: dropping subscriber %d - %s\n", __FUNCTION__, notifier.clients[i],
+                strerror(errno));
+        close(notifier.clients[i]);
+        notifier.clients[i] = -1;
+    }
+    pthread_mutex_unlock(&notifier.lock);
+    return sent;
+}
+
+static void *notifier_mainloop(void *arg) {
+    struct notify_batch batches[NOTIFY_KINDS];
+    struct timespec deadline;
+    int kind, full, pending;
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&notifier.lock);
+        for (;;) {
+            pending = full = 0;
+            for (kind = 0 ; kind < NOTIFY_KINDS ; kind++) {
+                pending |= (notifier.batches[kind].count > 0);
+                full |= (notifier.batches[kind].count == NOTIFY_MAX_IDS);
+            }
+            if (full)
+                break;
+            if (!pending) {
+                pthread_cond_wait(&notifier.posted, &notifier.lock);
+                continue;
+            }
+            deadline = notifier.first;
+            deadline.tv_nsec += NOTIFY_WINDOW_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            if (pthread_cond_timedwait(&notifier.posted, &notifier.lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        memcpy(batches, notifier.batches, sizeof(batches));
+        for (kind = 0 ; kind < NOTIFY_KINDS ; kind++)
+            notifier.batches[kind].count = 0;
+        pthread_cond_broadcast(&notifier.flushed);
+        pthread_mutex_unlock(&notifier.lock);
+
+        for (kind = 0 ; kind < NOTIFY_KINDS ; kind++) {
+            if (!batches[kind].count)
+                continue;
+            if (send_batch(kind, &batches[kind]) == 0)
+                broadcast_intent(kind, &batches[kind]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates the notification socket and starts the coalescing thread
+ *
+ * @return 0 on success, a negative errno value otherwise. Notifications are
+ * then delivered at once by intents.
+ */
+int notifier_init(void) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int fd, ret;
+
+    if (notifier.started)
+        return 0;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ret = -errno;
+        LOGE("%s: socket error - %s\n", __FUNCTION__, strerror(errno));
+        return ret;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    /* Abstract namespace : leading '\0' */
+    strncpy(addr.sun_path + 1, NOTIFY_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(NOTIFY_SOCKET_NAME);
+    if (bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, NOTIFY_MAX_CLIENTS) < 0) {
+        ret = -errno;
+        LOGE("%s: cannot listen on %s - %s\n", __FUNCTION__, NOTIFY_SOCKET_NAME,
+            strerror(errno));
+        close(fd);
+        return ret;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, notifier_mainloop, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        LOGE("%s: pthread_create error - %s\n", __FUNCTION__, strerror(ret));
+        close(fd);
+        return -ret;
+    }
+
+    pthread_mutex_lock(&notifier.lock);
+    notifier.listen_fd = fd;
+    notifier.started = 1;
+    pthread_mutex_unlock(&notifier.lock);
+    return 0;
+}
+
+int notifier_get_fd(void) {
+    return notifier.listen_fd;
+}
+
+/* Only system and CrashReport may subscribe */
+static int peer_allowed(int client) {
+    struct ucred cred;
+    struct stat info;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        LOGE("%s: can't get the subscriber credentials - %s\n", __FUNCTION__,
+            strerror(errno));
+        return 0;
+    }
+    if (cred.uid == 0 || cred.uid == NOTIFY_SYSTEM_UID)
+        return 1;
+    /* The data directory of the CrashReport package is owned by its uid */
+    if (stat(NOTIFY_CRASHREPORT_DIR, &info) == 0 && info.st_uid == cred.uid)
+        return 1;
+    LOGE("%s: subscriber pid %d uid %d rejected\n", __FUNCTION__, cred.pid, cred.uid);
+    return 0;
+}
+
+/**
+ * @brief Reactor handler accepting the subscribers
+ */
+int notifier_accept(int fd, void __attribute__((unused)) *ctx) {
+    int client, i;
+
+    client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client < 0)
+        return -errno;
+    if (!peer_allowed(client)) {
+        close(client);
+        return -EACCES;
+    }
+
+    pthread_mutex_lock(&notifier.lock);
+    for (i = 0 ; i < NOTIFY_MAX_CLIENTS ; i++)
+        if (notifier.clients[i] < 0)
+            break;
+    if (i < NOTIFY_MAX_CLIENTS) {
+        notifier.clients[i] = client;
+        notifier.sent[i] = 0;
+    }
+    pthread_mutex_unlock(&notifier.lock);
+
+    if (i == NOTIFY_MAX_CLIENTS) {
+        LOGE("%s: too many subscribers\n", __FUNCTION__);
+        close(client);
+        return -EMFILE;
+    }
+    LOGI("%s: new subscriber %d\n", __FUNCTION__, client);
+    return 0;
+}
+
+/**
+ * @brief Posts a notification to the subscribers
+ *
+ * The notification is sent at the end of the current coalescing window,
+ * or right away by an intent if the notifier is not started.
+ *
+ * @param kind of notification
+ * @param id of the event, may be NULL
+ */
+void notifier_post(e_notify_kind_t kind, const char *id) {
+    struct notify_batch *batch;
+    struct notify_batch single;
+    int i;
+
+    if (kind >= NOTIFY_KINDS)
+        return;
+
+    pthread_mutex_lock(&notifier.lock);
+    if (!notifier.started) {
+        pthread_mutex_unlock(&notifier.lock);
+        single.count = 0;
+        if (id) {
+            strncpy(single.ids[0], id, NOTIFY_ID_LEN - 1);
+            single.ids[0][NOTIFY_ID_LEN - 1] = 0;
+            single.count = 1;
+        }
+        broadcast_intent(kind, &single);
+        return;
+    }
+
+    batch = &notifier.batches[kind];
+    while (batch->count == NOTIFY_MAX_IDS)
+        pthread_cond_wait(&notifier.flushed, &notifier.lock);
+    /* The window starts with the first notification */
+    for (i = 0 ; i < NOTIFY_KINDS ; i++)
+        if (notifier.batches[i].count)
+            break;
+    if (i == NOTIFY_KINDS)
+        clock_gettime(CLOCK_REALTIME, &notifier.first);
+
+    if (id) {
+        for (i = 0 ; i < batch->count ; i++)
+            if (!strcmp(batch->ids[i], id))
+                break;
+        if (i == batch->count) {
+            strncpy(batch->ids[batch->count], id, NOTIFY_ID_LEN - 1);
+            batch->ids[batch->count][NOTIFY_ID_LEN - 1] = 0;
+            batch->count++;
+        }
+    }
+    /* A notification without id still needs a slot to be sent */
+    else if (!batch->count)
+        batch->ids[batch->count++][0] = 0;
+    pthread_cond_signal(&notifier.posted);
+    pthread_mutex_unlock(&notifier.lock);
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file notifier.h
+ * @brief File containing the notification channel to CrashReport.
+ *
+ * Subscribers connect to the NOTIFY_SOCKET_NAME local socket (abstract
+ * namespace). The notifications posted during a NOTIFY_WINDOW_MS window are
+ * coalesced and sent as a single line per kind:
+ *   "<kind> <event id> <event id>...\n"
+ * Only the root, system and CrashReport uids may subscribe. A subscriber
+ * that didn't read the previous notification is dropped. When no
+ * subscriber got the notification, it is delivered by an "am broadcast"
+ * intent instead.
+ */
+
+#ifndef __NOTIFIER_H__
+#define __NOTIFIER_H__
+
+#define NOTIFY_SOCKET_NAME      "crashlogd.notify"
+/* Owned by the CrashReport uid */
+#define NOTIFY_CRASHREPORT_DIR  "/data/data/com.intel.crashreport"
+/* Coalescing window (in ms) */
+#define NOTIFY_WINDOW_MS        250
+/* Max number of subscribers */
+#define NOTIFY_MAX_CLIENTS      4
+/* Max number of event ids per notification */
+#define NOTIFY_MAX_IDS          32
+#define NOTIFY_ID_LEN           64
+
+typedef enum e_notify_kind {
+    NOTIFY_CRASH = 0,       /* new events in the history */
+    NOTIFY_LOGS_COPIED,     /* logs of an event are complete */
+    NOTIFY_KINDS,
+} e_notify_kind_t;
+
+int notifier_init(void);
+int notifier_get_fd(void);
+int notifier_accept(int fd, void *ctx);
+void notifier_post(e_notify_kind_t kind, const char *id);
+
+#endif /* __NOTIFIER_H__ */
@@ -25,6 +25,7 @@
 #include "inotify_handler.h"
 #include "trigger.h"
 #include "ramdump.h"
+#include "filescan.h"
 
 #include <stdlib.h>
 
@@ -33,6 +34,9 @@ typedef enum e_crashtype_mode {
     RAM_PANIC_MODE, /*< computation of ram panic crashtype */
 } e_crashtype_mode_t;
 
+/* Max number of patterns in the PROP_IPANIC_PATTERN property */
+#define APLOGS_MAX_PATTERNS     10
+
 int cfg_check_ram_panic = 1;
 
 /*
@@ -44,60 +48,59 @@ int cfg_check_ram_panic = 1;
 static int check_aplogs_tobackup(char *filename) {
     char ipanic_chain[PROPERTY_VALUE_MAX];
     int nbpatterns, res;
-    char **patterns_array_32;
-    char **patterns_array_64;
-    char *SGX_64_pattern[] = {"SGXInitialise"};
-    int idx, nbrecords = 10, recordsize = PROPERTY_VALUE_MAX;
+    char **patterns_array;
+    char (*patterns_32)[PROPERTY_VALUE_MAX];
+    struct scan_rule rules[2*APLOGS_MAX_PATTERNS];
+    char hits[DIM(rules)];
+    static const struct scan_rule SGX_rules[] = {
+        {"EIP is at SGXInitialise", NULL, NULL, NULL},
+        {"SGXInitialise", NULL, "RIP:", NULL},
+    };
+    int idx, nbrecords = APLOGS_MAX_PATTERNS, recordsize = PROPERTY_VALUE_MAX;
 
     if (property_get(PROP_IPANIC_PATTERN, ipanic_chain, "") > 0) {
         /* Found the property, split it into an array */
-        patterns_array_32 = commachain_to_fixedarray(ipanic_chain, recordsize, nbrecords, &nbpatterns);
+        patterns_array = commachain_to_fixedarray(ipanic_chain, recordsize, nbrecords, &nbpatterns);
         if (nbpatterns < 0 ) {
             LOGE("%s: Cannot transform the property %s(which is %s) into an array... error is %d - %s\n",
                 __FUNCTION__, PROP_IPANIC_PATTERN, ipanic_chain, nbpatterns, strerror(-nbpatterns));
-            for (idx = 0 ; idx < nbrecords ; idx++) {
-                free(patterns_array_32[idx]);
-            }
-            free(patterns_array_32);
+            /* The array is already released on error */
             return 0;
         }
         if ( nbpatterns == 0 ) return 0;
-        //pattern 64 bit is a copy of pattern 32 before transformation
-        patterns_array_64 = (char**)malloc(nbrecords*sizeof(char*));
-        /* Add the prepattern "EIP is at" to each of the patterns */
-        for (idx = 0 ; idx < nbpatterns ; idx++) {
-            //copy each item for 64 pattern
-            patterns_array_64[idx] = (char*)malloc(recordsize*sizeof(char));
-            strncpy(patterns_array_64[idx], patterns_array_32[idx], recordsize-1);
-            char *prepattern = "EIP is at ";
-            int prepatternlen = strlen(prepattern);
-            memmove(&patterns_array_32[idx][prepatternlen], patterns_array_32[idx],
-                MIN((int)strlen(patterns_array_32[idx])+1, PROPERTY_VALUE_MAX-prepatternlen));
-            /* insure the chain is null terminated */
-            patterns_array_32[idx][PROPERTY_VALUE_MAX-1] = 0;
-            memcpy(patterns_array_32[idx], prepattern, prepatternlen);
+        patterns_32 = malloc(nbpatterns*sizeof(*patterns_32));
+        if (!patterns_32)
+            res = 0;
+        else {
+            /* Each pattern is searched with the prepattern "EIP is at" (32 bit)
+             * or on a line containing "RIP:" (64 bit), all in a single pass */
+            for (idx = 0 ; idx < nbpatterns ; idx++) {
+                snprintf(patterns_32[idx], sizeof(patterns_32[idx]), "EIP is at %s", patterns_array[idx]);
+                rules[2*idx].keyword = patterns_32[idx];
+                rules[2*idx].tail = NULL;
+                rules[2*idx].common = NULL;
+                rules[2*idx].name = NULL;
+                rules[2*idx+1].keyword = patterns_array[idx];
+                rules[2*idx+1].tail = NULL;
+                rules[2*idx+1].common = "RIP:";
+                rules[2*idx+1].name = NULL;
+            }
+            res = (scan_file(filename, rules, 2*nbpatterns, hits) > 0);
+            free(patterns_32);
         }
-        res = (find_oneofstrings_in_file(filename, (char**)patterns_array_32, nbpatterns) ||
-                find_oneofstrings_in_file_with_keyword(filename,  (char**)patterns_array_64, "RIP:", nbpatterns));
         if (res > 0){
             LOGE("%s: before process\n", __FUNCTION__);
             process_log_event(NULL, NULL, MODE_APLOGS);
         }
         /* Cleanup the patterns_array allocated in commchain... */
         for (idx = 0 ; idx < nbrecords ; idx++) {
-            free(patterns_array_32[idx]);
-        }
-        // pattern_64 is based on nbpatterns size
-        for (idx = 0 ; idx < nbpatterns ; idx++) {
-            free(patterns_array_64[idx]);
+            free(patterns_array[idx]);
         }
-        free(patterns_array_32);
-        free(patterns_array_64);
+        free(patterns_array);
     }
     else {
         /* By default, searches for the single following pattern... */
-        res = (find_str_in_file(filename, "EIP is at SGXInitialise", NULL) ||
-                find_oneofstrings_in_file_with_keyword(filename, SGX_64_pattern, "RIP:", 1));
+        res = (scan_file(filename, SGX_rules, DIM(SGX_rules), hits) > 0);
         if (res > 0)
             process_log_event(NULL, NULL, MODE_APLOGS);
     }
@@ -105,36 +108,49 @@ static int check_aplogs_tobackup(char *filename) {
     return res;
 }
 
+enum {
+    IPANIC_SWWDT,
+    IPANIC_SWWDT_TEST,
+    IPANIC_POWER_UP_DONE,
+    IPANIC_TYPES,
+};
+
+/* Patterns searched in the panic console. Rules from IPANIC_TYPES on give
+ * the crash type by priority order when it is not a SW watchdog */
+static const struct scan_rule ipanic_rules[] = {
+    [ IPANIC_SWWDT ] = {"Kernel panic - not syncing: Kernel Watchdog", NULL, NULL, KERNEL_SWWDT_CRASH},
+    [ IPANIC_SWWDT_TEST ] = {"[SHTDWN] WATCHDOG TIMEOUT for test!", NULL, NULL, KERNEL_SWWDT_FAKE_CRASH},
+    [ IPANIC_POWER_UP_DONE ] = {"power_up_host: host controller power up is done", NULL, NULL, NULL},
+    /* This panic is triggered by a fabric error. It is marked as a kernel
+     * panic linked to a HW watchdog to create a link between these 2
+     * critical crashes */
+    [ IPANIC_TYPES ] = {"EIP is at pmu_sc_irq", NULL, NULL, KERNEL_HWWDT_CRASH},
+    {"pmu_sc_irq", NULL, "RIP:", KERNEL_HWWDT_CRASH},
+    {"EIP is at panic_dbg_set", NULL, NULL, KERNEL_FAKE_CRASH},
+    {"EIP is at kwd_trigger_open", NULL, NULL, KERNEL_FAKE_CRASH},
+    {"EIP is at kwd_trigger_write", NULL, NULL, KERNEL_FAKE_CRASH},
+    {"panic_dbg_set", NULL, "RIP:", KERNEL_FAKE_CRASH},
+    {"kwd_trigger_write", NULL, "RIP:", KERNEL_FAKE_CRASH},
+};
+
 static void set_ipanic_crashtype_and_reason(char *console_name, char *crashtype, char *reason,
         e_crashtype_mode_t mode) {
-    char *key;
-    char *fake_32_pattern[] = {"EIP is at panic_dbg_set", "EIP is at kwd_trigger_open", "EIP is at kwd_trigger_write"};
-    char *fake_64_pattern[] = {"panic_dbg_set", "kwd_trigger_write"};
-    char *hwwdt_64_pattern[] = {"pmu_sc_irq"};
-    const int size_fake_32_pattern = ( sizeof (fake_32_pattern) ) / ( sizeof fake_32_pattern[0] );
-    const int size_fake_64_pattern = ( sizeof (fake_64_pattern) ) / ( sizeof fake_64_pattern[0] );
-    const int size_hwwdt_64_pattern = ( sizeof (hwwdt_64_pattern) ) / ( sizeof hwwdt_64_pattern[0] );
+    char hits[DIM(ipanic_rules)];
+    int rule;
 
     /* Set crash type according to pattern found in Ipanic console file or according to startup reason value*/
-    if (find_str_in_file(console_name, "Kernel panic - not syncing: Kernel Watchdog", NULL) > 0) {
-        strcpy(crashtype, KERNEL_SWWDT_CRASH);
-        if (find_str_in_file(console_name, "[SHTDWN] WATCHDOG TIMEOUT for test!", NULL) > 0)
-            strcpy(crashtype, KERNEL_SWWDT_FAKE_CRASH);
-    }
-    else if (find_str_in_file(console_name, "EIP is at pmu_sc_irq", NULL) > 0 ||
-            (find_oneofstrings_in_file_with_keyword(console_name, hwwdt_64_pattern, "RIP:", size_hwwdt_64_pattern) > 0))
-        // This panic is triggered by a fabric error
-        // It is marked as a kernel panic linked to a HW watdchog
-        // to create a link between these 2 critical crashes
-        strcpy(crashtype, KERNEL_HWWDT_CRASH);
-    else if ((find_oneofstrings_in_file(console_name, fake_32_pattern,size_fake_32_pattern) > 0) ||
-            (find_oneofstrings_in_file_with_keyword(console_name, fake_64_pattern, "RIP:", size_fake_64_pattern) > 0))
-        strcpy(crashtype, KERNEL_FAKE_CRASH);
+    if (scan_file(console_name, ipanic_rules, DIM(ipanic_rules), hits) < 0)
+        memset(hits, 0, sizeof(hits));
+
+    if (hits[IPANIC_SWWDT]) {
+        rule = (hits[IPANIC_SWWDT_TEST] ? IPANIC_SWWDT_TEST : IPANIC_SWWDT);
+        strcpy(crashtype, ipanic_rules[rule].name);
+    } else if ((rule = scan_first_hit(hits, IPANIC_TYPES, DIM(ipanic_rules))) >= 0)
+        strcpy(crashtype, ipanic_rules[rule].name);
     else
         strcpy(crashtype, KERNEL_CRASH);
 
-    if ((mode == EMMC_PANIC_MODE) &&
-            (find_str_in_file(console_name, "power_up_host: host controller power up is done", NULL) <= 0)) {
+    if ((mode == EMMC_PANIC_MODE) && !hits[IPANIC_POWER_UP_DONE]) {
         // An error is raised when the panic console file does not end normally
        raise_infoerror(ERROREVENT, IPANIC_CORRUPTED);
     }
@@ -169,6 +185,7 @@ int crashlog_check_panic(char *reason, int test) {
     char crash_console_name[PATHMAX] = {'\0'};
     char crashtype[32] = {'\0'};
     int dir;
+    char *dirbase;
     int copy_to_crash = 0, copy_to_panic = 0;
     const char *dateshort = get_current_time_short(1);
     char *key;
@@ -178,13 +195,13 @@ int crashlog_check_panic(char *reason, int test) {
         return 1;
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     copy_to_crash = (dir >= 0);
     copy_to_panic = dir_exists(PANIC_DIR);
 
     if (copy_to_crash) {
         // use crash file directly
-        snprintf(crash_path, sizeof(crash_path), "%s%d/", CRASH_DIR, dir);
+        snprintf(crash_path, sizeof(crash_path), "%s%d/", dirbase, dir);
 
         // Not created here...?
         snprintf(destination_tmp_name, sizeof(destination_tmp_name),
@@ -208,7 +225,7 @@ int crashlog_check_panic(char *reason, int test) {
                     "%s%s_%s.bin", crash_path, GBUFFER_NAME, dateshort);
         do_copy_eof(PANIC_GBUFFER_NAME, destination_tmp_name);
 
-        do_last_kmsg_copy(dir);
+        do_last_kmsg_copy(dirbase, dir);
     } else {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
     }
@@ -283,6 +300,7 @@ int crashlog_check_ram_panic(char *reason) {
     char ram_console[PATHMAX] = {'\0'};
     char crashtype[32] = {'\0'};
     int dir;
+    char *dirbase;
     int copy_to_crash = 0, copy_to_panic = 0;
     const char *dateshort = get_current_time_short(1);
     char *key;
@@ -300,14 +318,14 @@ int crashlog_check_ram_panic(char *reason) {
         return 1; /* Not a PANIC : return */
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
 
     copy_to_crash = (dir >= 0);
     copy_to_panic = dir_exists(PANIC_DIR);
 
     if (copy_to_crash) {
         // use crash file directly
-        snprintf(crash_path, sizeof(crash_path), "%s%d/", CRASH_DIR, dir);
+        snprintf(crash_path, sizeof(crash_path), "%s%d/", dirbase, dir);
 
         snprintf(crash_header_name, sizeof(crash_header_name),
                     "%s%s_%s.txt", crash_path, EMMC_HEADER_NAME, dateshort);
@@ -384,6 +402,7 @@ int crashlog_check_panic_header(char *reason) {
     char destination_tmp_name[PATHMAX] = {'\0'};
     char crashtype[32] = {'\0'};
     int dir;
+    char *dirbase;
     int copy_to_crash = 0, copy_to_panic = 0;
     const char *dateshort = get_current_time_short(1);
     char *key;
@@ -393,20 +412,20 @@ int crashlog_check_panic_header(char *reason) {
         return 1;
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
 
     copy_to_crash = (dir >= 0);
     copy_to_panic = dir_exists(PANIC_DIR);
 
     if (copy_to_crash) {
         // use crash file directly
-        snprintf(crash_path, sizeof(crash_path), "%s%d/", CRASH_DIR, dir);
+        snprintf(crash_path, sizeof(crash_path), "%s%d/", dirbase, dir);
 
         snprintf(crash_header_name, sizeof(crash_header_name),
                     "%s%s_%s.txt", crash_path, EMMC_HEADER_NAME, dateshort);
         do_copy_eof(PANIC_HEADER_NAME, crash_header_name);
 
-        do_last_kmsg_copy(dir);
+        do_last_kmsg_copy(dirbase, dir);
     }
 
     // NOT exclusive with copy_to_crash
@@ -471,6 +490,7 @@ int crashlog_check_kdump(char *reason, int test) {
     char *crashtype = NULL;
     char destination[PATHMAX] = {'\0'};
     int dir;
+    char *dirbase;
     char *key;
     const char *dateshort = get_current_time_short(1);
 
@@ -499,7 +519,7 @@ int crashlog_check_kdump(char *reason, int test) {
 
     if ((curr_stat == 3) || (test == 1)) {
 
-        dir = find_new_crashlog_dir(MODE_KDUMP);
+        dir = find_new_crashlog_dir(MODE_KDUMP, &dirbase);
         if (dir < 0) {
             LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
             key = raise_event(CRASHEVENT, crashtype, NULL, NULL);
@@ -515,7 +535,7 @@ int crashlog_check_kdump(char *reason, int test) {
         }
 
         /* Copy aplogs to KDUMP crash directory */
-        do_log_copy(crashtype, dir, dateshort, KDUMP_TYPE);
+        do_log_copy(crashtype, dirbase, dir, dateshort, KDUMP_TYPE);
 
         snprintf(destination, sizeof(destination), "%s%d/", KDUMP_CRASH_DIR, dir);
         key = raise_event(CRASHEVENT, crashtype, NULL, destination);
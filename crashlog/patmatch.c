@@ -0,0 +1,206 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file patmatch.c
+ * @brief File containing the multi-pattern matcher used to dispatch events.
+ */
+
+#include "patmatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The automaton is a dense transition table. To keep it small, the bytes
+ * are mapped to classes: one per byte used in the patterns and the class 0
+ * for all the others */
+struct patmatch {
+    int nstates;
+    int nclasses;
+    unsigned char classes[256];
+    int *delta;     /* nstates * nclasses transitions */
+    int *out;       /* lowest pattern index recognized in each state, or -1 */
+    int *match;     /* pattern ending exactly in each state, or -1 */
+    int *dict;      /* next state of the failure chain with a match, or -1 */
+    int *dup;       /* next pattern equal to each pattern, or -1 */
+};
+
+/**
+ * @brief Compiles a set of patterns
+ *
+ * @param patterns: array of patterns, NULL patterns never match
+ * @param count: number of patterns
+ *
+ * @return the matcher to be freed with patmatch_free, NULL on error.
+ */
+struct patmatch *patmatch_compile(const char **patterns, int count) {
+    struct patmatch *matcher;
+    int *fail = NULL, *queue = NULL;
+    int maxstates = 1, i, c, state, next, head, tail;
+    const unsigned char *ptr;
+
+    matcher = calloc(1, sizeof(struct patmatch));
+    if (!matcher) return NULL;
+
+    matcher->nclasses = 1;
+    for (i = 0 ; i < count ; i++) {
+        if (!patterns[i]) continue;
+        for (ptr = (const unsigned char *)patterns[i] ; *ptr ; ptr++) {
+            if (!matcher->classes[*ptr] && matcher->nclasses < 256)
+                matcher->classes[*ptr] = matcher->nclasses++;
+            maxstates++;
+        }
+    }
+
+    matcher->delta = malloc(maxstates * matcher->nclasses * sizeof(int));
+    matcher->out = malloc(maxstates * sizeof(int));
+    matcher->match = malloc(maxstates * sizeof(int));
+    matcher->dict = malloc(maxstates * sizeof(int));
+    matcher->dup = malloc((count > 0 ? count : 1) * sizeof(int));
+    fail = malloc(maxstates * sizeof(int));
+    queue = malloc(maxstates * sizeof(int));
+    if (!matcher->delta || !matcher->out || !matcher->match || !matcher->dict ||
+            !matcher->dup || !fail || !queue)
+        goto error;
+    memset(matcher->delta, -1, maxstates * matcher->nclasses * sizeof(int));
+    memset(matcher->out, -1, maxstates * sizeof(int));
+    memset(matcher->match, -1, maxstates * sizeof(int));
+    memset(matcher->dict, -1, maxstates * sizeof(int));
+    memset(matcher->dup, -1, (count > 0 ? count : 1) * sizeof(int));
+
+    /* Build the trie of the patterns */
+    matcher->nstates = 1;
+    for (i = 0 ; i < count ; i++) {
+        if (!patterns[i]) continue;
+        state = 0;
+        for (ptr = (const unsigned char *)patterns[i] ; *ptr ; ptr++) {
+            next = matcher->delta[state * matcher->nclasses + matcher->classes[*ptr]];
+            if (next < 0) {
+                next = matcher->nstates++;
+                matcher->delta[state * matcher->nclasses + matcher->classes[*ptr]] = next;
+            }
+            state = next;
+        }
+        if (matcher->out[state] < 0)
+            matcher->out[state] = matcher->match[state] = i;
+        else {
+            /* Same pattern as a previous one, chain it */
+            for (next = matcher->match[state] ; matcher->dup[next] >= 0 ; next = matcher->dup[next]);
+            matcher->dup[next] = i;
+        }
+    }
+
+    /* Turn it into an automaton, level by level */
+    head = tail = 0;
+    for (c = 0 ; c < matcher->nclasses ; c++) {
+        next = matcher->delta[c];
+        if (next < 0)
+            matcher->delta[c] = 0;
+        else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        state = queue[head++];
+        /* A state also recognizes the patterns of its failure state */
+        if (matcher->out[fail[state]] >= 0 &&
+                (matcher->out[state] < 0 || matcher->out[fail[state]] < matcher->out[state]))
+            matcher->out[state] = matcher->out[fail[state]];
+        matcher->dict[state] = (matcher->match[fail[state]] >= 0 ? fail[state] : matcher->dict[fail[state]]);
+        for (c = 0 ; c < matcher->nclasses ; c++) {
+            next = matcher->delta[state * matcher->nclasses + c];
+            if (next < 0)
+                matcher->delta[state * matcher->nclasses + c] =
+                    matcher->delta[fail[state] * matcher->nclasses + c];
+            else {
+                fail[next] = matcher->delta[fail[state] * matcher->nclasses + c];
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return matcher;
+
+error:
+    free(fail);
+    free(queue);
+    patmatch_free(matcher);
+    return NULL;
+}
+
+/**
+ * @brief Finds the first pattern contained in a text
+ *
+ * @return the index of the first pattern (in the compiled set order) found
+ * in text, -1 if none is found.
+ */
+int patmatch_first(const struct patmatch *matcher, const char *text) {
+    const unsigned char *ptr = (const unsigned char *)text;
+    int state = 0, best = matcher->out[0];
+
+    while (*ptr && best != 0) {
+        state = matcher->delta[state * matcher->nclasses + matcher->classes[*ptr++]];
+        if (matcher->out[state] >= 0 && (best < 0 || matcher->out[state] < best))
+            best = matcher->out[state];
+    }
+    return best;
+}
+
+/**
+ * @brief Reports every occurrence of the patterns in a buffer
+ *
+ * The buffer does not need to be null terminated. Overlapping occurrences
+ * are all reported, in the order of their end offset; equal patterns are
+ * reported in the compiled set order.
+ *
+ * @return 0 when the whole buffer is scanned, the non-zero value returned
+ * by callback otherwise.
+ */
+int patmatch_scan(const struct patmatch *matcher, const char *text, size_t len,
+        patmatch_callback callback, void *ctx) {
+    const unsigned char *ptr = (const unsigned char *)text;
+    size_t pos;
+    int state = 0, found, pattern, ret;
+
+    for (pos = 0 ; pos < len ; pos++) {
+        state = matcher->delta[state * matcher->nclasses + matcher->classes[ptr[pos]]];
+        if (matcher->out[state] < 0)
+            continue;
+        for (found = state ; found >= 0 ; found = matcher->dict[found]) {
+            if (matcher->match[found] < 0)
+                continue;
+            for (pattern = matcher->match[found] ; pattern >= 0 ; pattern = matcher->dup[pattern]) {
+                ret = callback(pattern, pos + 1, ctx);
+                if (ret)
+                    return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+void patmatch_free(struct patmatch *matcher) {
+    if (!matcher) return;
+    free(matcher->delta);
+    free(matcher->out);
+    free(matcher->match);
+    free(matcher->dict);
+    free(matcher->dup);
+    free(matcher);
+}
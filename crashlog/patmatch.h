@@ -0,0 +1,46 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file patmatch.h
+ * @brief File containing the multi-pattern matcher used to dispatch events.
+ *
+ * A set of patterns is compiled once into an Aho-Corasick automaton. A text
+ * is then scanned in a single pass, whatever the number of patterns, to find
+ * the first pattern of the set (in the set order) that the text contains.
+ * This gives the same result as calling strstr() on each pattern in turn.
+ * The automaton can also report every occurrence of every pattern in a
+ * buffer, to evaluate many rules over a whole file in a single pass.
+ */
+
+#ifndef __PATMATCH_H__
+#define __PATMATCH_H__
+
+#include <stddef.h>
+
+struct patmatch;
+
+/* Called for each occurrence found by patmatch_scan, end is the offset
+ * following the occurrence. A non-zero return value stops the scan. */
+typedef int (*patmatch_callback)(int pattern, size_t end, void *ctx);
+
+struct patmatch *patmatch_compile(const char **patterns, int count);
+int patmatch_first(const struct patmatch *matcher, const char *text);
+int patmatch_scan(const struct patmatch *matcher, const char *text, size_t len,
+        patmatch_callback callback, void *ctx);
+void patmatch_free(struct patmatch *matcher);
+
+#endif /* __PATMATCH_H__ */
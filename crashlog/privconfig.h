@@ -43,9 +43,23 @@
 #define MAXPATHSIZE             (512)
 /* find_str_in_file was implemented with 4KB*/
 #define MAXLINESIZE             MAX((2 * PROPERTY_VALUE_MAX), (4 * KB))
-#define CPBUFFERSIZE            (4*KB)
+#define CPBUFFERSIZE            (128*KB)
 #define SIZE_FOOTPRINT_MAX      ((PROPERTY_VALUE_MAX + 1) * 11)
 #define TIMEOUT_VALUE           (20*1000)
+/* A file closed by its writer, or unchanged for STABLE_QUIET_MS (in ms),
+ * is complete. The quiet window covers the pauses of a writer dumping a
+ * report in several steps */
+#define STABLE_QUIET_MS         500
+/* Max wait (in ms) for a file still being written */
+#define STABLE_DEADLINE_MS      2000
+/* Max wait (in ms) for a modem core dump archive still being written */
+#define COREDUMP_DEADLINE_MS    30000
+/* Max wait (in ms) for the logs of an event to reach the aplog, which is
+ * never closed by logcat: it is only given a short pause (in ms) */
+#define LOG_SETTLE_MS           (TIMEOUT_VALUE / 1000)
+#define LOG_QUIET_MS            10
+/* A directory copied by copy_dir() is complete once unchanged for this long (in ms) */
+#define COPY_DIR_QUIET_MS       5000
 #define MAX_WAIT_MMGR_CONNECT_SECONDS  5
 #define MMGR_CONNECT_RETRY_TIME_MS     200
 #define CMDSIZE_MAX             ((21*20) + 1)
@@ -91,6 +105,7 @@
 #define CRASHLOG_ERROR_DEAD     "CRASHLOG_DEAD"
 #define CRASHLOG_ERROR_PATH     "CRASHLOG_PATH"
 #define CRASHLOG_ERROR_FULL     "LOG_PARTITION_FULL"
+#define CRASHLOG_ERROR_QUEUE    "EVENT_QUEUE_FULL"
 #define CRASHLOG_SWWDT_MISSING  "SWWDT_MISSING"
 #define SYSSERVER_EVNAME        "UIWDT"
 #define ANR_EVNAME              "ANR"
@@ -112,6 +127,7 @@
 #define EXTRA_NAME              "EXTRA"
 #define NOTIFY_CONF_PATTERN     "INOTIFY"
 #define GENERAL_CONF_PATTERN    "GENERAL"
+#define ADMISSION_CONF_PATTERN  "ADMISSION"
 #define MPANIC_ABORT            "COREDUMP_ABORTED_BY_PLATFORM_SHUTDOWN"
 #define CRASHLOG_WATCHER_ERROR  "CRASHLOG_WATCHER"
 #define RAMCONSOLE              "RAMCONSOLE"
@@ -285,6 +301,16 @@ extern enum crashlog_mode g_crashlog_mode;
 #define PROP_SOC_VERSION        "ro.board.platform"
 #define PROP_REPORT_FAKE        "crashreport.events.fake"
 #define PROP_REPORT_COUNTDOWN   "crashreport.events.countdown"
+#define PROP_COMPRESS_LEVEL     "persist.crashlogd.compress.level"
+#define PROP_COMPRESS_FORMAT    "persist.crashlogd.compress.format"
+#define PROP_COMPRESS_LOGS      "persist.crashlogd.compress.logs"
+#define PROP_RETENTION_CRASH    "persist.crashlogd.retention.crash"
+#define PROP_RETENTION_STATS    "persist.crashlogd.retention.stats"
+#define PROP_RETENTION_APLOGS   "persist.crashlogd.retention.aplogs"
+#define PROP_RETENTION_BZ       "persist.crashlogd.retention.bz"
+#define PROP_RETENTION_AGE      "persist.crashlogd.retention.age"
+#define PROP_STORM_WINDOW       "persist.crashlogd.storm.window"
+#define PROP_STORM_BURST        "persist.crashlogd.storm.burst"
 
 /* DIRECTORIES */
 #ifndef __LINUX__
@@ -297,6 +323,7 @@ extern enum crashlog_mode g_crashlog_mode;
 #define PROC_DIR                RESDIR "/proc"
 #define DATA_DIR                RESDIR "/data"
 #define SYS_DIR                 RESDIR "/system"
+#define LOGGER_DIR              RESDIR "/dev/log"
 #define CACHE_DIR               RESDIR "/cache"
 #define PSTORE_DIR              RESDIR "/pstore"
 #define DEBUGFS_DIR             RESDIR "/d"
@@ -318,13 +345,14 @@ extern enum crashlog_mode g_crashlog_mode;
 #define SYS_SPID_DIR            RESDIR "/sys/spid"
 #define LOGS_MEDIA_DIR          DATA_DIR "/media/logs"
 #define KDUMP_DIR               LOGS_MEDIA_DIR "/kdump"
-#define SDSIZE_CURRENT_LOG      LOGS_DIR "/currentsdsize"
 #define REBOOT_DIR              DEBUGFS_DIR "/intel_scu_osnib"
 #define EVENTS_DIR              LOGS_DIR "/events"
 
 /* FILES */
 #define SYS_PROP                SYS_DIR "/build.prop"
+#define EVENT_LOG_TAGS          SYS_DIR "/etc/event-log-tags"
 #define HISTORY_FILE            LOGS_DIR "/history_event"
+#define HISTORY_RING_FILE       LOGS_DIR "/history_event.ring"
 #define UPTIME_FILE             LOGS_DIR "/uptime"
 #define BZ_CURRENT_LOG          LOGS_DIR "/currentbzlog"
 #define CRASH_CURRENT_LOG       LOGS_DIR "/currentcrashlog"
@@ -419,9 +447,6 @@ extern enum crashlog_mode g_crashlog_mode;
 #define MIN(a,b)                ((a) < (b) ? (a) : (b))
 #define MAX(a,b)                ((a) > (b) ? (a) : (b))
 
-/* SYSTEM COMMANDS */
-#define SDSIZE_SYSTEM_CMD "du -sk /mnt/sdcard/logs/ > /logs/currentsdsize"
-
 extern char *CRASH_DIR;
 extern char *STATS_DIR;
 extern char *APLOGS_DIR;
@@ -0,0 +1,192 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file propcache.c
+ * @brief File containing the cache of the system properties read per event.
+ */
+
+#include "propcache.h"
+#include "privconfig.h"
+
+#include <cutils/properties.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct propcache_entry {
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    long long stamp;        /* read time in ms, 0 if invalid */
+};
+
+static struct propcache_entry entries[PROPCACHE_SIZE];
+static int next_victim = 0;
+static pthread_mutex_t propcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + 1;
+}
+
+/* Returns the entry of key, NULL if not cached. propcache_lock shall be held */
+static struct propcache_entry *lookup(const char *key) {
+    int i;
+
+    for (i = 0 ; i < PROPCACHE_SIZE ; i++)
+        if (entries[i].key[0] && !strncmp(entries[i].key, key, PROPERTY_KEY_MAX))
+            return &entries[i];
+    return NULL;
+}
+
+/* Returns the entry to store key in. propcache_lock shall be held */
+static struct propcache_entry *allocate(const char *key) {
+    struct propcache_entry *entry;
+    int i;
+
+    for (i = 0 ; i < PROPCACHE_SIZE ; i++)
+        if (!entries[i].key[0])
+            break;
+    if (i == PROPCACHE_SIZE) {
+        i = next_victim;
+        next_victim = (next_victim + 1) % PROPCACHE_SIZE;
+    }
+    entry = &entries[i];
+    strncpy(entry->key, key, PROPERTY_KEY_MAX - 1);
+    entry->key[PROPERTY_KEY_MAX - 1] = 0;
+    entry->stamp = 0;
+    return entry;
+}
+
+static int is_fresh(const struct propcache_entry *entry, long long now) {
+    if (!entry->stamp)
+        return 0;
+    if (!strncmp(entry->key, "ro.", 3))
+        return 1;
+    return (now - entry->stamp < PROPCACHE_TTL_MS);
+}
+
+/**
+ * @brief Reads a property through the cache
+ *
+ * Same interface as property_get: an empty or missing property is reported
+ * with def (an empty string if def is NULL).
+ *
+ * @return the length of the value
+ */
+int propcache_get(const char *key, char *value, const char *def) {
+    struct propcache_entry *entry;
+    char fresh[PROPERTY_VALUE_MAX];
+    long long now = now_ms();
+
+    if (!key || !value)
+        return -1;
+
+    pthread_mutex_lock(&propcache_lock);
+    entry = lookup(key);
+    if (entry && is_fresh(entry, now)) {
+        strcpy(value, entry->value);
+        pthread_mutex_unlock(&propcache_lock);
+    } else {
+        pthread_mutex_unlock(&propcache_lock);
+
+        if (property_get((char *)key, fresh, "") <= 0)
+            fresh[0] = 0;
+        strcpy(value, fresh);
+
+        pthread_mutex_lock(&propcache_lock);
+        entry = lookup(key);
+        if (!entry)
+            entry = allocate(key);
+        strcpy(entry->value, fresh);
+        entry->stamp = now;
+        pthread_mutex_unlock(&propcache_lock);
+    }
+
+    if (!value[0] && def) {
+        strncpy(value, def, PROPERTY_VALUE_MAX - 1);
+        value[PROPERTY_VALUE_MAX - 1] = 0;
+    }
+    return strlen(value);
+}
+
+/**
+ * @brief Reads an integer property through the cache
+ *
+ * @return the value, def if the property is empty
+ */
+int propcache_get_int(const char *key, int def) {
+    char value[PROPERTY_VALUE_MAX];
+
+    if (propcache_get(key, value, NULL) <= 0)
+        return def;
+    return atoi(value);
+}
+
+/**
+ * @brief Checks the value of a property through the cache
+ *
+ * @return 1 if the property is set and starts with expected, 0 otherwise
+ */
+int propcache_is(const char *key, const char *expected) {
+    char value[PROPERTY_VALUE_MAX];
+
+    if (propcache_get(key, value, NULL) <= 0)
+        return 0;
+    return !strncmp(value, expected, strlen(expected));
+}
+
+/**
+ * @brief Sets a property and updates its cached value
+ *
+ * @return the property_set result
+ */
+int propcache_set(const char *key, const char *value) {
+    struct propcache_entry *entry;
+    int ret;
+
+    ret = property_set((char *)key, (char *)value);
+
+    pthread_mutex_lock(&propcache_lock);
+    entry = lookup(key);
+    if (entry) {
+        if (ret == 0 && value) {
+            strncpy(entry->value, value, PROPERTY_VALUE_MAX - 1);
+            entry->value[PROPERTY_VALUE_MAX - 1] = 0;
+            entry->stamp = now_ms();
+        } else
+            entry->stamp = 0;
+    }
+    pthread_mutex_unlock(&propcache_lock);
+    return ret;
+}
+
+/**
+ * @brief Drops the cached values, the next reads go to the property service
+ */
+void propcache_invalidate(void) {
+    int i;
+
+    pthread_mutex_lock(&propcache_lock);
+    for (i = 0 ; i < PROPCACHE_SIZE ; i++)
+        entries[i].stamp = 0;
+    pthread_mutex_unlock(&propcache_lock);
+}
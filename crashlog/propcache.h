@@ -0,0 +1,43 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file propcache.h
+ * @brief File containing the cache of the system properties read per event.
+ *
+ * Reading a property is an IPC with the property service. The values read
+ * while processing the events are kept in a small cache: read-only ("ro.")
+ * properties are read once, the others are read again once their value is
+ * older than PROPCACHE_TTL_MS. Properties set by crashlogd through
+ * propcache_set() are updated in the cache at once.
+ */
+
+#ifndef __PROPCACHE_H__
+#define __PROPCACHE_H__
+
+/* Max number of cached properties */
+#define PROPCACHE_SIZE          32
+/* Validity (in ms) of a cached value */
+#define PROPCACHE_TTL_MS        1000
+
+int propcache_get(const char *key, char *value, const char *def);
+int propcache_get_int(const char *key, int def);
+int propcache_is(const char *key, const char *expected);
+int propcache_set(const char *key, const char *value);
+void propcache_invalidate(void);
+
+#endif /* __PROPCACHE_H__ */
@@ -48,10 +48,11 @@ int crashlog_check_ramdump(const char * reason)
     char destination[PATHMAX] = {'\0'};
     char *crashtype = RAMDUMP_EVENT;
     int dir;
+    char *dirbase;
     const char *dateshort = get_current_time_short(1);
     char *key;
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, crashtype, NULL, NULL);
@@ -65,7 +66,7 @@ int crashlog_check_ramdump(const char * reason)
              __FUNCTION__, LM_DUMP_FILE, strerror(errno) );
     else {
         snprintf(destination, sizeof(destination), "%s%d/%s_%s.bin",
-                 CRASH_DIR, dir, SAVED_LM_BUFFER_NAME, dateshort);
+                 dirbase, dir, SAVED_LM_BUFFER_NAME, dateshort);
         do_copy_eof(LM_DUMP_FILE, destination);
     }
 
@@ -75,22 +76,22 @@ int crashlog_check_ramdump(const char * reason)
     else {
        destination[0] = '\0';
        snprintf(destination, sizeof(destination), "%s%d/%s_%s.txt",
-                CRASH_DIR, dir, SAVED_LBR_BUFFER_NAME, dateshort);
+                dirbase, dir, SAVED_LBR_BUFFER_NAME, dateshort);
        do_copy_eof(LBR_DUMP_FILE, destination);
     }
 
-    do_last_kmsg_copy(dir);
+    do_last_kmsg_copy(dirbase, dir);
 
     /* If startup reason contains "WDT_" without "FAKE", retrieve WDT crash event context */
     if (strstr(reason, "WDT_") && !strstr(reason, "FAKE")) {
-        snprintf(destination, sizeof(destination), "%s%d/", CRASH_DIR, dir);
-        flush_aplog(APLOG_BOOT, "WDT", &dir, get_current_time_short(0));
-        usleep(TIMEOUT_VALUE);
-        do_log_copy("WDT", dir, get_current_time_short(0), APLOG_TYPE);
+        snprintf(destination, sizeof(destination), "%s%d/", dirbase, dir);
+        flush_aplog(APLOG_BOOT, "WDT", dirbase, &dir, get_current_time_short(0));
+        wait_aplog_flushed();
+        do_log_copy("WDT", dirbase, dir, get_current_time_short(0), APLOG_TYPE);
     }
 
     destination[0] = '\0';
-    snprintf(destination, sizeof(destination), "%s%d/", CRASH_DIR, dir);
+    snprintf(destination, sizeof(destination), "%s%d/", dirbase, dir);
     key = raise_event(CRASHEVENT, crashtype, NULL, destination);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0),
             crashtype, destination);
@@ -0,0 +1,206 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file reactor.c
+ * @brief File containing the event reactor driving the crashlogd main loop.
+ */
+
+#include "reactor.h"
+#include "privconfig.h"
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+struct reactor_source {
+    int fd;
+    const char *name;
+    reactor_handler handler;
+    void *ctx;
+};
+
+static struct reactor_source sources[REACTOR_MAX_SOURCES];
+static int epoll_fd = -1;
+
+static struct reactor_source *get_source(int fd) {
+    int i;
+
+    for (i = 0 ; i < REACTOR_MAX_SOURCES ; i++) {
+        if (sources[i].handler && sources[i].fd == fd)
+            return &sources[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Initializes the reactor
+ *
+ * Creates the epoll instance.
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int reactor_init(void) {
+    if (epoll_fd >= 0)
+        return 0;
+
+    memset(sources, 0, sizeof(sources));
+    epoll_fd = epoll_create(REACTOR_MAX_SOURCES);
+    if (epoll_fd < 0) {
+        LOGE("%s: epoll_create failed - %s\n", __FUNCTION__, strerror(errno));
+        return -errno;
+    }
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/**
+ * @brief Registers a new source in the reactor
+ *
+ * The file descriptor is switched to non-blocking mode as required by the
+ * edge-triggered watching.
+ *
+ * @param fd of the source
+ * @param name of the source, used for logging
+ * @param handler called each time data is available on fd
+ * @param ctx given back to handler
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int reactor_add_source(int fd, const char *name, reactor_handler handler, void *ctx) {
+    struct epoll_event ev;
+    int i, flags;
+
+    if (fd < 0 || !handler) return -EINVAL;
+    if (epoll_fd < 0) return -EBADF;
+    if (get_source(fd)) return -EEXIST;
+
+    for (i = 0 ; i < REACTOR_MAX_SOURCES ; i++) {
+        if (!sources[i].handler)
+            break;
+    }
+    if (i == REACTOR_MAX_SOURCES) {
+        LOGE("%s: no more room for source %s\n", __FUNCTION__, name);
+        return -ENOSPC;
+    }
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOGE("%s: cannot set %s non blocking - %s\n", __FUNCTION__, name, strerror(errno));
+        return -errno;
+    }
+
+    sources[i].fd = fd;
+    sources[i].name = name;
+    sources[i].handler = handler;
+    sources[i].ctx = ctx;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &sources[i];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("%s: cannot watch %s - %s\n", __FUNCTION__, name, strerror(errno));
+        sources[i].handler = NULL;
+        return -errno;
+    }
+    LOGI("%s: source %s registered (fd %d)\n", __FUNCTION__, name, fd);
+    return 0;
+}
+
+/**
+ * @brief Unregisters a source from the reactor
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int reactor_del_source(int fd) {
+    struct reactor_source *source = get_source(fd);
+
+    if (!source) return -ENOENT;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    LOGI("%s: source %s unregistered (fd %d)\n", __FUNCTION__, source->name, fd);
+    source->handler = NULL;
+    source->fd = -1;
+    return 0;
+}
+
+/**
+ * @brief Calls the handler of a ready source until it is drained
+ *
+ * To prevent a flooding source from starving the others, the source is
+ * re-armed once its budget is spent so that epoll reports it again on the
+ * next loop.
+ */
+static void dispatch(struct reactor_source *source, unsigned int events) {
+    int i, ret = 0;
+    struct epoll_event ev;
+
+    for (i = 0 ; i < REACTOR_DRAIN_BUDGET ; i++) {
+        ret = source->handler(source->fd, source->ctx);
+        if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+            break;
+        /* The handler may have unregistered its own source */
+        if (!source->handler)
+            return;
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        LOGE("%s: source %s hung up, stop watching it\n", __FUNCTION__, source->name);
+        reactor_del_source(source->fd);
+    } else if (i == REACTOR_DRAIN_BUDGET) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = source;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, source->fd, &ev);
+    }
+}
+
+/**
+ * @brief Reactor main loop
+ *
+ * Waits for sources to be ready and dispatches them to their handler.
+ *
+ * @return -1 when the loop can't go on.
+ */
+int reactor_run(void) {
+    struct epoll_event events[REACTOR_MAX_SOURCES];
+    int nfds, i;
+
+    if (epoll_fd < 0) {
+        LOGE("%s: reactor is not initialized\n", __FUNCTION__);
+        return -1;
+    }
+
+    for (;;) {
+        nfds = epoll_wait(epoll_fd, events, REACTOR_MAX_SOURCES, -1);
+        if (nfds < 0) {
+            if (errno == EINTR) // Interrupted, need to recycle
+                continue;
+            LOGE("%s: epoll_wait failed - %s\n", __FUNCTION__, strerror(errno));
+            return -1;
+        }
+        for (i = 0 ; i < nfds ; i++) {
+            struct reactor_source *source = events[i].data.ptr;
+
+            if (source->handler)
+                dispatch(source, events[i].events);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file reactor.h
+ * @brief File containing the event reactor driving the crashlogd main loop.
+ *
+ * Every event source (file system watcher, modem manager pipe, kernel netlink
+ * socket...) registers its file descriptor and a handler. Sources are watched
+ * by a single epoll instance in edge-triggered mode, so the reactor calls the
+ * handler of a ready source repeatedly until the handler reports the source
+ * is drained.
+ * crashlogd does not fork children of its own: the ones of system() or
+ * popen() calls are waited for by their caller.
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+/* Max number of sources the reactor can watch */
+#define REACTOR_MAX_SOURCES     16
+/* Max number of handler calls on one source before giving a turn to others */
+#define REACTOR_DRAIN_BUDGET    64
+
+/* The handler API is:
+ * returns -EAGAIN (or -EWOULDBLOCK) when there is nothing left to read
+ * returns any other value once one unit of data has been consumed; a negative
+ * value reports a processing error, the reactor keeps draining the source
+ */
+typedef int (*reactor_handler) (int fd, void *ctx);
+
+int reactor_init(void);
+int reactor_add_source(int fd, const char *name, reactor_handler handler, void *ctx);
+int reactor_del_source(int fd);
+int reactor_run(void);
+
+#endif /* __REACTOR_H__ */
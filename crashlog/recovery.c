@@ -28,6 +28,7 @@
 int crashlog_check_recovery() {
     char destination[PATHMAX];
     int dir;
+    char *dirbase;
     char *key;
 
     //Check if trigger file exists
@@ -36,7 +37,7 @@ int crashlog_check_recovery() {
         return 0;
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, RECOVERY_ERROR, NULL, NULL);
@@ -48,12 +49,12 @@ int crashlog_check_recovery() {
 
     //copy log
     destination[0] = '\0';
-    snprintf(destination, sizeof(destination), "%s%d/%s", CRASH_DIR, dir, "recovery_last_log");
+    snprintf(destination, sizeof(destination), "%s%d/%s", dirbase, dir, "recovery_last_log");
     if (do_copy(RECOVERY_ERROR_LOG, destination, MAXFILESIZE) < 0)
         LOGE("%s: %s copy failed", __FUNCTION__, RECOVERY_ERROR_LOG);
-    do_last_kmsg_copy(dir);
+    do_last_kmsg_copy(dirbase, dir);
     destination[0] = '\0';
-    snprintf(destination, sizeof(destination), "%s%d/", CRASH_DIR, dir);
+    snprintf(destination, sizeof(destination), "%s%d/", dirbase, dir);
     key = raise_event(CRASHEVENT, RECOVERY_ERROR, NULL, destination);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), RECOVERY_ERROR, destination);
     remove(RECOVERY_ERROR_TRIGGER);
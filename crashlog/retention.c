@@ -0,0 +1,421 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file retention.c
+ * @brief File containing the retention manager of the eMMC crash directories.
+ */
+
+#include "retention.h"
+#include "fsutils.h"
+#include "usage.h"
+#include "privconfig.h"
+
+#include <cutils/properties.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+enum retention_class {
+    RETENTION_CRASH = 0,
+    RETENTION_STATS,
+    RETENTION_APLOGS,
+    RETENTION_BZ,
+    RETENTION_CLASSES
+};
+
+/* Eviction priorities, the lowest is evicted first */
+enum retention_priority {
+    PRIORITY_LOW = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_HIGH,
+};
+
+struct slot_record {
+    long long bytes;
+    time_t mtime;           /* last update of the slot */
+    time_t allocated;       /* allocation time during this run, 0 if none */
+    unsigned char present;
+    unsigned char indexed;  /* size and priority are known */
+    unsigned char priority;
+    unsigned int gen;       /* bumped on each allocation or eviction */
+};
+
+struct retention_class_info {
+    const char *dir;
+    char *prop;
+    long long budget;       /* bytes, 0 for no limit */
+    struct slot_record slots[MAX_DIRS];
+};
+
+static struct retention_class_info classes[RETENTION_CLASSES] = {
+    [RETENTION_CRASH] = { EMMC_CRASH_DIR, PROP_RETENTION_CRASH, 0, {{0}} },
+    [RETENTION_STATS] = { EMMC_STATS_DIR, PROP_RETENTION_STATS, 0, {{0}} },
+    [RETENTION_APLOGS] = { EMMC_APLOGS_DIR, PROP_RETENTION_APLOGS, 0, {{0}} },
+    [RETENTION_BZ] = { EMMC_BZ_DIR, PROP_RETENTION_BZ, 0, {{0}} },
+};
+
+/* Events whose slots are evicted last */
+static const char *high_priority_types[] = {
+    KERNEL_CRASH, MDMCRASH_EVNAME, KDUMP_CRASH, FABRIC_ERROR,
+};
+
+static pthread_mutex_t retention_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t retention_cond = PTHREAD_COND_INITIALIZER;
+static int retention_kicked = 0;
+static time_t max_age = 0;
+
+static int slot_count(void) {
+    return (gmaxfiles > 0 && gmaxfiles < MAX_DIRS ? gmaxfiles : MAX_DIRS);
+}
+
+static int get_prop_long(char *prop, long long *value) {
+    char buffer[PROPERTY_VALUE_MAX];
+
+    if (property_get(prop, buffer, "0") <= 0)
+        return -ENOENT;
+    *value = atoll(buffer);
+    if (*value < 0)
+        *value = 0;
+    return 0;
+}
+
+static void load_limits(void) {
+    long long value;
+    int i;
+
+    pthread_mutex_lock(&retention_lock);
+    for (i = 0 ; i < RETENTION_CLASSES ; i++)
+        if (get_prop_long(classes[i].prop, &value) == 0)
+            classes[i].budget = value * KB;
+    if (get_prop_long(PROP_RETENTION_AGE, &value) == 0)
+        max_age = (time_t)value * 24 * 3600;
+    pthread_mutex_unlock(&retention_lock);
+}
+
+static int slot_priority(int cls, const char *path) {
+    struct line_reader reader;
+    char crashfile[PATHMAX];
+    char line[MAXLINESIZE];
+    int priority = PRIORITY_NORMAL;
+    unsigned int i;
+
+    if (cls == RETENTION_APLOGS || cls == RETENTION_STATS)
+        return PRIORITY_LOW;
+
+    snprintf(crashfile, sizeof(crashfile), "%s/%s", path, CRASHFILE_NAME);
+    if (line_reader_open(&reader, crashfile) < 0)
+        return priority;
+    while (line_reader_next(&reader, line) > 0) {
+        if (strncmp(line, "TYPE=", 5))
+            continue;
+        for (i = 0 ; i < DIM(high_priority_types) ; i++)
+            if (!strncmp(line + 5, high_priority_types[i], strlen(high_priority_types[i])) &&
+                    !strstr(line, "FAKE"))
+                priority = PRIORITY_HIGH;
+        break;
+    }
+    line_reader_close(&reader);
+    return priority;
+}
+
+/* Measures a slot. Returns 1 if it was indexed */
+static int index_slot(int cls, int slot, time_t now) {
+    struct slot_record *record = &classes[cls].slots[slot];
+    struct slot_record found;
+    struct stat info;
+    char path[PATHMAX];
+    time_t allocated;
+    unsigned int gen;
+
+    pthread_mutex_lock(&retention_lock);
+    allocated = record->allocated;
+    gen = record->gen;
+    if (record->indexed || (allocated && now - allocated < RETENTION_SETTLE)) {
+        pthread_mutex_unlock(&retention_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&retention_lock);
+
+    memset(&found, 0, sizeof(found));
+    snprintf(path, sizeof(path), "%s%d", classes[cls].dir, slot);
+    if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+        found.present = 1;
+        found.bytes = usage_tree_bytes(path);
+        found.mtime = info.st_mtime;
+        found.priority = slot_priority(cls, path);
+    }
+
+    pthread_mutex_lock(&retention_lock);
+    /* Skip the result if the slot was reallocated or evicted meanwhile */
+    if (record->gen == gen) {
+        found.allocated = allocated;
+        found.indexed = 1;
+        found.gen = gen;
+        *record = found;
+    }
+    pthread_mutex_unlock(&retention_lock);
+    return 1;
+}
+
+/* Returns the slot to evict first in a class (all classes if cls is -1),
+ * -1 if none. retention_lock shall be held */
+static int pick_victim(int cls, int max_priority, time_t oldest, int *victim_cls) {
+    struct slot_record *record, *best = NULL;
+    int i, slot, victim = -1;
+
+    for (i = 0 ; i < RETENTION_CLASSES ; i++) {
+        if (cls >= 0 && i != cls)
+            continue;
+        for (slot = 0 ; slot < slot_count() ; slot++) {
+            record = &classes[i].slots[slot];
+            if (!record->present || !record->indexed ||
+                    record->priority > max_priority ||
+                    (oldest && record->mtime >= oldest))
+                continue;
+            if (!best || record->priority < best->priority ||
+                    (record->priority == best->priority && record->mtime < best->mtime)) {
+                best = record;
+                victim = slot;
+                *victim_cls = i;
+            }
+        }
+    }
+    return victim;
+}
+
+/* Evicts a slot. retention_lock shall be held, it is released meanwhile.
+ * The slot is renamed under the lock, so an allocation of the same slot
+ * can't be removed, then deleted out of the lock. Returns the bytes
+ * released */
+static long long evict_slot(int cls, int slot, int sync) {
+    struct slot_record *record = &classes[cls].slots[slot];
+    char path[PATHMAX], tombstone[PATHMAX];
+    long long bytes = record->bytes;
+    int res;
+
+    snprintf(path, sizeof(path), "%s%d", classes[cls].dir, slot);
+    LOGI("%s: evicting %s (%lld KB)\n", __FUNCTION__, path, bytes / KB);
+    res = rmfr_bury(path, tombstone, sizeof(tombstone));
+    if (res < 0 && res != -ENOENT) {
+        LOGW("%s: Cannot rename %s - %s\n", __FUNCTION__, path, strerror(-res));
+        rmfr(path);
+    }
+    record->present = 0;
+    record->bytes = 0;
+    record->gen++;
+    if (res < 0)
+        return bytes;
+
+    pthread_mutex_unlock(&retention_lock);
+    if (sync)
+        rmfr(tombstone);
+    else
+        rmfr_tombstone(tombstone);
+    pthread_mutex_lock(&retention_lock);
+    return bytes;
+}
+
+static long long class_bytes(int cls) {
+    long long total = 0;
+    int slot;
+
+    for (slot = 0 ; slot < slot_count() ; slot++)
+        if (classes[cls].slots[slot].present)
+            total += classes[cls].slots[slot].bytes;
+    return total;
+}
+
+static long long free_kb(void) {
+    struct statvfs info;
+
+    if (statvfs(LOGS_DIR, &info) < 0)
+        return -1;
+    return (long long)info.f_bavail * info.f_frsize / KB;
+}
+
+/* Evicts the slots over the limits, at most RETENTION_EVICT_MAX */
+static void enforce_limits(time_t now) {
+    long long needed;
+    int cls, slot, victim_cls, evicted = 0;
+
+    pthread_mutex_lock(&retention_lock);
+    /* Age limit */
+    while (max_age && evicted < RETENTION_EVICT_MAX &&
+            (slot = pick_victim(-1, PRIORITY_NORMAL, now - max_age, &victim_cls)) >= 0) {
+        evict_slot(victim_cls, slot, 0);
+        evicted++;
+    }
+    /* Budgets */
+    for (cls = 0 ; cls < RETENTION_CLASSES ; cls++) {
+        while (classes[cls].budget && evicted < RETENTION_EVICT_MAX &&
+                class_bytes(cls) > classes[cls].budget &&
+                (slot = pick_victim(cls, PRIORITY_NORMAL, 0, &victim_cls)) >= 0) {
+            evict_slot(victim_cls, slot, 0);
+            evicted++;
+        }
+    }
+    pthread_mutex_unlock(&retention_lock);
+
+    /* Free space reserve, the deferred deletions free it later on */
+    needed = free_kb();
+    if (needed < 0)
+        return;
+    needed = (RETENTION_RESERVE_KB - needed) * KB;
+    pthread_mutex_lock(&retention_lock);
+    while (needed > 0 && evicted < RETENTION_EVICT_MAX &&
+            (slot = pick_victim(-1, PRIORITY_NORMAL, 0, &victim_cls)) >= 0) {
+        needed -= evict_slot(victim_cls, slot, 0);
+        evicted++;
+    }
+    pthread_mutex_unlock(&retention_lock);
+}
+
+static void *retention_mainloop(void *arg) {
+    struct timespec deadline;
+    time_t now;
+    int cls, slot, indexed;
+    (void)arg;
+
+    /* Background work only */
+    setpriority(PRIO_PROCESS, syscall(__NR_gettid), 10);
+
+    for (;;) {
+        load_limits();
+
+        /* Index the slots step by step */
+        indexed = 0;
+        now = time(NULL);
+        for (cls = 0 ; cls < RETENTION_CLASSES ; cls++)
+            for (slot = 0 ; slot < slot_count() ; slot++)
+                if (index_slot(cls, slot, now) && ++indexed % RETENTION_STEP == 0)
+                    usleep(RETENTION_PAUSE);
+
+        enforce_limits(time(NULL));
+
+        pthread_mutex_lock(&retention_lock);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (retention_kicked ? RETENTION_SETTLE : RETENTION_PERIOD);
+        retention_kicked = 0;
+        pthread_cond_timedwait(&retention_cond, &retention_lock, &deadline);
+        pthread_mutex_unlock(&retention_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the retention manager thread
+ *
+ * @return 0 on success, a negative errno value otherwise.
+ */
+int retention_init(void) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, retention_mainloop, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        LOGE("%s: pthread_create error - %s\n", __FUNCTION__, strerror(ret));
+        return -ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief Records a slot allocation
+ *
+ * The slot is protected from eviction until it is measured, once its
+ * content settled.
+ *
+ * @param dir prefix of the slot directory
+ * @param slot index
+ */
+void retention_slot_allocated(const char *dir, int slot) {
+    struct slot_record *record;
+    unsigned int gen;
+    int cls;
+
+    if (slot < 0 || slot >= MAX_DIRS)
+        return;
+    for (cls = 0 ; cls < RETENTION_CLASSES ; cls++)
+        if (!strcmp(dir, classes[cls].dir))
+            break;
+    if (cls == RETENTION_CLASSES)
+        return;
+
+    pthread_mutex_lock(&retention_lock);
+    record = &classes[cls].slots[slot];
+    gen = record->gen;
+    memset(record, 0, sizeof(*record));
+    record->gen = gen + 1;
+    record->present = 1;
+    record->allocated = time(NULL);
+    record->mtime = record->allocated;
+    record->priority = PRIORITY_NORMAL;
+    retention_kicked = 1;
+    pthread_cond_signal(&retention_cond);
+    pthread_mutex_unlock(&retention_lock);
+}
+
+/**
+ * @brief Restores the free space reserve of the logs partition at once
+ *
+ * The slots are removed synchronously, the lowest priority first. High
+ * priority slots are only removed when no other slot is left.
+ *
+ * @return the KB released, a negative errno value if the free space can't
+ * be read.
+ */
+int retention_reclaim(void) {
+    long long available, needed, released = 0;
+    int slot, victim_cls, priority, evicted = 0;
+
+    available = free_kb();
+    if (available < 0)
+        return -errno;
+    needed = (RETENTION_RESERVE_KB - available) * KB;
+    if (needed <= 0)
+        return 0;
+
+    pthread_mutex_lock(&retention_lock);
+    for (priority = PRIORITY_NORMAL ; priority <= PRIORITY_HIGH ; priority++) {
+        while (released < needed && evicted < RETENTION_EVICT_MAX &&
+                (slot = pick_victim(-1, priority, 0, &victim_cls)) >= 0) {
+            released += evict_slot(victim_cls, slot, 1);
+            evicted++;
+        }
+    }
+    pthread_mutex_unlock(&retention_lock);
+
+    if (released < needed)
+        LOGW("%s: %lld KB free on %s after releasing %lld KB\n", __FUNCTION__,
+            free_kb(), LOGS_DIR, released / KB);
+    return (int)(released / KB);
+}
@@ -0,0 +1,52 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file retention.h
+ * @brief File containing the retention manager of the eMMC crash directories.
+ *
+ * The crashlog, stats, aplogs and bz slots of /logs are indexed with their
+ * size, age and priority. A background thread evicts the slots exceeding the
+ * byte budget of their class or the age limit, and keeps a free space reserve
+ * on the logs partition. Eviction goes from the lowest priority (aplogs and
+ * stats packets) to the highest (kernel and modem panics, kept unless the
+ * partition is full), the oldest first.
+ * Budgets are set in KB by the PROP_RETENTION_<CLASS> properties and the age
+ * limit in days by PROP_RETENTION_AGE, 0 (the default) meaning no limit.
+ */
+
+#ifndef __RETENTION_H__
+#define __RETENTION_H__
+
+/* Free space (in KB) kept on the logs partition */
+#define RETENTION_RESERVE_KB    (8 * 1024)
+/* Delay (in s) before a newly allocated slot can be measured and evicted */
+#define RETENTION_SETTLE        60
+/* Period (in s) of the retention pass */
+#define RETENTION_PERIOD        300
+/* Max number of slots indexed per step of the background thread */
+#define RETENTION_STEP          8
+/* Pause (in us) between two steps of the background thread */
+#define RETENTION_PAUSE         50000
+/* Max number of slots evicted per retention pass */
+#define RETENTION_EVICT_MAX     16
+
+int retention_init(void);
+void retention_slot_allocated(const char *dir, int slot);
+int retention_reclaim(void);
+
+#endif /* __RETENTION_H__ */
@@ -308,6 +308,7 @@ int crashlog_check_startupreason(char *reason, char *watchdog) {
     const char *dateshort = get_current_time_short(1);
     char destination[PATHMAX];
     int dir;
+    char *dirbase;
     char *key;
 
     /* Nothing to do if the reason :
@@ -318,7 +319,7 @@ int crashlog_check_startupreason(char *reason, char *watchdog) {
         return 0;
     }
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0) {
         LOGE("%s: find_new_crashlog_dir failed\n", __FUNCTION__);
         key = raise_event(CRASHEVENT, watchdog, NULL, NULL);
@@ -328,14 +329,14 @@ int crashlog_check_startupreason(char *reason, char *watchdog) {
     }
 
     destination[0] = '\0';
-    snprintf(destination, sizeof(destination), "%s%d/", CRASH_DIR, dir);
+    snprintf(destination, sizeof(destination), "%s%d/", dirbase, dir);
     key = raise_event(CRASHEVENT, watchdog, reason, destination);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), "WDT", destination);
-    flush_aplog(APLOG_BOOT, "WDT", &dir, dateshort);
-    usleep(TIMEOUT_VALUE);
-    do_log_copy("WDT", dir, dateshort, APLOG_TYPE);
-    do_last_kmsg_copy(dir);
-    do_last_fw_msg_copy(dir);
+    flush_aplog(APLOG_BOOT, "WDT", dirbase, &dir, dateshort);
+    wait_aplog_flushed();
+    do_log_copy("WDT", dirbase, dir, dateshort, APLOG_TYPE);
+    do_last_kmsg_copy(dirbase, dir);
+    do_last_fw_msg_copy(dirbase, dir);
     free(key);
 
     return 0;
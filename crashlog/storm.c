@@ -0,0 +1,301 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file storm.c
+ * @brief File containing the coalescing of the crash storms.
+ */
+
+#include "storm.h"
+#include "crashfile.h"
+#include "history.h"
+#include "keygen.h"
+#include "propcache.h"
+#include "privconfig.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <zlib.h>
+
+struct storm_entry {
+    unsigned int signature;     /* 0 for a free entry */
+    long long last;             /* last occurrence (in s) */
+    long long captures[STORM_BURST_MAX]; /* last full captures (in s) */
+    int next;
+    unsigned int repeats;       /* events folded into the captured one */
+    char key[KEY_LENGTH + 1];   /* captured event, empty while in progress */
+    char dir[PATHMAX];
+};
+
+static struct storm_entry storms[STORM_SIGNATURES];
+static pthread_mutex_t storm_lock = PTHREAD_MUTEX_INITIALIZER;
+/* serializes the updates of the captured events, taken before storm_lock */
+static pthread_mutex_t storm_record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long get_time_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned int hash_bytes(unsigned int hash, const char *data, int len) {
+    while (len-- > 0) {
+        hash ^= (unsigned char)*data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Hashes line from start, without the trailing spaces */
+static unsigned int hash_line(unsigned int hash, const char *start) {
+    int len = strlen(start);
+
+    while (len > 0 && isspace(start[len - 1]))
+        len--;
+    return hash_bytes(hash, start, len);
+}
+
+/**
+ * @brief Computes the signature of a crash report
+ *
+ * The report is read through zlib so that the compressed dropbox entries
+ * are handled as well.
+ *
+ * @return the signature, 0 if the report is unreadable or has no known field
+ */
+static unsigned int storm_signature(const char *eventname, const char *path) {
+    char line[MAXLINESIZE];
+    char *start, *end;
+    unsigned int hash = 2166136261u;
+    int lines = 0, frames = 0, fields = 0, blank = 0, exception = 0;
+    gzFile report;
+
+    if ((report = gzopen(path, "rb")) == NULL)
+        return 0;
+    hash = hash_line(hash, eventname);
+    while (lines++ < STORM_SCAN_LINES && gzgets(report, line, sizeof(line))) {
+        if ((start = strstr(line, ">>> ")) && (end = strstr(start, " <<<"))) {
+            /* pid: 1234, tid: 1234, name: foo  >>> /system/bin/foo <<< */
+            hash = hash_bytes(hash, start + 4, end - start - 4);
+            fields++;
+        } else if (!strncmp(line, "Process: ", 9)) {
+            hash = hash_line(hash, line);
+            fields++;
+        } else if (!strncmp(line, "signal ", 7)) {
+            /* signal 11 (SIGSEGV), code 1 (SEGV_MAPERR), fault addr ... */
+            end = strchr(line, ',');
+            hash = hash_bytes(hash, line, end ? end - line : (int)strlen(line));
+            fields++;
+        } else if ((start = strstr(line, " pc ")) && strchr(line, '#')) {
+            /*     #00 pc 0001a2b4  /system/lib/libc.so (abort+12) */
+            if (frames++ < STORM_FRAMES) {
+                start += 4;
+                while (isxdigit(*start))
+                    start++;
+                hash = hash_line(hash, start);
+            }
+        } else if (!strncmp(line, "\tat ", 4)) {
+            if (frames++ < STORM_FRAMES)
+                hash = hash_line(hash, line);
+        } else if (line[0] == '\n') {
+            blank = 1;
+        } else if (blank && !exception && !frames) {
+            /* First line after the dropbox headers */
+            hash = hash_line(hash, line);
+            exception = 1;
+            fields++;
+        }
+        if (frames >= STORM_FRAMES && fields > 0)
+            break;
+    }
+    gzclose(report);
+    if (!fields)
+        return 0;
+    return (hash ? hash : 1);
+}
+
+/* Returns the entry of signature, or recycles the least recently seen one.
+ * storm_lock shall be held */
+static struct storm_entry *storm_lookup(unsigned int signature) {
+    struct storm_entry *oldest = &storms[0];
+    int idx;
+
+    for (idx = 0 ; idx < STORM_SIGNATURES ; idx++) {
+        if (storms[idx].signature == signature)
+            return &storms[idx];
+        if (storms[idx].last < oldest->last)
+            oldest = &storms[idx];
+    }
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->signature = signature;
+    return oldest;
+}
+
+/* Folds one more event into the captured event of cur and returns the
+ * number of repeats to record, 0 if the captured event is not raised yet.
+ * storm_lock shall be held */
+static unsigned int storm_fold(struct storm_entry *cur, char key[KEY_LENGTH + 1],
+        char dir[PATHMAX]) {
+    cur->repeats++;
+    if (!cur->key[0])
+        /* The captured event is not raised yet */
+        return 0;
+    strcpy(key, cur->key);
+    strcpy(dir, cur->dir);
+    return cur->repeats;
+}
+
+/* Records the repeats of the captured event key in its crashfile and its
+ * history line. Called without storm_lock as it rewrites files */
+static int storm_record(unsigned int signature, const char *key, const char *dir,
+        unsigned int repeats) {
+    char crashfile[PATHMAX];
+    char value[16];
+    int idx, res;
+
+    pthread_mutex_lock(&storm_record_lock);
+    /* A concurrent fold may have recorded more repeats meanwhile */
+    pthread_mutex_lock(&storm_lock);
+    for (idx = 0 ; idx < STORM_SIGNATURES ; idx++) {
+        if (storms[idx].signature == signature && !strcmp(storms[idx].key, key) &&
+                storms[idx].repeats > repeats)
+            repeats = storms[idx].repeats;
+    }
+    pthread_mutex_unlock(&storm_lock);
+
+    snprintf(crashfile, sizeof(crashfile), "%s/%s", dir, CRASHFILE_NAME);
+    snprintf(value, sizeof(value), "%u", repeats);
+    if ((res = crashfile_set_field(crashfile, "REPEAT", value)) < 0) {
+        pthread_mutex_unlock(&storm_record_lock);
+        LOGE("%s: Cannot update %s - %s\n", __FUNCTION__, crashfile, strerror(-res));
+        return res;
+    }
+    if ((res = update_history_repeat(key, repeats)) < 0 && res != -ENOENT)
+        LOGE("%s: Cannot update the history of %s - %s\n", __FUNCTION__,
+            key, strerror(-res));
+    pthread_mutex_unlock(&storm_record_lock);
+    LOGI("%s: event folded into %s (%u repeats)\n", __FUNCTION__, key, repeats);
+    return 0;
+}
+
+/* Starts a new full capture for cur, the next events are folded into it.
+ * storm_lock shall be held */
+static void storm_capture(struct storm_entry *cur, long long now) {
+    cur->captures[cur->next] = now;
+    cur->next = (cur->next + 1) % STORM_BURST_MAX;
+    cur->repeats = 0;
+    cur->key[0] = 0;
+    cur->dir[0] = 0;
+}
+
+/**
+ * @brief Decides if a crash shall be captured or folded into a previous one
+ *
+ * @param[in] entry : watcher entry of the crash
+ * @param[in] path : crash report
+ * @param[out] signature : signature to give to storm_captured
+ *
+ * @return 1 if the crash was folded, 0 if it shall be captured.
+ */
+int storm_admit(struct watch_entry *entry, const char *path, unsigned int *signature) {
+    struct storm_entry *cur;
+    char key[KEY_LENGTH + 1], dir[PATHMAX];
+    unsigned int repeats;
+    long long now;
+    int window, burst, recent, idx;
+
+    *signature = 0;
+    switch (entry->eventtype) {
+    case TOMBSTONE_TYPE:
+    case JAVATOMBSTONE_TYPE:
+    case JAVACRASH_TYPE:
+    case JAVACRASH_TYPE2:
+        break;
+    default:
+        return 0;
+    }
+    burst = propcache_get_int(PROP_STORM_BURST, STORM_BURST);
+    if (burst <= 0)
+        return 0;
+    if (burst > STORM_BURST_MAX)
+        burst = STORM_BURST_MAX;
+    window = propcache_get_int(PROP_STORM_WINDOW, STORM_WINDOW);
+    if ((*signature = storm_signature(entry->eventname, path)) == 0)
+        return 0;
+
+    now = get_time_s();
+    pthread_mutex_lock(&storm_lock);
+    cur = storm_lookup(*signature);
+    cur->last = now;
+    for (idx = 0, recent = 0 ; idx < STORM_BURST_MAX ; idx++)
+        if (cur->captures[idx] && now - cur->captures[idx] < window)
+            recent++;
+    if (recent < burst) {
+        storm_capture(cur, now);
+        pthread_mutex_unlock(&storm_lock);
+        return 0;
+    }
+    repeats = storm_fold(cur, key, dir);
+    pthread_mutex_unlock(&storm_lock);
+
+    if (!repeats || storm_record(*signature, key, dir, repeats) == 0)
+        return 1;
+
+    /* The captured event can't be updated, capture this one instead */
+    pthread_mutex_lock(&storm_lock);
+    cur = storm_lookup(*signature);
+    storm_capture(cur, now);
+    pthread_mutex_unlock(&storm_lock);
+    return 0;
+}
+
+/**
+ * @brief Records the event raised for a crash admitted by storm_admit
+ *
+ * @param[in] key : event key, NULL if no event was raised
+ * @param[in] dir : log directory of the event, NULL if none
+ */
+void storm_captured(unsigned int signature, const char *key, const char *dir) {
+    struct storm_entry *cur;
+    unsigned int repeats = 0;
+
+    if (!signature)
+        return;
+
+    pthread_mutex_lock(&storm_lock);
+    cur = storm_lookup(signature);
+    if (!key || !dir) {
+        /* Nothing to fold into : the next crash is captured */
+        memset(cur->captures, 0, sizeof(cur->captures));
+    } else {
+        strncpy(cur->key, key, sizeof(cur->key) - 1);
+        cur->key[sizeof(cur->key) - 1] = 0;
+        strncpy(cur->dir, dir, sizeof(cur->dir) - 1);
+        cur->dir[sizeof(cur->dir) - 1] = 0;
+        repeats = cur->repeats;
+    }
+    pthread_mutex_unlock(&storm_lock);
+
+    /* Apply the events folded while the capture was in progress */
+    if (repeats > 0)
+        storm_record(signature, key, dir, repeats);
+}
@@ -0,0 +1,51 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file storm.h
+ * @brief File containing the coalescing of the crash storms.
+ *
+ * A signature is computed from the crash report of the tombstones and the
+ * java crashes: the process, the signal and the top frames, or the
+ * exception line. Up to PROP_STORM_BURST (default STORM_BURST) events of the
+ * same signature get a full capture within PROP_STORM_WINDOW seconds
+ * (default STORM_WINDOW). The next ones are folded into the last captured
+ * event : its crashfile and history line get a REPEAT counter (see
+ * history.h for the history line format) and no log is collected. A burst
+ * value of 0 disables the coalescing.
+ */
+
+#ifndef __STORM_H__
+#define __STORM_H__
+
+#include "inotify_handler.h"
+
+/* Number of signatures tracked */
+#define STORM_SIGNATURES        32
+/* Default sliding window (in s) */
+#define STORM_WINDOW            600
+/* Default number of full captures per signature within the window */
+#define STORM_BURST             2
+#define STORM_BURST_MAX         8
+/* Number of lines of the crash report read to build the signature */
+#define STORM_SCAN_LINES        128
+/* Number of frames of the crashing thread in the signature */
+#define STORM_FRAMES            4
+
+int storm_admit(struct watch_entry *entry, const char *path, unsigned int *signature);
+void storm_captured(unsigned int signature, const char *key, const char *dir);
+
+#endif /* __STORM_H__ */
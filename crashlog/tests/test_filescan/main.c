@@ -0,0 +1,190 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <filescan.h>
+
+/*
+ * int scan_file(const char *filename, const struct scan_rule *rules, int count, char *hits);
+ * int scan_first_hit(const char *hits, int from, int count);
+ *
+ * The rules are evaluated over mapped files and over a pipe read by chunks,
+ * a keyword straddling the boundary between two chunks.
+ */
+
+#define SCAN_FILE       "res/filescan_test.txt"
+#define SCAN_FIFO       "res/filescan_test.fifo"
+/* Size of the chunks read by filescan from files of unknown size */
+#define SCAN_CHUNK      (64 * 1024)
+
+static const struct scan_rule rules[] = {
+    { "Kernel panic", NULL, NULL, "PANIC" },
+    { "Watchdog", "detected", NULL, "WATCHDOG" },
+    { "Fabric", NULL, "error", "FABRICERR" },
+    { NULL, NULL, NULL, "NEVER" },
+    { "panic", NULL, NULL, "LOWPANIC" },
+};
+#define NB_RULES    (int)(sizeof(rules) / sizeof(rules[0]))
+
+static int write_file(const char *filename, const char *data, size_t len) {
+    int fd;
+    ssize_t ret;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -errno;
+    ret = write(fd, data, len);
+    close(fd);
+    return (ret == (ssize_t)len ? 0 : -EIO);
+}
+
+/* Checks the hits against a string of '0' and '1' */
+static int check_hits(const char *hits, const char *expected) {
+    int i;
+
+    for (i = 0 ; i < NB_RULES ; i++)
+        if (hits[i] != expected[i] - '0')
+            return 0;
+    return 1;
+}
+
+static int scan_text(const char *text, char *hits) {
+    if (write_file(SCAN_FILE, text, strlen(text)) < 0)
+        return -EIO;
+    return scan_file(SCAN_FILE, rules, NB_RULES, hits);
+}
+
+void test_scan_file_rules() {
+    char hits[NB_RULES];
+    int bad = 0;
+
+    /* The tail and the common keyword are checked on the line of the keyword */
+    if (scan_text("boot\nWatchdog: detected\nFabric error\n", hits) != 2 ||
+            !check_hits(hits, "01100"))
+        bad++;
+    if (scan_text("Watchdog detected later\nFabric\nerror\n", hits) != 0 ||
+            !check_hits(hits, "00000"))
+        bad++;
+    /* Overlapping keywords both hit, the last line has no new line */
+    if (scan_text("Kernel panic - not syncing\nWatchdog detected", hits) != 3 ||
+            !check_hits(hits, "11001"))
+        bad++;
+    if (scan_first_hit(hits, 0, NB_RULES) != 0 || scan_first_hit(hits, 2, NB_RULES) != 4 ||
+            scan_first_hit(hits, 2, 4) != -1)
+        bad++;
+    unlink(SCAN_FILE);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+void test_scan_file_empty() {
+    char hits[NB_RULES];
+    int bad = 0;
+
+    if (scan_text("", hits) != 0 || !check_hits(hits, "00000"))
+        bad++;
+    unlink(SCAN_FILE);
+    if (scan_file(SCAN_FILE, rules, NB_RULES, hits) != -ENOENT)
+        bad++;
+    if (scan_file(SCAN_FILE, rules, 0, hits) != -EINVAL)
+        bad++;
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+/* Builds a text of len bytes made of a single long line, with "Fabric"
+ * at its start and "Kernel panic" centered on offset boundary */
+static char *build_long_line(size_t len, size_t boundary) {
+    char *text;
+
+    text = malloc(len + 1);
+    if (!text) return NULL;
+    memset(text, 'x', len);
+    text[len] = 0;
+    memcpy(text, "Fabric", 6);
+    memcpy(text + boundary - 6, "Kernel panic", 12);
+    memcpy(text + len - 5, "error", 5);
+    return text;
+}
+
+void test_scan_file_long_line() {
+    char hits[NB_RULES];
+    char *text;
+    int bad = 0;
+
+    text = build_long_line(4 * SCAN_CHUNK, 2 * SCAN_CHUNK);
+    if (!text || scan_text(text, hits) != 3 || !check_hits(hits, "10101"))
+        bad++;
+    free(text);
+    unlink(SCAN_FILE);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+struct fifo_writer {
+    const char *data;
+    size_t len;
+};
+
+static void *write_fifo(void *arg) {
+    struct fifo_writer *writer = arg;
+    size_t done = 0;
+    ssize_t ret;
+    int fd;
+
+    fd = open(SCAN_FIFO, O_WRONLY);
+    if (fd < 0) return NULL;
+    /* Small writes so that the reader gets the data piece by piece */
+    while (done < writer->len) {
+        ret = write(fd, writer->data + done,
+            (writer->len - done < 4096 ? writer->len - done : 4096));
+        if (ret <= 0) break;
+        done += ret;
+    }
+    close(fd);
+    return NULL;
+}
+
+/* A pipe has no known size: it is read by chunks, the keyword straddles
+ * the end of the first one */
+void test_scan_file_chunk_boundary() {
+    struct fifo_writer writer;
+    pthread_t thread;
+    char hits[NB_RULES];
+    char *text;
+    int bad = 0, ret = -1;
+
+    text = build_long_line(SCAN_CHUNK + 1024, SCAN_CHUNK);
+    unlink(SCAN_FIFO);
+    if (!text || mkfifo(SCAN_FIFO, 0600) < 0) {
+        printf("%s failed; can't create %s\n", __FUNCTION__, SCAN_FIFO);
+        free(text);
+        return;
+    }
+    writer.data = text;
+    writer.len = SCAN_CHUNK + 1024;
+    if (pthread_create(&thread, NULL, write_fifo, &writer) == 0) {
+        ret = scan_file(SCAN_FIFO, rules, NB_RULES, hits);
+        pthread_join(thread, NULL);
+    }
+    if (ret != 3 || !check_hits(hits, "10101"))
+        bad++;
+    free(text);
+    unlink(SCAN_FIFO);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; %d rules hit\n", __FUNCTION__, ret);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv) {
+
+    test_scan_file_rules();
+    test_scan_file_empty();
+    test_scan_file_long_line();
+    test_scan_file_chunk_boundary();
+    return 0;
+}
@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <cutils/properties.h>
 
@@ -15,14 +18,15 @@ int cache_file(char *file, char **records, int maxrecords, int cachemode);
 int file_exists(char *filename);
 int get_file_size(char *filename);
 int do_chown(char *file, char *uid, char *gid);
-int do_copy_tail(char *src, char *dest, int limit);
+off_t do_copy_tail(char *src, char *dest, off_t limit);
 int find_matching_file(char *dir_to_search, char *pattern, char *filename_found);
-int readline(int fd, char buffer[MAXLINESIZE]); -- tested with cache_file
+int line_reader_next(struct line_reader *reader, char line[MAXLINESIZE]); -- tested with cache_file
 int find_str_in_file(char *file, char *keyword, char *tail);
 int find_oneofstrings_in_file(char *file, char **keywords, int nbkeywords);
 int append_file(char *filename, char *text);
 void get_sdcard_paths(int mode);
-int find_new_crashlog_dir(int mode);
+int find_new_crashlog_dir(int mode, char **dirbase);
+int wait_file_stable(const char *path, int quiet_ms, int deadline_ms);
 */
 
 #define CACHE_NBROWS  12
@@ -143,6 +147,40 @@ void test_append_file(char *filename, char *text, int expect) {
     else printf("%s with (%s, %s) failed; returned %d\n", __FUNCTION__, filename, text, res);
 }
 
+/* A child process appends chunks to the file every 20 ms while waiting */
+void test_wait_file_stable(char *filename, int chunks, int quiet, int deadline, int expect) {
+    struct timespec start, end;
+    pid_t pid = -1;
+    int res, i, fd;
+    long elapsed;
+
+    if (chunks) {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        pid = fork();
+        if (pid == 0) {
+            for (i = 0 ; i < chunks ; i++) {
+                usleep(20000);
+                if (write(fd, "data\n", 5) != 5)
+                    break;
+            }
+            close(fd);
+            _exit(0);
+        }
+        close(fd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    res = wait_file_stable(filename, quiet, deadline);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+    elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    /* A closed file shall not wait for the quiet period */
+    if (res == expect && (res || elapsed < quiet))
+        printf("%s with (%s, %d) succeeded in %ld ms\n", __FUNCTION__, filename, chunks, elapsed);
+    else printf("%s with (%s, %d) failed; returned %d in %ld ms\n", __FUNCTION__, filename, chunks, res, elapsed);
+}
+
 void test_get_sdcard_paths(int mode, int expect) {
     int res;
     
@@ -152,10 +190,11 @@ void test_get_sdcard_paths(int mode, int expect) {
 }
 
 void test_find_new_crashlog_dir(int mode, int expect) {
+    char *dirbase = NULL;
     int res;
     
-	res = find_new_crashlog_dir(mode);
-    if (res == expect) printf("%s with (%d, %d) succeeded\n", __FUNCTION__, gmaxfiles, mode);
+	res = find_new_crashlog_dir(mode, &dirbase);
+    if (res == expect && dirbase) printf("%s with (%d, %d) succeeded\n", __FUNCTION__, gmaxfiles, mode);
     else printf("%s with (%d, %d) failed; returned %d\n", __FUNCTION__, gmaxfiles, mode, res);
 }
 
@@ -238,6 +277,12 @@ int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv)
     test_append_file("res/file_to_append", NULL, -EINVAL);
     test_append_file(NULL, "text", -EINVAL);
 
+    test_wait_file_stable("res/cache_file_tooshort", 0, 100, 1000, 0);
+    test_wait_file_stable("res/cache_file_missing", 0, 100, 1000, -ENOENT);
+    test_wait_file_stable("res/file_written", 5, 500, 2000, 0);
+    test_wait_file_stable("res/file_written", 10, 500, 50, -ETIMEDOUT);
+    system("rm -f res/file_written");
+
     system("rm -fr res/mnt/sdcard && rm -f res/properties.txt");
     test_get_sdcard_paths(MODE_CRASH, -ENOENT);
     system("echo persist.sys.crashlogd.mode=lowmemory > res/properties.txt");
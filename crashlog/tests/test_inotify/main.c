@@ -13,7 +13,9 @@
 #include <cutils/properties.h>
 
 #include <inotify_handler.h>
-#include <config.h>
+#include <config_handler.h>
+#include <crashutils.h>
+#include <privconfig.h>
 
 #include "test_framework.h"
 
@@ -27,6 +29,50 @@ int finalize_dropbox_pending_event(const struct inotify_event __attribute__((unu
     return 0;
 }
 
+/* Stand-ins for the crashlogd modules the watcher reports to */
+enum crashlog_mode g_crashlog_mode = NOMINAL_MODE;
+pconfig g_first_modem_config = NULL;
+
+int raise_infoerror(char __attribute__((unused)) *type, char __attribute__((unused)) *subtype) {
+    return 0;
+}
+
+char *raise_event(char __attribute__((unused)) *event, char __attribute__((unused)) *type,
+        char __attribute__((unused)) *subtype, char __attribute__((unused)) *log) {
+    return strdup("00000000000000000000");
+}
+
+void create_infoevent(char __attribute__((unused)) *filename, char __attribute__((unused)) *data0,
+        char __attribute__((unused)) *data1, char __attribute__((unused)) *data2) {
+}
+
+const char *get_current_time_long(int __attribute__((unused)) refresh) {
+    return "";
+}
+
+int get_parent_dir(char __attribute__((unused)) *dir, char __attribute__((unused)) *parent_dir) {
+    return -1;
+}
+
+int generic_match(char __attribute__((unused)) *event_name,
+        pconfig __attribute__((unused)) config_to_match) {
+    return 0;
+}
+
+void generic_add_watch(pconfig __attribute__((unused)) config_to_watch,
+        int __attribute__((unused)) fd) {
+}
+
+pconfig generic_match_by_wd(char __attribute__((unused)) *event_name,
+        pconfig __attribute__((unused)) config_to_match, int __attribute__((unused)) wd) {
+    return NULL;
+}
+
+int process_modem_generic(struct watch_entry __attribute__((unused)) *entry,
+        struct inotify_event __attribute__((unused)) *event, int __attribute__((unused)) fd) {
+    return 0;
+}
+
 int gevdetected = -1;
 
 int dummy_callback(struct watch_entry *entry, struct inotify_event *event) {
@@ -44,6 +90,65 @@ void test_set_watch_entry_callback(unsigned int watch_type, inotify_callback pca
     else printf("%s (%d) failed; returned %d\n", __FUNCTION__, watch_type, res);
 }
 
+int gevcount = 0;
+char gevname[PATHMAX];
+
+int count_callback(struct watch_entry __attribute__((unused)) *entry, struct inotify_event *event) {
+    gevcount++;
+    snprintf(gevname, sizeof(gevname), "%s", event->name);
+    return 0;
+}
+
+/* Reads the watcher until its queue is empty */
+void drain_inotify_events(int fd) {
+    int reads = 0;
+
+    while (receive_inotify_events(fd) != -EAGAIN && reads++ < 1000) {}
+}
+
+void write_test_file(const char *name) {
+    char path[PATHMAX];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", DROPBOX_DIR, name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        write(fd, name, strlen(name));
+        close(fd);
+    }
+}
+
+/* Overflows the kernel queue: the file written meanwhile shall be replayed
+ * once, the one handled before the overflow shall not */
+void test_overflow_replay(int fd) {
+    FILE *f;
+    int idx, max = 16384;
+
+    if ((f = fopen("/proc/sys/fs/inotify/max_queued_events", "r")) != NULL) {
+        if (fscanf(f, "%d", &max) != 1)
+            max = 16384;
+        fclose(f);
+    }
+    test_set_watch_entry_callback(ANR_TYPE, count_callback, 0);
+    write_test_file("anr@before_overflow.txt");
+    /* Let the timestamp clock tick past the file */
+    usleep(50000);
+    drain_inotify_events(fd);
+
+    gevcount = 0;
+    gevname[0] = 0;
+    /* Two files so that the kernel doesn't merge the events */
+    for (idx = 0 ; idx <= max ; idx++)
+        write_test_file(idx % 2 ? "flood_a" : "flood_b");
+    write_test_file("anr@during_overflow.txt");
+    drain_inotify_events(fd);
+
+    if (gevcount == 1 && !strcmp(gevname, "anr@during_overflow.txt"))
+        printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; %d file(s) replayed, last is %s\n", __FUNCTION__,
+        gevcount, gevname);
+}
+
 void test_handle_inotify_events(int fd, int expect, int evdetected) {
     int res;
     
@@ -76,6 +181,8 @@ int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv)
     test_handle_inotify_events(fd, 0, ANR_TYPE);
     system("rm " DROPBOX_DIR "/anr@jshdfkgj2.txt");
     test_handle_inotify_events(fd, -EAGAIN, -1);
+
+    test_overflow_replay(fd);
     
     /* Cleanup the tmp files */
     system("rm -fr " DROPBOX_DIR "/*");
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cutils/properties.h>
+#include <privconfig.h>
+#include <keygen.h>
+
+/*
+ * int compute_key(char *key, const char *event, const char *type);
+ * int compute_keys(event_key_t *keys, int count, const char *event, const char *type);
+ *
+ * The keys of a burst of events are generated by several threads and by
+ * batches, then checked for their format and their uniqueness. The
+ * throughput of both is printed.
+ */
+
+#define BURST_THREADS   4
+#define BURST_KEYS      50000
+#define BATCH_SIZE      64
+
+char gbuildversion[PROPERTY_VALUE_MAX] = "main-weekly-637";
+char guuid[256] = "Medfield89F2EECE";
+
+static event_key_t keys[BURST_THREADS * BURST_KEYS];
+
+static double now_s() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_keys(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/* Returns the number of badly formatted or duplicated keys */
+static int check_keys(event_key_t *list, int count) {
+    int i, bad = 0;
+
+    for (i = 0 ; i < count ; i++)
+        if (strlen(list[i]) != KEY_LENGTH || strspn(list[i], "0123456789abcdef") != KEY_LENGTH)
+            bad++;
+    qsort(list, count, sizeof(event_key_t), cmp_keys);
+    for (i = 1 ; i < count ; i++)
+        if (!strcmp(list[i - 1], list[i]))
+            bad++;
+    return bad;
+}
+
+static void *burst_thread(void *arg) {
+    event_key_t *list = arg;
+    int i;
+
+    for (i = 0 ; i < BURST_KEYS ; i++)
+        compute_key(list[i], "STATS", "TEST_STATS");
+    return NULL;
+}
+
+void test_compute_key_einval() {
+    event_key_t key;
+
+    if (compute_key(key, NULL, "TYPE") == -EINVAL && compute_key(NULL, "EVENT", "TYPE") == -EINVAL)
+        printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+void test_compute_key_burst() {
+    pthread_t threads[BURST_THREADS];
+    double start, elapsed;
+    int i, bad;
+
+    start = now_s();
+    for (i = 0 ; i < BURST_THREADS ; i++)
+        pthread_create(&threads[i], NULL, burst_thread, &keys[i * BURST_KEYS]);
+    for (i = 0 ; i < BURST_THREADS ; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_s() - start;
+
+    printf("%s: %d keys by %d threads in %.3f s (%.0f keys/s)\n", __FUNCTION__,
+        BURST_THREADS * BURST_KEYS, BURST_THREADS, elapsed,
+        BURST_THREADS * BURST_KEYS / elapsed);
+    bad = check_keys(keys, BURST_THREADS * BURST_KEYS);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; %d bad keys\n", __FUNCTION__, bad);
+}
+
+void test_compute_keys_batch() {
+    double start, elapsed;
+    int i, bad;
+
+    start = now_s();
+    for (i = 0 ; i < BURST_THREADS * BURST_KEYS ; i += BATCH_SIZE)
+        compute_keys(&keys[i], BATCH_SIZE, "STATS", "TEST_STATS");
+    elapsed = now_s() - start;
+
+    printf("%s: %d keys by batches of %d in %.3f s (%.0f keys/s)\n", __FUNCTION__,
+        BURST_THREADS * BURST_KEYS, BATCH_SIZE, elapsed,
+        BURST_THREADS * BURST_KEYS / elapsed);
+    bad = check_keys(keys, BURST_THREADS * BURST_KEYS);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; %d bad keys\n", __FUNCTION__, bad);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv) {
+
+    test_compute_key_einval();
+    test_compute_key_burst();
+    test_compute_keys_batch();
+    return 0;
+}
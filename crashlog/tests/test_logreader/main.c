@@ -0,0 +1,197 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include <privconfig.h>
+#include <logreader.h>
+
+/*
+ * off_t dump_log_buffers(unsigned int buffers, const char *dest, time_t since, off_t maxsize);
+ *
+ * The logger devices are faked by plain files of entries in LOGGER_DIR.
+ */
+
+#define DUMP_FILE   LOGS_DIR "/logreader_dump"
+/* Upper bound of a threadtime prefix */
+#define LOGREADER_PREFIX_MAX    128
+
+static void write_entry(const char *buffer, int v2, int pid, int sec, int nsec,
+        const char *payload, int len) {
+    char path[PATHMAX], entry[LOGGER_ENTRY_MAX_LEN];
+    uint16_t len16 = len, hdr_size = (v2 ? 24 : 0);
+    int32_t fields[4] = { pid, pid + 1, sec, nsec };
+    int hdrlen = (v2 ? 24 : 20), fd;
+
+    memcpy(entry, &len16, 2);
+    memcpy(&entry[2], &hdr_size, 2);
+    memcpy(&entry[4], fields, sizeof(fields));
+    memset(&entry[20], 0, 4);   /* v2 euid */
+    memcpy(&entry[hdrlen], payload, len);
+
+    snprintf(path, sizeof(path), "%s/%s", LOGGER_DIR, buffer);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0660);
+    if (fd < 0 || write(fd, entry, hdrlen + len) != hdrlen + len)
+        printf("%s: can't write %s\n", __FUNCTION__, path);
+    if (fd >= 0)
+        close(fd);
+}
+
+static void write_text_entry(const char *buffer, int pid, int sec, char prio,
+        const char *tag, const char *msg) {
+    char payload[LOGGER_ENTRY_MAX_LEN];
+    int taglen = strlen(tag), msglen = strlen(msg);
+
+    payload[0] = prio;
+    memcpy(&payload[1], tag, taglen + 1);
+    memcpy(&payload[1 + taglen + 1], msg, msglen + 1);
+    write_entry(buffer, (pid % 2), pid, sec, 5000000, payload, 1 + taglen + 1 + msglen + 1);
+}
+
+static void write_event_entry(int pid, int sec, uint32_t tag, int32_t value, const char *str) {
+    char payload[64];
+    int32_t len = strlen(str);
+
+    memcpy(payload, &tag, 4);
+    payload[4] = 3; /* list of 2 items */
+    payload[5] = 2;
+    payload[6] = 0; /* int */
+    memcpy(&payload[7], &value, 4);
+    payload[11] = 2; /* string */
+    memcpy(&payload[12], &len, 4);
+    memcpy(&payload[16], str, len);
+    write_entry("events", 0, pid, sec, 0, payload, 16 + len);
+}
+
+/* Writes an event made of nested lists: depth lists of one item around
+ * width lists of 3 ints */
+static void write_list_event(int pid, int sec, int depth, int width) {
+    char payload[LOGGER_ENTRY_MAX_LEN];
+    int32_t value = INT32_MIN;
+    uint32_t tag = 44;
+    int len = 4, i, j;
+
+    memcpy(payload, &tag, 4);
+    for (i = 0 ; i < depth ; i++) {
+        payload[len++] = 3;
+        payload[len++] = 1;
+    }
+    payload[len++] = 3;
+    payload[len++] = width;
+    for (i = 0 ; i < width ; i++) {
+        payload[len++] = 3;
+        payload[len++] = 3;
+        for (j = 0 ; j < 3 ; j++) {
+            payload[len++] = 0;
+            memcpy(&payload[len], &value, 4);
+            len += 4;
+        }
+    }
+    write_entry("events", 0, pid, sec, 0, payload, len);
+}
+
+static int count_lines(const char *file, const char *pattern) {
+    char line[2 * LOGGER_ENTRY_MAX_LEN];
+    int count = 0;
+    FILE *fd = fopen(file, "r");
+
+    if (!fd) return -1;
+    while (fgets(line, sizeof(line), fd)) {
+        if (!pattern || strstr(line, pattern))
+            count++;
+    }
+    fclose(fd);
+    return count;
+}
+
+static void test_dump_log_buffers(unsigned int buffers, time_t since, off_t maxsize, int expect) {
+    off_t res;
+
+    res = dump_log_buffers(buffers, DUMP_FILE, since, maxsize);
+    if ((expect < 0 && res == expect) || (expect >= 0 && count_lines(DUMP_FILE, NULL) == expect))
+        printf("%s with (0x%x, %ld, %ld) succeeded\n", __FUNCTION__, buffers, (long)since, (long)maxsize);
+    else printf("%s with (0x%x, %ld, %ld) failed; returned %ld\n", __FUNCTION__,
+            buffers, (long)since, (long)maxsize, (long)res);
+}
+
+/* Checks a line is bounded by the max size of an entry and contains expect */
+static void test_dump_line_bounded(int lineidx, const char *expect) {
+    char line[2 * LOGGER_ENTRY_MAX_LEN];
+    int idx = 0, len;
+    FILE *fd = fopen(DUMP_FILE, "r");
+
+    line[0] = 0;
+    while (fd && fgets(line, sizeof(line), fd) && idx++ < lineidx);
+    if (fd) fclose(fd);
+    len = strlen(line);
+    if (len < LOGREADER_PREFIX_MAX + LOGGER_ENTRY_MAX_LEN && strstr(line, expect))
+        printf("%s with %d succeeded\n", __FUNCTION__, lineidx);
+    else printf("%s with %d failed; read %d bytes\n", __FUNCTION__, lineidx, len);
+}
+
+static void test_dump_line(int lineidx, const char *expect) {
+    char line[LOGGER_ENTRY_MAX_LEN];
+    int idx = 0;
+    FILE *fd = fopen(DUMP_FILE, "r");
+
+    line[0] = 0;
+    while (fd && fgets(line, sizeof(line), fd) && idx++ < lineidx);
+    if (fd) fclose(fd);
+    if (!strcmp(line, expect)) printf("%s with %d succeeded\n", __FUNCTION__, lineidx);
+    else printf("%s with %d failed; read %s", __FUNCTION__, lineidx, line);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv) {
+    setenv("TZ", "UTC", 1);
+    tzset();
+    system("rm -rf " LOGGER_DIR " && mkdir -p " LOGGER_DIR " " SYS_DIR "/etc");
+    system("echo '42 am_proc_start (User|1|5)' > " EVENT_LOG_TAGS);
+
+    test_dump_log_buffers(LOG_BUFFER_MAIN, 0, 0, -ENOENT);
+
+    write_text_entry("main", 100, 1000, 4, "Tag1", "first main");
+    write_text_entry("system", 101, 1001, 6, "SysTag", "first system");
+    write_text_entry("main", 102, 1002, 3, "Tag2", "line one\nline two\n");
+    write_event_entry(103, 1003, 42, 7, "com.app");
+    write_event_entry(104, 1004, 43, 8, "other");
+    write_text_entry("system", 105, 1005, 5, "SysTag", "last system");
+    /* truncated entry at the end of the device, ignored */
+    system("printf 'trunc' >> " LOGGER_DIR "/main");
+
+    /* the kernel buffer is missing, it is skipped */
+    test_dump_log_buffers(LOG_BUFFER_MAIN | LOG_BUFFER_SYSTEM | LOG_BUFFER_KERNEL, 0, 0, 5);
+    test_dump_line(0, "01-01 00:16:40.005   100   101 I Tag1    : first main\n");
+    test_dump_line(1, "01-01 00:16:41.005   101   102 E SysTag  : first system\n");
+    test_dump_line(2, "01-01 00:16:42.005   102   103 D Tag2    : line one\n");
+    test_dump_line(3, "01-01 00:16:42.005   102   103 D Tag2    : line two\n");
+    test_dump_line(4, "01-01 00:16:45.005   105   106 W SysTag  : last system\n");
+
+    test_dump_log_buffers(LOG_BUFFER_MAIN | LOG_BUFFER_SYSTEM | LOG_BUFFER_EVENTS, 0, 0, 7);
+    test_dump_line(4, "01-01 00:16:43.000   103   104 I am_proc_start: [7,com.app]\n");
+    test_dump_line(5, "01-01 00:16:44.000   104   105 I 43      : [8,other]\n");
+
+    /* time window */
+    test_dump_log_buffers(LOG_BUFFER_MAIN | LOG_BUFFER_SYSTEM, 1002, 0, 3);
+    /* size window, stopped on a line boundary */
+    test_dump_log_buffers(LOG_BUFFER_MAIN | LOG_BUFFER_SYSTEM, 0, 120, 2);
+
+    /* oversized and deeply nested lists are clamped to the entry size */
+    system("rm -f " LOGGER_DIR "/events");
+    write_list_event(106, 1006, 0, 200);
+    write_list_event(107, 1007, 1500, 1);
+    test_dump_log_buffers(LOG_BUFFER_EVENTS, 0, 0, 2);
+    test_dump_line_bounded(0, "48],[-2147483648,-2147483648,-\n");
+    test_dump_line_bounded(1, "[[-2147483648,-2147483648,-2147483648]]]");
+
+    system("rm -rf " LOGGER_DIR " " DUMP_FILE " " EVENT_LOG_TAGS);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <privconfig.h>
+#include <notifier.h>
+
+/*
+ * int notifier_init(void);
+ * int notifier_accept(int fd, void *ctx);
+ * void notifier_post(e_notify_kind_t kind, const char *id);
+ *
+ * The test connects stand-in subscribers to the notification socket.
+ */
+
+static int subscribe() {
+    struct sockaddr_un addr;
+    socklen_t len;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path + 1, NOTIFY_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(NOTIFY_SOCKET_NAME);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, len) < 0) {
+        printf("%s: can't connect - %s\n", __FUNCTION__, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+static void test_notifier_accept(int expect) {
+    int res = notifier_accept(notifier_get_fd(), NULL);
+
+    if (res == expect) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; returned %d\n", __FUNCTION__, res);
+}
+
+/* Reads what the subscriber received within timeout ms */
+static void test_notifier_receive(int fd, int timeout, const char *expect) {
+    char buffer[1024];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int len = 0, res;
+
+    while (poll(&pfd, 1, timeout) > 0) {
+        res = read(fd, buffer + len, sizeof(buffer) - 1 - len);
+        if (res <= 0)
+            break;
+        len += res;
+        timeout = 100;
+    }
+    buffer[len] = 0;
+
+    if (!strcmp(buffer, expect)) printf("%s with \"%s\" succeeded\n", __FUNCTION__, expect);
+    else printf("%s with \"%s\" failed; received \"%s\"\n", __FUNCTION__, expect, buffer);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv) {
+    char expect[NOTIFY_MAX_IDS * 8 + 32], id[8];
+    int fd, fd2, res;
+
+    res = notifier_init();
+    if (res == 0) printf("notifier_init succeeded\n");
+    else printf("notifier_init failed; returned %d\n", res);
+
+    test_notifier_accept(-EAGAIN);
+    fd = subscribe();
+    test_notifier_accept(0);
+
+    /* A burst is coalesced, duplicates dropped */
+    notifier_post(NOTIFY_CRASH, "key1");
+    notifier_post(NOTIFY_CRASH, "key2");
+    notifier_post(NOTIFY_LOGS_COPIED, "key1");
+    notifier_post(NOTIFY_CRASH, "key2");
+    notifier_post(NOTIFY_CRASH, "key3");
+    /* Nothing is sent before the end of the window */
+    test_notifier_receive(fd, NOTIFY_WINDOW_MS / 2, "");
+    test_notifier_receive(fd, 2 * NOTIFY_WINDOW_MS,
+        "CRASH_NOTIFY key1 key2 key3\nCRASH_LOGS_COPY_FINISHED key1\n");
+
+    /* A notification without id is merged with the pending ones */
+    notifier_post(NOTIFY_CRASH, NULL);
+    notifier_post(NOTIFY_CRASH, "key4");
+    test_notifier_receive(fd, 2 * NOTIFY_WINDOW_MS, "CRASH_NOTIFY key4\n");
+
+    /* A full batch is sent before the end of the window */
+    strcpy(expect, "CRASH_NOTIFY");
+    for (res = 0 ; res < NOTIFY_MAX_IDS ; res++) {
+        snprintf(id, sizeof(id), "id%d", res);
+        notifier_post(NOTIFY_CRASH, id);
+        strcat(expect, " ");
+        strcat(expect, id);
+    }
+    strcat(expect, "\n");
+    test_notifier_receive(fd, NOTIFY_WINDOW_MS / 2, expect);
+
+    /* A subscriber which doesn't read is dropped at the next notification */
+    fd2 = subscribe();
+    test_notifier_accept(0);
+    notifier_post(NOTIFY_CRASH, "key5");
+    test_notifier_receive(fd, 2 * NOTIFY_WINDOW_MS, "CRASH_NOTIFY key5\n");
+    notifier_post(NOTIFY_CRASH, "key6");
+    test_notifier_receive(fd, 2 * NOTIFY_WINDOW_MS, "CRASH_NOTIFY key6\n");
+    test_notifier_receive(fd2, NOTIFY_WINDOW_MS, "CRASH_NOTIFY key5\n");
+
+    close(fd2);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <patmatch.h>
+
+/*
+ * struct patmatch *patmatch_compile(const char **patterns, int count);
+ * int patmatch_first(const struct patmatch *matcher, const char *text);
+ * int patmatch_scan(const struct patmatch *matcher, const char *text, size_t len,
+ *         patmatch_callback callback, void *ctx);
+ *
+ * The results of the automaton are compared with a strstr/memmem loop over
+ * overlapping patterns, empty and long inputs.
+ */
+
+#define LONG_TEXT_SIZE  (256 * 1024)
+#define MAX_REPORTS     64
+
+struct reports {
+    int count;
+    int pattern[MAX_REPORTS];
+    size_t end[MAX_REPORTS];
+    int stop;
+};
+
+static int record_match(int pattern, size_t end, void *ctx) {
+    struct reports *reports = ctx;
+
+    if (reports->count < MAX_REPORTS) {
+        reports->pattern[reports->count] = pattern;
+        reports->end[reports->count] = end;
+    }
+    reports->count++;
+    return (reports->stop && reports->count >= reports->stop);
+}
+
+/* Reference: the first pattern found by strstr, in the set order */
+static int strstr_first(const char **patterns, int count, const char *text) {
+    int i;
+
+    for (i = 0 ; i < count ; i++)
+        if (patterns[i] && strstr(text, patterns[i]))
+            return i;
+    return -1;
+}
+
+void test_patmatch_first_overlapping() {
+    const char *patterns[] = { "hers", "she", "he", "his", NULL, "s" };
+    const char *texts[] = { "ushers", "she", "he", "h", "this", "ahishers", "", "xyz" };
+    struct patmatch *matcher;
+    unsigned int i;
+    int bad = 0;
+
+    matcher = patmatch_compile(patterns, 6);
+    if (!matcher) {
+        printf("%s failed; can't compile\n", __FUNCTION__);
+        return;
+    }
+    for (i = 0 ; i < sizeof(texts) / sizeof(texts[0]) ; i++)
+        if (patmatch_first(matcher, texts[i]) != strstr_first(patterns, 6, texts[i]))
+            bad++;
+    patmatch_free(matcher);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed; %d bad results\n", __FUNCTION__, bad);
+}
+
+void test_patmatch_scan_overlapping() {
+    const char *patterns[] = { "he", "she", "hers", "he" };
+    /* "ushers": she and both he end at 4, hers at 6 */
+    const int expected_pattern[] = { 1, 0, 3, 2 };
+    const size_t expected_end[] = { 4, 4, 4, 6 };
+    struct reports reports;
+    struct patmatch *matcher;
+    int i, bad = 0;
+
+    matcher = patmatch_compile(patterns, 4);
+    if (!matcher) {
+        printf("%s failed; can't compile\n", __FUNCTION__);
+        return;
+    }
+    memset(&reports, 0, sizeof(reports));
+    if (patmatch_scan(matcher, "ushers", 6, record_match, &reports) != 0 || reports.count != 4)
+        bad++;
+    for (i = 0 ; !bad && i < 4 ; i++)
+        if (reports.pattern[i] != expected_pattern[i] || reports.end[i] != expected_end[i])
+            bad++;
+
+    /* A non-zero callback return stops the scan */
+    memset(&reports, 0, sizeof(reports));
+    reports.stop = 2;
+    if (patmatch_scan(matcher, "ushers", 6, record_match, &reports) != 1 || reports.count != 2)
+        bad++;
+    patmatch_free(matcher);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+void test_patmatch_empty() {
+    const char *patterns[] = { NULL, "abc" };
+    struct reports reports;
+    struct patmatch *matcher;
+    int bad = 0;
+
+    /* No pattern at all */
+    matcher = patmatch_compile(patterns, 0);
+    if (!matcher || patmatch_first(matcher, "abc") != -1)
+        bad++;
+    patmatch_free(matcher);
+
+    /* Empty text and NULL patterns */
+    matcher = patmatch_compile(patterns, 2);
+    memset(&reports, 0, sizeof(reports));
+    if (!matcher || patmatch_first(matcher, "") != -1 ||
+            patmatch_scan(matcher, "abc", 0, record_match, &reports) != 0 || reports.count)
+        bad++;
+    patmatch_free(matcher);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+/* The buffer end cuts an occurrence: it must not be reported, the ones
+ * ending right at the end must be */
+void test_patmatch_scan_boundary() {
+    const char *patterns[] = { "KERNEL PANIC", "PANIC" };
+    const char *text = "xxKERNEL PANICxxKERNEL PANIC";
+    struct reports reports;
+    struct patmatch *matcher;
+    int bad = 0;
+
+    matcher = patmatch_compile(patterns, 2);
+    if (!matcher) {
+        printf("%s failed; can't compile\n", __FUNCTION__);
+        return;
+    }
+    memset(&reports, 0, sizeof(reports));
+    /* The second occurrence is cut in the middle of PANIC */
+    patmatch_scan(matcher, text, strlen(text) - 2, record_match, &reports);
+    if (reports.count != 2 || reports.end[0] != 14 || reports.end[1] != 14)
+        bad++;
+    memset(&reports, 0, sizeof(reports));
+    patmatch_scan(matcher, text, strlen(text), record_match, &reports);
+    if (reports.count != 4 || reports.end[3] != strlen(text))
+        bad++;
+    patmatch_free(matcher);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+void test_patmatch_long() {
+    const char *patterns[] = { "aaaab", "aab", "ba", "zzz" };
+    struct reports reports;
+    struct patmatch *matcher;
+    char *text;
+    int bad = 0;
+
+    text = malloc(LONG_TEXT_SIZE + 1);
+    if (!text) {
+        printf("%s failed; no memory\n", __FUNCTION__);
+        return;
+    }
+    memset(text, 'a', LONG_TEXT_SIZE);
+    text[LONG_TEXT_SIZE] = 0;
+    matcher = patmatch_compile(patterns, 4);
+
+    /* Only found at the very end */
+    text[LONG_TEXT_SIZE - 1] = 'b';
+    memset(&reports, 0, sizeof(reports));
+    if (patmatch_first(matcher, text) != strstr_first(patterns, 4, text) ||
+            patmatch_scan(matcher, text, LONG_TEXT_SIZE, record_match, &reports) != 0 ||
+            reports.count != 2 || reports.end[0] != LONG_TEXT_SIZE)
+        bad++;
+
+    /* Not found at all */
+    text[LONG_TEXT_SIZE - 1] = 'a';
+    memset(&reports, 0, sizeof(reports));
+    if (patmatch_first(matcher, text) != -1 ||
+            patmatch_scan(matcher, text, LONG_TEXT_SIZE, record_match, &reports) != 0 ||
+            reports.count)
+        bad++;
+    patmatch_free(matcher);
+    free(text);
+    if (!bad) printf("%s succeeded\n", __FUNCTION__);
+    else printf("%s failed\n", __FUNCTION__);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) **argv) {
+
+    test_patmatch_first_overlapping();
+    test_patmatch_scan_overlapping();
+    test_patmatch_empty();
+    test_patmatch_scan_boundary();
+    test_patmatch_long();
+    return 0;
+}
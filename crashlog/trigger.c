@@ -24,6 +24,7 @@
 #include "crashutils.h"
 #include "fsutils.h"
 #include "privconfig.h"
+#include "compress.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -34,29 +35,45 @@
 static void compress_aplog_folder(char *folder_path)
 {
 #ifdef FULL_REPORT
-    char cmd[PATHMAX];
     char spath[PATHMAX];
+    char dpath[PATHMAX];
     DIR *d;
     struct dirent* de;
+    e_compress_format_t format = get_compress_format();
+    int level = get_compress_level(format);
 
-    /* Compress aplog/bplog files */
-    snprintf(cmd, sizeof(cmd), "gzip %s/[ab]plog*", folder_path);
-    system(cmd);
-    /* Change owner and group of those aplog files */
+    /* Compress the aplog/bplog files not compressed while copied */
     d = opendir(folder_path);
-    if (d == 0) {
-         return;
-    }
-    else {
-        while ((de = readdir(d)) != 0) {
-           if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
-               continue;
-           snprintf(spath, sizeof(spath)-1,  "%s/%s", folder_path, de->d_name);
-           do_chown(spath, PERM_USER, PERM_GROUP);
-        }
-        closedir(d);
+    if (d == 0)
+        return;
+    while ((de = readdir(d)) != 0) {
+        if (strncmp(de->d_name, "aplog", 5) && strncmp(de->d_name, "bplog", 5))
+            continue;
+        if (is_compressed_name(de->d_name))
+            continue;
+        snprintf(spath, sizeof(spath), "%s/%s", folder_path, de->d_name);
+        snprintf(dpath, sizeof(dpath), "%s%s", spath, get_compress_suffix(format));
+        /* Like gzip, the original file is only removed once compressed */
+        if (compress_file(spath, dpath, format, level) >= 0)
+            remove(spath);
     }
+    closedir(d);
+#endif
+}
+
+/**
+ * @brief Copies an aplog/bplog file into a trigger directory
+ *
+ * With FULL_REPORT the file is compressed while being copied. If this fails
+ * it is copied as is and compressed afterwards by compress_aplog_folder.
+ */
+static void copy_aplog(char *src, char *dest)
+{
+#ifdef FULL_REPORT
+    if (compress_copy(src, dest, COPY_TAIL, 0) >= 0)
+        return;
 #endif
+    do_copy_tail(src, dest, 0);
 }
 
 /**
@@ -84,14 +101,14 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
     int aplogIsPresent, DepthValueRead = 0;
     int bplogFlag = 0;
     char value[PROPERTY_VALUE_MAX];
-    const char *logrootdir, *suppl_to_copy;
+    const char *suppl_to_copy;
+    char *logrootdir = NULL;
     char *event, *type, *logfile0, *logfile1;
     int packetidx, logidx, newdirperpacket, do_screenshot;
     struct stat info;
 
     switch (mode) {
         case MODE_BZ:
-            logrootdir = BZ_DIR;
             newdirperpacket = 0;
             suppl_to_copy = "bz_description";
             do_screenshot = 1;
@@ -99,7 +116,6 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
             type = BZMANUAL;
             break;
         case MODE_APLOGS:
-            logrootdir = APLOGS_DIR;
             newdirperpacket = 1;
             suppl_to_copy = NULL;
             do_screenshot = 0;
@@ -145,10 +161,12 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
        LOGD("%s: Trigger file not usable so get values from properties : Aplog Depth (%d) and Packet Nb (%d)", __FUNCTION__,
                aplogDepth, nbPacket);
     }
+    /* APLOG_FILE_0 can't be flushed by another copy until it is copied */
+    aplog_lock();
 #ifndef FULL_REPORT
     /* Manage APLOG=0 which means bz type="enhancement"*/
     if ( aplogDepth != 0 )
-        flush_aplog(APLOG, NULL, NULL, NULL);
+        flush_aplog(APLOG, NULL, NULL, NULL, NULL);
 #endif
     /* copy data file */
     for( packetidx = 0; packetidx < nbPacket ; packetidx++) {
@@ -165,17 +183,18 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
             if( !aplogIsPresent ) break;
 
             if( ( newdirperpacket && (logidx == 0) ) || (!newdirperpacket && (packetidx == 0) && (logidx == 0) ) ) {
-                dir = find_new_crashlog_dir(mode);
+                dir = find_new_crashlog_dir(mode, &logrootdir);
                 if (dir < 0) {
                     LOGE("%s: Cannot get a valid new crash directory for %s...\n", __FUNCTION__,
                             (triggername ? triggername : "no trigger file"));
+                    aplog_unlock();
                     return -1;
                 }
             }
             /* Set destination file*/
             snprintf(destination,sizeof(destination),"%s%d/aplog.%d", logrootdir,dir,(packetidx*aplogDepth)+logidx);
 
-            do_copy_tail(path, destination, 0);
+            copy_aplog(path, destination);
         }
 	    /* When a new crashlog dir is created per packet, send an event per dir */
         if( newdirperpacket && (dir != -1) ) {
@@ -188,12 +207,13 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
                 restart_profile_srv(2);
         }
     }
+    aplog_unlock();
     /* When no new crashlog dir is created per packet, send an event only at the end */
     /* For bz_trigger, treats bz_trigger file content and logs one BZEVENT event in history_event */
     /* In case of bz_trigger with APLOG=0 which means bz type="enhancement" and so no logs needed. */
     if( !newdirperpacket ) {
         if ( dir == -1 ) {
-            dir = find_new_crashlog_dir(mode);
+            dir = find_new_crashlog_dir(mode, &logrootdir);
             if (dir < 0) {
                 LOGE("%s: Cannot get a valid new crash directory for %s...\n", __FUNCTION__,
                         (triggername ? triggername : "no trigger file"));
@@ -211,11 +231,11 @@ int process_log_event(char *rootdir, char *triggername, int mode) {
                 logfile0 = compute_bp_log(""); //BPLOG_FILE_0
                 logfile1 = compute_bp_log(BPLOG_FILE_1_EXT ); //BPLOG_FILE_1;
                 if(stat(logfile0, &info) == 0){
-                    snprintf(destination,sizeof(destination), "%s%d/%s", BZ_DIR, dir,strrchr(logfile0,'/')+1);
-                    do_copy_tail(logfile0,destination, 0);
+                    snprintf(destination,sizeof(destination), "%s%d/%s", logrootdir, dir,strrchr(logfile0,'/')+1);
+                    copy_aplog(logfile0, destination);
                     if(info.st_size < 1*MB){
-                        snprintf(destination,sizeof(destination), "%s%d/%s", BZ_DIR, dir,strrchr(logfile1,'/')+1);
-                        do_copy_tail(logfile1,destination, 0);
+                        snprintf(destination,sizeof(destination), "%s%d/%s", logrootdir, dir,strrchr(logfile1,'/')+1);
+                        copy_aplog(logfile1, destination);
                     }
                 }
                 free(logfile0);
@@ -259,6 +279,7 @@ int process_stat_event(struct watch_entry *entry, struct inotify_event *event) {
     char tmp_data_name[PATHMAX];
     const char *dateshort = get_current_time_short(1);
     char *key, *p, tmp[32];
+    char *dirbase;
     int dir;
 
     snprintf(tmp, sizeof(tmp), "%s", event->name);
@@ -268,7 +289,7 @@ int process_stat_event(struct watch_entry *entry, struct inotify_event *event) {
         strcpy(p, "data");
     }
 
-    dir = find_new_crashlog_dir(MODE_STATS);
+    dir = find_new_crashlog_dir(MODE_STATS, &dirbase);
     if (dir < 0) {
         LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         key = raise_event(STATSEVENT, tmp, NULL, NULL);
@@ -281,16 +302,17 @@ int process_stat_event(struct watch_entry *entry, struct inotify_event *event) {
     if ( p ) {
         find_matching_file(entry->eventpath, tmp, tmp_data_name);
         snprintf(path, sizeof(path), "%s/%s", entry->eventpath, tmp_data_name);
-        snprintf(destination, sizeof(destination), "%s%d/%s", STATS_DIR, dir, tmp_data_name);
+        snprintf(destination, sizeof(destination), "%s%d/%s", dirbase, dir, tmp_data_name);
         do_copy(path, destination, MAXFILESIZE);
         remove(path);
     }
     /*copy trigger file*/
     snprintf(path, sizeof(path),"%s/%s",entry->eventpath,event->name);
-    snprintf(destination,sizeof(destination),"%s%d/%s", STATS_DIR,dir,event->name);
+    wait_file_complete(path, event->mask);
+    snprintf(destination,sizeof(destination),"%s%d/%s", dirbase,dir,event->name);
     do_copy(path, destination, MAXFILESIZE);
     remove(path);
-    snprintf(destination,sizeof(destination),"%s%d/", STATS_DIR,dir);
+    snprintf(destination,sizeof(destination),"%s%d/", dirbase,dir);
     /*create type */
     snprintf(tmp,sizeof(tmp),"%s",event->name);
     p = strstr(tmp,"_trigger");
@@ -304,8 +326,8 @@ int process_stat_event(struct watch_entry *entry, struct inotify_event *event) {
         snprintf(type,sizeof(type),"%s", event->name);
     /*for USBBOGUS case copy aplog file*/
     if (!strncmp(type, USBBOGUS, sizeof(USBBOGUS))) {
-        usleep(TIMEOUT_VALUE);
-        do_log_copy(type,dir,dateshort,APLOG_STATS_TYPE);
+        wait_aplog_flushed();
+        do_log_copy(type,dirbase,dir,dateshort,APLOG_STATS_TYPE);
     }
     key = raise_event(STATSEVENT, type, NULL, destination);
     LOGE("%-8s%-22s%-20s%s %s\n", STATSEVENT, key, get_current_time_long(0), type, destination);
@@ -0,0 +1,326 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file usage.c
+ * @brief File containing the disk usage accountant of the logs partitions.
+ */
+
+#include "usage.h"
+#include "privconfig.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/* getdents64 record, no header in bionic */
+struct usage_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#define USAGE_DENTS_SIZE        (8 * KB)
+
+struct usage_counter {
+    const char *root;
+    long long bytes;
+    long long quota_kb;
+    long long scanned;  /* time of the last scan (in s), 0 if none succeeded */
+    int scanning;
+};
+
+static struct usage_counter counters[USAGE_VOLUMES] = {
+    [USAGE_EMMC] = { LOGS_DIR, 0, LLONG_MAX, 0, 0 },
+    [USAGE_SD] = { SDCARD_LOGS_DIR, 0, LLONG_MAX, 0, 0 },
+};
+
+/* Startup scan : the entries at the top of the trees are shared out
+ * between the threads */
+struct usage_scan {
+    pthread_mutex_t lock;
+    long long total;
+    int rootfd;
+    char *names;        /* top entries, '\0' separated */
+    size_t size;
+    size_t next;
+};
+
+static long long entry_bytes(const struct stat *info) {
+    return (long long)info->st_blocks * 512;
+}
+
+/* Returns the bytes used by the tree under name, relative to dirfd */
+static long long scan_tree(int dirfd, const char *name) {
+    struct usage_dirent64 *de;
+    struct stat info;
+    char *dents;
+    long long total;
+    int fd, n, pos;
+
+    if (fstatat(dirfd, name, &info, AT_SYMLINK_NOFOLLOW) < 0)
+        return 0;
+    total = entry_bytes(&info);
+    if (!S_ISDIR(info.st_mode))
+        return total;
+
+    fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0)
+        return total;
+    dents = malloc(USAGE_DENTS_SIZE);
+    if (!dents) {
+        close(fd);
+        return total;
+    }
+    while ((n = syscall(__NR_getdents64, fd, dents, USAGE_DENTS_SIZE)) > 0) {
+        for (pos = 0 ; pos < n ; pos += de->d_reclen) {
+            de = (struct usage_dirent64 *)(dents + pos);
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                continue;
+            if (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN)
+                total += scan_tree(fd, de->d_name);
+            else if (fstatat(fd, de->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0)
+                total += entry_bytes(&info);
+        }
+    }
+    free(dents);
+    close(fd);
+    return total;
+}
+
+static void *scan_thread(void *arg) {
+    struct usage_scan *scan = arg;
+    const char *name;
+    long long total = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&scan->lock);
+        if (scan->next >= scan->size) {
+            pthread_mutex_unlock(&scan->lock);
+            break;
+        }
+        name = scan->names + scan->next;
+        scan->next += strlen(name) + 1;
+        pthread_mutex_unlock(&scan->lock);
+
+        total += scan_tree(scan->rootfd, name);
+    }
+    __sync_fetch_and_add(&scan->total, total);
+    return NULL;
+}
+
+static long long now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* Measures the space used by a volume and resets its counter. The files
+ * crashlogd didn't write itself are only accounted this way */
+static int scan_volume(e_usage_volume_t volume) {
+    struct usage_scan scan;
+    struct dirent *de;
+    struct stat info;
+    pthread_t threads[USAGE_SCAN_THREADS];
+    int started[USAGE_SCAN_THREADS];
+    DIR *d;
+    char *names;
+    size_t len;
+    int i, res;
+
+    if (!__sync_bool_compare_and_swap(&counters[volume].scanning, 0, 1))
+        return -EBUSY;
+    memset(&scan, 0, sizeof(scan));
+    d = opendir(counters[volume].root);
+    if (!d) {
+        res = -errno;
+        __sync_lock_release(&counters[volume].scanning);
+        return res;
+    }
+    scan.rootfd = dirfd(d);
+    if (fstat(scan.rootfd, &info) == 0)
+        scan.total = entry_bytes(&info);
+
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        len = strlen(de->d_name) + 1;
+        names = realloc(scan.names, scan.size + len);
+        if (!names)
+            break;
+        scan.names = names;
+        memcpy(scan.names + scan.size, de->d_name, len);
+        scan.size += len;
+    }
+
+    pthread_mutex_init(&scan.lock, NULL);
+    for (i = 0 ; i < USAGE_SCAN_THREADS ; i++)
+        started[i] = (pthread_create(&threads[i], NULL, scan_thread, &scan) == 0);
+    /* Whatever is left if no thread could be started */
+    scan_thread(&scan);
+    for (i = 0 ; i < USAGE_SCAN_THREADS ; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&scan.lock);
+
+    free(scan.names);
+    closedir(d);
+
+    /* The updates made during the scan are lost, the next scan fixes them */
+    __sync_lock_test_and_set(&counters[volume].bytes, scan.total);
+    counters[volume].scanned = now_seconds();
+    __sync_lock_release(&counters[volume].scanning);
+    return 0;
+}
+
+/**
+ * @brief Computes the space used by the logs trees
+ *
+ * @return 0 on success, a negative errno value if the eMMC logs tree can't
+ * be read.
+ */
+int usage_init(void) {
+    int res;
+
+    res = scan_volume(USAGE_EMMC);
+    if (res < 0)
+        LOGE("%s: Cannot scan %s - %s\n", __FUNCTION__, counters[USAGE_EMMC].root,
+            strerror(-res));
+    /* The SD card may be missing */
+    scan_volume(USAGE_SD);
+
+    LOGI("%s: eMMC logs %lld KB, SD card logs %lld KB\n", __FUNCTION__,
+        usage_get_kb(USAGE_EMMC), usage_get_kb(USAGE_SD));
+    return res;
+}
+
+/**
+ * @brief Returns the space used by a file or a directory tree
+ */
+long long usage_tree_bytes(const char *path) {
+    return scan_tree(AT_FDCWD, path);
+}
+
+/**
+ * @brief Returns the volume a path belongs to, USAGE_NONE if not tracked
+ */
+e_usage_volume_t usage_volume(const char *path) {
+    size_t len;
+    int i;
+
+    if (!path)
+        return USAGE_NONE;
+    for (i = 0 ; i < USAGE_VOLUMES ; i++) {
+        len = strlen(counters[i].root);
+        if (!strncmp(path, counters[i].root, len) &&
+                (path[len] == '/' || path[len] == '\0'))
+            return i;
+    }
+    return USAGE_NONE;
+}
+
+/**
+ * @brief Returns the space used by a file, 0 if it is missing or not tracked
+ */
+long long usage_bytes(const char *path) {
+    struct stat info;
+
+    if (usage_volume(path) == USAGE_NONE || lstat(path, &info) < 0)
+        return 0;
+    return entry_bytes(&info);
+}
+
+/**
+ * @brief Accounts bytes (negative when released) to the volume of path
+ */
+void usage_add(const char *path, long long bytes) {
+    e_usage_volume_t volume = usage_volume(path);
+
+    if (volume == USAGE_NONE || !bytes)
+        return;
+    __sync_fetch_and_add(&counters[volume].bytes, bytes);
+}
+
+/**
+ * @brief Accounts a file which was moved from src to dest
+ */
+void usage_moved(const char *src, const char *dest) {
+    struct stat info;
+    e_usage_volume_t from = usage_volume(src);
+    e_usage_volume_t to = usage_volume(dest);
+
+    if (from == to || lstat(dest, &info) < 0)
+        return;
+    if (from != USAGE_NONE)
+        __sync_fetch_and_sub(&counters[from].bytes, entry_bytes(&info));
+    if (to != USAGE_NONE)
+        __sync_fetch_and_add(&counters[to].bytes, entry_bytes(&info));
+}
+
+long long usage_get_kb(e_usage_volume_t volume) {
+    long long bytes;
+
+    if (volume >= USAGE_VOLUMES)
+        return 0;
+    bytes = __sync_fetch_and_add(&counters[volume].bytes, 0);
+    return (bytes > 0 ? bytes / KB : 0);
+}
+
+void usage_set_quota(e_usage_volume_t volume, long long kb) {
+    if (volume < USAGE_VOLUMES)
+        counters[volume].quota_kb = kb;
+}
+
+/**
+ * @brief Checks if a volume exceeds its quota
+ *
+ * @return 1 if the space used exceeds the quota, 0 otherwise
+ */
+int usage_over_quota(e_usage_volume_t volume) {
+    struct usage_counter *counter;
+    long long age;
+
+    if (volume >= USAGE_VOLUMES)
+        return 0;
+    counter = &counters[volume];
+
+    /* The counter drifts with the files written or deleted by others, and
+     * the SD card may be mounted after the startup scan: measure it again
+     * periodically, and before saying the quota is exceeded */
+    age = now_seconds() - counter->scanned;
+    if (!counter->scanned || age >= USAGE_RESCAN_PERIOD ||
+            (age >= USAGE_RESCAN_MIN_PERIOD &&
+             (__sync_fetch_and_add(&counter->bytes, 0) < 0 ||
+              usage_get_kb(volume) >= counter->quota_kb / 100 * USAGE_RESCAN_LEVEL))) {
+        if (scan_volume(volume) == 0)
+            LOGI("%s: %s measured again, %lld KB\n", __FUNCTION__, counter->root,
+                usage_get_kb(volume));
+    }
+    return usage_get_kb(volume) > counter->quota_kb;
+}
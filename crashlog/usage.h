@@ -0,0 +1,58 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file usage.h
+ * @brief File containing the disk usage accountant of the logs partitions.
+ *
+ * The space used by the eMMC and SD card logs trees is computed at startup,
+ * then updated each time crashlogd writes, moves or deletes a file in them.
+ * As other processes write there too, a tree is measured again
+ * periodically and when its quota is nearly reached. Values are in bytes
+ * allocated on disk, as reported by du.
+ */
+
+#ifndef __USAGE_H__
+#define __USAGE_H__
+
+typedef enum e_usage_volume {
+    USAGE_EMMC = 0,     /* LOGS_DIR */
+    USAGE_SD,           /* SDCARD_LOGS_DIR */
+    USAGE_VOLUMES,
+    USAGE_NONE = USAGE_VOLUMES,
+} e_usage_volume_t;
+
+/* Number of threads walking the trees at startup */
+#define USAGE_SCAN_THREADS      4
+/* A tree is measured again every USAGE_RESCAN_PERIOD seconds, and at most
+ * every USAGE_RESCAN_MIN_PERIOD seconds once it reached USAGE_RESCAN_LEVEL
+ * percent of its quota */
+#define USAGE_RESCAN_PERIOD     600
+#define USAGE_RESCAN_MIN_PERIOD 30
+#define USAGE_RESCAN_LEVEL      90
+
+int usage_init(void);
+e_usage_volume_t usage_volume(const char *path);
+long long usage_bytes(const char *path);
+long long usage_tree_bytes(const char *path);
+void usage_add(const char *path, long long bytes);
+void usage_moved(const char *src, const char *dest);
+long long usage_get_kb(e_usage_volume_t volume);
+void usage_set_quota(e_usage_volume_t volume, long long kb);
+int usage_over_quota(e_usage_volume_t volume);
+
+#endif /* __USAGE_H__ */
@@ -25,18 +25,19 @@
 #include "usercrash.h"
 #include "dropbox.h"
 #include "fsutils.h"
+#include "storm.h"
 
 #include "cutils/log.h"
 #include <sys/sha1.h>
 #include <stdlib.h>
 
-static void backup_apcoredump(unsigned int dir, char* name, char* path) {
+static void backup_apcoredump(char *dirbase, unsigned int dir, char* name, char* path) {
 
     char des[512] = { '\0', };
-    snprintf(des, sizeof(des), "%s%d/%s", CRASH_DIR, dir, name);
-    int status = do_copy_tail(path, des, 0);
+    snprintf(des, sizeof(des), "%s%d/%s", dirbase, dir, name);
+    off_t status = do_copy_tail(path, des, 0);
     if (status < 0)
-        LOGE("backup ap core dump status: %d.\n",status);
+        LOGE("backup ap core dump status: %d.\n", (int)status);
     else
         remove(path);
 }
@@ -52,38 +53,46 @@ static int priv_process_usercrash_event(struct watch_entry *entry, struct inotif
     char path[PATHMAX];
     char destion[PATHMAX];
     char *key;
+    unsigned int signature;
     int dir;
+    char *dirbase;
     /* Check for duplicate dropbox event first */
     if ((entry->eventtype == JAVACRASH_TYPE || entry->eventtype == JAVACRASH_TYPE2 || entry->eventtype == JAVATOMBSTONE_TYPE )
             && manage_duplicate_dropbox_events(event) )
         return 1;
 
-    dir = find_new_crashlog_dir(MODE_CRASH);
+    /* Then for a crash loop, once the report is fully written */
     snprintf(path, sizeof(path),"%s/%s", entry->eventpath, event->name);
+    wait_file_complete(path, event->mask);
+    if (storm_admit(entry, path, &signature))
+        return 1;
+
+    dir = find_new_crashlog_dir(MODE_CRASH, &dirbase);
     if (dir < 0 || !file_exists(path)) {
         if (dir < 0)
             LOGE("%s: Cannot get a valid new crash directory...\n", __FUNCTION__);
         else
             LOGE("%s: Cannot access %s\n", __FUNCTION__, path);
+        storm_captured(signature, NULL, NULL);
         key = raise_event(CRASHEVENT, entry->eventname, NULL, NULL);
         LOGE("%-8s%-22s%-20s%s\n", CRASHEVENT, key, get_current_time_long(0), entry->eventname);
         free(key);
         return -1;
     }
 
-    snprintf(destion,sizeof(destion),"%s%d/%s", CRASH_DIR, dir, event->name);
+    snprintf(destion,sizeof(destion),"%s%d/%s", dirbase, dir, event->name);
     do_copy_tail(path, destion, MAXFILESIZE);
     switch (entry->eventtype) {
         case APCORE_TYPE:
-            backup_apcoredump(dir, event->name, path);
-            do_log_copy(entry->eventname, dir, get_current_time_short(1), APLOG_TYPE);
+            backup_apcoredump(dirbase, dir, event->name, path);
+            do_log_copy(entry->eventname, dirbase, dir, get_current_time_short(1), APLOG_TYPE);
             break;
         case TOMBSTONE_TYPE:
         case JAVATOMBSTONE_TYPE:
         case JAVACRASH_TYPE2:
         case JAVACRASH_TYPE:
-            usleep(TIMEOUT_VALUE);
-            do_log_copy(entry->eventname, dir, get_current_time_short(1), APLOG_TYPE);
+            wait_aplog_flushed();
+            do_log_copy(entry->eventname, dirbase, dir, get_current_time_short(1), APLOG_TYPE);
             break;
         case HPROF_TYPE:
             remove(path);
@@ -92,15 +101,16 @@ static int priv_process_usercrash_event(struct watch_entry *entry, struct inotif
             LOGE("%s: Unexpected type of event(%d)\n", __FUNCTION__, entry->eventtype);
             break;
     }
-    snprintf(destion, sizeof(destion), "%s%d", CRASH_DIR, dir);
+    snprintf(destion, sizeof(destion), "%s%d", dirbase, dir);
     key = raise_event(CRASHEVENT, entry->eventname, NULL, destion);
+    storm_captured(signature, key, destion);
     LOGE("%-8s%-22s%-20s%s %s\n", CRASHEVENT, key, get_current_time_long(0), entry->eventname, destion);
     switch (entry->eventtype) {
     case TOMBSTONE_TYPE:
     case JAVACRASH_TYPE2:
     case JAVACRASH_TYPE:
 #ifdef FULL_REPORT
-        if ( start_dumpstate_srv(CRASH_DIR, dir, key) <= 0 )
+        if ( start_dumpstate_srv(dirbase, dir, key) <= 0 )
             /* Didn't start the dumpstate server (already running or failed) */
             free(key);
         break;
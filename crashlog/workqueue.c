@@ -0,0 +1,231 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file workqueue.c
+ * @brief File containing the worker pool processing the watched events.
+ */
+
+#include "workqueue.h"
+#include "crashutils.h"
+#include "privconfig.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct work_item {
+    struct watch_entry *entry;
+    struct inotify_event *event;
+};
+
+/* Event deferred while the queue of its worker is full */
+struct work_backlog {
+    struct work_backlog *next;
+    struct work_item item;
+};
+
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct work_item items[WORKQUEUE_DEPTH];
+    int head;
+    int count;
+    struct work_backlog *backlog;
+    struct work_backlog *backlog_tail;
+    int backlog_count;
+    int overflowed;
+    int report_overflow;
+};
+
+static struct worker workers[WORKQUEUE_WORKERS];
+static int workqueue_started = 0;
+
+static void *worker_mainloop(void *arg) {
+    struct worker *worker = arg;
+    struct work_backlog *node;
+    struct work_item item;
+    int report_overflow;
+
+    for (;;) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->count == 0)
+            pthread_cond_wait(&worker->not_empty, &worker->lock);
+        item = worker->items[worker->head];
+        worker->head = (worker->head + 1) % WORKQUEUE_DEPTH;
+        worker->count--;
+        /* The oldest deferred event takes the released slot */
+        node = worker->backlog;
+        if (node) {
+            worker->items[(worker->head + worker->count) % WORKQUEUE_DEPTH] = node->item;
+            worker->count++;
+            worker->backlog = node->next;
+            if (!worker->backlog)
+                worker->backlog_tail = NULL;
+            worker->backlog_count--;
+        }
+        if (worker->count == 0)
+            worker->overflowed = 0;
+        report_overflow = worker->report_overflow;
+        worker->report_overflow = 0;
+        pthread_mutex_unlock(&worker->lock);
+        free(node);
+
+        /* Reported from here as raising an event must not delay the monitor */
+        if (report_overflow)
+            raise_infoerror(ERROREVENT, CRASHLOG_ERROR_QUEUE);
+        if (item.entry->pcallback(item.entry, item.event) < 0)
+            LOGE("%s: Can't handle the event %s...\n", __FUNCTION__,
+                (item.event->len ? item.event->name : "empty event"));
+        free(item.event);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the workers
+ *
+ * @return 0 on success, a negative errno value otherwise. On failure the
+ * events keep being processed by the monitor thread.
+ */
+int workqueue_init(void) {
+    int i, ret;
+
+    if (workqueue_started)
+        return 0;
+
+    memset(workers, 0, sizeof(workers));
+    for (i = 0 ; i < WORKQUEUE_WORKERS ; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        pthread_cond_init(&workers[i].not_empty, NULL);
+        ret = pthread_create(&workers[i].thread, NULL, worker_mainloop, &workers[i]);
+        if (ret != 0) {
+            /* Workers already started wait forever on an empty queue */
+            LOGE("%s: pthread_create error - %s\n", __FUNCTION__, strerror(ret));
+            return -ret;
+        }
+    }
+    workqueue_started = 1;
+    return 0;
+}
+
+static int same_work(const struct work_item *item, struct watch_entry *entry,
+        const struct inotify_event *event) {
+    return (item->entry == entry && item->event->mask == event->mask &&
+            item->event->len == event->len &&
+            !memcmp(item->event->name, event->name, event->len));
+}
+
+/* Tells if the same event is already pending. worker->lock shall be held */
+static int is_pending(struct worker *worker, struct watch_entry *entry,
+        const struct inotify_event *event) {
+    struct work_backlog *node;
+    int i;
+
+    for (i = 0 ; i < worker->count ; i++)
+        if (same_work(&worker->items[(worker->head + i) % WORKQUEUE_DEPTH], entry, event))
+            return 1;
+    for (node = worker->backlog ; node ; node = node->next)
+        if (same_work(&node->item, entry, event))
+            return 1;
+    return 0;
+}
+
+/*
+ * The dropbox events of all the types share a worker: the pairing of a
+ * renamed file (IN_MOVED_FROM then IN_MOVED_TO) relies on their order
+ */
+static struct worker *worker_of(struct watch_entry *entry) {
+    if (entry->eventpath && !strcmp(entry->eventpath, DROPBOX_DIR))
+        return &workers[0];
+    return &workers[entry->eventtype % WORKQUEUE_WORKERS];
+}
+
+/**
+ * @brief Queues an event to be processed by the worker in charge of its type
+ *
+ * The event is copied (including its name) so the caller buffer can be
+ * reused right away. The call never blocks: if the worker queue is full, the
+ * event is deferred to the worker backlog, unless the same event is already
+ * pending, and an ERROR event is raised by the worker once per saturation.
+ *
+ * @return 0 on success, -ENODEV if the pool is not started (the caller shall
+ * then process the event itself), -EAGAIN if the backlog is full too,
+ * another negative errno value on error.
+ */
+int workqueue_push(struct watch_entry *entry, struct inotify_event *event) {
+    struct worker *worker;
+    struct inotify_event *copy;
+    struct work_backlog *node = NULL;
+    size_t size = sizeof(struct inotify_event) + event->len;
+
+    if (!workqueue_started)
+        return -ENODEV;
+
+    copy = malloc(size);
+    if (!copy) {
+        LOGE("%s: Cannot allocate the event %s\n", __FUNCTION__,
+            (event->len ? event->name : "empty event"));
+        return -ENOMEM;
+    }
+    memcpy(copy, event, size);
+
+    worker = worker_of(entry);
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count < WORKQUEUE_DEPTH) {
+        worker->items[(worker->head + worker->count) % WORKQUEUE_DEPTH].entry = entry;
+        worker->items[(worker->head + worker->count) % WORKQUEUE_DEPTH].event = copy;
+        worker->count++;
+        pthread_cond_signal(&worker->not_empty);
+        pthread_mutex_unlock(&worker->lock);
+        return 0;
+    }
+
+    if (!worker->overflowed) {
+        worker->overflowed = 1;
+        worker->report_overflow = 1;
+        LOGE("%s: queue full, deferring the events (event %s)\n", __FUNCTION__,
+            entry->eventname);
+    }
+    if (is_pending(worker, entry, event)) {
+        /* Coalesced with the pending one */
+        pthread_mutex_unlock(&worker->lock);
+        free(copy);
+        return 0;
+    }
+    if (worker->backlog_count < WORKQUEUE_BACKLOG)
+        node = malloc(sizeof(*node));
+    if (!node) {
+        pthread_mutex_unlock(&worker->lock);
+        LOGE("%s: backlog full, event %s not queued\n", __FUNCTION__,
+            (event->len ? event->name : "empty event"));
+        free(copy);
+        return -EAGAIN;
+    }
+    node->next = NULL;
+    node->item.entry = entry;
+    node->item.event = copy;
+    if (worker->backlog_tail)
+        worker->backlog_tail->next = node;
+    else
+        worker->backlog = node;
+    worker->backlog_tail = node;
+    worker->backlog_count++;
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/* Copyright (C) Intel 2013
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file workqueue.h
+ * @brief File containing the worker pool processing the watched events.
+ *
+ * The monitor thread only classifies the inotify events and pushes them to
+ * the pool; the workers run the event callbacks (logs copy, event raising...).
+ * Each event type is always routed to the same worker so events of a given
+ * type are processed in their reception order. The events of the dropbox
+ * directory, whatever their type, are all routed to one worker as their
+ * duplicate detection pairs events of different types.
+ * Each worker has a bounded queue: when it is full, the events are deferred
+ * to a backlog (an event already pending is not queued twice) so that the
+ * monitor thread never waits, and the worker raises an ERROR event to report
+ * the saturation.
+ */
+
+#ifndef __WORKQUEUE_H__
+#define __WORKQUEUE_H__
+
+#include "inotify_handler.h"
+
+/* Number of workers processing the events */
+#define WORKQUEUE_WORKERS       4
+/* Max number of pending events per worker */
+#define WORKQUEUE_DEPTH         32
+/* Max number of events deferred per worker once its queue is full */
+#define WORKQUEUE_BACKLOG       512
+
+int workqueue_init(void);
+int workqueue_push(struct watch_entry *entry, struct inotify_event *event);
+
+#endif /* __WORKQUEUE_H__ */